@@ -39,6 +39,7 @@
  * Opaque structure carrying a daemon connection
  */
 typedef	struct t_pvd_connection	t_pvd_connection;
+typedef	struct t_pvd_snapshot	t_pvd_snapshot;
 
 typedef	struct
 {
@@ -67,11 +68,62 @@ typedef	struct {
 #define	PVD_MESSAGE_READ	0
 #define	PVD_MORE_DATA_AVAILABLE	1
 
+/*
+ * Binary protocol (v2), negotiated by PVD_CONNECTION_PROMOTE_BINARY_V2
+ * Messages are made of a fixed little endian header (version, opcode,
+ * status, request id, payload length) followed by TLVs (see README.md)
+ * Replies carry the id of the request, notifications the id 0
+ */
+#define	PVD_BIN_VERSION		2
+#define	PVD_BIN_HEADER_SIZE	12
+#define	PVD_BIN_TLV_SIZE	6
+
+// Requests
+#define	PVD_OP_GET_LIST			0x01
+#define	PVD_OP_GET_ATTRIBUTES		0x02
+#define	PVD_OP_GET_ATTRIBUTE		0x03
+#define	PVD_OP_SUBSCRIBE		0x04
+#define	PVD_OP_UNSUBSCRIBE		0x05
+#define	PVD_OP_SUBSCRIBE_NOTIFICATIONS	0x06
+#define	PVD_OP_UNSUBSCRIBE_NOTIFICATIONS	0x07
+#define	PVD_OP_GET_SNAPSHOT_EVENTFD	0x08	// local clients only
+
+// Replies and notifications
+#define	PVD_OP_LIST		0x81
+#define	PVD_OP_ATTRIBUTES	0x82
+#define	PVD_OP_ATTRIBUTE	0x83
+#define	PVD_OP_ACK		0x84
+#define	PVD_OP_NEW_PVD		0x85
+#define	PVD_OP_DEL_PVD		0x86
+
+// Status of the replies
+#define	PVD_STATUS_OK			0
+#define	PVD_STATUS_UNKNOWN_PVD		1
+#define	PVD_STATUS_UNKNOWN_ATTRIBUTE	2
+#define	PVD_STATUS_INVALID_REQUEST	3
+#define	PVD_STATUS_FAILED		4	// resources shortage in the daemon
+
+// TLV types
+#define	PVD_TLV_PVDNAME		1
+#define	PVD_TLV_KEY		2
+#define	PVD_TLV_VALUE		3	// JSON string of the attribute value
+#define	PVD_TLV_GENERATION	4	// 32 bits, see PVD_ATTRIBUTES_DIFF
+
+typedef	struct {
+	int		opcode;
+	int		status;
+	unsigned int	id;
+	int		length;		// of the payload
+	char		*payload;	// TLVs
+}	t_pvd_bin_message;
+
 /*
  * Communication with the pvdid-daemon
  * Asynchronous notifications require the application to parse the
  * incoming strings. They are received via calls to recv()/read()
  * on the socket returned by pvd_connect()
+ * The _sync functions share a binary connection, attached to the connection
+ * they are given (a connection must not be used by several threads at once)
  */
 extern t_pvd_connection	*pvd_connect(int Port);
 extern void		pvd_disconnect(
@@ -82,6 +134,8 @@ extern t_pvd_connection	*pvd_get_control_socket(
 				t_pvd_connection *conn);
 extern t_pvd_connection	*pvd_get_binary_socket(
 				t_pvd_connection *conn);
+extern t_pvd_connection	*pvd_get_binary_v2_socket(
+				t_pvd_connection *conn);
 extern int		pvd_get_pvd_list(
 				t_pvd_connection *conn);
 extern int		pvd_get_pvd_list_sync(
@@ -94,6 +148,11 @@ extern int		pvd_get_attributes_sync(
 				t_pvd_connection *conn,
 				char *pvdname,
 				char **attributes);
+extern int		pvd_get_attributes_many(
+				t_pvd_connection *conn,
+				int n,
+				char **pvdnames,
+				char **attributes);
 extern int		pvd_get_attribute(
 				t_pvd_connection *conn,
 				char *pvdname, 
@@ -113,6 +172,10 @@ extern int		pvd_subscribe_pvd_notifications(
 extern int		pvd_unsubscribe_pvd_notifications(
 				t_pvd_connection *conn,
 				char *pvdname);
+extern int		pvd_subscribe_attributes_diff(
+				t_pvd_connection *conn);
+extern int		pvd_unsubscribe_attributes_diff(
+				t_pvd_connection *conn);
 extern int		pvd_get_rdnss(
 				t_pvd_connection *conn,
 				char *pvdname);
@@ -128,6 +191,30 @@ extern int		pvd_get_dnssl_sync(
 				char *pvdname, 
 				t_dnssl_list *PtDnssl);
 
+/*
+ * Lookups in the snapshot of the database published by the daemon in
+ * shared memory (local clients only, no system call involved). Changes
+ * can be waited for on the snapshot itself (futex), or via an eventfd
+ */
+extern t_pvd_snapshot	*pvd_snapshot_open(int Port);
+extern void		pvd_snapshot_close(t_pvd_snapshot *snap);
+extern int		pvd_snapshot_get_attribute(
+				t_pvd_snapshot *snap,
+				char *pvdname,
+				char *attrName,
+				char *value,
+				int size);
+extern int		pvd_snapshot_get_pvd_list(
+				t_pvd_snapshot *snap,
+				unsigned int since,
+				t_pvd_list *pvdList);
+extern unsigned int	pvd_snapshot_generation(t_pvd_snapshot *snap);
+extern int		pvd_snapshot_wait(
+				t_pvd_snapshot *snap,
+				unsigned int generation,
+				int timeout);
+extern int		pvd_snapshot_eventfd(t_pvd_snapshot *snap);
+
 /*
  * Accessors
  */
@@ -135,6 +222,7 @@ extern int		pvd_get_dnssl_sync(
 #define	REGULAR_CONNECTION	1
 #define	CONTROL_CONNECTION	2
 #define	BINARY_CONNECTION	3
+#define	BINARY_V2_CONNECTION	4
 
 extern int		pvd_connection_fd(t_pvd_connection *conn);
 extern int		pvd_connection_type(t_pvd_connection *conn);
@@ -145,12 +233,42 @@ extern int		pvd_connection_type(t_pvd_connection *conn);
 extern int		pvd_parse_pvd_list(char *msg, t_pvd_list *pvdList);
 extern int		pvd_parse_rdnss(char *msg, t_rdnss_list *PtRdnss);
 extern int		pvd_parse_dnssl(char *msg, t_dnssl_list *PtDnssl);
+extern int		pvd_parse_attributes_diff(
+				char *msg,
+				char *pvdname,
+				unsigned int *generation,
+				char **changed,
+				char **removed);
+extern int		pvd_parse_attributes_generation(
+				char *msg,
+				char *pvdname,
+				unsigned int *generation);
 extern void		pvd_release_rdnss(t_rdnss_list *PtRdnss);
 extern void		pvd_release_dnssl(t_dnssl_list *PtDnssl);
 
 extern	int		pvd_read_data(t_pvd_connection *conn);
 extern	int		pvd_get_message(t_pvd_connection *conn, int *multiLines, char **msg);
 
+/*
+ * Binary protocol (v2) helpers. Messages are read via pvd_read_data(), then
+ * pvd_bin_get_message() (same return codes as pvd_get_message())
+ */
+extern	int		pvd_bin_send_request(
+				t_pvd_connection *conn,
+				int opcode,
+				unsigned int id,
+				char *pvdname,
+				char *attrName);
+extern	int		pvd_bin_get_message(
+				t_pvd_connection *conn,
+				t_pvd_bin_message *msg);
+extern	int		pvd_bin_next_tlv(
+				t_pvd_bin_message *msg,
+				int *offset,
+				int *type,
+				char **value,
+				int *length);
+
 /*
  * Encapsulation of setsockopt/getsockopt calls (direct kernel communication)
  */
@@ -0,0 +1,61 @@
+/*
+	Copyright 2017 Cisco
+
+	Licensed under the Apache License, Version 2.0 (the "License");
+	you may not use this file except in compliance with the License.
+	You may obtain a copy of the License at
+
+		http://www.apache.org/licenses/LICENSE-2.0
+
+	Unless required by applicable law or agreed to in writing, software
+	distributed under the License is distributed on an "AS IS" BASIS,
+	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+	See the License for the specific language governing permissions and
+	limitations under the License.
+*/
+/*
+ * Encoding/decoding of the binary protocol (v2) messages, shared between
+ * the daemon and the client library. The protocol constants themselves
+ * are public (libpvd.h)
+ */
+
+#ifndef	PVD_BINARY_H
+#define	PVD_BINARY_H
+
+typedef	struct {
+	int		Version;
+	int		Opcode;
+	int		Status;
+	unsigned int	Id;
+	unsigned int	Length;		// of the payload
+}	t_BinaryHeader;
+
+/*
+ * Growable buffer in which messages are encoded. Allocation errors are
+ * remembered and reported once, by BBEndMessage()
+ */
+typedef	struct {
+	char	*Data;
+	int	Length;
+	int	Size;
+	int	Message;	// offset of the message being encoded
+	int	Error;
+}	t_BinaryBuffer;
+
+extern void	BinPutHeader(char *Header, int Opcode, int Status, unsigned int Id, int Length);
+extern void	BinGetHeader(char *Header, t_BinaryHeader *H);
+extern int	BinPutTlv(char *Buffer, int Type, char *Value, int Length);
+extern int	BinPutTlvInt(char *Buffer, int Type, unsigned int v);
+extern int	BinNextTlv(char **Pt, char *End, int *Type, char **Value, int *Length);
+extern int	BinGetTlvString(char *Value, int Length, char *s, int Size);
+
+extern void	BBInit(t_BinaryBuffer *BB);
+extern void	BBUninit(t_BinaryBuffer *BB);
+extern void	BBBeginMessage(t_BinaryBuffer *BB, int Opcode, int Status, unsigned int Id);
+extern void	BBAddTlv(t_BinaryBuffer *BB, int Type, char *Value, int Length);
+extern void	BBAddTlvString(t_BinaryBuffer *BB, int Type, char *s);
+extern int	BBEndMessage(t_BinaryBuffer *BB);
+
+#endif	/* PVD_BINARY_H */
+
+/* ex: set ts=8 noexpandtab wrap: */
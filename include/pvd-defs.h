@@ -31,6 +31,22 @@
 
 #define	DEFAULT_PVDD_PORT	10101
 
+// Local (AF_UNIX) socket of the daemon, derived from its port number. A
+// leading @ stands for the abstract namespace (no file system entry)
+#define	DEFAULT_PVDD_UNIX_SOCKET	"@pvdd.%d"
+
+// Name suffix of the SOCK_SEQPACKET companion of the local socket. It only
+// carries the binary protocol (v2), one message per datagram
+#define	PVDD_SEQPACKET_SUFFIX		".seq"
+
+// Name suffix of the local socket on which a running daemon hands over its
+// sockets and state to a new instance (warm restart, --upgrade option)
+#define	PVDD_UPGRADE_SUFFIX		".upgrade"
+
+// Shared memory object (shm_open()) in which the daemon publishes its
+// database, also derived from its port number
+#define	DEFAULT_PVDD_SNAPSHOT		"/pvdd.%d"
+
 #define	PVD_MAX_MSG_SIZE	2048
 
 #endif	/* PVD_DEFS_H */
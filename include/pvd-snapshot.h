@@ -0,0 +1,69 @@
+/*
+	Copyright 2017 Cisco
+
+	Licensed under the Apache License, Version 2.0 (the "License");
+	you may not use this file except in compliance with the License.
+	You may obtain a copy of the License at
+
+		http://www.apache.org/licenses/LICENSE-2.0
+
+	Unless required by applicable law or agreed to in writing, software
+	distributed under the License is distributed on an "AS IS" BASIS,
+	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+	See the License for the specific language governing permissions and
+	limitations under the License.
+*/
+/*
+ * Layout of the shared memory snapshot of the pvd database, shared between
+ * the daemon (writer) and the client library (readers)
+ *
+ * The region starts with a header, followed by one record per pvd. The
+ * daemon rewrites the records under a seqlock : Sequence is odd while an
+ * update is in progress, and readers retry when it has changed during
+ * their lookup. All integers are in host order, records are aligned on 4
+ *
+ * Generation is also a futex word : readers waiting for a change sleep on
+ * it. It keeps on growing when the daemon is restarted
+ */
+
+#ifndef	PVD_SNAPSHOT_H
+#define	PVD_SNAPSHOT_H
+
+#define	PVD_SNAPSHOT_MAGIC	0x53445650	// "PVDS"
+#define	PVD_SNAPSHOT_VERSION	1
+
+typedef	struct {
+	unsigned int	Magic;
+	unsigned int	Version;
+	unsigned int	Size;		// of the region (it only grows)
+	unsigned int	Superseded;	// a new daemon has replaced the region
+	unsigned int	Sequence;	// seqlock
+	unsigned int	Generation;	// incremented by each update (futex)
+	unsigned int	nPvd;
+	unsigned int	Length;		// bytes of records following the header
+}	t_SnapshotHeader;
+
+/*
+ * A pvd record : the \0 terminated name, followed by nAttributes pairs of
+ * lengths (including the \0) and \0 terminated key and value (JSON). Each
+ * pair is aligned on 4
+ */
+typedef	struct {
+	unsigned int	Length;		// of the whole record
+	unsigned int	Generation;	// of the last change of the pvd
+	unsigned int	nAttributes;
+	unsigned int	NameLength;	// including the \0
+	char		Name[];
+}	t_SnapshotPvd;
+
+typedef	struct {
+	unsigned int	KeyLength;	// including the \0
+	unsigned int	ValueLength;	// including the \0
+	char		Data[];		// key, then value
+}	t_SnapshotAttribute;
+
+#define	SNAPSHOT_ALIGN(n)	(((n) + 3) & ~3)
+
+#endif	/* PVD_SNAPSHOT_H */
+
+/* ex: set ts=8 noexpandtab wrap: */
@@ -44,6 +44,10 @@ extern char *Stringify(char *s);
 extern char *JsonString(char *str);
 extern char *JsonArray(int nStr, char **str);
 extern char *GetIntStr(int n);
+extern unsigned int HashString(char *s);
+
+struct sockaddr_un;
+extern int UnixSocketAddress(char *Name, struct sockaddr_un *sa);
 
 extern int lFlagVerbose;
 
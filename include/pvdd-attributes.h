@@ -0,0 +1,62 @@
+/*
+	Copyright 2017 Cisco
+
+	Licensed under the Apache License, Version 2.0 (the "License");
+	you may not use this file except in compliance with the License.
+	You may obtain a copy of the License at
+
+		http://www.apache.org/licenses/LICENSE-2.0
+
+	Unless required by applicable law or agreed to in writing, software
+	distributed under the License is distributed on an "AS IS" BASIS,
+	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+	See the License for the specific language governing permissions and
+	limitations under the License.
+*/
+#ifndef	PVDD_ATTRIBUTES_H
+#define	PVDD_ATTRIBUTES_H
+
+typedef	struct {
+	char		*Key;	// interned (NULL for a removed entry)
+	char		*Value;	// strduped
+	unsigned int	hash;	// HashString(Key)
+	unsigned int	generation;	// notification carrying the last change
+}	t_PvdAttribute;
+
+/*
+ * Growable table of attributes. Entries are kept in insertion order in
+ * the Entries array (removed entries leave a hole, with a NULL Key, until
+ * the next compaction). Index is an open addressing hash index (linear
+ * probing) of the Entries array
+ */
+typedef	struct {
+	int		nAttributes;	// number of live entries
+	int		nEntries;	// number of used slots in Entries
+	int		MaxEntries;
+	t_PvdAttribute	*Entries;
+	int		IndexSize;	// power of 2
+	int		*Index;
+}	t_AttributeTable;
+
+/*
+ * Attributes keys are interned : a given key string is stored once,
+ * whatever the number of pvd using it, and keys are compared by address
+ */
+extern char		*KeyIntern(char *Key);
+extern char		*KeyFind(char *Key);
+extern void		KeyRelease(char *Key);
+extern void		KeyStatistics(FILE *fo);
+
+/*
+ * Iteration, in insertion order : for (i = 0; i < T->nEntries; i++)
+ * skipping entries whose Key is NULL
+ */
+extern void		ATInit(t_AttributeTable *T);
+extern void		ATUninit(t_AttributeTable *T);
+extern t_PvdAttribute	*ATLookup(t_AttributeTable *T, char *Key);
+extern t_PvdAttribute	*ATAdd(t_AttributeTable *T, char *Key, char *Value);
+extern int		ATRemove(t_AttributeTable *T, char *Key);
+
+#endif	/* PVDD_ATTRIBUTES_H */
+
+/* ex: set ts=8 noexpandtab wrap: */
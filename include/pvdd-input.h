@@ -0,0 +1,46 @@
+/*
+	Copyright 2017 Cisco
+
+	Licensed under the Apache License, Version 2.0 (the "License");
+	you may not use this file except in compliance with the License.
+	You may obtain a copy of the License at
+
+		http://www.apache.org/licenses/LICENSE-2.0
+
+	Unless required by applicable law or agreed to in writing, software
+	distributed under the License is distributed on an "AS IS" BASIS,
+	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+	See the License for the specific language governing permissions and
+	limitations under the License.
+*/
+#ifndef	PVDD_INPUT_H
+#define	PVDD_INPUT_H
+
+#define	IB_MAXSIZE	(64 * 1024)	// longest line accepted from a client
+
+/*
+ * Per client input buffer. Bytes received but not yet parsed are kept from
+ * one read to the next, so that a line (or a binary message) can span
+ * several reads, and several of them can be received by a single read
+ * (pipelined requests)
+ */
+typedef	struct {
+	char	*Data;		// malloced (NULL if not allocated)
+	int	Size;
+	int	Start;		// first byte not yet parsed
+	int	Length;		// bytes available from Start
+	int	Scanned;	// bytes from Start known to contain no \n
+}	t_InputBuffer;
+
+extern void	IBInit(t_InputBuffer *B);
+extern void	IBUninit(t_InputBuffer *B);
+extern int	IBRead(t_InputBuffer *B, int s);
+extern int	IBAppend(t_InputBuffer *B, char *Data, int Length);
+extern char	*IBGetLine(t_InputBuffer *B);
+extern char	*IBGetRemainder(t_InputBuffer *B);
+extern char	*IBPeek(t_InputBuffer *B, int Length);
+extern char	*IBGetBytes(t_InputBuffer *B, int Length);
+
+#endif	/* PVDD_INPUT_H */
+
+/* ex: set ts=8 noexpandtab wrap: */
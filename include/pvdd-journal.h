@@ -0,0 +1,40 @@
+/*
+	Copyright 2017 Cisco
+
+	Licensed under the Apache License, Version 2.0 (the "License");
+	you may not use this file except in compliance with the License.
+	You may obtain a copy of the License at
+
+		http://www.apache.org/licenses/LICENSE-2.0
+
+	Unless required by applicable law or agreed to in writing, software
+	distributed under the License is distributed on an "AS IS" BASIS,
+	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+	See the License for the specific language governing permissions and
+	limitations under the License.
+*/
+#ifndef	PVDD_JOURNAL_H
+#define	PVDD_JOURNAL_H
+
+/*
+ * Persistent state of the changes made by the control clients (requires
+ * pvdd-attributes.h). JournalOpen() reads back the state saved in a
+ * directory, which JournalRestore() then hands over, pvd per pvd. The
+ * changes are recorded via the JournalXxx() functions, and written to
+ * disk by JournalFlush()
+ */
+extern int	JournalOpen(char *Dir);
+extern void	JournalRestore(void (*Restore)(
+				int pvdid,
+				char *pvdname,
+				t_AttributeTable *Attributes));
+extern void	JournalCreatePvd(int pvdid, char *pvdname);
+extern void	JournalSetAttribute(char *pvdname, char *Key, char *Value);
+extern void	JournalUnsetAttribute(char *pvdname, char *Key);
+extern void	JournalRemovePvd(char *pvdname);
+extern void	JournalFlush(void);
+extern void	JournalStatistics(FILE *fo);
+
+#endif	/* PVDD_JOURNAL_H */
+
+/* ex: set ts=8 noexpandtab wrap: */
@@ -18,6 +18,10 @@
 
 extern int open_icmpv6_socket(void);
 extern int HandleNetlink(int sock);
+extern void NetlinkStatistics(FILE *fo);
+extern void ReleaseRaState(void *State);
+extern char *SaveRaState(t_Pvd *PtPvd, int *Length);
+extern void LoadRaState(t_Pvd *PtPvd, char *pvdname, char *Record, int Length);
 extern void process_ra(
 		unsigned char *msg,
 		int len,
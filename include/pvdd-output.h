@@ -0,0 +1,60 @@
+/*
+	Copyright 2017 Cisco
+
+	Licensed under the Apache License, Version 2.0 (the "License");
+	you may not use this file except in compliance with the License.
+	You may obtain a copy of the License at
+
+		http://www.apache.org/licenses/LICENSE-2.0
+
+	Unless required by applicable law or agreed to in writing, software
+	distributed under the License is distributed on an "AS IS" BASIS,
+	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+	See the License for the specific language governing permissions and
+	limitations under the License.
+*/
+#ifndef	PVDD_OUTPUT_H
+#define	PVDD_OUTPUT_H
+
+// Policies applied when the output queue of a client exceeds the high
+// water mark
+#define	OQ_POLICY_DROP		1	// discard the oldest pending messages
+#define	OQ_POLICY_COALESCE	2	// discard superseded messages, then disconnect
+#define	OQ_POLICY_DISCONNECT	3	// release the client
+
+#define	OQ_DEFAULT_HIGHWATERMARK	(1024 * 1024)
+
+typedef	struct {
+	char	*Data;		// malloced
+	int	Length;
+	char	*Key;		// strduped coalescing key (NULL if none)
+}	t_OutputMessage;
+
+/*
+ * Per client queue of messages waiting for the socket to become writable
+ * Messages are kept in a growable circular array. Only whole messages are
+ * dropped or coalesced (except the head one, once partially written)
+ */
+typedef	struct {
+	t_OutputMessage	*Messages;
+	int		Size;		// power of 2 (0 if not allocated)
+	int		Head;
+	int		Count;
+	int		Offset;		// bytes of the head message already written
+	int		Bytes;		// bytes waiting to be written
+}	t_OutputQueue;
+
+extern int	OQSetPolicy(char *Policy);
+extern void	OQSetHighWaterMark(int HighWaterMark);
+extern void	OQStatistics(FILE *fo);
+
+extern void	OQInit(t_OutputQueue *Q);
+extern void	OQUninit(t_OutputQueue *Q);
+extern int	OQSend(t_OutputQueue *Q, int s, char *Data, int Length, char *Key);
+extern int	OQSendv(t_OutputQueue *Q, int s, struct iovec *iov, int iovcnt, char *Key);
+extern int	OQFlush(t_OutputQueue *Q, int s);
+extern int	OQQueue(t_OutputQueue *Q, char *Data, int Length, char *Key);
+
+#endif	/* PVDD_OUTPUT_H */
+
+/* ex: set ts=8 noexpandtab wrap: */
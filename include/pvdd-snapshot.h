@@ -0,0 +1,34 @@
+/*
+	Copyright 2017 Cisco
+
+	Licensed under the Apache License, Version 2.0 (the "License");
+	you may not use this file except in compliance with the License.
+	You may obtain a copy of the License at
+
+		http://www.apache.org/licenses/LICENSE-2.0
+
+	Unless required by applicable law or agreed to in writing, software
+	distributed under the License is distributed on an "AS IS" BASIS,
+	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+	See the License for the specific language governing permissions and
+	limitations under the License.
+*/
+#ifndef	PVDD_SNAPSHOT_H
+#define	PVDD_SNAPSHOT_H
+
+/*
+ * Publication of the pvd database in shared memory. A snapshot is built
+ * via SnapshotBegin(), SnapshotAddPvd() and SnapshotAddAttribute() calls
+ * (attributes being added to the last pvd), then made visible to the
+ * readers at once by SnapshotPublish()
+ */
+extern int		SnapshotOpen(char *Name);
+extern unsigned int	SnapshotBegin(void);
+extern void		SnapshotAddPvd(char *pvdname, unsigned int Generation);
+extern void		SnapshotAddAttribute(char *Key, char *Value);
+extern int		SnapshotPublish(void);
+extern void		SnapshotStatistics(FILE *fo);
+
+#endif	/* PVDD_SNAPSHOT_H */
+
+/* ex: set ts=8 noexpandtab wrap: */
@@ -0,0 +1,39 @@
+/*
+	Copyright 2017 Cisco
+
+	Licensed under the Apache License, Version 2.0 (the "License");
+	you may not use this file except in compliance with the License.
+	You may obtain a copy of the License at
+
+		http://www.apache.org/licenses/LICENSE-2.0
+
+	Unless required by applicable law or agreed to in writing, software
+	distributed under the License is distributed on an "AS IS" BASIS,
+	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+	See the License for the specific language governing permissions and
+	limitations under the License.
+*/
+#ifndef	PVDD_SUBSCRIPTIONS_H
+#define	PVDD_SUBSCRIPTIONS_H
+
+/*
+ * Set of clients (slots in the clients table) having subscribed to a given
+ * pvd name. The name does not need to be currently registered, and the
+ * wildcard subscription ("*") is an ordinary entry
+ */
+typedef	struct {
+	char		*pvdname;	// strduped
+	unsigned int	hash;		// HashString(pvdname)
+	int		nClients;
+	int		MaxClients;
+	int		*Clients;	// unordered
+}	t_Subscribers;
+
+extern int		SubscribersAdd(char *pvdname, int ix);
+extern void		SubscribersRemove(char *pvdname, int ix);
+extern t_Subscribers	*SubscribersLookup(char *pvdname);
+extern void		SubscribersStatistics(FILE *fo);
+
+#endif	/* PVDD_SUBSCRIPTIONS_H */
+
+/* ex: set ts=8 noexpandtab wrap: */
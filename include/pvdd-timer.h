@@ -0,0 +1,51 @@
+/*
+	Copyright 2017 Cisco
+
+	Licensed under the Apache License, Version 2.0 (the "License");
+	you may not use this file except in compliance with the License.
+	You may obtain a copy of the License at
+
+		http://www.apache.org/licenses/LICENSE-2.0
+
+	Unless required by applicable law or agreed to in writing, software
+	distributed under the License is distributed on an "AS IS" BASIS,
+	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+	See the License for the specific language governing permissions and
+	limitations under the License.
+*/
+#ifndef	PVDD_TIMER_H
+#define	PVDD_TIMER_H
+
+#define	TIMER_INFINITE	0xffffffffUL	// lifetime never expiring
+
+/*
+ * Timers, with a one second resolution. A timer is embedded in the
+ * structure it refers to (Data), and must be initialized by TimerInit()
+ * before being armed. Handler() is called once it expires, the timer being
+ * no longer armed (it may be armed again, or released)
+ *
+ * TimerRun() expires the timers whose delay has elapsed. TimerTimeout()
+ * returns the delay (in ms) after which it must be called again, -1 if no
+ * timer is armed
+ */
+typedef	struct t_Timer {
+	struct t_Timer	*next;	// NULL if not armed
+	struct t_Timer	*prev;
+	unsigned long	expires;	// tick
+	void		(*Handler)(struct t_Timer *T);
+	void		*Data;
+	int		Arg;
+}	t_Timer;
+
+extern void	TimerInit(t_Timer *T, void (*Handler)(t_Timer *T), void *Data, int Arg);
+extern void	TimerArm(t_Timer *T, unsigned long Delay);
+extern void	TimerCancel(t_Timer *T);
+extern int	TimerArmed(t_Timer *T);
+extern unsigned long	TimerRemaining(t_Timer *T);
+extern void	TimerRun(void);
+extern int	TimerTimeout(void);
+extern void	TimerStatistics(FILE *fo);
+
+#endif	/* PVDD_TIMER_H */
+
+/* ex: set ts=8 noexpandtab wrap: */
@@ -0,0 +1,36 @@
+/*
+	Copyright 2017 Cisco
+
+	Licensed under the Apache License, Version 2.0 (the "License");
+	you may not use this file except in compliance with the License.
+	You may obtain a copy of the License at
+
+		http://www.apache.org/licenses/LICENSE-2.0
+
+	Unless required by applicable law or agreed to in writing, software
+	distributed under the License is distributed on an "AS IS" BASIS,
+	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+	See the License for the specific language governing permissions and
+	limitations under the License.
+*/
+#ifndef	PVDD_UPGRADE_H
+#define	PVDD_UPGRADE_H
+
+#define	UPGRADE_TIMEOUT	10	// seconds, for each step of the transfer
+
+/*
+ * Warm restart : a running daemon hands over file descriptors and its
+ * (serialized) state to a new instance, over a SOCK_SEQPACKET local socket
+ * The running daemon calls UpgradeSend(), then UpgradeWaitDone() before
+ * exiting. The new instance calls UpgradeConnect() and UpgradeReceive(),
+ * then UpgradeDone() once it is ready to serve the clients
+ */
+extern int	UpgradeConnect(char *Name);
+extern int	UpgradeSend(int s, int *Fds, int nFds, char *State, int Length);
+extern int	UpgradeWaitDone(int s);
+extern int	UpgradeReceive(int s, int **Fds, int *nFds, char **State, int *Length);
+extern int	UpgradeDone(int s);
+
+#endif	/* PVDD_UPGRADE_H */
+
+/* ex: set ts=8 noexpandtab wrap: */
@@ -24,6 +24,9 @@ extern t_Pvd	*PvdBeginTransaction(char *pvdname);
 extern int	PvdSetAttr(t_Pvd *PtPvd, char *Key, char *Value);
 extern int	UnregisterPvd(char *pvdname);
 extern void	PvdEndTransaction(t_Pvd *PtPvd);
+extern t_Pvd	*PvdLookup(char *pvdname);
+extern unsigned int	PvdChanges(t_Pvd *PtPvd);
+extern void	**PvdRaState(t_Pvd *PtPvd);
 
 #endif	/* PVDD_H */
 
@@ -0,0 +1 @@
+#include "pvd-binary.c"
@@ -21,22 +21,35 @@
  *
  * 2 sets of functions :
  * + async functions
- * + sync functions. This family will use a per-call connection with the server
+ * + sync functions. This family uses separate binary (v2) connections with
+ * the server, taken from a small pool kept along with the connection passed
+ * by the caller. Requests are tagged with an id and can be pipelined
  */
 
+#define _GNU_SOURCE	// to have sendmmsg() defined
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
+#include <stddef.h>
 #include <fcntl.h>
 #include <malloc.h>
 #include <errno.h>
 #include <netdb.h>
+#include <time.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
 
 #include "pvd-defs.h"
 #include "pvd-utils.h"
+#include "pvd-binary.h"
+#include "pvd-snapshot.h"
 
 #include "libpvd.h"
 
@@ -51,6 +64,19 @@
 #undef	NEW
 #define	NEW(t)	((t *) malloc(sizeof(t)))
 
+/*
+ * Sync functions : they use binary (v2) connections (channels) taken from
+ * a per connection pool of at most SYNC_POOLSIZE idle channels, so that
+ * each call costs neither a connect() nor a close(). The pool slots are
+ * taken and given back atomically : several threads may issue sync calls
+ * on the same connection (each then gets its own channel)
+ * At most SYNC_WINDOW requests are outstanding on a channel (sent in
+ * batches), the replies being matched to the requests via their id. This
+ * bounds what the daemon has to queue for us
+ */
+#define	SYNC_POOLSIZE	4
+#define	SYNC_WINDOW	64
+
 struct t_pvd_connection {
 	int	fd;
 	int	type;		/* xxx_CONNECTION above */
@@ -60,6 +86,15 @@ struct t_pvd_connection {
 	char	ReadBuffer[4096];
 	int	InReadBuffer;	/* number of bytes already read in ReadBuffer */
 	t_StringBuffer	SB;	/* full lines are accumulated here */
+	char	*Message;	/* for BINARY_V2_CONNECTION (malloced) */
+	int	MessageSize;
+	int	InMessage;	/* number of bytes already in Message */
+	int	Seqpacket;	/* BINARY_V2_CONNECTION : one message per datagram */
+	int	Pending;	/* Seqpacket : Message not yet handed out */
+	struct sockaddr_storage Peer;	/* address of the daemon */
+	socklen_t	PeerLen;
+	t_pvd_connection *SyncPool[SYNC_POOLSIZE];	/* idle sync channels */
+	unsigned int	NextId;		/* of the next request on this channel */
 };
 
 // NewConnection : allocate a connection structure
@@ -87,6 +122,9 @@ static	void	DelConnection(t_pvd_connection *conn)
 {
 	if (conn != NULL) {
 		SBUninit(&conn->SB);
+		if (conn->Message != NULL) {
+			free(conn->Message);
+		}
 		free(conn);
 	}
 }
@@ -102,54 +140,35 @@ int	pvd_connection_type(t_pvd_connection *conn)
 	return(conn != NULL ? conn->type : INVALID_CONNECTION);
 }
 
-// ReadMsg : reads an incoming message on a binary socket. The first
-// bytes of the message carry the total length to read
-static	int	ReadMsg(int fd, char **String)
+static	int	SendExact(int fd, char *s)
 {
-	int		len;
-	char		msg[1024];
-	t_StringBuffer	SB;
-	int		n;
-
 	if (fd == -1) {
 		return(-1);
 	}
+	return(write(fd, s, strlen(s)) == strlen(s) ? 0 : -1);
+}
 
-	fcntl(fd, F_SETFD, fcntl(fd, F_GETFD) & ~O_NONBLOCK);
-
-	SBInit(&SB);
+static	int	SendBytes(int fd, char *Data, int Length)
+{
+	int	n;
 
-	if (recv(fd, &len, sizeof(len), MSG_WAITALL) != sizeof(len)) {
+	if (fd == -1) {
 		return(-1);
 	}
-	SBAddString(&SB, "");
-
-	while (len > 0) {
-		if ((n = read(fd, msg, sizeof(msg) - 1)) <= 0) {
-			// Remote disconnected (n == 0) or read error
-			SBUninit(&SB);
+	while (Length > 0) {
+		// The daemon may have gone : fail rather than raise SIGPIPE
+		if ((n = send(fd, Data, Length, MSG_NOSIGNAL)) == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
 			return(-1);
 		}
-		msg[n] = '\0';
-		SBAddString(&SB, "%s", msg);
-		len -= n;
+		Data += n;
+		Length -= n;
 	}
-
-	*String = SB.String;
-
-	// printf("ReadMsg : msg = %s\n", *String);
-
 	return(0);
 }
 
-static	int	SendExact(int fd, char *s)
-{
-	if (fd == -1) {
-		return(-1);
-	}
-	return(write(fd, s, strlen(s)) == strlen(s) ? 0 : -1);
-}
-
 // StripSpaces : remove heading spaces from a string and returns
 // the address of the first non space (this includes \n) character
 // of the string
@@ -176,14 +195,9 @@ static	int	GetInt(char *s, int *PtN)
 	return(-1);
 }
 
-// pvd_connect : returns a general connection (socket) with the pvdid
-// daemon
-t_pvd_connection	*pvd_connect(int Port)
+// GetPort : the port of the daemon, when not given (-1) by the caller
+static	int	GetPort(int Port)
 {
-	int			s;
-	struct sockaddr_in 	sa;
-	t_pvd_connection	*conn = NULL;
-
 	if (Port == -1) {
 		char	*EnvClientPort = NULL;
 
@@ -196,18 +210,67 @@ t_pvd_connection	*pvd_connect(int Port)
 			}
 		}
 	}
+	return(Port);
+}
 
-	if ((s = socket(AF_INET, SOCK_STREAM, 0)) == -1) {
-		return(NULL);
+// ConnectUnix : try to connect to the local (AF_UNIX) socket of the daemon
+// listening on a given port. Returns -1 if there is none
+static	int	ConnectUnix(int Port, struct sockaddr_un *sa, socklen_t *PtSalen)
+{
+	int	s;
+	int	salen;
+	char	*Name;
+	char	DefaultName[64];
+
+	if ((Name = getenv("PVDD_SOCKET")) == NULL) {
+		sprintf(DefaultName, DEFAULT_PVDD_UNIX_SOCKET, Port);
+		Name = DefaultName;
+	}
+	if (EQSTR(Name, "none") || (salen = UnixSocketAddress(Name, sa)) == -1) {
+		return(-1);
 	}
 
-	sa.sin_family = AF_INET;
-	sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
-	sa.sin_port = htons(Port);
+	if ((s = socket(AF_UNIX, SOCK_STREAM, 0)) == -1) {
+		return(-1);
+	}
 
-	if (connect(s, (struct sockaddr *) &sa, sizeof(sa)) == -1) {
+	if (connect(s, (struct sockaddr *) sa, salen) == -1) {
 		close(s);
-		return(NULL);
+		return(-1);
+	}
+	*PtSalen = salen;
+
+	return(s);
+}
+
+// pvd_connect : returns a general connection (socket) with the pvdid
+// daemon. The local socket of the daemon is preferred, the TCP one
+// being used if it can not be reached
+t_pvd_connection	*pvd_connect(int Port)
+{
+	int			s;
+	struct sockaddr_in 	sa;
+	struct sockaddr_storage	Peer;
+	socklen_t		PeerLen;
+	t_pvd_connection	*conn = NULL;
+
+	Port = GetPort(Port);
+
+	if ((s = ConnectUnix(Port, (struct sockaddr_un *) &Peer, &PeerLen)) == -1) {
+		if ((s = socket(AF_INET, SOCK_STREAM, 0)) == -1) {
+			return(NULL);
+		}
+
+		sa.sin_family = AF_INET;
+		sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		sa.sin_port = htons(Port);
+
+		if (connect(s, (struct sockaddr *) &sa, sizeof(sa)) == -1) {
+			close(s);
+			return(NULL);
+		}
+		memcpy(&Peer, &sa, sizeof(sa));
+		PeerLen = sizeof(sa);
 	}
 
 	if ((conn = NewConnection()) == NULL) {
@@ -215,6 +278,8 @@ t_pvd_connection	*pvd_connect(int Port)
 	}
 	else {
 		conn->fd = s;
+		memcpy(&conn->Peer, &Peer, PeerLen);
+		conn->PeerLen = PeerLen;
 	}
 
 	return(conn);
@@ -222,29 +287,31 @@ t_pvd_connection	*pvd_connect(int Port)
 
 // reopen_connection : given an initial connection where all parameters have been
 // supplied, just reuse the same connection parameters to create a new connection
-// with the server
-static	int	reopen_connection(int fd)
+// with the server. The address of the server is remembered : the initial
+// connection does not need to be alive (the daemon may have been restarted)
+static	int	reopen_connection(t_pvd_connection *conn)
 {
 	int s;
-	struct sockaddr sa;
-	socklen_t salen;
 
-	if (fd == -1) {
+	if (conn == NULL || conn->fd == -1) {
 		return(-1);
 	}
 
 	// We want to use the same connection parameters as the general connection
-	salen = sizeof(sa);
+	if (conn->PeerLen == 0) {
+		conn->PeerLen = sizeof(conn->Peer);
 
-	if (getpeername(fd, &sa, &salen) == -1) {
-		return(-1);
+		if (getpeername(conn->fd, (struct sockaddr *) &conn->Peer, &conn->PeerLen) == -1) {
+			conn->PeerLen = 0;
+			return(-1);
+		}
 	}
 
-	if ((s = socket(AF_INET, SOCK_STREAM, 0)) == -1) {
+	if ((s = socket(conn->Peer.ss_family, SOCK_STREAM, 0)) == -1) {
 		return(-1);
 	}
 
-	if (connect(s, &sa, salen) == -1) {
+	if (connect(s, (struct sockaddr *) &conn->Peer, conn->PeerLen) == -1) {
 		close(s);
 		return(-1);
 	}
@@ -256,19 +323,24 @@ t_pvd_connection	*pvd_reconnect(t_pvd_connection *conn)
 	int			s;
 	t_pvd_connection	*newconn = NULL;
 
-	if ((s = reopen_connection(pvd_connection_fd(conn))) != -1) {
+	if ((s = reopen_connection(conn)) != -1) {
 		if ((newconn = NewConnection()) == NULL) {
 			close(s);
 			return(NULL);
 		}
 		newconn->fd = s;
+		memcpy(&newconn->Peer, &conn->Peer, conn->PeerLen);
+		newconn->PeerLen = conn->PeerLen;
 	}
 	return(newconn);
 }
 
+static	void	FlushSyncChannels(t_pvd_connection *conn);
+
 void	pvd_disconnect(t_pvd_connection *conn)
 {
 	if (conn != NULL) {
+		FlushSyncChannels(conn);
 		close(conn->fd);
 		DelConnection(conn);
 	}
@@ -306,6 +378,506 @@ t_pvd_connection	*pvd_get_binary_socket(t_pvd_connection *conn)
 
 }
 
+// ConnectSeqpacket : connect to the SOCK_SEQPACKET companion of the local
+// socket the daemon has been reached through. Returns -1 if there is none
+static	int	ConnectSeqpacket(t_pvd_connection *conn)
+{
+	int			s;
+	int			l;
+	struct sockaddr_un	sa;
+
+	if (conn->PeerLen == 0 || conn->Peer.ss_family != AF_UNIX) {
+		return(-1);
+	}
+	memcpy(&sa, &conn->Peer, conn->PeerLen);
+
+	// Abstract names are not \0 terminated
+	if (sa.sun_path[0] == '\0') {
+		l = conn->PeerLen - offsetof(struct sockaddr_un, sun_path);
+	}
+	else {
+		l = strnlen(sa.sun_path, sizeof(sa.sun_path));
+	}
+	if (l + strlen(PVDD_SEQPACKET_SUFFIX) >= sizeof(sa.sun_path)) {
+		return(-1);
+	}
+	memcpy(&sa.sun_path[l], PVDD_SEQPACKET_SUFFIX, strlen(PVDD_SEQPACKET_SUFFIX) + 1);
+	l += strlen(PVDD_SEQPACKET_SUFFIX);
+
+	if ((s = socket(AF_UNIX, SOCK_SEQPACKET, 0)) == -1) {
+		return(-1);
+	}
+
+	if (connect(s,
+		    (struct sockaddr *) &sa,
+		    sa.sun_path[0] == '\0' ?
+			offsetof(struct sockaddr_un, sun_path) + l :
+			sizeof(sa)) == -1) {
+		close(s);
+		return(-1);
+	}
+	return(s);
+}
+
+// pvd_get_binary_v2_socket : returns a new connection using the binary
+// protocol (v2). Requests must then be sent via pvd_bin_send_request(), and
+// the replies and notifications read via pvd_bin_get_message()
+// For local clients, the SOCK_SEQPACKET socket of the daemon is preferred :
+// messages need no reassembly
+t_pvd_connection	*pvd_get_binary_v2_socket(t_pvd_connection *conn)
+{
+	int			s;
+	t_pvd_connection	*newconn = NULL;
+
+	if (conn != NULL && (s = ConnectSeqpacket(conn)) != -1) {
+		if ((newconn = NewConnection()) == NULL) {
+			close(s);
+			return(NULL);
+		}
+		newconn->fd = s;
+		memcpy(&newconn->Peer, &conn->Peer, conn->PeerLen);
+		newconn->PeerLen = conn->PeerLen;
+		newconn->type = BINARY_V2_CONNECTION;
+		newconn->Seqpacket = true;
+
+		return(newconn);
+	}
+
+	if ((newconn = pvd_reconnect(conn)) != NULL) {
+		if (SendExact(newconn->fd, "PVD_CONNECTION_PROMOTE_BINARY_V2\n") == -1) {
+			pvd_disconnect(newconn);
+			return(NULL);
+		}
+		newconn->type = BINARY_V2_CONNECTION;
+	}
+
+	return(newconn);
+}
+
+// SendMessages : send a buffer of consecutive binary messages. On a
+// SOCK_SEQPACKET connection, each of them must be a datagram of its own
+// (they are still sent by batches, via sendmmsg())
+static	int	SendMessages(t_pvd_connection *conn, char *Data, int Length)
+{
+	struct mmsghdr	msgs[SYNC_WINDOW];
+	struct iovec	iov[SYNC_WINDOW];
+	t_BinaryHeader	H;
+	char		*End = Data + Length;
+	int		i, n;
+
+	if (! conn->Seqpacket) {
+		return(SendBytes(conn->fd, Data, Length));
+	}
+
+	while (Data < End) {
+		memset(msgs, 0, sizeof(msgs));
+		for (n = 0; n < SYNC_WINDOW && Data < End; n++) {
+			BinGetHeader(Data, &H);
+			iov[n].iov_base = Data;
+			iov[n].iov_len = PVD_BIN_HEADER_SIZE + H.Length;
+			msgs[n].msg_hdr.msg_iov = &iov[n];
+			msgs[n].msg_hdr.msg_iovlen = 1;
+			Data += iov[n].iov_len;
+		}
+		for (i = 0; i < n; ) {
+			int	m;
+
+			if ((m = sendmmsg(conn->fd, &msgs[i], n - i, MSG_NOSIGNAL)) == -1) {
+				if (errno == EINTR) {
+					continue;
+				}
+				return(-1);
+			}
+			i += m;
+		}
+	}
+	return(0);
+}
+
+// ReadDatagram : read the next datagram of a SOCK_SEQPACKET connection
+// into its Message buffer (grown as needed). Malformed datagrams are
+// dropped
+static	int	ReadDatagram(t_pvd_connection *conn, int flags)
+{
+	int		n;
+	t_BinaryHeader	H;
+
+	for (;;) {
+		// Size of the next datagram
+		if ((n = recv(conn->fd, NULL, 0, MSG_PEEK | MSG_TRUNC | flags)) <= 0) {
+			if (n == -1 && errno == EINTR) {
+				continue;
+			}
+			return(-1);
+		}
+		if (n > conn->MessageSize) {
+			char	*Message;
+
+			if ((Message = realloc(conn->Message, n)) == NULL) {
+				return(-1);
+			}
+			conn->Message = Message;
+			conn->MessageSize = n;
+		}
+		if ((n = recv(conn->fd, conn->Message, conn->MessageSize, flags)) <= 0) {
+			if (n == -1 && errno == EINTR) {
+				continue;
+			}
+			return(-1);
+		}
+		if (n >= PVD_BIN_HEADER_SIZE) {
+			BinGetHeader(conn->Message, &H);
+			if (H.Length == n - PVD_BIN_HEADER_SIZE) {
+				break;
+			}
+		}
+	}
+	conn->InMessage = n;
+	conn->Pending = true;
+
+	return(0);
+}
+
+// pvd_bin_send_request : send a request on a binary (v2) connection. pvdname
+// and attrName are NULL if the request does not need them. The id is echoed
+// in the reply(ies)
+int	pvd_bin_send_request(
+		t_pvd_connection *conn,
+		int opcode,
+		unsigned int id,
+		char *pvdname,
+		char *attrName)
+{
+	t_BinaryBuffer	BB;
+	int		rc = -1;
+
+	BBInit(&BB);
+	BBBeginMessage(&BB, opcode, PVD_STATUS_OK, id);
+	if (pvdname != NULL) {
+		BBAddTlvString(&BB, PVD_TLV_PVDNAME, pvdname);
+	}
+	if (attrName != NULL) {
+		BBAddTlvString(&BB, PVD_TLV_KEY, attrName);
+	}
+	if (conn != NULL && BBEndMessage(&BB) == 0) {
+		rc = SendMessages(conn, BB.Data, BB.Length);
+	}
+	BBUninit(&BB);
+
+	return(rc);
+}
+
+// pvd_bin_next_tlv : iterate over the TLVs of a binary message. *offset
+// must be 0 for the first call. The value is not \0 terminated. Returns -1
+// when there is no more TLV
+int	pvd_bin_next_tlv(
+		t_pvd_bin_message *msg,
+		int *offset,
+		int *type,
+		char **value,
+		int *length)
+{
+	char	*pt = msg->payload + *offset;
+
+	if (BinNextTlv(&pt, msg->payload + msg->length, type, value, length) == -1) {
+		return(-1);
+	}
+	*offset = pt - msg->payload;
+
+	return(0);
+}
+
+typedef	int	(*t_SyncHandler)(void *Context, int i, t_pvd_bin_message *msg);
+
+// TakeSyncChannel : take an idle channel from the pool of a connection
+// Returns NULL if the pool is empty
+static	t_pvd_connection	*TakeSyncChannel(t_pvd_connection *conn)
+{
+	int			i;
+	t_pvd_connection	*chan;
+
+	for (i = 0; i < SYNC_POOLSIZE; i++) {
+		if (conn->SyncPool[i] != NULL &&
+		    (chan = __atomic_exchange_n(
+					&conn->SyncPool[i],
+					NULL,
+					__ATOMIC_ACQ_REL)) != NULL) {
+			return(chan);
+		}
+	}
+	return(NULL);
+}
+
+// ReleaseSyncChannel : give a channel back to the pool of a connection. It
+// is closed if the pool is full
+static	void	ReleaseSyncChannel(t_pvd_connection *conn, t_pvd_connection *chan)
+{
+	int			i;
+	t_pvd_connection	*Empty;
+
+	for (i = 0; i < SYNC_POOLSIZE; i++) {
+		Empty = NULL;
+		if (__atomic_compare_exchange_n(
+				&conn->SyncPool[i],
+				&Empty,
+				chan,
+				false,
+				__ATOMIC_ACQ_REL,
+				__ATOMIC_ACQUIRE)) {
+			return;
+		}
+	}
+	pvd_disconnect(chan);
+}
+
+// FlushSyncChannels : close all the idle channels of a connection
+static	void	FlushSyncChannels(t_pvd_connection *conn)
+{
+	t_pvd_connection	*chan;
+
+	while ((chan = TakeSyncChannel(conn)) != NULL) {
+		pvd_disconnect(chan);
+	}
+}
+
+// SyncReceive : wait for the next message on a sync channel
+static	int	SyncReceive(t_pvd_connection *chan, t_pvd_bin_message *msg)
+{
+	int	n;
+
+	while (pvd_bin_get_message(chan, msg) == PVD_NO_MESSAGE_READ) {
+		if (chan->Seqpacket) {
+			if (ReadDatagram(chan, 0) == -1) {
+				return(-1);
+			}
+			continue;
+		}
+		if ((n = recv(chan->fd,
+			      &chan->ReadBuffer[chan->InReadBuffer],
+			      sizeof(chan->ReadBuffer) - 1 - chan->InReadBuffer,
+			      0)) <= 0) {
+			if (n == -1 && errno == EINTR) {
+				continue;
+			}
+			return(-1);
+		}
+		chan->InReadBuffer += n;
+	}
+	return(0);
+}
+
+// SyncExchange : send n requests of the same kind (one per pvd name, if
+// pvdnames is not NULL) on a channel, and hand each reply to Handler, along
+// with the index of the request. Returns -1 on I/O error (the number of
+// replies received so far is stored in *PtReceived)
+static	int	SyncExchange(
+			t_pvd_connection *chan,
+			int opcode,
+			int n,
+			char **pvdnames,
+			char *attrName,
+			t_SyncHandler Handler,
+			void *Context,
+			int *PtReceived)
+{
+	t_pvd_bin_message	msg;
+	t_BinaryBuffer		BB;
+	unsigned int		FirstId;
+	int			Sent = 0;
+	int			i;
+
+	*PtReceived = 0;
+
+	FirstId = chan->NextId;
+	chan->NextId += n;
+
+	BBInit(&BB);
+
+	while (*PtReceived < n) {
+		// Refill the window once half of it has been answered (small
+		// writes would be delayed by Nagle's algorithm)
+		if (Sent < n && Sent - *PtReceived <= SYNC_WINDOW / 2) {
+			BB.Length = 0;
+			for (; Sent < n && Sent - *PtReceived < SYNC_WINDOW; Sent++) {
+				BBBeginMessage(&BB, opcode, PVD_STATUS_OK, FirstId + Sent);
+				if (pvdnames != NULL) {
+					BBAddTlvString(&BB, PVD_TLV_PVDNAME, pvdnames[Sent]);
+				}
+				if (attrName != NULL) {
+					BBAddTlvString(&BB, PVD_TLV_KEY, attrName);
+				}
+				BBEndMessage(&BB);
+			}
+			if (BB.Error || SendMessages(chan, BB.Data, BB.Length) == -1) {
+				BBUninit(&BB);
+				return(-1);
+			}
+		}
+
+		if (SyncReceive(chan, &msg) == -1) {
+			BBUninit(&BB);
+			return(-1);
+		}
+		// Not one of ours (notifications, stale replies) : ignore
+		if ((i = msg.id - FirstId) < 0 || i >= Sent) {
+			continue;
+		}
+		Handler(Context, i, &msg);
+		(*PtReceived)++;
+	}
+
+	BBUninit(&BB);
+	return(0);
+}
+
+// SyncRequests : same as SyncExchange, on a channel of a connection. A
+// channel failing before any reply has been received most likely dates
+// back to a previous instance of the daemon : all the idle channels are
+// then discarded and the requests are sent again on a new channel
+static	int	SyncRequests(
+			t_pvd_connection *conn,
+			int opcode,
+			int n,
+			char **pvdnames,
+			char *attrName,
+			t_SyncHandler Handler,
+			void *Context)
+{
+	t_pvd_connection	*chan;
+	int			Pooled;
+	int			Received;
+
+	if (conn == NULL) {
+		return(-1);
+	}
+
+	for (;;) {
+		if ((chan = TakeSyncChannel(conn)) != NULL) {
+			Pooled = true;
+		}
+		else {
+			if ((chan = pvd_get_binary_v2_socket(conn)) == NULL) {
+				return(-1);
+			}
+			Pooled = false;
+		}
+
+		if (SyncExchange(
+				chan,
+				opcode,
+				n,
+				pvdnames,
+				attrName,
+				Handler,
+				Context,
+				&Received) == 0) {
+			ReleaseSyncChannel(conn, chan);
+			return(0);
+		}
+
+		// The channel is out of sync (or dead) : never reuse it
+		pvd_disconnect(chan);
+
+		if (! Pooled || Received > 0) {
+			return(-1);
+		}
+		FlushSyncChannels(conn);
+	}
+}
+
+// TlvDup : return a malloced \0 terminated copy of a TLV value, followed by
+// a suffix
+static	char	*TlvDup(char *value, int length, char *suffix)
+{
+	char	*s;
+
+	if ((s = malloc(length + strlen(suffix) + 1)) != NULL) {
+		memcpy(s, value, length);
+		strcpy(s + length, suffix);
+	}
+	return(s);
+}
+
+// SyncGetList : PVD_OP_LIST reply handler
+static	int	SyncGetList(void *Context, int i, t_pvd_bin_message *msg)
+{
+	t_pvd_list	*pvdList = (t_pvd_list *) Context;
+	int		offset = 0;
+	int		type;
+	char		*value;
+	int		length;
+
+	pvdList->npvd = 0;
+
+	while (pvd_bin_next_tlv(msg, &offset, &type, &value, &length) == 0) {
+		if (type == PVD_TLV_PVDNAME && pvdList->npvd < DIM(pvdList->pvdnames)) {
+			pvdList->pvdnames[pvdList->npvd++] = TlvDup(value, length, "");
+		}
+	}
+	return(0);
+}
+
+// SyncGetAttributes : PVD_OP_ATTRIBUTES reply handler. The attributes are
+// turned into the JSON object sent by the text protocol
+static	int	SyncGetAttributes(void *Context, int i, t_pvd_bin_message *msg)
+{
+	char		**attributes = (char **) Context;
+	t_StringBuffer	SB;
+	int		offset = 0;
+	int		type;
+	char		*value;
+	int		length;
+	int		n = 0;
+
+	attributes[i] = NULL;
+
+	if (msg->status != PVD_STATUS_OK) {
+		return(-1);
+	}
+
+	SBInit(&SB);
+	SBAddString(&SB, "{");
+	while (pvd_bin_next_tlv(msg, &offset, &type, &value, &length) == 0) {
+		if (type == PVD_TLV_KEY) {
+			SBAddString(&SB, "%s\n\t\"%.*s\" : ", n++ == 0 ? "" : ",", length, value);
+		} else
+		if (type == PVD_TLV_VALUE) {
+			SBAddString(&SB, "%.*s", length, value);
+		}
+	}
+	SBAddString(&SB, "\n}\n");
+
+	attributes[i] = SB.String;
+
+	return(0);
+}
+
+// SyncGetAttribute : PVD_OP_ATTRIBUTE reply handler. As with the text
+// protocol, an unknown attribute is null
+static	int	SyncGetAttribute(void *Context, int i, t_pvd_bin_message *msg)
+{
+	char	**attrValue = (char **) Context;
+	int	offset = 0;
+	int	type;
+	char	*value;
+	int	length;
+
+	attrValue[i] = NULL;
+
+	if (msg->status == PVD_STATUS_UNKNOWN_ATTRIBUTE) {
+		attrValue[i] = strdup("null\n");
+		return(0);
+	}
+
+	while (pvd_bin_next_tlv(msg, &offset, &type, &value, &length) == 0) {
+		if (type == PVD_TLV_VALUE) {
+			attrValue[i] = TlvDup(value, length, "\n");
+			return(0);
+		}
+	}
+	return(-1);
+}
+
 // pvd_get_pvd_list : send a PVD_GET_LIST message to the daemon
 // It does not wait for a reply
 int	pvd_get_pvd_list(t_pvd_connection *conn)
@@ -338,23 +910,9 @@ int	pvd_parse_pvd_list(char *msg, t_pvd_list *pvdList)
 // It waits for a reply
 int	pvd_get_pvd_list_sync(t_pvd_connection *conn, t_pvd_list *pvdList)
 {
-	t_pvd_connection	*newconn = NULL;
-	int			rc = -1;
-	char			*msg;
-	char			pvdString[2048];
-
-	if ((newconn = pvd_get_binary_socket(conn)) != NULL) {
-		if (pvd_get_pvd_list(newconn) == 0 && ReadMsg(newconn->fd, &msg) == 0) {
-			if (sscanf(msg, "PVD_LIST %[^\n]\n", pvdString) == 1) {
-				// pvdString contains a list of space separated FQDN pvdIds
-				pvd_parse_pvd_list(pvdString, pvdList);
-				rc = 0;
-			}
-			free(msg);
-		}
-		pvd_disconnect(newconn);
-	}
-	return(rc);
+	pvdList->npvd = 0;
+
+	return(SyncRequests(conn, PVD_OP_GET_LIST, 1, NULL, NULL, SyncGetList, pvdList));
 }
 
 int	pvd_get_attributes(t_pvd_connection *conn, char *pvdname)
@@ -375,25 +933,47 @@ int	pvd_get_attributes_sync(
 		char *pvdname,
 		char **attributes)
 {
-	t_pvd_connection	*newconn = NULL;
-	char			*msg;
-	char			Pattern[2048];
-
 	*attributes = NULL;
 
-	if ((newconn = pvd_get_binary_socket(conn)) != NULL) {
-		if (pvd_get_attributes(newconn, pvdname) == 0 &&
-		    ReadMsg(newconn->fd, &msg) == 0) {
-			sprintf(Pattern, "PVD_ATTRIBUTES %s", pvdname);
+	if (SyncRequests(
+			conn,
+			PVD_OP_GET_ATTRIBUTES,
+			1,
+			&pvdname,
+			NULL,
+			SyncGetAttributes,
+			attributes) == -1) {
+		return(-1);
+	}
+	return(*attributes == NULL ? -1 : 0);
+}
+
+// pvd_get_attributes_many : same as pvd_get_attributes_sync, for n pvd at
+// once (the requests are pipelined). attributes[i] is NULL if pvdnames[i]
+// is unknown. Returns -1 on error (the attributes received so far must be
+// freed anyway)
+int	pvd_get_attributes_many(
+		t_pvd_connection *conn,
+		int n,
+		char **pvdnames,
+		char **attributes)
+{
+	int	i;
 
-			if (strncmp(msg, Pattern, strlen(Pattern)) == 0) {
-				*attributes = strdup(StripSpaces(&msg[strlen(Pattern)]));
-			}
-			free(msg);
-		}
-		pvd_disconnect(newconn);
+	for (i = 0; i < n; i++) {
+		attributes[i] = NULL;
 	}
-	return(*attributes == NULL ? -1 : 0);
+	if (n == 0) {
+		return(0);
+	}
+	return(SyncRequests(
+			conn,
+			PVD_OP_GET_ATTRIBUTES,
+			n,
+			pvdnames,
+			NULL,
+			SyncGetAttributes,
+			attributes));
 }
 
 int	pvd_get_attribute(t_pvd_connection *conn, char *pvdname, char *attrName)
@@ -411,26 +991,18 @@ int	pvd_get_attribute_sync(
 		char *pvdname, 
 		char *attrName, char **attrValue)
 {
-	t_pvd_connection	*newconn = NULL;
-	char			*msg;
-	char			Pattern[2048];
-
 	*attrValue = NULL;
 
-	if ((newconn = pvd_get_binary_socket(conn)) != NULL) {
-		if (pvd_get_attribute(newconn, pvdname, attrName) == 0 &&
-		    ReadMsg(newconn->fd, &msg) == 0) {
-			sprintf(Pattern, "PVD_ATTRIBUTE %s %s", pvdname, attrName);
-
-			if (strncmp(msg, Pattern, strlen(Pattern)) == 0) {
-				*attrValue = strdup(StripSpaces(&msg[strlen(Pattern)]));
-			}
-
-			free(msg);
-		}
-		pvd_disconnect(newconn);
+	if (SyncRequests(
+			conn,
+			PVD_OP_GET_ATTRIBUTE,
+			1,
+			&pvdname,
+			attrName,
+			SyncGetAttribute,
+			attrValue) == -1) {
+		return(-1);
 	}
-
 	return(*attrValue == NULL ? -1 : 0);
 }
 
@@ -464,6 +1036,168 @@ int	pvd_unsubscribe_pvd_notifications(t_pvd_connection *conn, char *pvdname)
 	return(SendExact(pvd_connection_fd(conn), s));
 }
 
+// pvd_subscribe_attributes_diff : once called, the attributes notifications
+// for the subscribed pvd are PVD_ATTRIBUTES_DIFF messages, carrying only
+// the changes (see pvd_parse_attributes_diff)
+int	pvd_subscribe_attributes_diff(t_pvd_connection *conn)
+{
+	return(SendExact(pvd_connection_fd(conn), "PVD_SUBSCRIBE_ATTRIBUTES_DIFF\n"));
+}
+
+int	pvd_unsubscribe_attributes_diff(t_pvd_connection *conn)
+{
+	return(SendExact(pvd_connection_fd(conn), "PVD_UNSUBSCRIBE_ATTRIBUTES_DIFF\n"));
+}
+
+// SkipJsonValue : return the address of the first character following the
+// JSON value (object, array, string or scalar) starting at s, NULL if the
+// value is not terminated
+static	char	*SkipJsonValue(char *s)
+{
+	int	Depth = 0;
+	int	InString = false;
+
+	s = StripSpaces(s);
+
+	for (; *s != '\0'; s++) {
+		if (InString) {
+			if (*s == '\\' && s[1] != '\0') {
+				s++;
+			} else
+			if (*s == '"') {
+				InString = false;
+				if (Depth == 0) {
+					return(s + 1);
+				}
+			}
+			continue;
+		}
+		switch (*s) {
+		case '"' :
+			InString = true;
+			break;
+		case '{' :
+		case '[' :
+			Depth++;
+			break;
+		case '}' :
+		case ']' :
+			if (Depth == 0) {
+				return(s);	// end of an enclosing scalar
+			}
+			if (--Depth == 0) {
+				return(s + 1);
+			}
+			break;
+		case ',' :
+		case ' ' :
+		case '\t' :
+		case '\n' :
+			if (Depth == 0) {
+				return(s);
+			}
+			break;
+		}
+	}
+	return(Depth == 0 && ! InString ? s : NULL);
+}
+
+// GetJsonMember : return (strduped) the value of a given member of the
+// JSON object msg points to. The member is searched at the top level only
+static	char	*GetJsonMember(char *msg, char *Name)
+{
+	char	*pt;
+	char	*End;
+	char	*Value;
+	int	l = strlen(Name);
+
+	if (*(pt = StripSpaces(msg)) != '{') {
+		return(NULL);
+	}
+	pt++;
+
+	while (*(pt = StripSpaces(pt)) == '"') {
+		int	Found = strncmp(pt + 1, Name, l) == 0 && pt[l + 1] == '"';
+
+		// Skip the member name and the ':'
+		if ((pt = SkipJsonValue(pt)) == NULL ||
+		    *(pt = StripSpaces(pt)) != ':') {
+			return(NULL);
+		}
+		pt = StripSpaces(pt + 1);
+
+		if ((End = SkipJsonValue(pt)) == NULL) {
+			return(NULL);
+		}
+		if (Found) {
+			if ((Value = malloc(End - pt + 1)) != NULL) {
+				memcpy(Value, pt, End - pt);
+				Value[End - pt] = '\0';
+			}
+			return(Value);
+		}
+		if (*(pt = StripSpaces(End)) == ',') {
+			pt++;
+		}
+	}
+	return(NULL);
+}
+
+// pvd_parse_attributes_diff : parse a PVD_ATTRIBUTES_DIFF notification
+// pvdname must be PVDNAMSIZ long. The changed output parameter receives the
+// JSON object of the changed (or created) attributes, removed the JSON
+// array of the removed attributes names. They need to be freed using
+// free() by the caller
+// The generation is incremented for each notification of the pvd : a gap
+// means that a notification has been lost (the client should then use
+// pvd_get_attributes to resynchronize, see pvd_parse_attributes_generation)
+int	pvd_parse_attributes_diff(
+		char *msg,
+		char *pvdname,
+		unsigned int *generation,
+		char **changed,
+		char **removed)
+{
+	char	Format[64];
+	int	n = 0;
+
+	*changed = NULL;
+	*removed = NULL;
+
+	sprintf(Format, "PVD_ATTRIBUTES_DIFF %%%d[^ ] %%u%%n", PVDNAMSIZ - 1);
+
+	if (sscanf(msg, Format, pvdname, generation, &n) != 2 || n == 0) {
+		return(-1);
+	}
+
+	if ((*changed = GetJsonMember(&msg[n], "changed")) == NULL ||
+	    (*removed = GetJsonMember(&msg[n], "removed")) == NULL) {
+		if (*changed != NULL) {
+			free(*changed);
+			*changed = NULL;
+		}
+		return(-1);
+	}
+	return(0);
+}
+
+// pvd_parse_attributes_generation : parse the first line of the reply to
+// PVD_GET_ATTRIBUTES received by a client having subscribed to the deltas
+// (pvd_subscribe_attributes_diff). The reply reflects the notifications
+// up to the returned generation : the PVD_ATTRIBUTES_DIFF notifications
+// whose generation is not greater must be ignored
+int	pvd_parse_attributes_generation(
+		char *msg,
+		char *pvdname,
+		unsigned int *generation)
+{
+	char	Format[64];
+
+	sprintf(Format, "PVD_ATTRIBUTES %%%d[^ ] %%u", PVDNAMSIZ - 1);
+
+	return(sscanf(msg, Format, pvdname, generation) == 2 ? 0 : -1);
+}
+
 // ParseStringArray : given a string ["...", "...", ...], returns
 // the  different ... strings in the given array
 // The substrings must not contain ] or "
@@ -564,22 +1298,12 @@ int	pvd_get_rdnss_sync(
 		char *pvdname,
 		t_rdnss_list *PtRdnss)
 {
-	t_pvd_connection	*newconn = NULL;
-	int			rc = -1;
-	char			*msg;
-	char			Pattern[2048];
-
-	if ((newconn = pvd_get_binary_socket(conn)) != NULL) {
-		if (pvd_get_rdnss(newconn, pvdname) == 0 &&
-		    ReadMsg(newconn->fd, &msg) == 0) {
-			sprintf(Pattern, "PVD_ATTRIBUTE %s rdnss\n", pvdname);
+	int	rc = -1;
+	char	*value;
 
-			if (strncmp(msg, Pattern, strlen(Pattern)) == 0) {
-				rc = pvd_parse_rdnss(&msg[strlen(Pattern)], PtRdnss);
-			}
-			free(msg);
-		}
-		pvd_disconnect(newconn);
+	if (pvd_get_attribute_sync(conn, pvdname, "rdnss", &value) == 0) {
+		rc = pvd_parse_rdnss(value, PtRdnss);
+		free(value);
 	}
 	return(rc);
 }
@@ -598,26 +1322,440 @@ int	pvd_get_dnssl_sync(
 		char *pvdname,
 		t_dnssl_list *PtDnssl)
 {
-	t_pvd_connection	*newconn = NULL;
-	int			rc = -1;
-	char			*msg;
-	char			Pattern[2048];
+	int	rc = -1;
+	char	*value;
+
+	if (pvd_get_attribute_sync(conn, pvdname, "dnssl", &value) == 0) {
+		rc = pvd_parse_dnssl(value, PtDnssl);
+		free(value);
+	}
+	return(rc);
+}
+
+/*
+ * Snapshot functions : lookups in the copy of the database the daemon
+ * publishes in shared memory (see pvd-snapshot.h). They cost no system call
+ * at all, but are only available to the clients running on the same host
+ * than the daemon. The lookups are lock free : they are retried when the
+ * daemon has updated the snapshot in the meantime
+ */
+#define	SNAPSHOT_MAXRETRIES	1000
+
+struct t_pvd_snapshot {
+	char			Name[64];
+	t_SnapshotHeader	*Header;
+	unsigned int		Size;		/* of the mapping */
+	int			Port;
+	t_pvd_connection	*EventConn;	/* for the eventfd (NULL if none) */
+	int			EventFd;
+};
+
+// MapSnapshot : (re)map the region of the daemon. The previous mapping
+// is only released on success
+static	int	MapSnapshot(t_pvd_snapshot *snap)
+{
+	int			fd;
+	struct stat		st;
+	t_SnapshotHeader	*H;
+
+	if ((fd = shm_open(snap->Name, O_RDONLY, 0)) == -1) {
+		return(-1);
+	}
+	if (fstat(fd, &st) == -1 || st.st_size < (off_t) sizeof(t_SnapshotHeader)) {
+		close(fd);
+		return(-1);
+	}
+	H = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+
+	if (H == MAP_FAILED) {
+		return(-1);
+	}
+	if (__atomic_load_n(&H->Magic, __ATOMIC_ACQUIRE) != PVD_SNAPSHOT_MAGIC ||
+	    H->Version != PVD_SNAPSHOT_VERSION) {
+		munmap(H, st.st_size);
+		return(-1);
+	}
+
+	if (snap->Header != NULL) {
+		munmap(snap->Header, snap->Size);
+	}
+	snap->Header = H;
+	snap->Size = st.st_size;
+
+	return(0);
+}
+
+// pvd_snapshot_open : map the snapshot published by the daemon listening
+// on a given port (-1 for the default one). The PVDD_SNAPSHOT environment
+// variable overrides the name of the shared memory object
+t_pvd_snapshot	*pvd_snapshot_open(int Port)
+{
+	char		*Name;
+	t_pvd_snapshot	*snap;
+
+	if ((snap = NEW(t_pvd_snapshot)) == NULL) {
+		return(NULL);
+	}
+	snap->Port = GetPort(Port);
+	if ((Name = getenv("PVDD_SNAPSHOT")) != NULL) {
+		snprintf(snap->Name, sizeof(snap->Name), "%s", Name);
+	}
+	else {
+		snprintf(snap->Name, sizeof(snap->Name), DEFAULT_PVDD_SNAPSHOT, snap->Port);
+	}
+	snap->Header = NULL;
+	snap->Size = 0;
+	snap->EventConn = NULL;
+	snap->EventFd = -1;
+
+	if (MapSnapshot(snap) == -1) {
+		free(snap);
+		return(NULL);
+	}
+	return(snap);
+}
+
+static	void	CloseSnapshotEventFd(t_pvd_snapshot *snap)
+{
+	if (snap->EventFd != -1) {
+		close(snap->EventFd);
+		snap->EventFd = -1;
+	}
+	if (snap->EventConn != NULL) {
+		pvd_disconnect(snap->EventConn);
+		snap->EventConn = NULL;
+	}
+}
+
+void	pvd_snapshot_close(t_pvd_snapshot *snap)
+{
+	if (snap != NULL) {
+		CloseSnapshotEventFd(snap);
+		munmap(snap->Header, snap->Size);
+		free(snap);
+	}
+}
+
+// NextPvdRecord : iterate over the pvd records (*Offset must be 0 for the
+// first call). The daemon may be rewriting them : all lengths are checked
+// before being used. Returns NULL at the end, or on inconsistent records
+static	t_SnapshotPvd	*NextPvdRecord(t_pvd_snapshot *snap, unsigned int *Offset)
+{
+	unsigned int	Limit = snap->Size - sizeof(t_SnapshotHeader);
+	t_SnapshotPvd	*PtPvd;
+
+	if (snap->Header->Length < Limit) {
+		Limit = snap->Header->Length;
+	}
+	if (*Offset + sizeof(t_SnapshotPvd) > Limit) {
+		return(NULL);
+	}
+
+	PtPvd = (t_SnapshotPvd *) ((char *) (snap->Header + 1) + *Offset);
+
+	if (PtPvd->Length < sizeof(t_SnapshotPvd) + PtPvd->NameLength ||
+	    PtPvd->Length > Limit - *Offset ||
+	    PtPvd->NameLength == 0 ||
+	    PtPvd->Name[PtPvd->NameLength - 1] != '\0') {
+		return(NULL);
+	}
+	*Offset += PtPvd->Length;
+
+	return(PtPvd);
+}
+
+// SnapshotLookup : search an attribute in the records. The result is only
+// meaningful if the sequence number has not changed in the meantime
+typedef	struct {
+	char	*pvdname;
+	char	*attrName;
+	char	*value;
+	int	size;
+}	t_SnapshotLookup;
+
+static	int	SnapshotLookup(t_pvd_snapshot *snap, void *Context)
+{
+	t_SnapshotLookup	*L = (t_SnapshotLookup *) Context;
+	unsigned int		Offset = 0;
+	unsigned int		End;
+	unsigned int		nl = strlen(L->pvdname) + 1;
+	unsigned int		al = strlen(L->attrName) + 1;
+	unsigned int		l;
+	char			*Record;
+	t_SnapshotPvd		*PtPvd;
+	t_SnapshotAttribute	*PtAttr;
+
+	while ((PtPvd = NextPvdRecord(snap, &Offset)) != NULL) {
+		if (PtPvd->NameLength == nl && memcmp(PtPvd->Name, L->pvdname, nl) == 0) {
+			break;
+		}
+	}
+	if (PtPvd == NULL) {
+		return(-1);
+	}
+
+	Record = (char *) PtPvd;
+	End = PtPvd->Length;
+
+	for (Offset = SNAPSHOT_ALIGN(sizeof(t_SnapshotPvd) + PtPvd->NameLength);
+	     Offset + sizeof(t_SnapshotAttribute) <= End;
+	     Offset += l) {
+		PtAttr = (t_SnapshotAttribute *) (Record + Offset);
+
+		l = SNAPSHOT_ALIGN(sizeof(t_SnapshotAttribute) +
+				   PtAttr->KeyLength +
+				   PtAttr->ValueLength);
+		if (PtAttr->KeyLength == 0 || PtAttr->ValueLength == 0 ||
+		    PtAttr->KeyLength > End - Offset ||
+		    PtAttr->ValueLength > End - Offset || l > End - Offset) {
+			return(-1);
+		}
+		if (PtAttr->KeyLength == al && memcmp(PtAttr->Data, L->attrName, al) == 0) {
+			l = PtAttr->ValueLength - 1;
+			if (L->size > 0) {
+				memcpy(L->value, PtAttr->Data + al, l < (unsigned int) L->size ? l : L->size - 1);
+				L->value[l < (unsigned int) L->size ? l : L->size - 1] = '\0';
+			}
+			return(l);
+		}
+	}
+	return(-1);
+}
+
+// SnapshotRead : run a reader on a consistent snapshot. The reader is run
+// again if the daemon has updated the snapshot meanwhile. The snapshot is
+// remapped transparently when it has grown or when the daemon has been
+// restarted
+static	int	SnapshotRead(
+			t_pvd_snapshot *snap,
+			int (*Reader)(t_pvd_snapshot *snap, void *Context),
+			void *Context)
+{
+	int			i;
+	int			rc;
+	unsigned int		Sequence;
+	t_SnapshotHeader	*H;
+
+	for (i = 0; i < SNAPSHOT_MAXRETRIES; i++) {
+		H = snap->Header;
+
+		if (__atomic_load_n(&H->Superseded, __ATOMIC_ACQUIRE) ||
+		    __atomic_load_n(&H->Size, __ATOMIC_RELAXED) > snap->Size) {
+			if (MapSnapshot(snap) == -1) {
+				return(-1);
+			}
+			continue;
+		}
+
+		Sequence = __atomic_load_n(&H->Sequence, __ATOMIC_ACQUIRE);
+		if (Sequence & 1) {
+			continue;	// update in progress
+		}
+
+		rc = Reader(snap, Context);
+
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (__atomic_load_n(&H->Sequence, __ATOMIC_RELAXED) == Sequence) {
+			return(rc);
+		}
+	}
+	errno = EAGAIN;
+	return(-1);
+}
+
+// pvd_snapshot_get_attribute : copy the (JSON) value of an attribute of a
+// pvd into value (truncated to size bytes, \0 included, as snprintf() does)
+// Returns the length of the value, or -1 if the pvd or the attribute are
+// unknown
+int	pvd_snapshot_get_attribute(
+		t_pvd_snapshot *snap,
+		char *pvdname,
+		char *attrName,
+		char *value,
+		int size)
+{
+	t_SnapshotLookup	L;
+
+	L.pvdname = pvdname;
+	L.attrName = attrName;
+	L.value = value;
+	L.size = size;
+
+	return(SnapshotRead(snap, SnapshotLookup, &L));
+}
 
-	if ((newconn = pvd_get_binary_socket(conn)) != NULL) {
-		if (pvd_get_dnssl(newconn, pvdname) == 0 &&
-		    ReadMsg(newconn->fd, &msg) == 0) {
-			sprintf(Pattern, "PVD_ATTRIBUTE %s dnssl\n", pvdname);
+// SnapshotPvdList : collect the names of the pvd changed since a given
+// generation. What a previous (inconsistent) run has collected is released
+typedef	struct {
+	unsigned int	since;
+	t_pvd_list	*pvdList;
+}	t_SnapshotPvdList;
 
-			if (strncmp(msg, Pattern, strlen(Pattern)) == 0) {
-				rc = pvd_parse_dnssl(&msg[strlen(Pattern)], PtDnssl);
+static	int	SnapshotPvdList(t_pvd_snapshot *snap, void *Context)
+{
+	t_SnapshotPvdList	*L = (t_SnapshotPvdList *) Context;
+	t_pvd_list		*pvdList = L->pvdList;
+	unsigned int		Offset = 0;
+	t_SnapshotPvd		*PtPvd;
+
+	while (pvdList->npvd > 0) {
+		free(pvdList->pvdnames[--pvdList->npvd]);
+	}
+
+	while ((PtPvd = NextPvdRecord(snap, &Offset)) != NULL) {
+		if (L->since != 0 && (int) (PtPvd->Generation - L->since) <= 0) {
+			continue;
+		}
+		if (pvdList->npvd < DIM(pvdList->pvdnames)) {
+			if ((pvdList->pvdnames[pvdList->npvd] = strdup(PtPvd->Name)) == NULL) {
+				return(-1);
 			}
-			free(msg);
+			pvdList->npvd++;
+		}
+	}
+	return(0);
+}
+
+// pvd_snapshot_get_pvd_list : fill in the output array with the names of
+// the pvd changed after a given generation (see pvd_snapshot_generation()),
+// 0 standing for all of them. They need to be freed using free() by the
+// caller. Removed pvd are obviously not listed
+int	pvd_snapshot_get_pvd_list(
+		t_pvd_snapshot *snap,
+		unsigned int since,
+		t_pvd_list *pvdList)
+{
+	int			rc;
+	t_SnapshotPvdList	L;
+
+	L.since = since;
+	L.pvdList = pvdList;
+	pvdList->npvd = 0;
+
+	if ((rc = SnapshotRead(snap, SnapshotPvdList, &L)) == -1) {
+		while (pvdList->npvd > 0) {
+			free(pvdList->pvdnames[--pvdList->npvd]);
 		}
-		pvd_disconnect(newconn);
 	}
 	return(rc);
 }
 
+// pvd_snapshot_generation : generation number of the snapshot, incremented
+// by each update of the daemon's database
+unsigned int	pvd_snapshot_generation(t_pvd_snapshot *snap)
+{
+	if (__atomic_load_n(&snap->Header->Superseded, __ATOMIC_ACQUIRE)) {
+		MapSnapshot(snap);
+	}
+	return(__atomic_load_n(&snap->Header->Generation, __ATOMIC_ACQUIRE));
+}
+
+// pvd_snapshot_wait : wait for the generation number of the snapshot to
+// differ from a given one (at most timeout ms, -1 for no limit), sleeping
+// on it (futex). Returns -1 if it has not changed (errno is ETIMEDOUT, or
+// EINTR if a signal has been caught)
+int	pvd_snapshot_wait(t_pvd_snapshot *snap, unsigned int generation, int timeout)
+{
+	struct timespec		ts;
+	t_SnapshotHeader	*H = snap->Header;
+
+	ts.tv_sec = timeout / 1000;
+	ts.tv_nsec = (timeout % 1000) * 1000000;
+
+	while (__atomic_load_n(&H->Generation, __ATOMIC_ACQUIRE) == generation &&
+	       ! __atomic_load_n(&H->Superseded, __ATOMIC_ACQUIRE)) {
+		// The kernel checks the value of the word before sleeping
+		if (syscall(SYS_futex,
+			    &H->Generation,
+			    FUTEX_WAIT,
+			    generation,
+			    timeout < 0 ? NULL : &ts,
+			    NULL,
+			    0) == -1 &&
+		    errno != EAGAIN) {
+			return(-1);
+		}
+	}
+	return(pvd_snapshot_generation(snap) == generation ? -1 : 0);
+}
+
+// pvd_snapshot_eventfd : returns a descriptor that becomes readable when
+// the snapshot is updated (the 8 bytes counter must then be read, see
+// eventfd(2)), allowing to wait in poll()/epoll along with other events
+// It is requested to the daemon over a dedicated local connection, and
+// is valid until pvd_snapshot_close(). A new one must be requested after
+// a restart of the daemon (pvd_snapshot_generation() has then changed,
+// but the previous descriptor is no longer signaled)
+int	pvd_snapshot_eventfd(t_pvd_snapshot *snap)
+{
+	t_pvd_connection	*conn;
+	char			Header[PVD_BIN_HEADER_SIZE];
+	struct iovec		iov;
+	struct msghdr		msg;
+	struct cmsghdr		*cmsg;
+	union {
+		struct cmsghdr	Align;
+		char		Buffer[CMSG_SPACE(sizeof(int))];
+	}	Control;
+	t_BinaryHeader		H;
+	int			n;
+	int			fd = -1;
+
+	CloseSnapshotEventFd(snap);
+
+	if ((conn = pvd_connect(snap->Port)) == NULL) {
+		return(-1);
+	}
+	snap->EventConn = pvd_get_binary_v2_socket(conn);
+	pvd_disconnect(conn);
+
+	if (snap->EventConn == NULL ||
+	    pvd_bin_send_request(snap->EventConn,
+				 PVD_OP_GET_SNAPSHOT_EVENTFD, 1, NULL, NULL) == -1) {
+		CloseSnapshotEventFd(snap);
+		return(-1);
+	}
+
+	// The descriptor comes with the first byte of the reply
+	iov.iov_base = Header;
+	iov.iov_len = sizeof(Header);
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = Control.Buffer;
+	msg.msg_controllen = sizeof(Control.Buffer);
+
+	while ((n = recvmsg(snap->EventConn->fd, &msg, MSG_WAITALL | MSG_CMSG_CLOEXEC)) == -1 &&
+	       errno == EINTR) {
+		;
+	}
+
+	for (cmsg = n > 0 ? CMSG_FIRSTHDR(&msg) : NULL;
+	     cmsg != NULL;
+	     cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+		if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS &&
+		    cmsg->cmsg_len == CMSG_LEN(sizeof(int))) {
+			memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+		}
+	}
+
+	if (n == sizeof(Header)) {
+		BinGetHeader(Header, &H);
+	}
+	if (n != sizeof(Header) || H.Opcode != PVD_OP_ACK || H.Status != PVD_STATUS_OK ||
+	    H.Length != 0 || fd == -1) {
+		if (fd != -1) {
+			close(fd);
+		}
+		CloseSnapshotEventFd(snap);
+		return(-1);
+	}
+	snap->EventFd = fd;
+
+	return(fd);
+}
+
 /*
  * UpdateReadBuffer : given the start of a new string in the read buffer of a
  * connection, move all the data starting at this byte to the beginning
@@ -677,6 +1815,12 @@ int	pvd_read_data(t_pvd_connection *conn)
 {
 	int	n, m;
 
+	// One datagram, one message : no need for the read buffer
+	if (conn->Seqpacket) {
+		return(ReadDatagram(conn, MSG_DONTWAIT) == -1 ?
+				PVD_READ_ERROR : PVD_READ_OK);
+	}
+
 	/*
 	 * Some data is available : read as much as we can. Don't
 	 * bother for now with the connection type. It will be handled
@@ -836,6 +1980,90 @@ Loop :
 	return(PVD_MESSAGE_READ);
 }
 
+/*
+ * pvd_bin_get_message : extract the next message from the data read by
+ * pvd_read_data() on a binary (v2) connection. The payload stays valid
+ * until the next call
+ */
+int	pvd_bin_get_message(t_pvd_connection *conn, t_pvd_bin_message *msg)
+{
+	t_BinaryHeader	H;
+	int		Needed;
+	int		n;
+
+	if (conn->Seqpacket) {
+		if (! conn->Pending) {
+			return(PVD_NO_MESSAGE_READ);
+		}
+		conn->Pending = false;
+		BinGetHeader(conn->Message, &H);
+
+		msg->opcode = H.Opcode;
+		msg->status = H.Status;
+		msg->id = H.Id;
+		msg->length = H.Length;
+		msg->payload = conn->Message + PVD_BIN_HEADER_SIZE;
+
+		return(PVD_MESSAGE_READ);
+	}
+
+	// The previous message has been handed out
+	if (conn->InMessage >= PVD_BIN_HEADER_SIZE) {
+		BinGetHeader(conn->Message, &H);
+		if (conn->InMessage == PVD_BIN_HEADER_SIZE + H.Length) {
+			conn->InMessage = 0;
+		}
+	}
+
+	for (;;) {
+		Needed = PVD_BIN_HEADER_SIZE;
+		if (conn->InMessage >= PVD_BIN_HEADER_SIZE) {
+			BinGetHeader(conn->Message, &H);
+			Needed += H.Length;
+		}
+		if (Needed > conn->MessageSize) {
+			char	*Message;
+
+			if ((Message = realloc(conn->Message, Needed)) == NULL) {
+				return(PVD_NO_MESSAGE_READ);
+			}
+			conn->Message = Message;
+			conn->MessageSize = Needed;
+		}
+
+		// Move what is available from the read buffer
+		if ((n = Needed - conn->InMessage) > conn->InReadBuffer) {
+			n = conn->InReadBuffer;
+		}
+		memcpy(conn->Message + conn->InMessage, conn->ReadBuffer, n);
+		conn->InMessage += n;
+		UpdateReadBuffer(conn, conn->ReadBuffer + n);
+
+		if (conn->InMessage < Needed) {
+			return(PVD_NO_MESSAGE_READ);
+		}
+		if (Needed > PVD_BIN_HEADER_SIZE) {
+			break;
+		}
+		// The header is complete : now read the payload, if any
+		BinGetHeader(conn->Message, &H);
+		if (H.Length == 0) {
+			break;
+		}
+	}
+
+	msg->opcode = H.Opcode;
+	msg->status = H.Status;
+	msg->id = H.Id;
+	msg->length = H.Length;
+	msg->payload = conn->Message + PVD_BIN_HEADER_SIZE;
+
+	if (conn->InReadBuffer >= PVD_BIN_HEADER_SIZE) {
+		return(PVD_MORE_DATA_AVAILABLE);
+	}
+	return(PVD_MESSAGE_READ);
+}
+
 /*
  * Helper functions directly talking to the kernel via sockets options
  * (the functions above were talking to the pvdid daemon)
@@ -0,0 +1,229 @@
+/*
+	Copyright 2017 Cisco
+
+	Licensed under the Apache License, Version 2.0 (the "License");
+	you may not use this file except in compliance with the License.
+	You may obtain a copy of the License at
+
+		http://www.apache.org/licenses/LICENSE-2.0
+
+	Unless required by applicable law or agreed to in writing, software
+	distributed under the License is distributed on an "AS IS" BASIS,
+	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+	See the License for the specific language governing permissions and
+	limitations under the License.
+*/
+/*
+ * pvd-binary.c : binary protocol (v2) messages. All integers are little
+ * endian, whatever the host. A message is made of a fixed header :
+ *
+ *	0	version (1 byte)
+ *	1	opcode (1 byte)
+ *	2	status (2 bytes)
+ *	4	request id (4 bytes)
+ *	8	length of the payload (4 bytes)
+ *
+ * followed by a payload made of TLVs : type (2 bytes), length (4 bytes)
+ * and value (not \0 terminated)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pvd-utils.h"
+#include "pvd-binary.h"
+#include "libpvd.h"
+
+#define	BB_MINSIZE	1024
+
+static	inline	void	PutLe16(unsigned char *pt, unsigned int v)
+{
+	pt[0] = v & 0xFF;
+	pt[1] = (v >> 8) & 0xFF;
+}
+
+static	inline	void	PutLe32(unsigned char *pt, unsigned int v)
+{
+	pt[0] = v & 0xFF;
+	pt[1] = (v >> 8) & 0xFF;
+	pt[2] = (v >> 16) & 0xFF;
+	pt[3] = (v >> 24) & 0xFF;
+}
+
+static	inline	unsigned int	GetLe16(unsigned char *pt)
+{
+	return(pt[0] | (pt[1] << 8));
+}
+
+static	inline	unsigned int	GetLe32(unsigned char *pt)
+{
+	return(pt[0] | (pt[1] << 8) | (pt[2] << 16) | ((unsigned int) pt[3] << 24));
+}
+
+// BinPutHeader : encode a message header (PVD_BIN_HEADER_SIZE bytes)
+void	BinPutHeader(char *Header, int Opcode, int Status, unsigned int Id, int Length)
+{
+	unsigned char	*pt = (unsigned char *) Header;
+
+	pt[0] = PVD_BIN_VERSION;
+	pt[1] = Opcode;
+	PutLe16(&pt[2], Status);
+	PutLe32(&pt[4], Id);
+	PutLe32(&pt[8], Length);
+}
+
+// BinPutTlv : encode a TLV. The buffer must be at least PVD_BIN_TLV_SIZE +
+// Length bytes long. Returns the size of the TLV
+int	BinPutTlv(char *Buffer, int Type, char *Value, int Length)
+{
+	unsigned char	*pt = (unsigned char *) Buffer;
+
+	PutLe16(pt, Type);
+	PutLe32(&pt[2], Length);
+	memcpy(&pt[PVD_BIN_TLV_SIZE], Value, Length);
+
+	return(PVD_BIN_TLV_SIZE + Length);
+}
+
+// BinPutTlvInt : encode a TLV carrying a 32 bits integer (little endian)
+// The buffer must be at least PVD_BIN_TLV_SIZE + 4 bytes long
+int	BinPutTlvInt(char *Buffer, int Type, unsigned int v)
+{
+	unsigned char	Value[4];
+
+	PutLe32(Value, v);
+
+	return(BinPutTlv(Buffer, Type, (char *) Value, sizeof(Value)));
+}
+
+void	BinGetHeader(char *Header, t_BinaryHeader *H)
+{
+	unsigned char	*pt = (unsigned char *) Header;
+
+	H->Version = pt[0];
+	H->Opcode = pt[1];
+	H->Status = GetLe16(&pt[2]);
+	H->Id = GetLe32(&pt[4]);
+	H->Length = GetLe32(&pt[8]);
+}
+
+// BinNextTlv : decode the TLV *Pt points to, and make *Pt point to the
+// next one. Returns -1 at the end of the payload, or if the TLV overflows it
+int	BinNextTlv(char **Pt, char *End, int *Type, char **Value, int *Length)
+{
+	unsigned char	*pt = (unsigned char *) *Pt;
+	unsigned int	l;
+
+	if (End - *Pt < PVD_BIN_TLV_SIZE) {
+		return(-1);
+	}
+	l = GetLe32(&pt[2]);
+	if (l > End - *Pt - PVD_BIN_TLV_SIZE) {
+		return(-1);
+	}
+	*Type = GetLe16(pt);
+	*Value = *Pt + PVD_BIN_TLV_SIZE;
+	*Length = l;
+	*Pt = *Value + l;
+
+	return(0);
+}
+
+// BinGetTlvString : copy a TLV value as a \0 terminated string. Returns -1
+// if it does not fit in Size bytes
+int	BinGetTlvString(char *Value, int Length, char *s, int Size)
+{
+	if (Length >= Size) {
+		return(-1);
+	}
+	memcpy(s, Value, Length);
+	s[Length] = '\0';
+
+	return(0);
+}
+
+void	BBInit(t_BinaryBuffer *BB)
+{
+	memset(BB, 0, sizeof(*BB));
+}
+
+void	BBUninit(t_BinaryBuffer *BB)
+{
+	if (BB->Data != NULL) {
+		free(BB->Data);
+	}
+	BBInit(BB);
+}
+
+// BBReserve : make room for Length more bytes. Returns NULL on error
+static	char	*BBReserve(t_BinaryBuffer *BB, int Length)
+{
+	int	Size;
+	char	*Data;
+	char	*pt;
+
+	if (BB->Error) {
+		return(NULL);
+	}
+	if (BB->Length + Length > BB->Size) {
+		for (Size = BB->Size == 0 ? BB_MINSIZE : BB->Size;
+		     BB->Length + Length > Size;
+		     Size *= 2) {
+			;
+		}
+		if ((Data = realloc(BB->Data, Size)) == NULL) {
+			DLOG("memory overflow allocating binary message\n");
+			BB->Error = true;
+			return(NULL);
+		}
+		BB->Data = Data;
+		BB->Size = Size;
+	}
+	pt = BB->Data + BB->Length;
+	BB->Length += Length;
+
+	return(pt);
+}
+
+// BBBeginMessage : append the header of a new message. Its length is set
+// by BBEndMessage()
+void	BBBeginMessage(t_BinaryBuffer *BB, int Opcode, int Status, unsigned int Id)
+{
+	char	*pt;
+
+	BB->Message = BB->Length;
+
+	if ((pt = BBReserve(BB, PVD_BIN_HEADER_SIZE)) != NULL) {
+		BinPutHeader(pt, Opcode, Status, Id, 0);
+	}
+}
+
+void	BBAddTlv(t_BinaryBuffer *BB, int Type, char *Value, int Length)
+{
+	char	*pt;
+
+	if ((pt = BBReserve(BB, PVD_BIN_TLV_SIZE + Length)) != NULL) {
+		BinPutTlv(pt, Type, Value, Length);
+	}
+}
+
+void	BBAddTlvString(t_BinaryBuffer *BB, int Type, char *s)
+{
+	BBAddTlv(BB, Type, s, strlen(s));
+}
+
+// BBEndMessage : set the payload length of the last message. Returns -1 if
+// an allocation has failed since BBInit()
+int	BBEndMessage(t_BinaryBuffer *BB)
+{
+	if (BB->Error) {
+		return(-1);
+	}
+	PutLe32((unsigned char *) BB->Data + BB->Message + 8,
+		BB->Length - BB->Message - PVD_BIN_HEADER_SIZE);
+
+	return(0);
+}
+
+/* ex: set ts=8 noexpandtab wrap: */
@@ -23,6 +23,9 @@
 #include <string.h>
 #include <stdarg.h>
 #include <errno.h>
+#include <stddef.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 
 #include "pvd-utils.h"
 
@@ -83,13 +86,11 @@ int SBAddString(t_StringBuffer *SB, char *fmt, ...)
 
 	// Do we need to extend the buffer ?
 	if (n + 1 > r) {
-		int NewSize = SB->Length + n;
+		// Room for the string, its '\0' and the MaxLength - 1 margin,
+		// rounded up to the next 4K boundary
+		int NewSize = (SB->Length + n + 2 + 4095) / 4096 * 4096;
 		char *pt;
 
-		if ((NewSize % 4096) != 0) {
-			NewSize = NewSize / 4096 + 4096;
-		}
-
 		if ((pt = realloc(SB->String, NewSize)) == NULL) {
 			DLOG("memory overflow reallocating string buffer\n");
 			return(-1);
@@ -97,9 +98,11 @@ int SBAddString(t_StringBuffer *SB, char *fmt, ...)
 		SB->String = pt;
 		SB->MaxLength = NewSize;
 
+		r = SB->MaxLength - 1 - SB->Length;
+
 		va_start(ap, fmt);
 
-		if ((n = vsnprintf(&SB->String[SB->Length], r, fmt, ap)) != r) {
+		if ((n = vsnprintf(&SB->String[SB->Length], r, fmt, ap)) >= r) {
 			DLOG("internal error (extending a buffer string)\n");
 			va_end(ap);
 			return(-1);
@@ -203,6 +206,19 @@ char	*JsonArray(int nStr, char **str)
 	return(SB.String);
 }
 
+/* HashString : FNV-1a hash of a string */
+unsigned int	HashString(char *s)
+{
+	unsigned int	h = 2166136261U;
+	unsigned char	*pt = (unsigned char *) s;
+
+	while (*pt != '\0') {
+		h ^= *pt++;
+		h *= 16777619U;
+	}
+	return(h);
+}
+
 /* GetIntStr : return a static string representation of an integer */
 char	*GetIntStr(int n)
 {
@@ -213,4 +229,28 @@ char	*GetIntStr(int n)
 	return(lS);
 }
 
+/*
+ * UnixSocketAddress : fill an AF_UNIX address from a socket name. Names
+ * starting with @ are in the abstract namespace. Returns the length of the
+ * address, -1 if the name is too long
+ */
+int	UnixSocketAddress(char *Name, struct sockaddr_un *sa)
+{
+	int	l = strlen(Name);
+
+	if (l >= sizeof(sa->sun_path)) {
+		return(-1);
+	}
+
+	memset(sa, 0, sizeof(*sa));
+	sa->sun_family = AF_UNIX;
+	memcpy(sa->sun_path, Name, l);
+
+	if (Name[0] == '@') {
+		sa->sun_path[0] = '\0';
+		return(offsetof(struct sockaddr_un, sun_path) + l);
+	}
+	return(sizeof(*sa));
+}
+
 /* ex: set ts=8 noexpandtab wrap: */
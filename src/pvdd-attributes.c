@@ -0,0 +1,390 @@
+/*
+	Copyright 2017 Cisco
+
+	Licensed under the Apache License, Version 2.0 (the "License");
+	you may not use this file except in compliance with the License.
+	You may obtain a copy of the License at
+
+		http://www.apache.org/licenses/LICENSE-2.0
+
+	Unless required by applicable law or agreed to in writing, software
+	distributed under the License is distributed on an "AS IS" BASIS,
+	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+	See the License for the specific language governing permissions and
+	limitations under the License.
+*/
+/*
+ * pvdd-attributes.c : per pvd table of attributes. Lookups are done via
+ * a hash index, while iterations (JSON serialization) follow the order
+ * in which the attributes have been created
+ *
+ * The keys are shared by all pvd via a global pool of refcounted interned
+ * strings (most pvd have the same set of well known keys)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "pvd-utils.h"
+#include "pvdd-attributes.h"
+
+#define	AT_EMPTY	-1	// free slot in the index
+#define	AT_DELETED	-2	// slot of a removed entry (tombstone)
+
+#define	AT_MININDEX	16
+#define	AT_MINENTRIES	8
+
+#define	KEYPOOL_MINSIZE	256	// power of 2
+
+/*
+ * Interned key : the key string is allocated along with its header. The
+ * address of the Key field is what is handed out to the callers
+ */
+typedef	struct {
+	unsigned int	hash;
+	int		refcnt;
+	char		Key[];
+}	t_InternedKey;
+
+#define	KEYHEADER(k)	((t_InternedKey *) ((k) - offsetof(t_InternedKey, Key)))
+
+// Open addressing (linear probing) set of interned keys
+static	int		lKeyPoolSize = 0;
+static	int		lNKeys = 0;
+static	t_InternedKey	**lKeyPool = NULL;
+
+// Memory accounting : bytes used by the pool vs bytes the same keys would
+// use if they were duplicated for every reference
+static	long		lKeyBytes = 0;
+static	long		lKeyRefs = 0;
+static	long		lKeyRefBytes = 0;
+
+// KeyPoolSlot : return the slot of a given key in the pool, or the empty
+// slot where it would be inserted
+static	int	KeyPoolSlot(char *Key, unsigned int h)
+{
+	int		i;
+	int		Mask = lKeyPoolSize - 1;
+	t_InternedKey	*pt;
+
+	for (i = h & Mask; (pt = lKeyPool[i]) != NULL; i = (i + 1) & Mask) {
+		if (pt->hash == h && (pt->Key == Key || EQSTR(pt->Key, Key))) {
+			break;
+		}
+	}
+	return(i);
+}
+
+// KeyPoolGrow : double the size of the pool and reinsert all keys
+static	int	KeyPoolGrow(void)
+{
+	int		i, j;
+	int		OldSize = lKeyPoolSize;
+	t_InternedKey	**OldPool = lKeyPool;
+	int		NewSize = OldSize == 0 ? KEYPOOL_MINSIZE : OldSize * 2;
+
+	if ((lKeyPool = calloc(NewSize, sizeof(t_InternedKey *))) == NULL) {
+		DLOG("memory overflow allocating keys pool\n");
+		lKeyPool = OldPool;
+		return(-1);
+	}
+	lKeyPoolSize = NewSize;
+
+	for (i = 0; i < OldSize; i++) {
+		if (OldPool[i] != NULL) {
+			for (j = OldPool[i]->hash & (NewSize - 1);
+			     lKeyPool[j] != NULL;
+			     j = (j + 1) & (NewSize - 1)) {
+				;
+			}
+			lKeyPool[j] = OldPool[i];
+		}
+	}
+	if (OldPool != NULL) {
+		free(OldPool);
+	}
+	return(0);
+}
+
+// KeyIntern : return the interned version of a key, creating it if
+// needed. Each call takes a reference that must be given back via
+// KeyRelease()
+char	*KeyIntern(char *Key)
+{
+	int		i;
+	int		l;
+	unsigned int	h = HashString(Key);
+	t_InternedKey	*pt;
+
+	if ((lNKeys + 1) * 2 > lKeyPoolSize && KeyPoolGrow() == -1) {
+		return(NULL);
+	}
+
+	if ((pt = lKeyPool[i = KeyPoolSlot(Key, h)]) == NULL) {
+		l = strlen(Key) + 1;
+		if ((pt = malloc(sizeof(t_InternedKey) + l)) == NULL) {
+			DLOG("memory overflow allocating key %s\n", Key);
+			return(NULL);
+		}
+		pt->hash = h;
+		pt->refcnt = 0;
+		memcpy(pt->Key, Key, l);
+		lKeyPool[i] = pt;
+		lNKeys++;
+		lKeyBytes += sizeof(t_InternedKey) + l;
+	}
+	pt->refcnt++;
+	lKeyRefs++;
+	lKeyRefBytes += strlen(pt->Key) + 1;
+
+	return(pt->Key);
+}
+
+// KeyFind : return the interned version of a key, NULL if no such key
+// is currently in use. No reference is taken
+char	*KeyFind(char *Key)
+{
+	t_InternedKey	*pt;
+
+	if (lKeyPoolSize == 0) {
+		return(NULL);
+	}
+	pt = lKeyPool[KeyPoolSlot(Key, HashString(Key))];
+
+	return(pt == NULL ? NULL : pt->Key);
+}
+
+// KeyRelease : drop a reference on an interned key. The last reference
+// frees the key (following keys of the cluster are shifted back)
+void	KeyRelease(char *Key)
+{
+	t_InternedKey	*pt = KEYHEADER(Key);
+	int		i, j, k;
+	int		Mask = lKeyPoolSize - 1;
+
+	lKeyRefs--;
+	lKeyRefBytes -= strlen(Key) + 1;
+
+	if (--pt->refcnt > 0) {
+		return;
+	}
+
+	for (i = pt->hash & Mask; lKeyPool[i] != pt; i = (i + 1) & Mask) {
+		;
+	}
+	lKeyPool[i] = NULL;
+
+	for (j = (i + 1) & Mask; lKeyPool[j] != NULL; j = (j + 1) & Mask) {
+		k = lKeyPool[j]->hash & Mask;
+		if (i <= j ? (i < k && k <= j) : (i < k || k <= j)) {
+			continue;
+		}
+		lKeyPool[i] = lKeyPool[j];
+		lKeyPool[j] = NULL;
+		i = j;
+	}
+
+	lNKeys--;
+	lKeyBytes -= sizeof(t_InternedKey) + strlen(pt->Key) + 1;
+	free(pt);
+}
+
+// KeyStatistics : dump the memory accounting of the keys pool
+void	KeyStatistics(FILE *fo)
+{
+	fprintf(fo,
+		"attributes keys : %d interned keys, %ld bytes "
+		"(+ %ld bytes of pool), %ld references\n",
+		lNKeys,
+		lKeyBytes,
+		(long) (lKeyPoolSize * sizeof(t_InternedKey *)),
+		lKeyRefs);
+	fprintf(fo,
+		"attributes keys : %ld bytes without interning, %ld bytes saved\n",
+		lKeyRefBytes,
+		lKeyRefBytes - lKeyBytes -
+			(long) (lKeyPoolSize * sizeof(t_InternedKey *)));
+}
+
+void	ATInit(t_AttributeTable *T)
+{
+	memset(T, 0, sizeof(*T));
+}
+
+void	ATUninit(t_AttributeTable *T)
+{
+	int	i;
+
+	for (i = 0; i < T->nEntries; i++) {
+		if (T->Entries[i].Key != NULL) {
+			KeyRelease(T->Entries[i].Key);
+			free(T->Entries[i].Value);
+		}
+	}
+	if (T->Entries != NULL) {
+		free(T->Entries);
+	}
+	if (T->Index != NULL) {
+		free(T->Index);
+	}
+	ATInit(T);
+}
+
+// ATFindSlot : return the index slot referencing a given key, -1 if
+// the key is not in the table. The key is first resolved in the pool of
+// interned keys : the table itself then only compares addresses
+static	int	ATFindSlot(t_AttributeTable *T, char *Key)
+{
+	int		i, e;
+	int		Mask = T->IndexSize - 1;
+	unsigned int	h;
+
+	if (T->IndexSize == 0 || (Key = KeyFind(Key)) == NULL) {
+		return(-1);
+	}
+	h = KEYHEADER(Key)->hash;
+
+	for (i = h & Mask; (e = T->Index[i]) != AT_EMPTY; i = (i + 1) & Mask) {
+		if (e >= 0 && T->Entries[e].Key == Key) {
+			return(i);
+		}
+	}
+	return(-1);
+}
+
+// ATRebuild : remove the holes from the entries array (preserving the
+// order of the live entries) and rebuild an index of the given size
+static	int	ATRebuild(t_AttributeTable *T, int IndexSize)
+{
+	int	i, j;
+	int	*Index;
+	int	Mask = IndexSize - 1;
+
+	if ((Index = malloc(IndexSize * sizeof(int))) == NULL) {
+		DLOG("memory overflow allocating attributes index\n");
+		return(-1);
+	}
+	for (i = 0; i < IndexSize; i++) {
+		Index[i] = AT_EMPTY;
+	}
+
+	for (i = j = 0; i < T->nEntries; i++) {
+		if (T->Entries[i].Key != NULL) {
+			T->Entries[j++] = T->Entries[i];
+		}
+	}
+	T->nEntries = j;
+
+	for (j = 0; j < T->nEntries; j++) {
+		for (i = T->Entries[j].hash & Mask;
+		     Index[i] != AT_EMPTY;
+		     i = (i + 1) & Mask) {
+			;
+		}
+		Index[i] = j;
+	}
+
+	if (T->Index != NULL) {
+		free(T->Index);
+	}
+	T->Index = Index;
+	T->IndexSize = IndexSize;
+
+	return(0);
+}
+
+t_PvdAttribute	*ATLookup(t_AttributeTable *T, char *Key)
+{
+	int	i;
+
+	if ((i = ATFindSlot(T, Key)) == -1) {
+		return(NULL);
+	}
+	return(&T->Entries[T->Index[i]]);
+}
+
+// ATAdd : append a new attribute. The key must not already be in the table
+// It is interned by the table. Value must have been allocated by the caller :
+// it belongs to the table on success
+t_PvdAttribute	*ATAdd(t_AttributeTable *T, char *Key, char *Value)
+{
+	int		i;
+	int		Mask;
+	int		IndexSize;
+	t_PvdAttribute	*pt;
+	char		*IKey;
+
+	// Make room in the entries array, first by discarding holes
+	if (T->nEntries == T->MaxEntries && T->nAttributes < T->nEntries) {
+		if (ATRebuild(T, T->IndexSize) == -1) {
+			return(NULL);
+		}
+	}
+	if (T->nEntries == T->MaxEntries) {
+		int	MaxEntries = T->MaxEntries == 0 ? AT_MINENTRIES : T->MaxEntries * 2;
+
+		if ((pt = realloc(T->Entries, MaxEntries * sizeof(*pt))) == NULL) {
+			DLOG("memory overflow allocating attributes\n");
+			return(NULL);
+		}
+		T->Entries = pt;
+		T->MaxEntries = MaxEntries;
+	}
+
+	// Keep the index (live entries and tombstones) at most half full
+	if ((T->nEntries + 1) * 2 > T->IndexSize) {
+		for (IndexSize = AT_MININDEX;
+		     (T->nAttributes + 1) * 2 > IndexSize;
+		     IndexSize *= 2) {
+			;
+		}
+		if (ATRebuild(T, IndexSize) == -1) {
+			return(NULL);
+		}
+	}
+
+	if ((IKey = KeyIntern(Key)) == NULL) {
+		return(NULL);
+	}
+
+	pt = &T->Entries[T->nEntries];
+	pt->Key = IKey;
+	pt->Value = Value;
+	pt->hash = KEYHEADER(IKey)->hash;
+	pt->generation = 0;
+
+	Mask = T->IndexSize - 1;
+	for (i = pt->hash & Mask; T->Index[i] >= 0; i = (i + 1) & Mask) {
+		;
+	}
+	T->Index[i] = T->nEntries++;
+	T->nAttributes++;
+
+	return(pt);
+}
+
+// ATRemove : remove an attribute. Returns -1 if the key is unknown
+int	ATRemove(t_AttributeTable *T, char *Key)
+{
+	int		i;
+	t_PvdAttribute	*pt;
+
+	if ((i = ATFindSlot(T, Key)) == -1) {
+		return(-1);
+	}
+
+	pt = &T->Entries[T->Index[i]];
+	KeyRelease(pt->Key);
+	free(pt->Value);
+	pt->Key = NULL;
+	pt->Value = NULL;
+
+	T->Index[i] = AT_DELETED;
+	T->nAttributes--;
+
+	return(0);
+}
+
+/* ex: set ts=8 noexpandtab wrap: */
@@ -0,0 +1,215 @@
+/*
+	Copyright 2017 Cisco
+
+	Licensed under the Apache License, Version 2.0 (the "License");
+	you may not use this file except in compliance with the License.
+	You may obtain a copy of the License at
+
+		http://www.apache.org/licenses/LICENSE-2.0
+
+	Unless required by applicable law or agreed to in writing, software
+	distributed under the License is distributed on an "AS IS" BASIS,
+	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+	See the License for the specific language governing permissions and
+	limitations under the License.
+*/
+/*
+ * pvdd-input.c : per client input buffers and incremental line parser
+ *
+ * Received bytes are appended to the buffer of the client, and complete
+ * lines are handed out in place (the \n being replaced by a \0). A partial
+ * line stays in the buffer until the next read completes it. Binary
+ * connections get chunks of known length instead. The parsed bytes are
+ * only reclaimed (moving the partial line to the beginning of the buffer)
+ * when room is needed for the next read
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#include "pvd-defs.h"
+#include "pvd-utils.h"
+#include "pvdd-input.h"
+
+#define	IB_MINSIZE	PVD_MAX_MSG_SIZE
+
+void	IBInit(t_InputBuffer *B)
+{
+	memset(B, 0, sizeof(*B));
+}
+
+void	IBUninit(t_InputBuffer *B)
+{
+	if (B->Data != NULL) {
+		free(B->Data);
+	}
+	IBInit(B);
+}
+
+// IBMakeRoom : make sure that some bytes can be appended to the buffer
+// Returns -1 if the buffer is full (line too long, or memory overflow)
+static	int	IBMakeRoom(t_InputBuffer *B)
+{
+	int	Size;
+	char	*Data;
+
+	if (B->Length == 0) {
+		B->Start = 0;
+	}
+	if (B->Start + B->Length < B->Size) {
+		return(0);
+	}
+
+	// Reclaim the bytes already parsed
+	if (B->Start > 0) {
+		memmove(B->Data, B->Data + B->Start, B->Length);
+		B->Start = 0;
+		return(0);
+	}
+
+	if (B->Size >= IB_MAXSIZE) {
+		DLOG("input buffer full (%d bytes without end of line)\n", B->Length);
+		errno = EMSGSIZE;
+		return(-1);
+	}
+
+	Size = B->Size == 0 ? IB_MINSIZE : B->Size * 2;
+	if (Size > IB_MAXSIZE) {
+		Size = IB_MAXSIZE;
+	}
+	if ((Data = realloc(B->Data, Size)) == NULL) {
+		DLOG("memory overflow allocating input buffer\n");
+		errno = ENOMEM;
+		return(-1);
+	}
+	B->Data = Data;
+	B->Size = Size;
+
+	return(0);
+}
+
+// IBRead : append to the buffer what can be read on a (non blocking) socket
+// Same return code as recv() : the number of bytes read, 0 if the peer has
+// closed the connection, -1 on error (errno being set, EAGAIN included)
+// Lines previously returned by IBGetLine() are no longer valid
+int	IBRead(t_InputBuffer *B, int s)
+{
+	int	n;
+
+	if (IBMakeRoom(B) == -1) {
+		return(-1);
+	}
+
+	n = recv(s,
+		 B->Data + B->Start + B->Length,
+		 B->Size - B->Start - B->Length,
+		 MSG_DONTWAIT);
+	if (n > 0) {
+		B->Length += n;
+	}
+	return(n);
+}
+
+// IBAppend : fill an empty buffer with bytes received by another instance
+// of the daemon (warm restart). Returns -1 if they do not fit
+int	IBAppend(t_InputBuffer *B, char *Data, int Length)
+{
+	int	Size;
+	char	*NewData;
+
+	if (Length > IB_MAXSIZE) {
+		errno = EMSGSIZE;
+		return(-1);
+	}
+	if (Length > B->Size) {
+		for (Size = IB_MINSIZE; Size < Length; Size *= 2) {
+			;
+		}
+		if ((NewData = realloc(B->Data, Size)) == NULL) {
+			DLOG("memory overflow allocating input buffer\n");
+			errno = ENOMEM;
+			return(-1);
+		}
+		B->Data = NewData;
+		B->Size = Size;
+	}
+	memcpy(B->Data, Data, Length);
+	B->Start = 0;
+	B->Length = Length;
+	B->Scanned = 0;
+
+	return(0);
+}
+
+// IBGetLine : return the next complete line of the buffer, without its \n
+// NULL if no complete line is available
+char	*IBGetLine(t_InputBuffer *B)
+{
+	char	*Line = B->Data + B->Start;
+	char	*pt;
+	int	l;
+
+	if (B->Length == 0) {
+		return(NULL);
+	}
+	if ((pt = memchr(Line + B->Scanned, '\n', B->Length - B->Scanned)) == NULL) {
+		B->Scanned = B->Length;
+		return(NULL);
+	}
+	*pt = '\0';
+
+	l = pt - Line + 1;
+	B->Start += l;
+	B->Length -= l;
+	B->Scanned = 0;
+
+	return(Line);
+}
+
+// IBGetRemainder : return the unterminated line left in the buffer (when
+// the peer has closed the connection), NULL if none
+char	*IBGetRemainder(t_InputBuffer *B)
+{
+	char	*Line;
+
+	// Room is needed for the terminating \0
+	if (B->Length == 0 || IBMakeRoom(B) == -1) {
+		return(NULL);
+	}
+	Line = B->Data + B->Start;
+	Line[B->Length] = '\0';
+
+	B->Start += B->Length;
+	B->Length = 0;
+	B->Scanned = 0;
+
+	return(Line);
+}
+
+// IBPeek : return the first Length bytes of the buffer, without consuming
+// them. NULL if less bytes are available
+char	*IBPeek(t_InputBuffer *B, int Length)
+{
+	return(B->Length < Length ? NULL : B->Data + B->Start);
+}
+
+// IBGetBytes : same as IBPeek(), the bytes being consumed (binary messages)
+char	*IBGetBytes(t_InputBuffer *B, int Length)
+{
+	char	*Data;
+
+	if ((Data = IBPeek(B, Length)) == NULL) {
+		return(NULL);
+	}
+	B->Start += Length;
+	B->Length -= Length;
+	B->Scanned = 0;
+
+	return(Data);
+}
+
+/* ex: set ts=8 noexpandtab wrap: */
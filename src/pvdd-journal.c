@@ -0,0 +1,771 @@
+/*
+	Copyright 2017 Cisco
+
+	Licensed under the Apache License, Version 2.0 (the "License");
+	you may not use this file except in compliance with the License.
+	You may obtain a copy of the License at
+
+		http://www.apache.org/licenses/LICENSE-2.0
+
+	Unless required by applicable law or agreed to in writing, software
+	distributed under the License is distributed on an "AS IS" BASIS,
+	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+	See the License for the specific language governing permissions and
+	limitations under the License.
+*/
+/*
+ * pvdd-journal.c : persistent state of the pvd and attributes pushed by the
+ * control clients (-d option), so that they survive a restart of the daemon
+ *
+ * Each change is appended to a journal file. When the journal has grown
+ * large enough, the whole state is written (compacted) into a state file,
+ * and the journal starts again from scratch. Both files begin with an epoch
+ * record : a journal is only replayed over the state of the same epoch (a
+ * crash in the middle of a compaction leaves an older journal, whose
+ * changes are already in the state)
+ *
+ * The files are sequences of records : a header (length and checksum of
+ * the payload) followed by the payload, an operation code and its \0
+ * terminated arguments. A truncated or corrupted record (crash while
+ * appending) ends the journal, which is cut there
+ *
+ * The records are buffered, and written once per loop of the daemon : a
+ * burst of changes costs a single write() and a single fdatasync()
+ *
+ * The state itself is kept in memory (it only holds what the control
+ * clients have pushed, the attributes learnt from the RAs or from the
+ * kernel are not persistent)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "pvd-utils.h"
+#include "pvdd-attributes.h"
+#include "pvdd-journal.h"
+
+#define	JOURNAL_FILE		"pvdd.journal"
+#define	STATE_FILE		"pvdd.state"
+#define	STATE_TMPFILE		"pvdd.state.tmp"
+#define	JOURNAL_TMPFILE		"pvdd.journal.tmp"
+
+// The journal is compacted when larger than both of them
+#define	JOURNAL_MINCOMPACT	(1024 * 1024)
+#define	JOURNAL_STATERATIO	2	// times the size of the state
+
+#define	JOURNAL_INDEXMINSIZE	64	// power of 2
+#define	JOURNAL_BUFMINSIZE	4096
+
+// Operations
+#define	JOP_EPOCH	1	// epoch
+#define	JOP_CREATE	2	// pvdid, pvdname
+#define	JOP_SET		3	// pvdname, key, value
+#define	JOP_UNSET	4	// pvdname, key
+#define	JOP_REMOVE	5	// pvdname
+
+#define	JOP_MAXARGS	3
+
+typedef	struct {
+	unsigned int	Length;		// of the payload
+	unsigned int	Check;		// FNV-1a of the payload
+}	t_RecordHeader;
+
+// A pvd of the persistent state. pvdid is -1 for pvd not created by a
+// control client (they have received attributes only)
+typedef	struct {
+	char			*pvdname;	// strduped
+	unsigned int		hash;		// HashString(pvdname)
+	int			pvdid;
+	t_AttributeTable	Attributes;
+}	t_JournalPvd;
+
+// Growable buffer in which records are encoded
+typedef	struct {
+	char	*Data;
+	int	Length;
+	int	Size;
+	int	Error;
+}	t_RecordBuffer;
+
+static	char		*lDir = NULL;
+static	int		lFd = -1;	// journal, opened in append mode
+static	unsigned int	lEpoch = 0;
+static	long		lJournalSize = 0;
+static	long		lStateSize = 0;
+static	t_RecordBuffer	lPending;	// records not written yet
+
+// Set after a write error : nothing is appended to the journal until a
+// compaction succeeds (the state it writes includes the pending records)
+static	int		lDamaged = false;
+
+// Open addressing (linear probing) index of the persistent pvd
+static	int		lIndexSize = 0;
+static	int		lNEntries = 0;
+static	t_JournalPvd	**lIndex = NULL;
+
+// Counters
+static	long		lRecords = 0;
+static	long		lSyncs = 0;
+static	long		lCompactions = 0;
+static	long		lWriteErrors = 0;
+static	long		lLoadedRecords = 0;
+static	long		lLoadMs = 0;
+
+static	long	GetTimeMs(void)
+{
+	struct timespec	ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return(ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+}
+
+static	unsigned int	Checksum(char *Data, int Length)
+{
+	int		i;
+	unsigned int	h = 2166136261u;
+
+	for (i = 0; i < Length; i++) {
+		h ^= (unsigned char) Data[i];
+		h *= 16777619u;
+	}
+	return(h);
+}
+
+/*
+ * In memory state
+ */
+
+// IndexSlot : return the slot of a given name in the index, or the empty
+// slot where it would be inserted
+static	int	IndexSlot(char *pvdname, unsigned int h)
+{
+	int		i;
+	int		Mask = lIndexSize - 1;
+	t_JournalPvd	*pt;
+
+	for (i = h & Mask; (pt = lIndex[i]) != NULL; i = (i + 1) & Mask) {
+		if (pt->hash == h && EQSTR(pt->pvdname, pvdname)) {
+			break;
+		}
+	}
+	return(i);
+}
+
+// IndexGrow : double the size of the index and reinsert all entries
+static	int	IndexGrow(void)
+{
+	int		i, j;
+	int		OldSize = lIndexSize;
+	t_JournalPvd	**OldIndex = lIndex;
+	int		NewSize = OldSize == 0 ? JOURNAL_INDEXMINSIZE : OldSize * 2;
+
+	if ((lIndex = calloc(NewSize, sizeof(t_JournalPvd *))) == NULL) {
+		DLOG("memory overflow allocating journal index\n");
+		lIndex = OldIndex;
+		return(-1);
+	}
+	lIndexSize = NewSize;
+
+	for (i = 0; i < OldSize; i++) {
+		if (OldIndex[i] != NULL) {
+			for (j = OldIndex[i]->hash & (NewSize - 1);
+			     lIndex[j] != NULL;
+			     j = (j + 1) & (NewSize - 1)) {
+				;
+			}
+			lIndex[j] = OldIndex[i];
+		}
+	}
+	if (OldIndex != NULL) {
+		free(OldIndex);
+	}
+	return(0);
+}
+
+// IndexRemove : remove an entry from the index. Following entries of the
+// cluster are shifted back
+static	void	IndexRemove(int i)
+{
+	int	j, k;
+	int	Mask = lIndexSize - 1;
+
+	ATUninit(&lIndex[i]->Attributes);
+	free(lIndex[i]->pvdname);
+	free(lIndex[i]);
+	lIndex[i] = NULL;
+
+	for (j = (i + 1) & Mask; lIndex[j] != NULL; j = (j + 1) & Mask) {
+		k = lIndex[j]->hash & Mask;
+		if (i <= j ? (i < k && k <= j) : (i < k || k <= j)) {
+			continue;
+		}
+		lIndex[i] = lIndex[j];
+		lIndex[j] = NULL;
+		i = j;
+	}
+	lNEntries--;
+}
+
+// GetJournalPvd : retrieve a pvd of the state, creating it if needed
+static	t_JournalPvd	*GetJournalPvd(char *pvdname)
+{
+	int		i;
+	unsigned int	h = HashString(pvdname);
+	t_JournalPvd	*pt;
+
+	if ((lNEntries + 1) * 2 > lIndexSize && IndexGrow() == -1) {
+		return(NULL);
+	}
+	if ((pt = lIndex[i = IndexSlot(pvdname, h)]) != NULL) {
+		return(pt);
+	}
+
+	if ((pt = malloc(sizeof(t_JournalPvd))) == NULL ||
+	    (pt->pvdname = strdup(pvdname)) == NULL) {
+		DLOG("memory overflow allocating journal entry for %s\n", pvdname);
+		free(pt);
+		return(NULL);
+	}
+	pt->hash = h;
+	pt->pvdid = -1;
+	ATInit(&pt->Attributes);
+	lIndex[i] = pt;
+	lNEntries++;
+
+	return(pt);
+}
+
+// Apply : apply an operation to the state
+static	void	Apply(int Op, char **Args)
+{
+	int		i;
+	char		*Value;
+	t_JournalPvd	*pt;
+	t_PvdAttribute	*Attr;
+
+	switch (Op) {
+	case JOP_CREATE :
+		if ((pt = GetJournalPvd(Args[1])) != NULL) {
+			pt->pvdid = atoi(Args[0]);
+		}
+		break;
+	case JOP_SET :
+		if ((pt = GetJournalPvd(Args[0])) == NULL ||
+		    (Value = strdup(Args[2])) == NULL) {
+			break;
+		}
+		if ((Attr = ATLookup(&pt->Attributes, Args[1])) != NULL) {
+			free(Attr->Value);
+			Attr->Value = Value;
+		} else
+		if (ATAdd(&pt->Attributes, Args[1], Value) == NULL) {
+			free(Value);
+		}
+		break;
+	case JOP_UNSET :
+		if (lIndexSize > 0 &&
+		    (pt = lIndex[IndexSlot(Args[0], HashString(Args[0]))]) != NULL) {
+			ATRemove(&pt->Attributes, Args[1]);
+		}
+		break;
+	case JOP_REMOVE :
+		if (lIndexSize > 0 &&
+		    lIndex[i = IndexSlot(Args[0], HashString(Args[0]))] != NULL) {
+			IndexRemove(i);
+		}
+		break;
+	}
+}
+
+/*
+ * Records encoding and decoding
+ */
+static	void	RBReserve(t_RecordBuffer *RB, int Length)
+{
+	int	Size;
+	char	*Data;
+
+	if (RB->Error || RB->Length + Length <= RB->Size) {
+		return;
+	}
+	for (Size = RB->Size == 0 ? JOURNAL_BUFMINSIZE : RB->Size;
+	     RB->Length + Length > Size;
+	     Size *= 2) {
+		;
+	}
+	if ((Data = realloc(RB->Data, Size)) == NULL) {
+		DLOG("memory overflow allocating journal records\n");
+		RB->Error = true;
+		return;
+	}
+	RB->Data = Data;
+	RB->Size = Size;
+}
+
+static	void	RBUninit(t_RecordBuffer *RB)
+{
+	if (RB->Data != NULL) {
+		free(RB->Data);
+	}
+	memset(RB, 0, sizeof(*RB));
+}
+
+// AddRecord : encode a record (nArgs arguments) at the end of a buffer
+static	void	AddRecord(t_RecordBuffer *RB, int Op, int nArgs, char **Args)
+{
+	int		i;
+	int		l;
+	int		Length = 1;
+	char		*pt;
+	t_RecordHeader	H;
+
+	for (i = 0; i < nArgs; i++) {
+		Length += strlen(Args[i]) + 1;
+	}
+	RBReserve(RB, sizeof(H) + Length);
+	if (RB->Error) {
+		return;
+	}
+
+	pt = RB->Data + RB->Length + sizeof(H);
+	*pt++ = Op;
+	for (i = 0; i < nArgs; i++) {
+		l = strlen(Args[i]) + 1;
+		memcpy(pt, Args[i], l);
+		pt += l;
+	}
+
+	H.Length = Length;
+	H.Check = Checksum(RB->Data + RB->Length + sizeof(H), Length);
+	memcpy(RB->Data + RB->Length, &H, sizeof(H));
+
+	RB->Length += sizeof(H) + Length;
+}
+
+// NextRecord : decode the record starting at *Offset. Returns the operation
+// code, or -1 if the record is truncated or corrupted
+static	int	NextRecord(char *Data, int Length, int *Offset, char **Args)
+{
+	int		i;
+	int		Op;
+	char		*pt;
+	char		*End;
+	t_RecordHeader	H;
+
+	if (*Offset + (int) sizeof(H) > Length) {
+		return(-1);
+	}
+	memcpy(&H, Data + *Offset, sizeof(H));
+
+	pt = Data + *Offset + sizeof(H);
+	if (H.Length < 2 || H.Length > Length - *Offset - sizeof(H) ||
+	    Checksum(pt, H.Length) != H.Check || pt[H.Length - 1] != '\0') {
+		return(-1);
+	}
+	End = pt + H.Length;
+	Op = (unsigned char) *pt++;
+	*Offset += sizeof(H) + H.Length;
+
+	// The arguments are \0 terminated strings following the operation
+	for (i = 0; i < JOP_MAXARGS; i++) {
+		if (pt < End) {
+			Args[i] = pt;
+			pt += strlen(pt) + 1;
+		}
+		else {
+			Args[i] = "";
+		}
+	}
+	return(Op);
+}
+
+// Record : apply a change to the state, and queue its record
+static	void	Record(int Op, int nArgs, char **Args)
+{
+	if (lFd == -1) {
+		return;
+	}
+	Apply(Op, Args);
+	AddRecord(&lPending, Op, nArgs, Args);
+	lRecords++;
+}
+
+/*
+ * Files
+ */
+static	char	*FilePath(char *File)
+{
+	static	char	Path[1024];
+
+	snprintf(Path, sizeof(Path), "%s/%s", lDir, File);
+
+	return(Path);
+}
+
+// ReadFile : read a whole file. Returns NULL if it does not exist
+static	char	*ReadFile(char *File, int *Length)
+{
+	int		fd;
+	int		n;
+	char		*Data;
+	struct stat	st;
+
+	if ((fd = open(FilePath(File), O_RDONLY)) == -1) {
+		return(NULL);
+	}
+	if (fstat(fd, &st) == -1 || (Data = malloc(st.st_size + 1)) == NULL) {
+		close(fd);
+		return(NULL);
+	}
+	for (*Length = 0; *Length < st.st_size; *Length += n) {
+		if ((n = read(fd, Data + *Length, st.st_size - *Length)) <= 0) {
+			if (n == -1 && errno == EINTR) {
+				n = 0;
+				continue;
+			}
+			break;
+		}
+	}
+	close(fd);
+
+	return(Data);
+}
+
+static	int	WriteAll(int fd, char *Data, int Length)
+{
+	int	n;
+
+	while (Length > 0) {
+		if ((n = write(fd, Data, Length)) == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return(-1);
+		}
+		Data += n;
+		Length -= n;
+	}
+	return(0);
+}
+
+// SyncDir : make the renames in the directory durable
+static	void	SyncDir(void)
+{
+	int	fd;
+
+	if ((fd = open(lDir, O_RDONLY | O_DIRECTORY)) != -1) {
+		fsync(fd);
+		close(fd);
+	}
+}
+
+// WriteFile : atomically replace a file (written in a temporary file, synced
+// and then renamed)
+static	int	WriteFile(char *TmpFile, char *File, char *Data, int Length)
+{
+	int	fd;
+	char	Path[1024];
+
+	snprintf(Path, sizeof(Path), "%s", FilePath(TmpFile));
+
+	if ((fd = open(Path, O_WRONLY | O_CREAT | O_TRUNC, 0600)) == -1) {
+		DLOG("journal : %s : %s\n", Path, strerror(errno));
+		return(-1);
+	}
+	if (WriteAll(fd, Data, Length) == -1 || fsync(fd) == -1) {
+		DLOG("journal : %s : %s\n", Path, strerror(errno));
+		close(fd);
+		unlink(Path);
+		return(-1);
+	}
+	close(fd);
+
+	if (rename(Path, FilePath(File)) == -1) {
+		DLOG("journal : rename %s : %s\n", Path, strerror(errno));
+		unlink(Path);
+		return(-1);
+	}
+	SyncDir();
+
+	return(0);
+}
+
+// AddEpochRecord : the record starting the state and journal files
+static	void	AddEpochRecord(t_RecordBuffer *RB, unsigned int Epoch)
+{
+	char	s[32];
+	char	*Args[1] = { s };
+
+	sprintf(s, "%u", Epoch);
+	AddRecord(RB, JOP_EPOCH, 1, Args);
+}
+
+// Compact : write the state in a new state file, and start a new journal
+// The pending records are part of the state : they are discarded
+static	int	Compact(void)
+{
+	int		i, j;
+	int		rc = -1;
+	char		pvdid[32];
+	char		*Args[JOP_MAXARGS];
+	t_JournalPvd	*pt;
+	t_PvdAttribute	*Attr;
+	t_RecordBuffer	RB;
+
+	memset(&RB, 0, sizeof(RB));
+	AddEpochRecord(&RB, lEpoch + 1);
+
+	for (i = 0; i < lIndexSize; i++) {
+		if ((pt = lIndex[i]) == NULL) {
+			continue;
+		}
+		if (pt->pvdid != -1) {
+			sprintf(pvdid, "%d", pt->pvdid);
+			Args[0] = pvdid;
+			Args[1] = pt->pvdname;
+			AddRecord(&RB, JOP_CREATE, 2, Args);
+		}
+		Attr = pt->Attributes.Entries;
+		for (j = 0; j < pt->Attributes.nEntries; j++) {
+			if (Attr[j].Key != NULL) {
+				Args[0] = pt->pvdname;
+				Args[1] = Attr[j].Key;
+				Args[2] = Attr[j].Value;
+				AddRecord(&RB, JOP_SET, 3, Args);
+			}
+		}
+	}
+
+	if (! RB.Error &&
+	    WriteFile(STATE_TMPFILE, STATE_FILE, RB.Data, RB.Length) == 0) {
+		lEpoch++;
+		lStateSize = RB.Length;
+
+		// From now on, the current journal is obsolete (its epoch
+		// is the previous one)
+		RB.Length = 0;
+		AddEpochRecord(&RB, lEpoch);
+		lDamaged = true;
+		if (! RB.Error &&
+		    WriteFile(JOURNAL_TMPFILE, JOURNAL_FILE, RB.Data, RB.Length) == 0) {
+			if (lFd != -1) {
+				close(lFd);
+			}
+			if ((lFd = open(FilePath(JOURNAL_FILE), O_WRONLY | O_APPEND)) != -1) {
+				lJournalSize = RB.Length;
+				lPending.Length = 0;
+				lDamaged = false;
+				lCompactions++;
+				rc = 0;
+			}
+		}
+	}
+	RBUninit(&RB);
+
+	if (rc == -1) {
+		DLOG("journal : compaction failed\n");
+	}
+	return(rc);
+}
+
+// Load : apply the records of a file to the state. The epoch of the file
+// is returned, unless Check is set : the records are then only applied if
+// the file is of the given epoch. End is the offset of the first invalid
+// record. Returns -1 if the file has not been applied
+static	int	Load(char *Data, int Length, int Check, unsigned int *Epoch, int *End)
+{
+	int		Op;
+	int		Offset = 0;
+	unsigned int	FileEpoch;
+	char		*Args[JOP_MAXARGS];
+
+	if (NextRecord(Data, Length, &Offset, Args) != JOP_EPOCH) {
+		return(-1);
+	}
+	FileEpoch = strtoul(Args[0], NULL, 10);
+	if (Check && FileEpoch != *Epoch) {
+		return(-1);
+	}
+	*Epoch = FileEpoch;
+
+	for (*End = Offset; (Op = NextRecord(Data, Length, &Offset, Args)) != -1; *End = Offset) {
+		Apply(Op, Args);
+		lLoadedRecords++;
+	}
+	return(0);
+}
+
+// JournalOpen : read back the state saved in a directory, and prepare the
+// journal. The state is compacted unless the journal was empty, so that
+// the next start is as fast as possible (and a damaged journal is cut)
+int	JournalOpen(char *Dir)
+{
+	int	Length;
+	int	End;
+	int	NeedCompact = true;
+	long	Start = GetTimeMs();
+	long	Records;
+	char	*Data;
+
+	if ((lDir = strdup(Dir)) == NULL) {
+		return(-1);
+	}
+
+	if ((Data = ReadFile(STATE_FILE, &Length)) != NULL) {
+		if (Load(Data, Length, false, &lEpoch, &End) == -1 || End != Length) {
+			DLOG("journal : %s is corrupted\n", FilePath(STATE_FILE));
+		}
+		lStateSize = Length;
+		free(Data);
+	}
+
+	if ((Data = ReadFile(JOURNAL_FILE, &Length)) != NULL) {
+		Records = lLoadedRecords;
+
+		if (Load(Data, Length, lStateSize > 0, &lEpoch, &End) == -1) {
+			DLOG("journal : %s is obsolete, ignored\n", FilePath(JOURNAL_FILE));
+		}
+		else {
+			if (End != Length) {
+				DLOG("journal : %s cut after %d bytes\n",
+				     FilePath(JOURNAL_FILE), End);
+			}
+			NeedCompact = lLoadedRecords > Records || End != Length;
+		}
+		free(Data);
+	}
+
+	if (NeedCompact) {
+		Compact();
+	}
+	else {
+		lJournalSize = Length;
+		lFd = open(FilePath(JOURNAL_FILE), O_WRONLY | O_APPEND);
+	}
+	lLoadMs = GetTimeMs() - Start;
+
+	if (lFd == -1) {
+		DLOG("journal : can not be opened in %s\n", lDir);
+		return(-1);
+	}
+	return(0);
+}
+
+// JournalRestore : hand over the state read back by JournalOpen()
+void	JournalRestore(void (*Restore)(int pvdid, char *pvdname, t_AttributeTable *Attributes))
+{
+	int	i;
+
+	for (i = 0; i < lIndexSize; i++) {
+		if (lIndex[i] != NULL) {
+			Restore(lIndex[i]->pvdid, lIndex[i]->pvdname, &lIndex[i]->Attributes);
+		}
+	}
+}
+
+void	JournalCreatePvd(int pvdid, char *pvdname)
+{
+	char	s[32];
+	char	*Args[2] = { s, pvdname };
+
+	sprintf(s, "%d", pvdid);
+	Record(JOP_CREATE, 2, Args);
+}
+
+void	JournalSetAttribute(char *pvdname, char *Key, char *Value)
+{
+	char	*Args[3] = { pvdname, Key, Value };
+
+	Record(JOP_SET, 3, Args);
+}
+
+void	JournalUnsetAttribute(char *pvdname, char *Key)
+{
+	char	*Args[2] = { pvdname, Key };
+
+	Record(JOP_UNSET, 2, Args);
+}
+
+void	JournalRemovePvd(char *pvdname)
+{
+	char	*Args[1] = { pvdname };
+
+	Record(JOP_REMOVE, 1, Args);
+}
+
+// JournalFlush : write (and sync) the pending records, compacting the
+// journal when it has grown too large. On write errors, what may have been
+// written is cut and the state is compacted instead. Until a compaction
+// succeeds, the next flushes only retry it
+void	JournalFlush(void)
+{
+	if (lFd == -1 || (lPending.Length == 0 && ! lPending.Error)) {
+		return;
+	}
+
+	if (lDamaged) {
+		if (Compact() == -1) {
+			lPending.Length = 0;
+			lPending.Error = false;
+		}
+		return;
+	}
+
+	if (lPending.Error ||
+	    WriteAll(lFd, lPending.Data, lPending.Length) == -1 ||
+	    fdatasync(lFd) == -1) {
+		DLOG("journal : write error (%s)\n", strerror(errno));
+		lWriteErrors++;
+		if (ftruncate(lFd, lJournalSize) == -1) {
+			DLOG("journal : can not be cut (%s)\n", strerror(errno));
+		}
+		lPending.Error = false;
+		if (Compact() == -1) {
+			lDamaged = true;
+			lPending.Length = 0;
+		}
+		return;
+	}
+	lSyncs++;
+	lJournalSize += lPending.Length;
+	lPending.Length = 0;
+
+	if (lJournalSize > JOURNAL_MINCOMPACT &&
+	    lJournalSize > JOURNAL_STATERATIO * lStateSize) {
+		Compact();
+	}
+}
+
+// JournalStatistics : dump the journal counters
+void	JournalStatistics(FILE *fo)
+{
+	if (lDir == NULL) {
+		fprintf(fo, "journal : none\n");
+		return;
+	}
+	fprintf(fo,
+		"journal : %d pvd, %ld records loaded in %ld ms, %ld records "
+		"written (%ld syncs), %ld compactions, %ld write errors%s, "
+		"epoch %u, %ld + %ld bytes\n",
+		lNEntries,
+		lLoadedRecords,
+		lLoadMs,
+		lRecords,
+		lSyncs,
+		lCompactions,
+		lWriteErrors,
+		lDamaged ? " (compaction pending)" : "",
+		lEpoch,
+		lStateSize,
+		lJournalSize);
+}
+
+/* ex: set ts=8 noexpandtab wrap: */
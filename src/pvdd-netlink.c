@@ -22,12 +22,16 @@
  * been simplified to no longer check irrelevant error
  * patterns (mostly consistency checks done by radvd when
  * receiving RAs against what it had advertised)
+ *
+ * RAs are received by batches (recvmmsg()), in buffers allocated once
  */
 
-#define _GNU_SOURCE	// to have in6_pktinfo defined
+#define _GNU_SOURCE	// to have in6_pktinfo and recvmmsg() defined
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
 #include <unistd.h>
 #include <limits.h>
 #include <sys/types.h>
@@ -45,6 +49,7 @@
 #include "pvd-defs.h"
 #include "pvdd.h"
 #include "pvdd-netlink.h"
+#include "pvdd-timer.h"
 #include "pvd-utils.h"
 
 #define	_DLOG(level, args...)	DLOG(args)
@@ -56,6 +61,11 @@
 
 #define MSG_SIZE_RECV 1500
 
+// Max number of RAs received by one recvmmsg() call
+#define	RA_BATCH	32
+
+#define	CHDR_SIZE	(CMSG_SPACE(sizeof(struct in6_pktinfo)) + CMSG_SPACE(sizeof(int)))
+
 /* Option types (defined also at least in glibc 2.2's netinet/icmp6.h) */
 
 #ifndef ND_OPT_RTR_ADV_INTERVAL
@@ -144,6 +154,27 @@ struct nd_opt_pvd_info_local {
 	unsigned char nd_opt_pvdidi_suffix[];
 };
 
+// Receive buffers of a batch
+static	struct mmsghdr		lMsgs[RA_BATCH];
+static	struct iovec		lIov[RA_BATCH];
+static	struct sockaddr_in6	lAddrs[RA_BATCH];
+static	unsigned char		lBuffers[RA_BATCH][MSG_SIZE_RECV];
+static	union {
+	unsigned char	buf[CHDR_SIZE];
+	struct cmsghdr	align;
+}	lChdrs[RA_BATCH];
+
+// Counters
+static	long	lRaReceived = 0;
+static	long	lRaBatches = 0;
+static	int	lRaMaxBatch = 0;
+static	long	lRaRendered = 0;	// attributes
+static	long	lRaUnchanged = 0;	// RAs without any change
+static	long	lRaCacheHits = 0;
+static	long	lRaCacheMisses = 0;
+static	long	lRaExpired = 0;		// prefixes, RDNSS and DNSSL
+static	long	lRaPvdExpired = 0;
+
 /* This assumes that str is not null and str_size > 0 */
 char *addrtostr(struct in6_addr const *addr, char *str, size_t str_size)
 {
@@ -160,49 +191,168 @@ char *addrtostr(struct in6_addr const *addr, char *str, size_t str_size)
 }
 
 /*
- * process_ra : we are mostly interested in gathering pvd related information that
- * might be of interest for clients. We want to assign the whole RA to any pvd
- * if such pvd option is found in the RA. Othewise, the RA will be an pvd orphan !
+ * Options of interest of an RA, decoded in place : nothing is allocated
+ * nor rendered while parsing. The suffixes of the DNSSL options are kept
+ * in wire format, as references into the message
+ */
+#define	RA_MAXPREFIX	32
+#define	RA_MAXRDNSS	8	// No more than 3 per option anyway
+#define	RA_MAXDNSSL	16	// More than sufficient ?
+#define	RA_SUFFIXSIZE	256	// dotted representation of a DNSSL suffix
+#define	RA_SUFFIXWIRE	(RA_SUFFIXSIZE + 2)	// same, in wire format
+
+typedef	struct t_RaOptions {
+	char		pvdname[PVDNAMSIZ];
+	int		pvdIdSeq;
+	int		pvdIdH;
+	int		pvdIdL;
+	unsigned long	RouterLifetime;
+	int		nPrefix;
+	struct in6_addr	Prefix[RA_MAXPREFIX];
+	int		PrefixLen[RA_MAXPREFIX];
+	unsigned long	PrefixLifetime[RA_MAXPREFIX];	// valid lifetime
+	int		nRdnss;
+	struct in6_addr	Rdnss[RA_MAXRDNSS];
+	unsigned long	RdnssLifetime[RA_MAXRDNSS];
+	int		nDnssl;
+	unsigned char	*Dnssl[RA_MAXDNSSL];	// labels, in the message
+	int		DnsslLen[RA_MAXDNSSL];
+	unsigned long	DnsslLifetime[RA_MAXDNSSL];
+}	t_RaOptions;
+
+/*
+ * Values of the attributes set by the last RA of a pvd. They are only
+ * valid as long as the attributes have not been changed by anyone else
+ * (changes being then still equal to PvdChanges())
  *
- * We must take care of RA with nd_ra_router_lifetime == 0 (RA is becoming invalid)
- * TODO: the ra parsing behaviour is not yet inline with the draft-01
+ * Each prefix, RDNSS and DNSSL entry expires at the end of its lifetime,
+ * unless refreshed by a new RA. It is then removed from its attribute. The
+ * whole pvd expires at the end of the router lifetime. An attribute is
+ * stale if it may differ from the one the entries of a new RA would give
+ * (some have expired, or it may have been changed by someone else)
  */
-void process_ra(unsigned char *msg,
-		int len,
-		struct sockaddr_in6 *addr,
-		struct in6_addr *sin6_addr,
-		char *if_name)
+typedef	struct t_RaState {
+	int		valid;
+	unsigned int	changes;
+	char		pvdname[PVDNAMSIZ];
+	int		pvdIdSeq;
+	int		pvdIdH;
+	int		pvdIdL;
+	char		if_name[IF_NAMESIZE];
+	struct in6_addr	srcAddress;
+	t_Timer		PvdTimer;
+
+	int		nPrefix;
+	int		PrefixStale;
+	struct in6_addr	Prefix[RA_MAXPREFIX];
+	int		PrefixLen[RA_MAXPREFIX];
+	char		PrefixExpired[RA_MAXPREFIX];
+	t_Timer		PrefixTimer[RA_MAXPREFIX];
+
+	int		nRdnss;
+	int		RdnssStale;
+	struct in6_addr	Rdnss[RA_MAXRDNSS];
+	char		RdnssExpired[RA_MAXRDNSS];
+	t_Timer		RdnssTimer[RA_MAXRDNSS];
+
+	int		nDnssl;
+	int		DnsslStale;
+	int		DnsslLen[RA_MAXDNSSL];
+	unsigned char	Dnssl[RA_MAXDNSSL][RA_SUFFIXWIRE];
+	char		DnsslExpired[RA_MAXDNSSL];
+	t_Timer		DnsslTimer[RA_MAXDNSSL];
+}	t_RaState;
+
+// DecodeDnssl : reference the suffixes of a DNSSL option. The whole
+// option is ignored as soon as a suffix is too long
+static	void	DecodeDnssl(
+			struct nd_opt_dnssl_info_local *dnssl_info,
+			t_RaOptions *Opt,
+			char *addr_str)
 {
-	int i;
-	char addr_str[INET6_ADDRSTRLEN];
-	char pvdname[PVDNAMSIZ];
-	int pvdIdSeq = -1;
-	int pvdIdH = 0;
-	int pvdIdL = 0;
-	t_Pvd *PtPvd;
-	char *TabDNSSL[16];	// More than sufficient ?
-	int nDNSSL = 0;
-	char *TabRDNSS[8];	// No more than 3 anyway
-	int nRDNSS = 0;
-	struct {
-		char *prefix;	// strduped
-		int prefixLen;
-	}	TabPrefix[32];
-	int nPrefix = 0;
-
-	addrtostr(
-		addr != NULL ? &addr->sin6_addr : sin6_addr,
-		addr_str, sizeof(addr_str));
+	int		offset;
+	int		label_len;
+	int		start = -1;
+	int		suffixLen = 0;	// dotted representation
+	int		Length = (dnssl_info->nd_opt_dnssli_len - 1) * 8;
+	int		nDnssl = Opt->nDnssl;	// on entry, to drop the option
+	unsigned char	*suffixes = dnssl_info->nd_opt_dnssli_suffixes;
+
+	for (offset = 0; offset < Length;) {
+		label_len = suffixes[offset++];
+
+		if (label_len == 0) {
+			/*
+			 * Ignore empty suffixes. They're
+			 * probably just padding...
+			 */
+			if (start == -1)
+				continue;
+
+			if (Opt->nDnssl < RA_MAXDNSSL) {
+				Opt->Dnssl[Opt->nDnssl] = &suffixes[start];
+				Opt->DnsslLen[Opt->nDnssl] = offset - start;
+				Opt->DnsslLifetime[Opt->nDnssl] = ntohl(dnssl_info->nd_opt_dnssli_lifetime);
+				Opt->nDnssl++;
+			}
 
-	pvdname[0] = '\0';
+			start = -1;
+			suffixLen = 0;
+			continue;
+		}
 
-	// The message begins with a struct nd_router_advert structure
-	struct nd_router_advert *radvert = (struct nd_router_advert *)msg;
+		if (RA_SUFFIXSIZE - suffixLen < label_len + 2 ||
+		    offset + label_len > Length) {
+			DLOG("oversized suffix in DNSSL option from %s\n", addr_str);
+			Opt->nDnssl = nDnssl;
+			break;
+		}
 
-	len -= sizeof(struct nd_router_advert);
+		if (start == -1) {
+			start = offset - 1;
+		}
+		else {
+			suffixLen++;
+		}
+		suffixLen += label_len;
+		offset += label_len;
+	}
 
-	if (len == 0)
-		return;
+	DLOG("ND_OPT_DNSSL_INFORMATION : %d DNSSL items (max %d)\n",
+		Opt->nDnssl,
+		RA_MAXDNSSL);
+}
+
+// DnsslToString : dotted representation of a DNSSL suffix (decoded by
+// DecodeDnssl, hence known to fit in RA_SUFFIXSIZE bytes)
+static	char	*DnsslToString(unsigned char *Labels, char *suffix)
+{
+	int	label_len;
+
+	suffix[0] = '\0';
+
+	while ((label_len = *Labels++) != 0) {
+		if (suffix[0] != '\0')
+			strcat(suffix, ".");
+		strncat(suffix, (char *) Labels, label_len);
+		Labels += label_len;
+	}
+	return(suffix);
+}
+
+// DecodeRa : decode the options of an RA. Returns -1 if it must be ignored
+static	int	DecodeRa(unsigned char *msg, int len, t_RaOptions *Opt, char *addr_str)
+{
+	Opt->pvdname[0] = '\0';
+	Opt->pvdIdSeq = -1;
+	Opt->pvdIdH = 0;
+	Opt->pvdIdL = 0;
+	Opt->RouterLifetime = ntohs(((struct nd_router_advert *)msg)->nd_ra_router_lifetime);
+	Opt->nPrefix = 0;
+	Opt->nRdnss = 0;
+	Opt->nDnssl = 0;
+
+	len -= sizeof(struct nd_router_advert);
 
 	uint8_t *opt_str = (uint8_t *)(msg + sizeof(struct nd_router_advert));
 
@@ -230,25 +380,23 @@ void process_ra(unsigned char *msg,
 		case ND_OPT_MTU: {
 			struct nd_opt_mtu *mtu = (struct nd_opt_mtu *)opt_str;
 			if (len < sizeof(*mtu))
-				return;
+				return(-1);
 
 			DLOG("ND_OPT_MTU present in RA (%d)\n", ntohl(mtu->nd_opt_mtu_mtu));
 
 			break;
 		}
 		case ND_OPT_PREFIX_INFORMATION: {
-			char prefix_str[INET6_ADDRSTRLEN];
 			struct nd_opt_prefix_info *pinfo = (struct nd_opt_prefix_info *)opt_str;
 			if (len < sizeof(*pinfo))
-				return;
+				return(-1);
 
-			addrtostr(&pinfo->nd_opt_pi_prefix, prefix_str, sizeof(prefix_str));
+			if (Opt->nPrefix < RA_MAXPREFIX) {
+				Opt->Prefix[Opt->nPrefix] = pinfo->nd_opt_pi_prefix;
+				Opt->PrefixLen[Opt->nPrefix] = pinfo->nd_opt_pi_prefix_len;
+				Opt->PrefixLifetime[Opt->nPrefix] = ntohl(pinfo->nd_opt_pi_valid_time);
 
-			if (nPrefix < DIM(TabPrefix)) {
-				TabPrefix[nPrefix].prefix = strdup(prefix_str);
-				TabPrefix[nPrefix].prefixLen = pinfo->nd_opt_pi_prefix_len;
-
-				nPrefix++;
+				Opt->nPrefix++;
 			}
 
 			break;
@@ -276,96 +424,66 @@ void process_ra(unsigned char *msg,
 
 			DLOG("ND_OPT_RDNSS_INFORMATION present in RA\n");
 
-			char rdnss_str[INET6_ADDRSTRLEN];
+			if (Opt->nRdnss + 3 > RA_MAXRDNSS) {
+				break;
+			}
+
+			int first = Opt->nRdnss;
 			int count = rdnssinfo->nd_opt_rdnssi_len;
 			switch (count) {
 			case 7 :
-				addrtostr(&rdnssinfo->nd_opt_rdnssi_addr3, rdnss_str, sizeof(rdnss_str));
-				TabRDNSS[nRDNSS++] = strdup(rdnss_str);
+				Opt->Rdnss[Opt->nRdnss++] = rdnssinfo->nd_opt_rdnssi_addr3;
 				/* FALLTHROUGH */
 			case 5 :
-				addrtostr(&rdnssinfo->nd_opt_rdnssi_addr2, rdnss_str, sizeof(rdnss_str));
-				TabRDNSS[nRDNSS++] = strdup(rdnss_str);
+				Opt->Rdnss[Opt->nRdnss++] = rdnssinfo->nd_opt_rdnssi_addr2;
 				/* FALLTHROUGH */
 			case 3 :
-				addrtostr(&rdnssinfo->nd_opt_rdnssi_addr1, rdnss_str, sizeof(rdnss_str));
-				TabRDNSS[nRDNSS++] = strdup(rdnss_str);
+				Opt->Rdnss[Opt->nRdnss++] = rdnssinfo->nd_opt_rdnssi_addr1;
 				break;
 			}
+			for (; first < Opt->nRdnss; first++) {
+				Opt->RdnssLifetime[first] = ntohl(rdnssinfo->nd_opt_rdnssi_lifetime);
+			}
 			break;
 		}
 		case ND_OPT_DNSSL_INFORMATION: {
-			int offset;
 			struct nd_opt_dnssl_info_local *dnssl_info = (struct nd_opt_dnssl_info_local *)opt_str;
-			char suffix[256] = {""};
 
 			DLOG("sizeof(nd_opt_dnssl_info_local) = %d\n", (int) sizeof(*dnssl_info));
 			if (len < sizeof(*dnssl_info))
-				return;
-
-			for (offset = 0; offset < (dnssl_info->nd_opt_dnssli_len - 1) * 8;) {
-				int label_len = dnssl_info->nd_opt_dnssli_suffixes[offset++];
-
-				if (label_len == 0) {
-					/*
-					 * Ignore empty suffixes. They're
-					 * probably just padding...
-					 */
-					if (suffix[0] == '\0')
-						continue;
-
-					if (nDNSSL < DIM(TabDNSSL)) {
-						TabDNSSL[nDNSSL++] = strdup(suffix);
-					}
+				return(-1);
 
-					suffix[0] = '\0';
-					continue;
-				}
-
-				if ((sizeof(suffix) - strlen(suffix)) < (label_len + 2)) {
-					DLOG("oversized suffix in DNSSL option from %s\n", addr_str);
-					break;
-				}
-
-				if (suffix[0] != '\0')
-					strcat(suffix, ".");
-				strncat(suffix, (char *)&dnssl_info->nd_opt_dnssli_suffixes[offset], label_len);
-				offset += label_len;
-			}
-
-			DLOG("ND_OPT_DNSSL_INFORMATION : %d DNSSL items (max %d)\n",
-				nDNSSL,
-				(int) DIM(TabDNSSL));
+			DecodeDnssl(dnssl_info, Opt, addr_str);
 			break;
 		}
 		case ND_OPT_PVDID: {
 			int pvdNameLen;
 			struct nd_opt_pvdid *pvd = (struct nd_opt_pvdid *) opt_str;
 			if (len < sizeof(*pvd))
-				return;
+				return(-1);
 			DLOG("ND_OPT_PVDID present in RA\n");
 
-			if (pvdname[0] != '\0') {
+			if (Opt->pvdname[0] != '\0') {
 				DLOG("PVDID option already defined. Ignoring this one\n");
 				break;
 			}
 
-			pvdIdSeq = ntohs(pvd->nd_opt_pvd_sequence);
-			pvdIdH = (ntohs(pvd->nd_opt_pvd_flags) >> 15) & 0x01;
-			pvdIdL = (ntohs(pvd->nd_opt_pvd_flags) >> 14) & 0x01;
+			Opt->pvdIdSeq = ntohs(pvd->nd_opt_pvd_sequence);
+			Opt->pvdIdH = (ntohs(pvd->nd_opt_pvd_flags) >> 15) & 0x01;
+			Opt->pvdIdL = (ntohs(pvd->nd_opt_pvd_flags) >> 14) & 0x01;
 
 			DLOG("pvdIdSeq = %d, pvdIdH = %d, pvdIdL = %d\n",
-				pvdIdSeq, pvdIdH, pvdIdL);
+				Opt->pvdIdSeq, Opt->pvdIdH, Opt->pvdIdL);
 
 			pvdNameLen = optlen - sizeof(*pvd);
 
 			if (pvdNameLen >= PVDNAMSIZ) {
 				pvdNameLen = PVDNAMSIZ - 1;
 			}
-			strncpy(pvdname, (char *) pvd->nd_opt_pvd_name, pvdNameLen);
-			pvdname[pvdNameLen] = '\0';
+			strncpy(Opt->pvdname, (char *) pvd->nd_opt_pvd_name, pvdNameLen);
+			Opt->pvdname[pvdNameLen] = '\0';
 
-			DLOG("Pvdname : %s\n", pvdname);
+			DLOG("Pvdname : %s\n", Opt->pvdname);
 
 			break;
 		}
@@ -383,111 +501,753 @@ void process_ra(unsigned char *msg,
 
 	_DLOG(LOG_DEBUG, "processed RA\n");
 
+	return(0);
+}
+
+// DnsslChanged : compare the DNSSL suffixes of an RA with the ones saved
+static	int	DnsslChanged(t_RaOptions *Opt, t_RaState *State)
+{
+	int	i;
+
+	if (Opt->nDnssl != State->nDnssl) {
+		return(true);
+	}
+	for (i = 0; i < Opt->nDnssl; i++) {
+		if (Opt->DnsslLen[i] != State->DnsslLen[i] ||
+		    memcmp(Opt->Dnssl[i], State->Dnssl[i], Opt->DnsslLen[i]) != 0) {
+			return(true);
+		}
+	}
+	return(false);
+}
+
+// SetRdnss : render the rdnss attribute, from the entries not expired
+static	void	SetRdnss(t_Pvd *PtPvd, t_RaState *State)
+{
+	int	i;
+	int	n = 0;
+	char	rdnss_str[RA_MAXRDNSS][INET6_ADDRSTRLEN];
+	char	*TabRDNSS[RA_MAXRDNSS];
+	char	*pt;
+
+	for (i = 0; i < State->nRdnss; i++) {
+		if (! State->RdnssExpired[i]) {
+			TabRDNSS[n] = addrtostr(&State->Rdnss[i], rdnss_str[n], sizeof(rdnss_str[n]));
+			n++;
+		}
+	}
+	if ((pt = JsonArray(n, TabRDNSS)) != NULL) {
+		PvdSetAttr(PtPvd, "rdnss", pt);
+		free(pt);
+	}
+	State->RdnssStale = false;
+}
+
+// SetDnssl : render the dnssl attribute, from the entries not expired
+static	void	SetDnssl(t_Pvd *PtPvd, t_RaState *State)
+{
+	int	i;
+	int	n = 0;
+	char	suffix[RA_MAXDNSSL][RA_SUFFIXSIZE];
+	char	*TabDNSSL[RA_MAXDNSSL];
+	char	*pt;
+
+	for (i = 0; i < State->nDnssl; i++) {
+		if (! State->DnsslExpired[i]) {
+			TabDNSSL[n] = DnsslToString(State->Dnssl[i], suffix[n]);
+			n++;
+		}
+	}
+	if ((pt = JsonArray(n, TabDNSSL)) != NULL) {
+		PvdSetAttr(PtPvd, "dnssl", pt);
+		free(pt);
+	}
+	State->DnsslStale = false;
+}
+
+// SetPrefixes : render the prefixes attribute, from the entries not expired
+static	void	SetPrefixes(t_Pvd *PtPvd, t_RaState *State)
+{
+	int		i;
+	int		n = 0;
+	char		prefix_str[INET6_ADDRSTRLEN];
+	t_StringBuffer	SB;
+
+	for (i = 0; i < State->nPrefix; i++) {
+		if (! State->PrefixExpired[i]) {
+			n++;
+		}
+	}
+
+	SBInit(&SB);
+	SBAddString(&SB,  "{\n");
+	for (i = 0; i < State->nPrefix; i++) {
+		if (State->PrefixExpired[i]) {
+			continue;
+		}
+		addrtostr(&State->Prefix[i], prefix_str, sizeof(prefix_str));
+		SBAddString(
+			&SB,
+			"\t\"%s/%d\" : { ",
+			prefix_str,
+			State->PrefixLen[i]);
+		SBAddString(
+			&SB,
+			"\"prefix\" : \"%s\", ",
+			prefix_str);
+		SBAddString(
+			&SB,
+			"\"prefixLen\" : \"%d\" }%s\n",
+			State->PrefixLen[i],
+			--n == 0 ? "" : ",");
+	}
+	SBAddString(&SB, "}\n");
+	PvdSetAttr(PtPvd, "prefixes", SB.String);
+	SBUninit(&SB);
+	State->PrefixStale = false;
+}
+
+// EntryExpired : a prefix, RDNSS or DNSSL entry has reached the end of its
+// lifetime. Its attribute is rendered again, without it
+static	void	EntryExpired(
+			t_RaState *State,
+			char *Expired,
+			int *Stale,
+			void (*Set)(t_Pvd *PtPvd, t_RaState *State))
+{
+	int	Valid;
+	t_Pvd	*PtPvd;
+
+	*Expired = true;
+	*Stale = true;
+	lRaExpired++;
+
+	if ((PtPvd = PvdBeginTransaction(State->pvdname)) == NULL) {
+		return;
+	}
+	Valid = State->valid && State->changes == PvdChanges(PtPvd);
+
+	Set(PtPvd, State);
+	*Stale = true;	// until the entry is refreshed
+
+	PvdEndTransaction(PtPvd);
+
+	// The state still matches the attributes
+	if (Valid) {
+		State->changes = PvdChanges(PtPvd);
+	}
+}
+
+static	void	PrefixExpired(t_Timer *T)
+{
+	t_RaState	*State = T->Data;
+
+	DLOG("%s : prefix %d expired\n", State->pvdname, T->Arg);
+	EntryExpired(State, &State->PrefixExpired[T->Arg], &State->PrefixStale, SetPrefixes);
+}
+
+static	void	RdnssExpired(t_Timer *T)
+{
+	t_RaState	*State = T->Data;
+
+	DLOG("%s : RDNSS %d expired\n", State->pvdname, T->Arg);
+	EntryExpired(State, &State->RdnssExpired[T->Arg], &State->RdnssStale, SetRdnss);
+}
+
+static	void	DnsslExpired(t_Timer *T)
+{
+	t_RaState	*State = T->Data;
+
+	DLOG("%s : DNSSL %d expired\n", State->pvdname, T->Arg);
+	EntryExpired(State, &State->DnsslExpired[T->Arg], &State->DnsslStale, SetDnssl);
+}
+
+// PvdExpired : the router lifetime is over, as if an RA with a null router
+// lifetime had been received. The state is released with the pvd
+static	void	PvdExpired(t_Timer *T)
+{
+	t_RaState	*State = T->Data;
+	char		pvdname[PVDNAMSIZ];
+
+	DLOG("%s : router lifetime expired. Unregistering\n", State->pvdname);
+	lRaPvdExpired++;
+
+	strcpy(pvdname, State->pvdname);
+	UnregisterPvd(pvdname);
+}
+
+// NewRaState : allocate the state of a pvd
+static	t_RaState	*NewRaState(char *pvdname)
+{
+	int		i;
+	t_RaState	*State;
+
+	if ((State = malloc(sizeof(*State))) == NULL) {
+		return(NULL);
+	}
+	State->valid = false;
+	strcpy(State->pvdname, pvdname);
+	TimerInit(&State->PvdTimer, PvdExpired, State, 0);
+
+	State->nPrefix = 0;
+	State->PrefixStale = false;
+	for (i = 0; i < RA_MAXPREFIX; i++) {
+		TimerInit(&State->PrefixTimer[i], PrefixExpired, State, i);
+	}
+	State->nRdnss = 0;
+	State->RdnssStale = false;
+	for (i = 0; i < RA_MAXRDNSS; i++) {
+		TimerInit(&State->RdnssTimer[i], RdnssExpired, State, i);
+	}
+	State->nDnssl = 0;
+	State->DnsslStale = false;
+	for (i = 0; i < RA_MAXDNSSL; i++) {
+		TimerInit(&State->DnsslTimer[i], DnsslExpired, State, i);
+	}
+	return(State);
+}
+
+// ReleaseRaState : release the state of a pvd (called when the pvd is
+// released)
+void	ReleaseRaState(void *pt)
+{
+	int		i;
+	t_RaState	*State = pt;
+
+	TimerCancel(&State->PvdTimer);
+	for (i = 0; i < RA_MAXPREFIX; i++) {
+		TimerCancel(&State->PrefixTimer[i]);
+	}
+	for (i = 0; i < RA_MAXRDNSS; i++) {
+		TimerCancel(&State->RdnssTimer[i]);
+	}
+	for (i = 0; i < RA_MAXDNSSL; i++) {
+		TimerCancel(&State->DnsslTimer[i]);
+	}
+	free(State);
+}
+
+/*
+ * The state of a pvd is handed over to a new instance of the daemon
+ * (--upgrade) as is, its timers carrying the remaining lifetimes instead
+ * of their expiration tick. Both instances being the same build (or close
+ * enough), the record is rejected if its size differs
+ */
+static	void	SaveTimer(t_Timer *Saved, t_Timer *T)
+{
+	Saved->next = Saved->prev = NULL;
+	Saved->expires = TimerRemaining(T);
+	Saved->Handler = NULL;
+	Saved->Data = NULL;
+}
+
+// SaveRaState : serialize the state of a pvd. Returns NULL if it has none
+// The record is valid until the next call
+char	*SaveRaState(t_Pvd *PtPvd, int *Length)
+{
+	static	t_RaState	lSaved;
+
+	int		i;
+	t_RaState	*State = *PvdRaState(PtPvd);
+
+	if (State == NULL) {
+		return(NULL);
+	}
+	lSaved = *State;
+
+	// Only tell if the state still matches the attributes
+	lSaved.valid = State->valid && State->changes == PvdChanges(PtPvd);
+	lSaved.changes = 0;
+
+	SaveTimer(&lSaved.PvdTimer, &State->PvdTimer);
+	for (i = 0; i < RA_MAXPREFIX; i++) {
+		SaveTimer(&lSaved.PrefixTimer[i], &State->PrefixTimer[i]);
+	}
+	for (i = 0; i < RA_MAXRDNSS; i++) {
+		SaveTimer(&lSaved.RdnssTimer[i], &State->RdnssTimer[i]);
+	}
+	for (i = 0; i < RA_MAXDNSSL; i++) {
+		SaveTimer(&lSaved.DnsslTimer[i], &State->DnsslTimer[i]);
+	}
+
+	*Length = sizeof(lSaved);
+	return((char *) &lSaved);
+}
+
+// LoadRaState : rebuild the state of a pvd, once its attributes have been
+// restored, and arm its timers again
+void	LoadRaState(t_Pvd *PtPvd, char *pvdname, char *Record, int Length)
+{
+	static	t_RaState	lLoaded;	// the record may not be aligned
+
+	int		i;
+	t_RaState	*Saved = &lLoaded;
+	t_RaState	*State;
+
+	if (Length != sizeof(t_RaState)) {
+		DLOG("%s : invalid RA state record\n", pvdname);
+		return;
+	}
+	memcpy(Saved, Record, Length);
+
+	if (Saved->nPrefix < 0 || Saved->nPrefix > RA_MAXPREFIX ||
+	    Saved->nRdnss < 0 || Saved->nRdnss > RA_MAXRDNSS ||
+	    Saved->nDnssl < 0 || Saved->nDnssl > RA_MAXDNSSL) {
+		DLOG("%s : invalid RA state record\n", pvdname);
+		return;
+	}
+	if ((State = NewRaState(pvdname)) == NULL) {
+		return;
+	}
+
+	// The timers are initialized by NewRaState()
+	memcpy(State, Saved, offsetof(t_RaState, PvdTimer));
+	strcpy(State->pvdname, pvdname);
+	State->changes = PvdChanges(PtPvd);
+	State->if_name[IF_NAMESIZE - 1] = '\0';
+	TimerArm(&State->PvdTimer, Saved->PvdTimer.expires);
+
+	State->nPrefix = Saved->nPrefix;
+	State->PrefixStale = Saved->PrefixStale;
+	memcpy(State->Prefix, Saved->Prefix, sizeof(State->Prefix));
+	memcpy(State->PrefixLen, Saved->PrefixLen, sizeof(State->PrefixLen));
+	memcpy(State->PrefixExpired, Saved->PrefixExpired, sizeof(State->PrefixExpired));
+	for (i = 0; i < State->nPrefix; i++) {
+		TimerArm(&State->PrefixTimer[i], Saved->PrefixTimer[i].expires);
+	}
+
+	State->nRdnss = Saved->nRdnss;
+	State->RdnssStale = Saved->RdnssStale;
+	memcpy(State->Rdnss, Saved->Rdnss, sizeof(State->Rdnss));
+	memcpy(State->RdnssExpired, Saved->RdnssExpired, sizeof(State->RdnssExpired));
+	for (i = 0; i < State->nRdnss; i++) {
+		TimerArm(&State->RdnssTimer[i], Saved->RdnssTimer[i].expires);
+	}
+
+	State->nDnssl = Saved->nDnssl;
+	State->DnsslStale = Saved->DnsslStale;
+	memcpy(State->DnsslLen, Saved->DnsslLen, sizeof(State->DnsslLen));
+	memcpy(State->Dnssl, Saved->Dnssl, sizeof(State->Dnssl));
+	memcpy(State->DnsslExpired, Saved->DnsslExpired, sizeof(State->DnsslExpired));
+	for (i = 0; i < State->nDnssl; i++) {
+		TimerArm(&State->DnsslTimer[i], Saved->DnsslTimer[i].expires);
+	}
+
+	if (*PvdRaState(PtPvd) != NULL) {
+		ReleaseRaState(*PvdRaState(PtPvd));
+	}
+	*PvdRaState(PtPvd) = State;
+}
+
+// RearmTimers : (re)arm the timers of the entries of an RA, the entries
+// beyond them being dropped (an option absent from the RA leaves its
+// entries as they are)
+static	void	RearmTimers(t_RaState *State, t_RaOptions *Opt)
+{
+	int	i;
+
+	TimerArm(&State->PvdTimer, Opt->RouterLifetime);
+
+	if (Opt->nPrefix > 0) {
+		for (i = 0; i < Opt->nPrefix; i++) {
+			TimerArm(&State->PrefixTimer[i], Opt->PrefixLifetime[i]);
+			State->PrefixExpired[i] = false;
+		}
+		for (; i < State->nPrefix; i++) {
+			TimerCancel(&State->PrefixTimer[i]);
+		}
+	}
+	if (Opt->nRdnss > 0) {
+		for (i = 0; i < Opt->nRdnss; i++) {
+			TimerArm(&State->RdnssTimer[i], Opt->RdnssLifetime[i]);
+			State->RdnssExpired[i] = false;
+		}
+		for (; i < State->nRdnss; i++) {
+			TimerCancel(&State->RdnssTimer[i]);
+		}
+	}
+	if (Opt->nDnssl > 0) {
+		for (i = 0; i < Opt->nDnssl; i++) {
+			TimerArm(&State->DnsslTimer[i], Opt->DnsslLifetime[i]);
+			State->DnsslExpired[i] = false;
+		}
+		for (; i < State->nDnssl; i++) {
+			TimerCancel(&State->DnsslTimer[i]);
+		}
+	}
+}
+
+/*
+ * Fingerprints of the RAs last received from each router (interface and
+ * source link local address), a router sending one RA per pvd. Routers
+ * resend the same RAs over and over : an RA is ignored if its fingerprint
+ * is known, and if the pvd it has updated (if any) has not been changed
+ * since then. The lifetimes are not part of the fingerprint : they are
+ * refreshed instead (RefreshRa())
+ *
+ * The cache is a set associative one, the least recently used entry of a
+ * set being replaced
+ */
+#define	RA_CACHESETS	64	// must be a power of 2
+#define	RA_CACHEWAYS	4
+
+typedef	struct t_RaCacheEntry {
+	int		ifindex;	// 0 if unused
+	struct in6_addr	src;
+	uint64_t	fingerprint;
+	int		len;
+	char		pvdname[PVDNAMSIZ];	// empty if none
+	unsigned int	changes;	// PvdChanges() of the pvd
+	unsigned long	used;
+}	t_RaCacheEntry;
+
+static	t_RaCacheEntry	lRaCache[RA_CACHESETS][RA_CACHEWAYS];
+static	unsigned long	lRaCacheClock = 0;
+
+// FnvBytes : add some bytes to a 64 bits FNV-1a hash
+static	uint64_t	FnvBytes(uint64_t h, unsigned char *pt, int n)
+{
+	while (n-- > 0) {
+		h ^= *pt++;
+		h *= 1099511628211ULL;
+	}
+	return(h);
+}
+
+// Fingerprint : hash of an RA, its checksum and lifetimes excluded (the
+// router lifetime only counts as being null or not). The options being
+// walked as by DecodeRa(), this is O(len)
+static	uint64_t	Fingerprint(unsigned char *msg, int len)
+{
+	int		optlen;
+	int		from;
+	int		to;
+	unsigned char	zero;
+	uint64_t	h = 14695981039346656037ULL;
+	struct nd_router_advert *radvert = (struct nd_router_advert *)msg;
+
+	zero = radvert->nd_ra_router_lifetime == 0;
+
+	h = FnvBytes(h, msg, 2);	// type, code
+	h = FnvBytes(h, msg + 4, 2);	// hop limit, flags
+	h = FnvBytes(h, &zero, 1);
+	h = FnvBytes(h, msg + 8, 8);	// reachable time, retransmission timer
+
+	msg += sizeof(struct nd_router_advert);
+	len -= sizeof(struct nd_router_advert);
+
+	while (len >= 2) {
+		optlen = msg[1] << 3;
+
+		if (optlen == 0 || optlen > len) {
+			break;
+		}
+
+		switch (msg[0]) {
+		case ND_OPT_PREFIX_INFORMATION:	// valid and preferred
+			from = 4;
+			to = 12;
+			break;
+		case ND_OPT_ROUTE_INFORMATION:
+		case ND_OPT_RDNSS_INFORMATION:
+		case ND_OPT_DNSSL_INFORMATION:
+			from = 4;
+			to = 8;
+			break;
+		default:
+			from = to = optlen;
+			break;
+		}
+		if (to > optlen) {
+			from = to = optlen;
+		}
+		h = FnvBytes(h, msg, from);
+		h = FnvBytes(h, msg + to, optlen - to);
+
+		len -= optlen;
+		msg += optlen;
+	}
+	// Garbage, if any
+	return(FnvBytes(h, msg, len));
+}
+
+// RaCacheLookup : entry of the cache for a given RA of a given router. If
+// it is not known, the entry to be replaced is returned (its ifindex does
+// not match)
+static	t_RaCacheEntry	*RaCacheLookup(
+				int ifindex,
+				struct in6_addr *src,
+				uint64_t fingerprint,
+				int len)
+{
+	int		i;
+	uint64_t	h = fingerprint;
+	t_RaCacheEntry	*Set;
+	t_RaCacheEntry	*Victim;
+
+	h = FnvBytes(h, (unsigned char *) &ifindex, sizeof(ifindex));
+	h = FnvBytes(h, (unsigned char *) src, sizeof(*src));
+
+	Set = lRaCache[h & (RA_CACHESETS - 1)];
+	Victim = &Set[0];
+
+	for (i = 0; i < RA_CACHEWAYS; i++) {
+		if (Set[i].ifindex == ifindex &&
+		    Set[i].fingerprint == fingerprint &&
+		    Set[i].len == len &&
+		    IN6_ARE_ADDR_EQUAL(&Set[i].src, src)) {
+			return(&Set[i]);
+		}
+		if (Set[i].used < Victim->used) {
+			Victim = &Set[i];
+		}
+	}
+	Victim->ifindex = 0;
+	return(Victim);
+}
+
+// RaCacheValid : check if the pvd updated by a known RA (if any) has been
+// left as is. It may have been removed, or changed by a control client
+static	int	RaCacheValid(t_RaCacheEntry *Entry)
+{
+	t_Pvd	*PtPvd;
+
+	if (Entry->pvdname[0] != '\0' &&
+	    ((PtPvd = PvdLookup(Entry->pvdname)) == NULL ||
+	     PvdChanges(PtPvd) != Entry->changes)) {
+		return(false);
+	}
+	return(true);
+}
+
+/*
+ * ApplyRa : apply an RA to the pvd it belongs to (if any). Returns -1 if
+ * the result must not be cached, otherwise the name of the pvd (empty if
+ * none) and the stamp of its last change are returned
+ *
+ * We are mostly interested in gathering pvd related information that
+ * might be of interest for clients. We want to assign the whole RA to any pvd
+ * if such pvd option is found in the RA. Othewise, the RA will be an pvd orphan !
+ *
+ * We must take care of RA with nd_ra_router_lifetime == 0 (RA is becoming invalid)
+ * TODO: the ra parsing behaviour is not yet inline with the draft-01
+ *
+ * The options are compared with the ones of the previous RA of the pvd (as
+ * long as its attributes have not been changed otherwise) : only the
+ * attributes whose options have changed are rendered and updated. The
+ * lifetimes of the entries of the RA are refreshed
+ */
+static int ApplyRa(unsigned char *msg,
+		int len,
+		struct in6_addr *src,
+		char *if_name,
+		char *pvdname,
+		unsigned int *changes)
+{
+	int i;
+	char addr_str[INET6_ADDRSTRLEN];
+	t_Pvd *PtPvd;
+	t_RaOptions Opt;
+	t_RaState *State;
+	void **PtState;
+	int Valid;
+	int Rendered = 0;
+	int DnsslChange, RdnssChange, PrefixChange;
+
+	addrtostr(src, addr_str, sizeof(addr_str));
+
+	// The message begins with a struct nd_router_advert structure
+	struct nd_router_advert *radvert = (struct nd_router_advert *)msg;
+
+	pvdname[0] = '\0';
+
+	if (len == sizeof(struct nd_router_advert))
+		return(0);
+
+	if (DecodeRa(msg, len, &Opt, addr_str) == -1) {
+		return(0);
+	}
+
 	// If we have seen a Pvd, we will update some fields of interest
 	// However, if the RA is becoming invalid, we must notify that the PVD
 	// has disappeared !
-	if (pvdname[0] == '\0') {
+	if (Opt.pvdname[0] == '\0') {
 		// No PvD option defined in this RA
-		goto Exit;
+		return(0);
 	}
 
 	DLOG("PVD option being handled at the end of the RA\n");
 
 	if (radvert->nd_ra_router_lifetime == 0) {
 		DLOG("RA becoming invalidated. Unregistering\n");
-		UnregisterPvd(pvdname);
-		goto Exit;	// Release allocated structures
+		UnregisterPvd(Opt.pvdname);
+		return(-1);
 	}
 
-	if ((PtPvd = PvdBeginTransaction(pvdname)) == NULL) {
-		return;
+	if ((PtPvd = PvdBeginTransaction(Opt.pvdname)) == NULL) {
+		return(-1);
 	}
 
-	PvdSetAttr(PtPvd, "sequenceNumber", GetIntStr(pvdIdSeq));
-	PvdSetAttr(PtPvd, "hFlag", GetIntStr(pvdIdH));
-	PvdSetAttr(PtPvd, "lFlag", GetIntStr(pvdIdL));
-	PvdSetAttr(PtPvd, "interface", Stringify(JsonString(if_name)));
-	PvdSetAttr(PtPvd, "srcAddress", Stringify(addr_str));
-
-	if (nDNSSL > 0) {
-		char	*pt = JsonArray(nDNSSL, TabDNSSL);
+	// The state is allocated once per pvd
+	PtState = PvdRaState(PtPvd);
+	if ((State = *PtState) == NULL) {
+		State = *PtState = NewRaState(Opt.pvdname);
+	}
+	Valid = State != NULL && State->valid && State->changes == PvdChanges(PtPvd);
 
-		if (pt != NULL) {
-			PvdSetAttr(PtPvd, "dnssl", pt);
-			free(pt);
-		}
+	if (! Valid || State->pvdIdSeq != Opt.pvdIdSeq) {
+		PvdSetAttr(PtPvd, "sequenceNumber", GetIntStr(Opt.pvdIdSeq));
+		Rendered++;
+	}
+	if (! Valid || State->pvdIdH != Opt.pvdIdH) {
+		PvdSetAttr(PtPvd, "hFlag", GetIntStr(Opt.pvdIdH));
+		Rendered++;
+	}
+	if (! Valid || State->pvdIdL != Opt.pvdIdL) {
+		PvdSetAttr(PtPvd, "lFlag", GetIntStr(Opt.pvdIdL));
+		Rendered++;
+	}
+	if (! Valid || strcmp(State->if_name, if_name) != 0) {
+		PvdSetAttr(PtPvd, "interface", Stringify(JsonString(if_name)));
+		Rendered++;
+	}
+	if (! Valid || ! IN6_ARE_ADDR_EQUAL(&State->srcAddress, src)) {
+		PvdSetAttr(PtPvd, "srcAddress", Stringify(addr_str));
+		Rendered++;
 	}
 
-	if (nRDNSS > 0) {
-		char	*pt = JsonArray(nRDNSS, TabRDNSS);
+	if (State == NULL) {
+		// No way to remember (nor to expire) the entries
+		PvdEndTransaction(PtPvd);
+		return(-1);
+	}
 
-		if (pt != NULL) {
-			PvdSetAttr(PtPvd, "rdnss", pt);
-			free(pt);
+	// An option absent from the RA leaves the attribute as it is
+	DnsslChange = Opt.nDnssl > 0 &&
+		(! Valid || State->DnsslStale || DnsslChanged(&Opt, State));
+
+	RdnssChange = Opt.nRdnss > 0 &&
+		(! Valid ||
+		 State->RdnssStale ||
+		 Opt.nRdnss != State->nRdnss ||
+		 memcmp(Opt.Rdnss, State->Rdnss, Opt.nRdnss * sizeof(Opt.Rdnss[0])) != 0);
+
+	PrefixChange = Opt.nPrefix > 0 &&
+		(! Valid ||
+		 State->PrefixStale ||
+		 Opt.nPrefix != State->nPrefix ||
+		 memcmp(Opt.Prefix, State->Prefix, Opt.nPrefix * sizeof(Opt.Prefix[0])) != 0 ||
+		 memcmp(Opt.PrefixLen, State->PrefixLen, Opt.nPrefix * sizeof(Opt.PrefixLen[0])) != 0);
+
+	// The entries are saved first : the attributes are rendered from them
+	RearmTimers(State, &Opt);
+
+	if (Opt.nPrefix > 0) {
+		memcpy(State->Prefix, Opt.Prefix, Opt.nPrefix * sizeof(Opt.Prefix[0]));
+		memcpy(State->PrefixLen, Opt.PrefixLen, Opt.nPrefix * sizeof(Opt.PrefixLen[0]));
+		State->nPrefix = Opt.nPrefix;
+	}
+	if (Opt.nRdnss > 0) {
+		memcpy(State->Rdnss, Opt.Rdnss, Opt.nRdnss * sizeof(Opt.Rdnss[0]));
+		State->nRdnss = Opt.nRdnss;
+	}
+	if (Opt.nDnssl > 0) {
+		for (i = 0; i < Opt.nDnssl; i++) {
+			memcpy(State->Dnssl[i], Opt.Dnssl[i], Opt.DnsslLen[i]);
+			State->DnsslLen[i] = Opt.DnsslLen[i];
 		}
+		State->nDnssl = Opt.nDnssl;
 	}
 
-	if (nPrefix > 0) {
-		t_StringBuffer	SB;
-
-		SBInit(&SB);
-		SBAddString(&SB,  "{\n");
-		for (i = 0; i < nPrefix; i++) {
-			SBAddString(
-				&SB,
-				"\t\"%s/%d\" : { ",
-				TabPrefix[i].prefix,
-				TabPrefix[i].prefixLen);
-			SBAddString(
-				&SB,
-				"\"prefix\" : \"%s\", ",
-				TabPrefix[i].prefix);
-			SBAddString(
-				&SB,
-				"\"prefixLen\" : \"%d\" }%s\n",
-				TabPrefix[i].prefixLen,
-				i == nPrefix - 1 ? "" : ",");
-		}
-		SBAddString(&SB, "}\n");
-		PvdSetAttr(PtPvd, "prefixes", SB.String);
-		SBUninit(&SB);
+	if (DnsslChange) {
+		SetDnssl(PtPvd, State);
+		Rendered++;
+	}
+	if (RdnssChange) {
+		SetRdnss(PtPvd, State);
+		Rendered++;
+	}
+	if (PrefixChange) {
+		SetPrefixes(PtPvd, State);
+		Rendered++;
 	}
 
 	PvdEndTransaction(PtPvd);
 
-Exit :
-	for (i = 0; i < nDNSSL; i++) {
-		if (TabDNSSL[i] != NULL) {
-			free(TabDNSSL[i]);
-		}
+	if (Rendered == 0) {
+		lRaUnchanged++;
 	}
+	lRaRendered += Rendered;
 
-	for (i = 0; i < nRDNSS; i++) {
-		if (TabRDNSS[i] != NULL) {
-			free(TabRDNSS[i]);
-		}
+	strcpy(pvdname, Opt.pvdname);
+	*changes = PvdChanges(PtPvd);
+
+	// The attributes absent from the RA may have been changed by others
+	if (! Valid) {
+		State->PrefixStale |= Opt.nPrefix == 0;
+		State->RdnssStale |= Opt.nRdnss == 0;
+		State->DnsslStale |= Opt.nDnssl == 0;
 	}
+	State->pvdIdSeq = Opt.pvdIdSeq;
+	State->pvdIdH = Opt.pvdIdH;
+	State->pvdIdL = Opt.pvdIdL;
+	snprintf(State->if_name, sizeof(State->if_name), "%s", if_name);
+	State->srcAddress = *src;
+	State->changes = PvdChanges(PtPvd);
+	State->valid = true;
 
-	for (i = 0; i < nPrefix; i++) {
-		free(TabPrefix[i].prefix);
+	return(0);
+}
+
+// RefreshRa : an RA already applied is received again. The lifetimes of
+// its entries are refreshed. Returns -1 if it must be applied again
+static int RefreshRa(t_RaCacheEntry *Entry, unsigned char *msg, int len, char *addr_str)
+{
+	t_Pvd *PtPvd;
+	t_RaState *State;
+	t_RaOptions Opt;
+
+	if (Entry->pvdname[0] == '\0') {
+		return(0);
+	}
+	if ((PtPvd = PvdLookup(Entry->pvdname)) == NULL ||
+	    (State = *PvdRaState(PtPvd)) == NULL ||
+	    DecodeRa(msg, len, &Opt, addr_str) == -1) {
+		return(-1);
+	}
+	if ((Opt.nPrefix > 0 && State->PrefixStale) ||
+	    (Opt.nRdnss > 0 && State->RdnssStale) ||
+	    (Opt.nDnssl > 0 && State->DnsslStale)) {
+		return(-1);
 	}
+	RearmTimers(State, &Opt);
+
+	return(0);
+}
+
+// process_ra : apply an RA (see ApplyRa())
+void process_ra(unsigned char *msg,
+		int len,
+		struct sockaddr_in6 *addr,
+		struct in6_addr *sin6_addr,
+		char *if_name)
+{
+	char pvdname[PVDNAMSIZ];
+	unsigned int changes;
 
-	return;
+	ApplyRa(msg, len, addr != NULL ? &addr->sin6_addr : sin6_addr,
+		if_name, pvdname, &changes);
 }
 
 static void process(
-		int sock,
 		unsigned char *msg, int len,
 		struct sockaddr_in6 *addr,
-		struct in6_pktinfo *pkt_info)
+		int ifindex,
+		char *if_name)
 {
-	char if_namebuf[IF_NAMESIZE] = {""};
-	char *if_name = if_indextoname(pkt_info->ipi6_ifindex, if_namebuf);
 	char addr_str[INET6_ADDRSTRLEN];
-
-	if (!if_name) {
-		if_name = "unknown interface";
-	}
+	uint64_t fingerprint;
+	t_RaCacheEntry *Entry;
 
 	addrtostr(&addr->sin6_addr, addr_str, sizeof(addr_str));
 
@@ -524,98 +1284,168 @@ static void process(
 		return;
 	}
 
-	process_ra(msg, len, addr, NULL, if_name);
-}
+	fingerprint = Fingerprint(msg, len);
+	Entry = RaCacheLookup(ifindex, &addr->sin6_addr, fingerprint, len);
+	Entry->used = ++lRaCacheClock;
 
-static int recv_ra(
-		int sock,
-		unsigned char *msg,
-		struct sockaddr_in6 *addr,
-		struct in6_pktinfo **pkt_info,
-		unsigned char *chdr)
-{
-	struct iovec iov;
-	iov.iov_len = MSG_SIZE_RECV;
-	iov.iov_base = (caddr_t)msg;
-
-	struct msghdr mhdr;
-	memset(&mhdr, 0, sizeof(mhdr));
-	mhdr.msg_name = (caddr_t)addr;
-	mhdr.msg_namelen = sizeof(*addr);
-	mhdr.msg_iov = &iov;
-	mhdr.msg_iovlen = 1;
-	mhdr.msg_control = (void *)chdr;
-	mhdr.msg_controllen = CMSG_SPACE(sizeof(struct in6_pktinfo)) + CMSG_SPACE(sizeof(int));
-
-	int len = recvmsg(sock, &mhdr, 0);
-	struct cmsghdr *cmsg;
+	if (Entry->ifindex != 0 &&
+	    RaCacheValid(Entry) &&
+	    RefreshRa(Entry, msg, len, addr_str) == 0) {
+		// Same RA : only its lifetimes are refreshed
+		lRaCacheHits++;
+		return;
+	}
+	lRaCacheMisses++;
 
-	if (len < 0) {
-		if (errno != EINTR) {
-			_DLOG(LOG_ERR, "recvmsg: %s\n", strerror(errno));
-		}
-		return len;
+	if (ApplyRa(msg, len, &addr->sin6_addr, if_name, Entry->pvdname, &Entry->changes) == -1) {
+		Entry->ifindex = 0;
+		return;
 	}
+	Entry->ifindex = ifindex;
+	Entry->src = addr->sin6_addr;
+	Entry->fingerprint = fingerprint;
+	Entry->len = len;
+}
 
-	for (cmsg = CMSG_FIRSTHDR(&mhdr); cmsg != NULL; cmsg = CMSG_NXTHDR(&mhdr, cmsg)) {
-		if (cmsg->cmsg_level != IPPROTO_IPV6)
+// get_pktinfo : retrieve the IPV6_PKTINFO of a received message (NULL if
+// missing or bogus)
+static struct in6_pktinfo *get_pktinfo(struct msghdr *mhdr)
+{
+	struct cmsghdr *cmsg;
+	struct in6_pktinfo *pkt_info;
+
+	for (cmsg = CMSG_FIRSTHDR(mhdr); cmsg != NULL; cmsg = CMSG_NXTHDR(mhdr, cmsg)) {
+		if (cmsg->cmsg_level != IPPROTO_IPV6 || cmsg->cmsg_type != IPV6_PKTINFO)
 			continue;
 
-		switch (cmsg->cmsg_type) {
-		case IPV6_PKTINFO:
-			if ((cmsg->cmsg_len == CMSG_LEN(sizeof(struct in6_pktinfo))) &&
-			    ((struct in6_pktinfo *)CMSG_DATA(cmsg))->ipi6_ifindex) {
-				*pkt_info = (struct in6_pktinfo *)CMSG_DATA(cmsg);
-			} else {
-				_DLOG(LOG_ERR, "received a bogus IPV6_PKTINFO from the kernel! len=%d, index=%d\n",
-				     (int)cmsg->cmsg_len, ((struct in6_pktinfo *)CMSG_DATA(cmsg))->ipi6_ifindex);
-				return -1;
-			}
-			break;
+		pkt_info = (struct in6_pktinfo *)CMSG_DATA(cmsg);
+		if ((cmsg->cmsg_len == CMSG_LEN(sizeof(struct in6_pktinfo))) &&
+		    pkt_info->ipi6_ifindex) {
+			return pkt_info;
 		}
+		_DLOG(LOG_ERR, "received a bogus IPV6_PKTINFO from the kernel! len=%d, index=%d\n",
+		     (int)cmsg->cmsg_len, pkt_info->ipi6_ifindex);
+		return NULL;
 	}
+	return NULL;
+}
 
-	char if_namebuf[IF_NAMESIZE] = {""};
-	char *if_name = 0;
-	if (pkt_info && *pkt_info) {
-		if_name = if_indextoname((*pkt_info)->ipi6_ifindex, if_namebuf);
+// recv_ra : receive a batch of RAs. Returns the number of RAs received,
+// -1 on error (errno being set, EAGAIN included)
+static int recv_ra(int sock)
+{
+	int i;
+	struct msghdr *mhdr;
+
+	// The kernel updates the lengths : they are reset for each batch
+	for (i = 0; i < RA_BATCH; i++) {
+		mhdr = &lMsgs[i].msg_hdr;
+
+		lIov[i].iov_base = (caddr_t)lBuffers[i];
+		lIov[i].iov_len = MSG_SIZE_RECV;
+
+		mhdr->msg_name = (caddr_t)&lAddrs[i];
+		mhdr->msg_namelen = sizeof(lAddrs[i]);
+		mhdr->msg_iov = &lIov[i];
+		mhdr->msg_iovlen = 1;
+		mhdr->msg_control = (void *)lChdrs[i].buf;
+		mhdr->msg_controllen = CHDR_SIZE;
+		mhdr->msg_flags = 0;
 	}
-	if (!if_name) {
-		if_name = "unknown interface";
+
+	int n = recvmmsg(sock, lMsgs, RA_BATCH, MSG_DONTWAIT, NULL);
+
+	if (n < 0) {
+		if (errno != EINTR && errno != EAGAIN && errno != EWOULDBLOCK) {
+			_DLOG(LOG_ERR, "recvmmsg: %s\n", strerror(errno));
+		}
+		return n;
 	}
-	_DLOG(LOG_DEBUG, "%s recvmsg len=%d\n", if_name, len);
 
-	return len;
+	lRaBatches++;
+	lRaReceived += n;
+	if (n > lRaMaxBatch) {
+		lRaMaxBatch = n;
+	}
+	return n;
 }
 
+/*
+ * HandleNetlink : the socket is drained until no more RA is available
+ * (the main loop is notified in edge triggered mode). A batch shorter
+ * than RA_BATCH means that the socket has been drained. The name of an
+ * interface is resolved once per batch
+ */
 int	HandleNetlink(int sockIcmpv6)
 {
-	int     len;
-	struct sockaddr_in6 rcv_addr;
-	struct in6_pktinfo *pkt_info = NULL;
-	unsigned char msg[MSG_SIZE_RECV];
-	unsigned char chdr[CMSG_SPACE(sizeof(struct in6_pktinfo)) +
-			   CMSG_SPACE(sizeof(int))];
+	int     i;
+	int     n;
+	int     ifindex;
+	char    if_namebuf[IF_NAMESIZE];
+	char    *if_name;
+	struct in6_pktinfo *pkt_info;
+
+	do {
+		if ((n = recv_ra(sockIcmpv6)) < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			break;
+		}
 
-	DLOG("RA received\n");
+		DLOG("%d RA received\n", n);
 
-	len = recv_ra(sockIcmpv6, msg, &rcv_addr, &pkt_info, chdr);
+		ifindex = 0;
+		if_name = NULL;
+
+		for (i = 0; i < n; i++) {
+			if ((pkt_info = get_pktinfo(&lMsgs[i].msg_hdr)) == NULL) {
+				_DLOG(LOG_INFO, "recv_ra returned null pkt_info\n");
+				continue;
+			}
+			if (lMsgs[i].msg_len <= 0) {
+				_DLOG(LOG_INFO, "recv_ra returned len <= 0: %d\n", lMsgs[i].msg_len);
+				continue;
+			}
+
+			if (pkt_info->ipi6_ifindex != ifindex) {
+				ifindex = pkt_info->ipi6_ifindex;
+				if ((if_name = if_indextoname(ifindex, if_namebuf)) == NULL) {
+					if_name = "unknown interface";
+				}
+			}
+
+			process(lBuffers[i], lMsgs[i].msg_len, &lAddrs[i], ifindex, if_name);
+		}
+	} while (n == RA_BATCH || (n < 0 && errno == EINTR));
 
-	if (len > 0 && pkt_info)
-	{
-		process(sockIcmpv6, msg, len, &rcv_addr, pkt_info);
-	}
-	else if (!pkt_info)
-	{
-		_DLOG(LOG_INFO, "recv_ra returned null pkt_info\n");
-	}
-	else if (len <= 0)
-	{
-		_DLOG(LOG_INFO, "recv_ra returned len <= 0: %d\n", len);
-	}
 	return(0);
 }
 
+// NetlinkStatistics : dump the RA reception and parsing counters
+void	NetlinkStatistics(FILE *fo)
+{
+	fprintf(fo,
+		"RA : %ld received, %ld batches (max %d per batch, limit %d), "
+		"%ld attributes rendered, %ld RAs without any change\n",
+		lRaReceived,
+		lRaBatches,
+		lRaMaxBatch,
+		RA_BATCH,
+		lRaRendered,
+		lRaUnchanged);
+	fprintf(fo,
+		"RA cache : %ld hits, %ld misses (%ld%% hits)\n",
+		lRaCacheHits,
+		lRaCacheMisses,
+		lRaCacheHits + lRaCacheMisses == 0 ?
+			0 : lRaCacheHits * 100 / (lRaCacheHits + lRaCacheMisses));
+	fprintf(fo,
+		"RA lifetimes : %ld entries expired, %ld pvd expired\n",
+		lRaExpired,
+		lRaPvdExpired);
+}
+
 int open_icmpv6_socket(void)
 {
 	int     sock;
@@ -0,0 +1,349 @@
+/*
+	Copyright 2017 Cisco
+
+	Licensed under the Apache License, Version 2.0 (the "License");
+	you may not use this file except in compliance with the License.
+	You may obtain a copy of the License at
+
+		http://www.apache.org/licenses/LICENSE-2.0
+
+	Unless required by applicable law or agreed to in writing, software
+	distributed under the License is distributed on an "AS IS" BASIS,
+	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+	See the License for the specific language governing permissions and
+	limitations under the License.
+*/
+/*
+ * pvdd-output.c : per client output queues. Clients sockets are non
+ * blocking : a message that can not be written at once is queued, and the
+ * queue is flushed when the socket becomes writable again (EPOLLOUT). This
+ * way, a slow client never stalls the daemon
+ *
+ * The amount of pending data is limited by a high water mark. When a
+ * client falls behind, a policy decides what to do (drop the oldest
+ * messages, coalesce superseded notifications or disconnect the client)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+#include "pvd-utils.h"
+#include "pvdd-output.h"
+
+#define	OQ_MINSIZE	8	// power of 2
+
+static	int	lPolicy = OQ_POLICY_COALESCE;
+static	int	lHighWaterMark = OQ_DEFAULT_HIGHWATERMARK;
+
+// Counters
+static	long	lQueuedMessages = 0;
+static	long	lDroppedMessages = 0;
+static	long	lCoalescedMessages = 0;
+static	long	lDisconnections = 0;
+static	int	lMaxBytes = 0;
+
+// OQSetPolicy : select the policy by name. Returns -1 if it is unknown
+int	OQSetPolicy(char *Policy)
+{
+	if (EQSTR(Policy, "drop")) {
+		lPolicy = OQ_POLICY_DROP;
+	} else
+	if (EQSTR(Policy, "coalesce")) {
+		lPolicy = OQ_POLICY_COALESCE;
+	} else
+	if (EQSTR(Policy, "disconnect")) {
+		lPolicy = OQ_POLICY_DISCONNECT;
+	}
+	else {
+		return(-1);
+	}
+	return(0);
+}
+
+void	OQSetHighWaterMark(int HighWaterMark)
+{
+	lHighWaterMark = HighWaterMark;
+}
+
+// OQStatistics : dump the output queues counters
+void	OQStatistics(FILE *fo)
+{
+	fprintf(fo,
+		"output queues : %ld messages queued, %ld dropped, "
+		"%ld coalesced, %ld disconnections\n",
+		lQueuedMessages,
+		lDroppedMessages,
+		lCoalescedMessages,
+		lDisconnections);
+	fprintf(fo,
+		"output queues : %d bytes max queued (high water mark %d)\n",
+		lMaxBytes,
+		lHighWaterMark);
+}
+
+void	OQInit(t_OutputQueue *Q)
+{
+	memset(Q, 0, sizeof(*Q));
+}
+
+void	OQUninit(t_OutputQueue *Q)
+{
+	int	i;
+	t_OutputMessage	*M;
+
+	for (i = 0; i < Q->Count; i++) {
+		M = &Q->Messages[(Q->Head + i) & (Q->Size - 1)];
+		free(M->Data);
+		if (M->Key != NULL) {
+			free(M->Key);
+		}
+	}
+	if (Q->Messages != NULL) {
+		free(Q->Messages);
+	}
+	OQInit(Q);
+}
+
+// WriteSome : write as much as possible of a buffer on a non blocking
+// socket. Returns the number of bytes written, -1 on error
+static	int	WriteSome(int s, char *Data, int Length)
+{
+	int	n;
+	int	Written = 0;
+
+	while (Written < Length) {
+		if ((n = write(s, Data + Written, Length - Written)) == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				break;
+			}
+			return(-1);
+		}
+		Written += n;
+	}
+	return(Written);
+}
+
+// RemoveMessage : remove the i-th pending message (0 being the head one). The
+// following messages are shifted back
+static	void	RemoveMessage(t_OutputQueue *Q, int i)
+{
+	int		Mask = Q->Size - 1;
+	t_OutputMessage	*M = &Q->Messages[(Q->Head + i) & Mask];
+
+	Q->Bytes -= M->Length - (i == 0 ? Q->Offset : 0);
+	free(M->Data);
+	if (M->Key != NULL) {
+		free(M->Key);
+	}
+
+	if (i == 0) {
+		Q->Head = (Q->Head + 1) & Mask;
+		Q->Offset = 0;
+	}
+	else {
+		for (; i < Q->Count - 1; i++) {
+			Q->Messages[(Q->Head + i) & Mask] =
+				Q->Messages[(Q->Head + i + 1) & Mask];
+		}
+	}
+	Q->Count--;
+}
+
+// AppendMessage : queue a copy of a message (gathering its fragments), of
+// which Offset bytes have already been written (the queue must then be empty)
+static	int	AppendMessage(
+			t_OutputQueue *Q,
+			struct iovec *iov,
+			int iovcnt,
+			int Length,
+			int Offset,
+			char *Key)
+{
+	int		i;
+	int		l;
+	int		Size;
+	t_OutputMessage	*Messages;
+	t_OutputMessage	*M;
+
+	if (Q->Count == Q->Size) {
+		Size = Q->Size == 0 ? OQ_MINSIZE : Q->Size * 2;
+
+		if ((Messages = malloc(Size * sizeof(t_OutputMessage))) == NULL) {
+			DLOG("memory overflow allocating output queue\n");
+			return(-1);
+		}
+		for (i = 0; i < Q->Count; i++) {
+			Messages[i] = Q->Messages[(Q->Head + i) & (Q->Size - 1)];
+		}
+		if (Q->Messages != NULL) {
+			free(Q->Messages);
+		}
+		Q->Messages = Messages;
+		Q->Size = Size;
+		Q->Head = 0;
+	}
+
+	M = &Q->Messages[(Q->Head + Q->Count) & (Q->Size - 1)];
+
+	if ((M->Data = malloc(Length)) == NULL) {
+		DLOG("memory overflow allocating output message\n");
+		return(-1);
+	}
+	for (i = l = 0; i < iovcnt; i++) {
+		memcpy(M->Data + l, iov[i].iov_base, iov[i].iov_len);
+		l += iov[i].iov_len;
+	}
+	M->Length = Length;
+	M->Key = NULL;
+	if (Key != NULL && (M->Key = strdup(Key)) == NULL) {
+		free(M->Data);
+		DLOG("memory overflow allocating output message\n");
+		return(-1);
+	}
+
+	if (Q->Count == 0) {
+		Q->Offset = Offset;
+	}
+	Q->Count++;
+	Q->Bytes += Length - Offset;
+
+	lQueuedMessages++;
+	if (Q->Bytes > lMaxBytes) {
+		lMaxBytes = Q->Bytes;
+	}
+	return(0);
+}
+
+// OQFlush : write the pending messages, until the socket would block
+// Returns -1 on I/O error
+int	OQFlush(t_OutputQueue *Q, int s)
+{
+	int		n;
+	t_OutputMessage	*M;
+
+	while (Q->Count > 0) {
+		M = &Q->Messages[Q->Head];
+
+		if ((n = WriteSome(s, M->Data + Q->Offset, M->Length - Q->Offset)) == -1) {
+			return(-1);
+		}
+		Q->Offset += n;
+		Q->Bytes -= n;
+
+		if (Q->Offset < M->Length) {
+			break;
+		}
+		RemoveMessage(Q, 0);
+	}
+	return(0);
+}
+
+// OQSendv : send a whole message, made of iovcnt fragments, to a client
+// queuing what can not be written now. In the nominal case (nothing pending)
+// the fragments are written by a single writev(), without being copied
+// Messages with the same (non NULL) Key supersede each other
+// A message is always accepted when nothing is pending, even if larger
+// than the high water mark. Returns -1 if the client must be released (I/O
+// error, or policy)
+int	OQSendv(t_OutputQueue *Q, int s, struct iovec *iov, int iovcnt, char *Key)
+{
+	int	i;
+	int	n;
+	int	First;
+	int	Length = 0;
+
+	for (i = 0; i < iovcnt; i++) {
+		Length += iov[i].iov_len;
+	}
+
+	// Give the pending messages a chance first (preserving the order)
+	if (Q->Count > 0 && OQFlush(Q, s) == -1) {
+		return(-1);
+	}
+
+	if (Q->Count == 0) {
+		while ((n = writev(s, iov, iovcnt)) == -1 && errno == EINTR) {
+			;
+		}
+		if (n == -1) {
+			if (errno != EAGAIN && errno != EWOULDBLOCK) {
+				return(-1);
+			}
+			n = 0;
+		}
+		if (n == Length) {
+			return(0);
+		}
+		// Partial write : the socket buffer is most likely full, but
+		// try to write the remainder before waiting for EPOLLOUT
+		if (AppendMessage(Q, iov, iovcnt, Length, n, Key) == -1) {
+			return(-1);
+		}
+		return(OQFlush(Q, s));
+	}
+
+	// The client is behind. A partially written head message can
+	// neither be dropped nor coalesced
+	First = Q->Offset > 0 ? 1 : 0;
+
+	if (Key != NULL && lPolicy == OQ_POLICY_COALESCE) {
+		for (i = First; i < Q->Count; i++) {
+			char	*K = Q->Messages[(Q->Head + i) & (Q->Size - 1)].Key;
+
+			if (K != NULL && EQSTR(K, Key)) {
+				RemoveMessage(Q, i);
+				lCoalescedMessages++;
+				break;
+			}
+		}
+	}
+
+	if (Q->Bytes + Length > lHighWaterMark) {
+		if (lPolicy == OQ_POLICY_DROP) {
+			while (First < Q->Count && Q->Bytes + Length > lHighWaterMark) {
+				RemoveMessage(Q, First);
+				lDroppedMessages++;
+			}
+		}
+		else {
+			DLOG("output queue of socket %d full (%d bytes)\n", s, Q->Bytes);
+			lDisconnections++;
+			return(-1);
+		}
+	}
+
+	return(AppendMessage(Q, iov, iovcnt, Length, 0, Key));
+}
+
+// OQQueue : queue a message without trying to write it. This is how the
+// queue of a client handed over by another instance of the daemon is
+// rebuilt (warm restart), the pending messages being flushed on EPOLLOUT
+int	OQQueue(t_OutputQueue *Q, char *Data, int Length, char *Key)
+{
+	struct iovec	iov;
+
+	iov.iov_base = Data;
+	iov.iov_len = Length;
+
+	return(AppendMessage(Q, &iov, 1, Length, 0, Key));
+}
+
+// OQSend : same as OQSendv(), for a message made of a single buffer
+int	OQSend(t_OutputQueue *Q, int s, char *Data, int Length, char *Key)
+{
+	struct iovec	iov;
+
+	iov.iov_base = Data;
+	iov.iov_len = Length;
+
+	return(OQSendv(Q, s, &iov, 1, Key));
+}
+
+/* ex: set ts=8 noexpandtab wrap: */
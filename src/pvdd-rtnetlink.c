@@ -162,7 +162,9 @@ void *rtnetlink_recv(t_rtnetlink_cnx *cnx, int *type)
 	}
 
 	if (n < 0) {
-		perror("recvmsg");	/* TODO : only output in debug mode */
+		if (errno != EAGAIN && errno != EWOULDBLOCK) {
+			perror("recvmsg");	/* TODO : only output in debug mode */
+		}
 		return(NULL);
 	}
 
@@ -0,0 +1,297 @@
+/*
+	Copyright 2017 Cisco
+
+	Licensed under the Apache License, Version 2.0 (the "License");
+	you may not use this file except in compliance with the License.
+	You may obtain a copy of the License at
+
+		http://www.apache.org/licenses/LICENSE-2.0
+
+	Unless required by applicable law or agreed to in writing, software
+	distributed under the License is distributed on an "AS IS" BASIS,
+	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+	See the License for the specific language governing permissions and
+	limitations under the License.
+*/
+/*
+ * pvdd-snapshot.c : read-only snapshot of the pvd database, published in a
+ * shared memory object (shm_open()). Local clients map it and look up the
+ * attributes without talking to the daemon at all
+ *
+ * A new snapshot is first built in a private staging buffer. It is then
+ * copied into the shared region under a seqlock, so that the readers never
+ * see a partially written database (they retry instead)
+ *
+ * Readers may also sleep until the next update, on the generation number
+ * of the region (a futex word)
+ */
+
+#define _GNU_SOURCE	// to have mremap() defined
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include "pvd-utils.h"
+#include "pvd-snapshot.h"
+#include "pvdd-snapshot.h"
+
+#define	SNAPSHOT_MINSIZE	(64 * 1024)	// initial size of the region
+
+// The shared region
+static	int			lFd = -1;
+static	t_SnapshotHeader	*lHeader = NULL;
+static	unsigned int		lSize = 0;
+
+// Staging buffer
+static	char		*lStaging = NULL;
+static	int		lStagingSize = 0;
+static	int		lLength = 0;
+static	int		lPvd = -1;	// offset of the record being built
+static	unsigned int	lNPvd = 0;
+static	int		lError = false;
+
+// Counters
+static	long		lPublished = 0;
+static	long		lPublishedBytes = 0;
+static	long		lWakeups = 0;
+
+// WakeReaders : wake up the readers sleeping on the generation number of a
+// region, that has just been changed. The readers map the region read-only
+// and can not register themselves : the system call is always issued
+static	void	WakeReaders(t_SnapshotHeader *H)
+{
+	int	n;
+
+	if ((n = syscall(SYS_futex, &H->Generation, FUTEX_WAKE, INT_MAX, NULL, NULL, 0)) > 0) {
+		lWakeups += n;
+	}
+}
+
+// SnapshotOpen : create the shared memory object. A region left by a
+// previous instance of the daemon is flagged as superseded (its readers
+// will then switch to the new one) and unlinked. The generation number
+// goes on from the one of this region
+int	SnapshotOpen(char *Name)
+{
+	int			fd;
+	unsigned int		Generation = 0;
+	t_SnapshotHeader	*H;
+
+	if ((fd = shm_open(Name, O_RDWR, 0)) != -1) {
+		if ((H = mmap(NULL, sizeof(*H), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) != MAP_FAILED) {
+			if (H->Magic == PVD_SNAPSHOT_MAGIC) {
+				__atomic_store_n(&H->Superseded, 1, __ATOMIC_RELEASE);
+				Generation = __atomic_add_fetch(&H->Generation, 1, __ATOMIC_RELEASE);
+				WakeReaders(H);
+			}
+			munmap(H, sizeof(*H));
+		}
+		close(fd);
+		shm_unlink(Name);
+	}
+
+	if ((lFd = shm_open(Name, O_RDWR | O_CREAT | O_EXCL, 0644)) == -1) {
+		return(-1);
+	}
+	fchmod(lFd, 0644);	// whatever the umask
+
+	if (ftruncate(lFd, SNAPSHOT_MINSIZE) == -1 ||
+	    (lHeader = mmap(NULL,
+			    SNAPSHOT_MINSIZE,
+			    PROT_READ | PROT_WRITE,
+			    MAP_SHARED,
+			    lFd,
+			    0)) == MAP_FAILED) {
+		close(lFd);
+		shm_unlink(Name);
+		lFd = -1;
+		lHeader = NULL;
+		return(-1);
+	}
+	lSize = SNAPSHOT_MINSIZE;
+
+	lHeader->Version = PVD_SNAPSHOT_VERSION;
+	lHeader->Size = lSize;
+	lHeader->Superseded = 0;
+	lHeader->Sequence = 0;
+	lHeader->Generation = Generation;
+	lHeader->nPvd = 0;
+	lHeader->Length = 0;
+	__atomic_store_n(&lHeader->Magic, PVD_SNAPSHOT_MAGIC, __ATOMIC_RELEASE);
+
+	return(0);
+}
+
+// Reserve : make room for Length more bytes in the staging buffer. Returns
+// NULL on memory overflow (remembered until SnapshotPublish())
+static	char	*Reserve(int Length)
+{
+	int	Size;
+	char	*Staging;
+
+	if (lError) {
+		return(NULL);
+	}
+	if (lLength + Length > lStagingSize) {
+		for (Size = lStagingSize == 0 ? SNAPSHOT_MINSIZE : lStagingSize;
+		     lLength + Length > Size;
+		     Size *= 2) {
+			;
+		}
+		if ((Staging = realloc(lStaging, Size)) == NULL) {
+			DLOG("memory overflow building the snapshot\n");
+			lError = true;
+			return(NULL);
+		}
+		lStaging = Staging;
+		lStagingSize = Size;
+	}
+	lLength += Length;
+
+	return(lStaging + lLength - Length);
+}
+
+// SnapshotBegin : start a new snapshot. Returns its generation number, to
+// be given to the pvd that have changed
+unsigned int	SnapshotBegin(void)
+{
+	lLength = 0;
+	lPvd = -1;
+	lNPvd = 0;
+	lError = false;
+
+	return(lHeader == NULL ? 0 : lHeader->Generation + 1);
+}
+
+void	SnapshotAddPvd(char *pvdname, unsigned int Generation)
+{
+	int		l = strlen(pvdname) + 1;
+	int		Length = SNAPSHOT_ALIGN(sizeof(t_SnapshotPvd) + l);
+	t_SnapshotPvd	*pt;
+
+	if (lHeader == NULL || (pt = (t_SnapshotPvd *) Reserve(Length)) == NULL) {
+		return;
+	}
+	memset(pt, 0, Length);
+	pt->Length = Length;
+	pt->Generation = Generation;
+	pt->nAttributes = 0;
+	pt->NameLength = l;
+	memcpy(pt->Name, pvdname, l);
+
+	lPvd = (char *) pt - lStaging;
+	lNPvd++;
+}
+
+void	SnapshotAddAttribute(char *Key, char *Value)
+{
+	int			kl = strlen(Key) + 1;
+	int			vl = strlen(Value) + 1;
+	int			Length = SNAPSHOT_ALIGN(sizeof(t_SnapshotAttribute) + kl + vl);
+	t_SnapshotAttribute	*pt;
+	t_SnapshotPvd		*PtPvd;
+
+	if (lHeader == NULL || lPvd == -1 ||
+	    (pt = (t_SnapshotAttribute *) Reserve(Length)) == NULL) {
+		return;
+	}
+	memset(pt, 0, Length);
+	pt->KeyLength = kl;
+	pt->ValueLength = vl;
+	memcpy(pt->Data, Key, kl);
+	memcpy(pt->Data + kl, Value, vl);
+
+	// The staging buffer may have moved
+	PtPvd = (t_SnapshotPvd *) (lStaging + lPvd);
+	PtPvd->Length += Length;
+	PtPvd->nAttributes++;
+}
+
+// Grow : enlarge the shared region. Readers mapping less than Size remap it
+static	int	Grow(unsigned int Needed)
+{
+	unsigned int		Size;
+	t_SnapshotHeader	*H;
+
+	for (Size = lSize; Size < Needed; Size *= 2) {
+		;
+	}
+	if (ftruncate(lFd, Size) == -1) {
+		DLOG("snapshot : ftruncate(%u) : %s\n", Size, strerror(errno));
+		return(-1);
+	}
+	if ((H = mremap(lHeader, lSize, Size, MREMAP_MAYMOVE)) == MAP_FAILED) {
+		DLOG("snapshot : mremap(%u) : %s\n", Size, strerror(errno));
+		return(-1);
+	}
+	lHeader = H;
+	lSize = Size;
+
+	return(0);
+}
+
+// SnapshotPublish : replace the content of the shared region by the
+// snapshot built since SnapshotBegin(). On error, the previous snapshot
+// stays in place
+int	SnapshotPublish(void)
+{
+	unsigned int	Sequence;
+
+	if (lHeader == NULL || lError) {
+		return(-1);
+	}
+	if (sizeof(t_SnapshotHeader) + lLength > lSize &&
+	    Grow(sizeof(t_SnapshotHeader) + lLength) == -1) {
+		return(-1);
+	}
+
+	Sequence = lHeader->Sequence;
+
+	__atomic_store_n(&lHeader->Sequence, Sequence + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	memcpy(lHeader + 1, lStaging, lLength);
+	lHeader->Length = lLength;
+	lHeader->nPvd = lNPvd;
+	lHeader->Size = lSize;
+	__atomic_store_n(&lHeader->Generation, lHeader->Generation + 1, __ATOMIC_RELAXED);
+
+	__atomic_store_n(&lHeader->Sequence, Sequence + 2, __ATOMIC_RELEASE);
+
+	WakeReaders(lHeader);
+
+	lPublished++;
+	lPublishedBytes += lLength;
+
+	return(0);
+}
+
+// SnapshotStatistics : dump the snapshot counters
+void	SnapshotStatistics(FILE *fo)
+{
+	if (lHeader == NULL) {
+		fprintf(fo, "snapshot : none\n");
+		return;
+	}
+	fprintf(fo,
+		"snapshot : %ld updates (%ld bytes copied, %ld readers woken up), %u pvd, "
+		"%u bytes (region size %u)\n",
+		lPublished,
+		lPublishedBytes,
+		lWakeups,
+		lHeader->nPvd,
+		lHeader->Length,
+		lSize);
+}
+
+/* ex: set ts=8 noexpandtab wrap: */
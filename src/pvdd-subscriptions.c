@@ -0,0 +1,211 @@
+/*
+	Copyright 2017 Cisco
+
+	Licensed under the Apache License, Version 2.0 (the "License");
+	you may not use this file except in compliance with the License.
+	You may obtain a copy of the License at
+
+		http://www.apache.org/licenses/LICENSE-2.0
+
+	Unless required by applicable law or agreed to in writing, software
+	distributed under the License is distributed on an "AS IS" BASIS,
+	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+	See the License for the specific language governing permissions and
+	limitations under the License.
+*/
+/*
+ * pvdd-subscriptions.c : reverse index of the subscriptions, from a pvd
+ * name to the set of subscribed clients. Notifying the changes of a pvd
+ * only costs the number of its subscribers, whatever the number of clients
+ * and of subscriptions per client
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pvd-utils.h"
+#include "pvdd-subscriptions.h"
+
+#define	SUBINDEX_MINSIZE	64	// power of 2
+#define	SUBSCRIBERS_MINSIZE	4
+
+// Open addressing (linear probing) index of the subscribers sets
+static	int		lIndexSize = 0;
+static	int		lNEntries = 0;
+static	t_Subscribers	**lIndex = NULL;
+
+// IndexSlot : return the slot of a given name in the index, or the empty
+// slot where it would be inserted
+static	int	IndexSlot(char *pvdname, unsigned int h)
+{
+	int		i;
+	int		Mask = lIndexSize - 1;
+	t_Subscribers	*pt;
+
+	for (i = h & Mask; (pt = lIndex[i]) != NULL; i = (i + 1) & Mask) {
+		if (pt->hash == h && EQSTR(pt->pvdname, pvdname)) {
+			break;
+		}
+	}
+	return(i);
+}
+
+// IndexGrow : double the size of the index and reinsert all entries
+static	int	IndexGrow(void)
+{
+	int		i, j;
+	int		OldSize = lIndexSize;
+	t_Subscribers	**OldIndex = lIndex;
+	int		NewSize = OldSize == 0 ? SUBINDEX_MINSIZE : OldSize * 2;
+
+	if ((lIndex = calloc(NewSize, sizeof(t_Subscribers *))) == NULL) {
+		DLOG("memory overflow allocating subscriptions index\n");
+		lIndex = OldIndex;
+		return(-1);
+	}
+	lIndexSize = NewSize;
+
+	for (i = 0; i < OldSize; i++) {
+		if (OldIndex[i] != NULL) {
+			for (j = OldIndex[i]->hash & (NewSize - 1);
+			     lIndex[j] != NULL;
+			     j = (j + 1) & (NewSize - 1)) {
+				;
+			}
+			lIndex[j] = OldIndex[i];
+		}
+	}
+	if (OldIndex != NULL) {
+		free(OldIndex);
+	}
+	return(0);
+}
+
+// IndexRemove : remove an (empty) entry from the index. Following entries
+// of the cluster are shifted back
+static	void	IndexRemove(int i)
+{
+	int	j, k;
+	int	Mask = lIndexSize - 1;
+
+	free(lIndex[i]->Clients);
+	free(lIndex[i]->pvdname);
+	free(lIndex[i]);
+	lIndex[i] = NULL;
+
+	for (j = (i + 1) & Mask; lIndex[j] != NULL; j = (j + 1) & Mask) {
+		k = lIndex[j]->hash & Mask;
+		if (i <= j ? (i < k && k <= j) : (i < k || k <= j)) {
+			continue;
+		}
+		lIndex[i] = lIndex[j];
+		lIndex[j] = NULL;
+		i = j;
+	}
+	lNEntries--;
+}
+
+// SubscribersLookup : return the set of clients having subscribed to a
+// given pvd name, NULL if none
+t_Subscribers	*SubscribersLookup(char *pvdname)
+{
+	if (lIndexSize == 0) {
+		return(NULL);
+	}
+	return(lIndex[IndexSlot(pvdname, HashString(pvdname))]);
+}
+
+// SubscribersAdd : add a client to the subscribers of a pvd name. The
+// caller must make sure that the client is not already in the set
+int	SubscribersAdd(char *pvdname, int ix)
+{
+	int		i;
+	unsigned int	h = HashString(pvdname);
+	t_Subscribers	*pt;
+
+	if ((lNEntries + 1) * 2 > lIndexSize && IndexGrow() == -1) {
+		return(-1);
+	}
+
+	if ((pt = lIndex[i = IndexSlot(pvdname, h)]) == NULL) {
+		if ((pt = malloc(sizeof(t_Subscribers))) == NULL) {
+			DLOG("memory overflow allocating subscribers of %s\n", pvdname);
+			return(-1);
+		}
+		if ((pt->pvdname = strdup(pvdname)) == NULL) {
+			DLOG("memory overflow allocating subscribers of %s\n", pvdname);
+			free(pt);
+			return(-1);
+		}
+		pt->hash = h;
+		pt->nClients = 0;
+		pt->MaxClients = 0;
+		pt->Clients = NULL;
+		lIndex[i] = pt;
+		lNEntries++;
+	}
+
+	if (pt->nClients == pt->MaxClients) {
+		int	MaxClients = pt->MaxClients == 0 ?
+					SUBSCRIBERS_MINSIZE : pt->MaxClients * 2;
+		int	*Clients;
+
+		if ((Clients = realloc(pt->Clients, MaxClients * sizeof(int))) == NULL) {
+			DLOG("memory overflow allocating subscribers of %s\n", pvdname);
+			if (pt->nClients == 0) {
+				IndexRemove(i);
+			}
+			return(-1);
+		}
+		pt->Clients = Clients;
+		pt->MaxClients = MaxClients;
+	}
+	pt->Clients[pt->nClients++] = ix;
+
+	return(0);
+}
+
+// SubscribersRemove : remove a client from the subscribers of a pvd name
+// The entry is released with its last subscriber
+void	SubscribersRemove(char *pvdname, int ix)
+{
+	int		i, j;
+	t_Subscribers	*pt;
+
+	if (lIndexSize == 0 ||
+	    (pt = lIndex[i = IndexSlot(pvdname, HashString(pvdname))]) == NULL) {
+		return;
+	}
+
+	for (j = 0; j < pt->nClients; j++) {
+		if (pt->Clients[j] == ix) {
+			pt->Clients[j] = pt->Clients[--pt->nClients];
+			break;
+		}
+	}
+
+	if (pt->nClients == 0) {
+		IndexRemove(i);
+	}
+}
+
+// SubscribersStatistics : dump the size of the subscriptions index
+void	SubscribersStatistics(FILE *fo)
+{
+	int	i;
+	long	n = 0;
+
+	for (i = 0; i < lIndexSize; i++) {
+		if (lIndex[i] != NULL) {
+			n += lIndex[i]->nClients;
+		}
+	}
+	fprintf(fo,
+		"subscriptions : %ld subscriptions to %d pvd names (index size %d)\n",
+		n,
+		lNEntries,
+		lIndexSize);
+}
+
+/* ex: set ts=8 noexpandtab wrap: */
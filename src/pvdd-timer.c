@@ -0,0 +1,286 @@
+/*
+	Copyright 2017 Cisco
+
+	Licensed under the Apache License, Version 2.0 (the "License");
+	you may not use this file except in compliance with the License.
+	You may obtain a copy of the License at
+
+		http://www.apache.org/licenses/LICENSE-2.0
+
+	Unless required by applicable law or agreed to in writing, software
+	distributed under the License is distributed on an "AS IS" BASIS,
+	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+	See the License for the specific language governing permissions and
+	limitations under the License.
+*/
+/*
+ * pvdd-timer.c : hierarchical timer wheel, used to expire the data learnt
+ * from the RAs, whose lifetimes are given in seconds
+ *
+ * TIMER_LEVELS wheels of TIMER_SLOTS slots each : the first one has a one
+ * second resolution, each next one a TIMER_SLOTS times coarser one. A
+ * timer is put in the slot of the finest wheel covering its delay, and
+ * moved (cascaded) to a finer wheel when the slot it is in is reached
+ *
+ * Arming, cancelling and expiring a timer are O(1) : the slots are
+ * circular lists, and the wheels only move forward. A timer is cascaded at
+ * most TIMER_LEVELS - 1 times (more only if its delay is beyond the range
+ * of the last wheel)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "pvd-utils.h"
+#include "pvdd-timer.h"
+
+#define	TIMER_BITS	6
+#define	TIMER_SLOTS	(1 << TIMER_BITS)
+#define	TIMER_MASK	(TIMER_SLOTS - 1)
+#define	TIMER_LEVELS	4
+#define	TIMER_RANGE	(1UL << (TIMER_LEVELS * TIMER_BITS))	// ticks
+
+#define	TIMER_TICK	1000	// ms
+
+// Slots of the wheels (heads of circular lists)
+static	t_Timer		lWheels[TIMER_LEVELS][TIMER_SLOTS];
+static	int		lInitialized = false;
+
+static	long		lOrigin = 0;	// time of tick 0 (ms)
+static	unsigned long	lNow = 0;	// current tick
+static	int		lNTimers = 0;	// armed
+
+// Counters
+static	long		lArmed = 0;
+static	long		lExpired = 0;
+static	long		lCascaded = 0;
+
+// GetTimeMs : monotonic time, in milliseconds
+static	long	GetTimeMs(void)
+{
+	struct timespec	ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return(ts.tv_sec * 1000L + ts.tv_nsec / 1000000L);
+}
+
+// GetTick : current tick, according to the clock (the wheels may lag
+// behind, until the next TimerRun())
+static	unsigned long	GetTick(void)
+{
+	return((GetTimeMs() - lOrigin) / TIMER_TICK);
+}
+
+static	void	InitWheels(void)
+{
+	int	i, j;
+
+	for (i = 0; i < TIMER_LEVELS; i++) {
+		for (j = 0; j < TIMER_SLOTS; j++) {
+			lWheels[i][j].next = lWheels[i][j].prev = &lWheels[i][j];
+		}
+	}
+	lOrigin = GetTimeMs();
+	lNow = 0;
+	lInitialized = true;
+}
+
+static	void	Unlink(t_Timer *T)
+{
+	T->prev->next = T->next;
+	T->next->prev = T->prev;
+	T->next = T->prev = NULL;
+}
+
+static	void	Append(t_Timer *Head, t_Timer *T)
+{
+	T->next = Head;
+	T->prev = Head->prev;
+	Head->prev->next = T;
+	Head->prev = T;
+}
+
+// Place : put a timer in the slot of the finest wheel covering its delay.
+// Delays beyond the range of the last wheel are put in its farthest slot
+static	void	Place(t_Timer *T)
+{
+	int		Level;
+	unsigned long	Expires = T->expires;
+	unsigned long	Delta = Expires - lNow;
+
+	if (Expires < lNow) {	// already elapsed
+		Expires = lNow;
+		Delta = 0;
+	}
+	if (Delta >= TIMER_RANGE) {
+		Expires = lNow + TIMER_RANGE - 1;
+		Delta = TIMER_RANGE - 1;
+	}
+	for (Level = 0; Delta >= (1UL << ((Level + 1) * TIMER_BITS)); Level++) {
+		;
+	}
+	Append(&lWheels[Level][(Expires >> (Level * TIMER_BITS)) & TIMER_MASK], T);
+}
+
+// Cascade : move the timers of a slot to the finer wheels. Returns the
+// index of the slot
+static	int	Cascade(int Level)
+{
+	int	Index = (lNow >> (Level * TIMER_BITS)) & TIMER_MASK;
+	t_Timer	*Head = &lWheels[Level][Index];
+	t_Timer	*T;
+
+	while ((T = Head->next) != Head) {
+		Unlink(T);
+		Place(T);
+		lCascaded++;
+	}
+	return(Index);
+}
+
+// Tick : move the wheels one tick forward, expiring the timers of the
+// reached slot. The timers are unlinked one by one, as handlers may cancel
+// other timers of the same slot
+static	void	Tick(void)
+{
+	int	Level;
+	t_Timer	*Head;
+	t_Timer	*T;
+
+	lNow++;
+
+	if ((lNow & TIMER_MASK) == 0) {
+		for (Level = 1; Level < TIMER_LEVELS && Cascade(Level) == 0; Level++) {
+			;
+		}
+	}
+
+	Head = &lWheels[0][lNow & TIMER_MASK];
+	while ((T = Head->next) != Head) {
+		Unlink(T);
+		lNTimers--;
+		lExpired++;
+		T->Handler(T);
+	}
+}
+
+void	TimerInit(t_Timer *T, void (*Handler)(t_Timer *T), void *Data, int Arg)
+{
+	T->next = T->prev = NULL;
+	T->expires = 0;
+	T->Handler = Handler;
+	T->Data = Data;
+	T->Arg = Arg;
+}
+
+// TimerArm : (re)arm a timer, Delay being in seconds (TIMER_INFINITE
+// cancels it)
+void	TimerArm(t_Timer *T, unsigned long Delay)
+{
+	if (! lInitialized) {
+		InitWheels();
+	}
+	TimerCancel(T);
+
+	if (Delay == TIMER_INFINITE) {
+		return;
+	}
+
+	// A tick is elapsed when the wheels reach the next one
+	T->expires = GetTick() + Delay + 1;
+	Place(T);
+	lNTimers++;
+	lArmed++;
+}
+
+void	TimerCancel(t_Timer *T)
+{
+	if (T->next != NULL) {
+		Unlink(T);
+		lNTimers--;
+	}
+}
+
+int	TimerArmed(t_Timer *T)
+{
+	return(T->next != NULL);
+}
+
+// TimerRemaining : delay (in seconds) before a timer expires, as given to
+// TimerArm(). TIMER_INFINITE if it is not armed
+unsigned long	TimerRemaining(t_Timer *T)
+{
+	unsigned long	Now;
+
+	if (T->next == NULL) {
+		return(TIMER_INFINITE);
+	}
+	Now = GetTick();
+
+	return(T->expires > Now + 1 ? T->expires - Now - 1 : 0);
+}
+
+// TimerRun : bring the wheels up to date
+void	TimerRun(void)
+{
+	unsigned long	Now;
+
+	if (lNTimers == 0) {
+		// Nothing to expire : the wheels can jump forward. Only
+		// the timers armed from now on are concerned
+		if (lInitialized) {
+			lNow = GetTick();
+		}
+		return;
+	}
+
+	for (Now = GetTick(); lNow < Now && lNTimers > 0; ) {
+		Tick();
+	}
+	if (lNTimers == 0) {
+		lNow = Now;
+	}
+}
+
+// TimerTimeout : delay (ms) until the next tick having timers to expire, or
+// until the next cascade (whatever comes first). The finest wheel only is
+// looked at : this is bounded by its number of slots
+int	TimerTimeout(void)
+{
+	int		i;
+	unsigned long	Next;
+	long		Delay;
+
+	if (lNTimers == 0) {
+		return(-1);
+	}
+
+	for (i = 1; i <= TIMER_SLOTS; i++) {
+		Next = lNow + i;
+		if ((Next & TIMER_MASK) == 0 ||
+		    lWheels[0][Next & TIMER_MASK].next != &lWheels[0][Next & TIMER_MASK]) {
+			break;
+		}
+	}
+
+	if ((Delay = lOrigin + (long) Next * TIMER_TICK - GetTimeMs()) < 0) {
+		return(0);
+	}
+	return((int) Delay);
+}
+
+// TimerStatistics : dump the timers counters
+void	TimerStatistics(FILE *fo)
+{
+	fprintf(fo,
+		"timers : %d armed, %ld armings, %ld expired, %ld cascaded\n",
+		lNTimers,
+		lArmed,
+		lExpired,
+		lCascaded);
+}
+
+/* ex: set ts=8 noexpandtab wrap: */
@@ -0,0 +1,337 @@
+/*
+	Copyright 2017 Cisco
+
+	Licensed under the Apache License, Version 2.0 (the "License");
+	you may not use this file except in compliance with the License.
+	You may obtain a copy of the License at
+
+		http://www.apache.org/licenses/LICENSE-2.0
+
+	Unless required by applicable law or agreed to in writing, software
+	distributed under the License is distributed on an "AS IS" BASIS,
+	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+	See the License for the specific language governing permissions and
+	limitations under the License.
+*/
+/*
+ * pvdd-upgrade.c : warm restart. A new instance of the daemon takes over
+ * the listening sockets, the clients connections and the state of the
+ * running one, so that the clients do not notice the restart
+ *
+ * The running daemon listens on a SOCK_SEQPACKET local socket. The new
+ * instance connects to it, and receives :
+ * - the file descriptors, by batches of UPGRADE_MAXFDS (SCM_RIGHTS)
+ * - the serialized state (opaque here), by chunks of UPGRADE_CHUNK bytes
+ * - an end message, carrying the number of file descriptors
+ * It acknowledges the transfer once it is ready to serve. Until then, the
+ * running daemon does nothing else, and goes on serving if the transfer
+ * fails (the new instance then exits)
+ *
+ * Each datagram is a binary protocol (v2) message, with private opcodes
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/uio.h>
+
+#include "pvd-utils.h"
+#include "pvd-binary.h"
+#include "pvdd-upgrade.h"
+#include "libpvd.h"
+
+#define	UPGRADE_OP_FDS		0x40	// Id : number of file descriptors attached
+#define	UPGRADE_OP_STATE	0x41	// payload : chunk of the state
+#define	UPGRADE_OP_END		0x42	// Id : total number of file descriptors
+#define	UPGRADE_OP_DONE		0x43	// from the new instance
+
+#define	UPGRADE_MAXFDS		128	// per datagram (SCM_MAX_FD is 253)
+#define	UPGRADE_CHUNK		(32 * 1024)
+
+// SetTimeout : the transfer is made of blocking calls, but none of them
+// must block forever
+static	int	SetTimeout(int s)
+{
+	struct timeval	tv;
+
+	tv.tv_sec = UPGRADE_TIMEOUT;
+	tv.tv_usec = 0;
+
+	if (setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) == -1 ||
+	    setsockopt(s, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv)) == -1) {
+		return(-1);
+	}
+	return(0);
+}
+
+// SendMessage : send a datagram, nFds file descriptors being attached to it
+static	int	SendMessage(
+			int s,
+			int Opcode,
+			unsigned int Id,
+			char *Payload,
+			int Length,
+			int *Fds,
+			int nFds)
+{
+	char		Header[PVD_BIN_HEADER_SIZE];
+	struct iovec	iov[2];
+	struct msghdr	msg;
+	struct cmsghdr	*cmsg;
+	union {
+		char		buf[CMSG_SPACE(UPGRADE_MAXFDS * sizeof(int))];
+		struct cmsghdr	align;
+	}	u;
+	int		n;
+
+	BinPutHeader(Header, Opcode, 0, Id, Length);
+
+	iov[0].iov_base = Header;
+	iov[0].iov_len = sizeof(Header);
+	iov[1].iov_base = Payload;
+	iov[1].iov_len = Length;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = iov;
+	msg.msg_iovlen = Length > 0 ? 2 : 1;
+
+	if (nFds > 0) {
+		memset(&u, 0, sizeof(u));
+		msg.msg_control = u.buf;
+		msg.msg_controllen = CMSG_SPACE(nFds * sizeof(int));
+
+		cmsg = CMSG_FIRSTHDR(&msg);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN(nFds * sizeof(int));
+		memcpy(CMSG_DATA(cmsg), Fds, nFds * sizeof(int));
+	}
+
+	while ((n = sendmsg(s, &msg, MSG_NOSIGNAL)) == -1 && errno == EINTR) {
+		;
+	}
+	if (n != sizeof(Header) + Length) {
+		DLOG("upgrade : sendmsg : %s\n", n == -1 ? strerror(errno) : "short write");
+		return(-1);
+	}
+	return(0);
+}
+
+// ReceiveMessage : receive a datagram (at most UPGRADE_CHUNK bytes of
+// payload) in Buffer. The file descriptors attached to it, if any, are
+// returned in Fds (*nFds of them)
+static	int	ReceiveMessage(int s, t_BinaryHeader *H, char *Buffer, int *Fds, int *nFds)
+{
+	struct iovec	iov;
+	struct msghdr	msg;
+	struct cmsghdr	*cmsg;
+	union {
+		char		buf[CMSG_SPACE(UPGRADE_MAXFDS * sizeof(int))];
+		struct cmsghdr	align;
+	}	u;
+	int		n;
+
+	*nFds = 0;
+
+	iov.iov_base = Buffer;
+	iov.iov_len = PVD_BIN_HEADER_SIZE + UPGRADE_CHUNK;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = u.buf;
+	msg.msg_controllen = sizeof(u.buf);
+
+	while ((n = recvmsg(s, &msg, MSG_CMSG_CLOEXEC)) == -1 && errno == EINTR) {
+		;
+	}
+	if (n <= 0) {
+		DLOG("upgrade : recvmsg : %s\n", n == -1 ? strerror(errno) : "connection closed");
+		return(-1);
+	}
+
+	for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+		if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+			*nFds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+			memcpy(Fds, CMSG_DATA(cmsg), *nFds * sizeof(int));
+		}
+	}
+
+	if ((msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC)) != 0 || n < PVD_BIN_HEADER_SIZE) {
+		DLOG("upgrade : invalid message (%d bytes)\n", n);
+		goto Invalid;
+	}
+	BinGetHeader(Buffer, H);
+	if (H->Version != PVD_BIN_VERSION || H->Length != n - PVD_BIN_HEADER_SIZE) {
+		DLOG("upgrade : invalid message (version %d)\n", H->Version);
+		goto Invalid;
+	}
+	return(0);
+
+Invalid :
+	while (*nFds > 0) {
+		close(Fds[--(*nFds)]);
+	}
+	return(-1);
+}
+
+// UpgradeConnect : connect to the running daemon. Returns -1 if there is
+// none (or if it can not be reached)
+int	UpgradeConnect(char *Name)
+{
+	int			s;
+	int			salen;
+	struct sockaddr_un	sa;
+
+	if ((salen = UnixSocketAddress(Name, &sa)) == -1) {
+		errno = ENAMETOOLONG;
+		return(-1);
+	}
+
+	if ((s = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0)) == -1) {
+		return(-1);
+	}
+	if (SetTimeout(s) == -1 || connect(s, (struct sockaddr *) &sa, salen) == -1) {
+		close(s);
+		return(-1);
+	}
+	return(s);
+}
+
+// UpgradeSend : hand over file descriptors and the state (running daemon)
+int	UpgradeSend(int s, int *Fds, int nFds, char *State, int Length)
+{
+	int	i;
+	int	n;
+
+	if (SetTimeout(s) == -1) {
+		return(-1);
+	}
+
+	for (i = 0; i < nFds; i += n) {
+		n = nFds - i < UPGRADE_MAXFDS ? nFds - i : UPGRADE_MAXFDS;
+		if (SendMessage(s, UPGRADE_OP_FDS, n, NULL, 0, Fds + i, n) == -1) {
+			return(-1);
+		}
+	}
+
+	for (i = 0; i < Length; i += n) {
+		n = Length - i < UPGRADE_CHUNK ? Length - i : UPGRADE_CHUNK;
+		if (SendMessage(s, UPGRADE_OP_STATE, 0, State + i, n, NULL, 0) == -1) {
+			return(-1);
+		}
+	}
+
+	return(SendMessage(s, UPGRADE_OP_END, nFds, NULL, 0, NULL, 0));
+}
+
+// UpgradeWaitDone : wait for the new instance to acknowledge the transfer
+// (running daemon). Returns -1 if it has failed : the running daemon must
+// then go on serving
+int	UpgradeWaitDone(int s)
+{
+	t_BinaryHeader	H;
+	char		Buffer[PVD_BIN_HEADER_SIZE + UPGRADE_CHUNK];
+	int		Fds[UPGRADE_MAXFDS];
+	int		nFds;
+
+	if (ReceiveMessage(s, &H, Buffer, Fds, &nFds) == -1) {
+		return(-1);
+	}
+	while (nFds > 0) {
+		close(Fds[--nFds]);
+	}
+	return(H.Opcode == UPGRADE_OP_DONE ? 0 : -1);
+}
+
+// UpgradeReceive : receive the file descriptors and the state (new
+// instance). Both are malloced. Returns -1 on error, nothing being
+// returned (the received file descriptors are closed)
+int	UpgradeReceive(int s, int **PtFds, int *PtNFds, char **PtState, int *PtLength)
+{
+	static	char	lBuffer[PVD_BIN_HEADER_SIZE + UPGRADE_CHUNK];
+
+	t_BinaryHeader	H;
+	int		Received[UPGRADE_MAXFDS];
+	int		nReceived;
+	int		*Fds = NULL;
+	int		nFds = 0;
+	char		*State = NULL;
+	int		Length = 0;
+	void		*pt;
+
+	while (true) {
+		if (ReceiveMessage(s, &H, lBuffer, Received, &nReceived) == -1) {
+			goto Error;
+		}
+
+		if (nReceived > 0) {
+			if ((pt = realloc(Fds, (nFds + nReceived) * sizeof(int))) == NULL) {
+				DLOG("upgrade : memory overflow\n");
+				while (nReceived > 0) {
+					close(Received[--nReceived]);
+				}
+				goto Error;
+			}
+			Fds = pt;
+			memcpy(Fds + nFds, Received, nReceived * sizeof(int));
+			nFds += nReceived;
+		}
+
+		if (H.Opcode == UPGRADE_OP_STATE) {
+			if ((pt = realloc(State, Length + H.Length)) == NULL) {
+				DLOG("upgrade : memory overflow\n");
+				goto Error;
+			}
+			State = pt;
+			memcpy(State + Length, lBuffer + PVD_BIN_HEADER_SIZE, H.Length);
+			Length += H.Length;
+		} else
+		if (H.Opcode == UPGRADE_OP_END) {
+			break;
+		} else
+		if (H.Opcode != UPGRADE_OP_FDS) {
+			DLOG("upgrade : unexpected message (opcode %d)\n", H.Opcode);
+			goto Error;
+		}
+	}
+
+	if (H.Id != nFds) {
+		DLOG("upgrade : %d file descriptors received (%u expected)\n", nFds, H.Id);
+		goto Error;
+	}
+
+	*PtFds = Fds;
+	*PtNFds = nFds;
+	*PtState = State;
+	*PtLength = Length;
+
+	return(0);
+
+Error :
+	while (nFds > 0) {
+		close(Fds[--nFds]);
+	}
+	if (Fds != NULL) {
+		free(Fds);
+	}
+	if (State != NULL) {
+		free(State);
+	}
+	return(-1);
+}
+
+// UpgradeDone : acknowledge the transfer (new instance). The running daemon
+// exits as soon as it gets it
+int	UpgradeDone(int s)
+{
+	return(SendMessage(s, UPGRADE_OP_DONE, 0, NULL, 0, NULL, 0));
+}
+
+/* ex: set ts=8 noexpandtab wrap: */
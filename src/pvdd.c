@@ -30,7 +30,8 @@
  * this information in its central repository
  *
  * In addition, a persistent state of the repository can be flushed in the file
- * system
+ * system : the changes made by the control clients are journaled in the -d
+ * directory, and restored when the daemon starts
  *
  * The daemon creates one listening socket.
  * Clients connecting wishing to update some daemon's content need to promote their
@@ -39,11 +40,22 @@
  * GENERAL (initial state, before promotion)
  * CONTROL
  *
- * We may want to restrict, via credentials, access to the control socket
+ * Local clients can also connect via an AF_UNIX socket (cheaper than the TCP
+ * loopback). On this socket, the promotion to the control type is granted
+ * according to the credentials of the peer (root, or the daemon's user)
+ * A SOCK_SEQPACKET companion socket carries the binary protocol (v2), each
+ * request, reply or notification being a single datagram (no framing)
  *
  * The daemon will also collect information from the kernel via the netlink raw
  * interface
+ *
+ * A new instance of the daemon, started with --upgrade, takes over the
+ * listening sockets, the clients connections and the state of the running
+ * one (warm restart, see pvdd-upgrade.c) : the clients keep their
+ * connections, their subscriptions and their pending messages
  */
+#define _GNU_SOURCE	// to have struct ucred defined
+
 #include <stdio.h>
 #include <unistd.h>
 #include <stdlib.h>
@@ -54,8 +66,16 @@
 #include <malloc.h>
 #include <libgen.h>	// basename()
 #include <netdb.h>
+#include <fcntl.h>
+#include <time.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/uio.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <net/if.h>
 
 #include "config.h"
@@ -71,6 +91,15 @@
 #include "pvd-utils.h"
 #include "pvdd-netlink.h"
 #include "pvdd-rtnetlink.h"
+#include "pvdd-attributes.h"
+#include "pvdd-input.h"
+#include "pvd-binary.h"
+#include "pvdd-output.h"
+#include "pvdd-subscriptions.h"
+#include "pvdd-snapshot.h"
+#include "pvdd-journal.h"
+#include "pvdd-upgrade.h"
+#include "pvdd-timer.h"
 
 #include "libpvd.h"
 
@@ -79,21 +108,76 @@
 #define	NEW(t)	((t *) malloc(sizeof(t)))
 
 // Clients sockets types. General sockets can be promoted to control sockets
+// Binary v2 sockets speak the binary protocol (requests included)
 #define	SOCKET_GENERAL		1
 #define	SOCKET_BINARY		2
 #define	SOCKET_CONTROL		3
+#define	SOCKET_BINARY_V2	4
 
 // Max numbers of items. TODO : replace these hard coded limits by dynamic
 // implementation (but, doing this, make sure we avoid DOS)
+// The attributes table of a pvd grows on demand, up to MAXATTRIBUTES
 #define	MAXCLIENTS	1024
 #define	MAXATTRIBUTES	128
 
+// Longest attribute name accepted (terminating \0 included)
+#define	ATTRNAMSIZ	1024
+
+// Size of the pvd hash index (open addressing, linear probing). It must be
+// a power of 2, and is twice MAXPVD to keep the load factor below 1/2
+#define	PVDHASHSIZE	(MAXPVD * 2)
+
+// Max number of events retrieved by one epoll_wait() call
+#define	MAXEVENTS	64
+
+// Max number of payload parts for SendMultiLines()
+#define	MAXFRAGMENTS	8
+
+// Multi-lines messages delimiters (non binary connections)
+#define	BEGIN_MULTILINE	"PVD_BEGIN_MULTILINE\n"
+#define	END_MULTILINE	"PVD_END_MULTILINE\n"
+
 // Clients can request to be notified on some changes. No notifications by
 // default
 #define	SUBSCRIPTION_LIST	0x01
 #define	SUBSCRIPTION_NEW_PVD	0x02
 #define	SUBSCRIPTION_DEL_PVD	0x04
 
+// Listening sockets, handed over to a new instance of the daemon
+#define	LISTENER_TCP		0
+#define	LISTENER_UNIX		1
+#define	LISTENER_SEQPACKET	2
+#define	LISTENER_UPGRADE	3
+#define	NLISTENERS		4
+
+// Records of the state handed over to a new instance of the daemon (binary
+// protocol messages, with private opcodes and TLVs). Integers are in host
+// order, and file descriptors are given by their index in the transfer
+#define	UPGRADE_REC_LISTENER	0x01	// Id : file descriptor, Status : LISTENER_xxx
+#define	UPGRADE_REC_PVD		0x02	// Id : pvdid
+#define	UPGRADE_REC_CLIENT	0x03	// Id : slot, Status : socket type
+
+#define	UPGRADE_TLV_GENERATION		16
+#define	UPGRADE_TLV_KERNEL_RDNSS	17
+#define	UPGRADE_TLV_USER_RDNSS		18
+#define	UPGRADE_TLV_KERNEL_DNSSL	19
+#define	UPGRADE_TLV_USER_DNSSL		20
+#define	UPGRADE_TLV_SOCKET		21
+#define	UPGRADE_TLV_EVENTFD		22
+#define	UPGRADE_TLV_MASK		23
+#define	UPGRADE_TLV_FLAGS		24	// UPGRADE_xxx
+#define	UPGRADE_TLV_UID			25
+#define	UPGRADE_TLV_TRANSACTION		26
+#define	UPGRADE_TLV_MULTILINES		27	// partial multi-lines message
+#define	UPGRADE_TLV_INPUT		28	// partial line (or binary message)
+#define	UPGRADE_TLV_OUTPUT_KEY		29	// key of the next output message
+#define	UPGRADE_TLV_OUTPUT		30	// pending output message
+#define	UPGRADE_TLV_RA_STATE		31	// values learnt from the RAs
+
+#define	UPGRADE_DIFFMODE	0x01
+#define	UPGRADE_LOCAL		0x02
+#define	UPGRADE_SEQPACKET	0x04
+
 /* types definitions --------------------------------------------- */
 typedef	struct t_PvdNameList
 {
@@ -110,18 +194,47 @@ typedef	struct t_PvdClient
 	char		*pvdIdTransaction;	// NULL is no transaction
 	int		multiLines;
 	t_StringBuffer	SB;
+	t_InputBuffer	Input;		// partial line received
+	t_OutputQueue	Output;		// messages waiting for EPOLLOUT
+	int		diffMode;	// PVD_ATTRIBUTES_DIFF notifications
+	unsigned int	notifyStamp;	// last notification sent to the client
+	int		local;		// connected via the AF_UNIX socket
+	uid_t		uid;		// of the peer (local clients only)
+	int		seqpacket;	// one binary message per datagram
+	int		eventFd;	// signaled on snapshot updates (-1 if none)
 }	t_PvdClient;
 
-typedef	struct {
-	char	*Key;	// strduped
-	char	*Value;	// strduped
-}	t_PvdAttribute;
-
 typedef	struct t_Pvd {
 	char	*pvdname;	// strduped
+	unsigned int	hash;	// HashString(pvdname)
 	int	pvdid;
 	int	dirty;
-	t_PvdAttribute Attributes[MAXATTRIBUTES];
+	t_AttributeTable Attributes;
+
+	/*
+	 * Cached PVD_ATTRIBUTES message, rebuilt on demand after any change
+	 * of the attributes (NULL if invalid) : the payload length (binary
+	 * connections header), followed by the payload itself (PVD_ATTRIBUTES
+	 * line and JSON object, '\0' terminated)
+	 */
+	char	*AttributesFrame;
+	int	AttributesFrameLen;	// including the length header
+
+	// Same, for the binary protocol (v2) : payload of the PVD_OP_ATTRIBUTES
+	// message (the header carries the request id, it is not cached)
+	char	*BinaryAttributes;
+	int	BinaryAttributesLen;
+
+	/*
+	 * Delta notifications : generation is the number of the last
+	 * attributes notification. Attributes changed since then have a
+	 * greater generation, and the removed ones are listed in
+	 * RemovedKeys (interned keys)
+	 */
+	unsigned int	generation;
+	int	nRemovedKeys;
+	int	MaxRemovedKeys;
+	char	**RemovedKeys;
 
 	/*
 	 * Special case for the RDNSS/DNSSL options :
@@ -141,22 +254,105 @@ typedef	struct t_Pvd {
 	int	nUserDnssl;
 	char	*UserDnssl[MAXDNSSLPERPVD];
 
+	// Registration order list (newest first), used for iterations
 	struct t_Pvd	*next;
+	struct t_Pvd	*prev;
+
+	// List of pvd whose attributes notification is delayed
+	int		notifyPending;
+	struct t_Pvd	*nextPending;
+
+	// Generation of the shared memory snapshot carrying its last change
+	// (snapshotChanged : changed since the last snapshot)
+	unsigned int	snapshotGeneration;
+	int		snapshotChanged;
+
+	/*
+	 * Stamp of the last change of the attributes, whatever their origin
+	 * (stamps are never reused, even by another pvd), and values decoded
+	 * from the last RA of this pvd (opaque, owned by the RA parser,
+	 * released with the pvd)
+	 */
+	unsigned int	changes;
+	void		*raState;
 }	t_Pvd;
 
 /* variables declarations ---------------------------------------- */
 static	int		lNClients = 0;
 static	t_PvdClient	lTabClients[MAXCLIENTS];
 
+static	int	lNPvd = 0;
 static	t_Pvd	*lFirstPvd = NULL;
+static	t_Pvd	*lPvdHash[PVDHASHSIZE];
+
+// Stamp of the last change of the attributes of any pvd
+static	unsigned int	lPvdChanges = 0;
 
 static	char	*lMyName = "";
 
 static	int	lKernelHasPvdSupport = false;
 
+// Set by the SIGUSR1 handler : statistics are dumped by the main loop
+static	volatile sig_atomic_t	lFlagDumpStatistics = false;
+
+// Incremented for each attributes notification
+static	unsigned int	lNotifyStamp = 0;
+
+// Commands counters
+static	long	lCommandsParsed = 0;
+static	long	lCommandsInvalid = 0;
+static	long	lBinaryRequests = 0;
+
+// Cached PVD_ATTRIBUTES messages counters
+static	long	lFrameCacheHits = 0;
+static	long	lFrameCacheRebuilds = 0;
+
+// Attributes notifications coalescing window (--notify-delay-ms option). If
+// not 0, the notifications are delayed, so that a burst of updates of a pvd
+// results in one notification. The pending ones are sent at lNotifyDeadline
+static	int	lNotifyDelay = 0;
+static	long	lNotifyDeadline;
+static	t_Pvd	*lFirstPendingPvd = NULL;
+static	t_Pvd	*lLastPendingPvd = NULL;
+static	long	lNotifyRequests = 0;
+static	long	lNotifySent = 0;
+
+// The main loop is an edge triggered epoll reactor. Each client slot is
+// registered with its t_PvdClient address as epoll data pointer. The
+// other sockets are registered with the address of these tags
+static	int	lEpollFd = -1;
+static	int	lServerTag;
+static	int	lUnixServerTag;
+static	int	lSeqpacketServerTag;
+static	int	lUpgradeServerTag;
+static	int	lIcmpv6Tag;
+static	int	lRtnlTag;
+
+// Can TCP clients promote their connection to the control type (they can
+// not be authenticated, hence not by default) ?
+static	int	lTcpControl = false;
+
+// Is the database published in shared memory ? It is published again at
+// most once per main loop iteration, when something has changed (and the
+// attributes notifications are not being delayed)
+static	int	lSnapshot = false;
+static	int	lSnapshotDirty = false;
+
+// Clients having requested an eventfd signaled on its updates
+static	int	lEventFdClients[MAXCLIENTS];
+static	int	lNEventFds = 0;
+
 /* functions definitions ----------------------------------------- */
 static	int	NotifyPvdAttributes(t_Pvd *PtPvd);
+static	int	NotifyPvdAttributesNow(t_Pvd *PtPvd);
+static	void	FlushPendingNotifications(void);
+static	void	InvalidateAttributesFrame(t_Pvd *PtPvd);
+static	void	ClearRemovedKeys(t_Pvd *PtPvd);
+static	void	RemoveEventFdClient(int ix);
 static	int	RemoveSubscription(int ix, char *pvdname);
+static	int	SendBinary(int ix, int Opcode, int Status, unsigned int Id, char *Payload, int Length, char *Key);
+static	int	SendBinaryPvdName(int ix, int Opcode, int Status, unsigned int Id, char *pvdname);
+static	int	ParseArgs(char *pt, int nArgs, char **Args, int Rest);
 
 static	int	usage(char *s)
 {
@@ -174,10 +370,39 @@ static	int	usage(char *s)
 		"\t-p|--port <#> : port number for clients requests (default %d)\n",
 		DEFAULT_PVDD_PORT);
 	fprintf(fo,
-		"\t-d|--dir <path> : directory in which information is stored (none by default)\n");
+		"\t-u|--unix-socket <name>|none : local socket for clients requests\n"
+		"\t\t(default " DEFAULT_PVDD_UNIX_SOCKET ", @ standing for the abstract\n"
+		"\t\tnamespace)\n",
+		DEFAULT_PVDD_PORT);
+	fprintf(fo,
+		"\t--snapshot <name>|none : shared memory object in which the pvd\n"
+		"\t\tdatabase is published (default " DEFAULT_PVDD_SNAPSHOT ")\n",
+		DEFAULT_PVDD_PORT);
+	fprintf(fo,
+		"\t--tcp-control : TCP clients can update the pvd attributes as well\n"
+		"\t\t(by default, only local clients running as root or as the\n"
+		"\t\tdaemon's user can)\n");
+	fprintf(fo,
+		"\t-d|--dir <path> : directory in which the changes made by the control\n"
+		"\t\tclients are saved, and restored from at startup (none by default)\n");
+	fprintf(fo,
+		"\t--upgrade : take over the sockets, clients and state of the daemon\n"
+		"\t\trunning with the same local socket (warm restart). It exits once\n"
+		"\t\tthe transfer is complete. Starts afresh if there is none\n");
+	fprintf(fo,
+		"\t-q|--queue-size <#> : max bytes queued for a slow client (default %d)\n",
+		OQ_DEFAULT_HIGHWATERMARK);
+	fprintf(fo,
+		"\t--queue-policy drop|coalesce|disconnect : what to do when a client\n"
+		"\t\tqueue is full (default coalesce)\n");
+	fprintf(fo,
+		"\t--notify-delay-ms <#> : attributes notifications coalescing window\n"
+		"\t\t(default 0, ie no delay)\n");
 	fprintf(fo,
 		"\n"
 		"Clients using the companion library can set the PVDD_PORT environment\n");
+	fprintf(fo,
+		"variable (and PVDD_SOCKET for the local socket, none to disable it)\n");
 	fprintf(fo,
 		"\nBy default, pvdd attempts to guess if the kernel is pvd aware. If this\n");
 	fprintf(fo,
@@ -188,10 +413,64 @@ static	int	usage(char *s)
 		"will make pvdd  fall back in a degraded mode where it parses itself\n");
 	fprintf(fo,
 		"RAs\n");
+	fprintf(fo,
+		"\nSending SIGUSR1 to pvdd dumps internal statistics on stderr\n");
 
 	return(s == NULL ? 0 : 1);
 }
 
+// HandleSigUsr1 : request a dump of the statistics
+static	void	HandleSigUsr1(int sig)
+{
+	lFlagDumpStatistics = true;
+}
+
+// DumpStatistics : dump some internal counters on stderr
+static	void	DumpStatistics(void)
+{
+	int	i, n;
+
+	for (i = n = 0; i < lNClients; i++) {
+		if (lTabClients[i].s != -1) {
+			n++;
+		}
+	}
+	fprintf(stderr, "%s statistics :\n", lMyName);
+	fprintf(stderr, "pvd : %d registered (max %d)\n", lNPvd, MAXPVD);
+	fprintf(stderr, "clients : %d connected (max %d)\n", n, MAXCLIENTS);
+	KeyStatistics(stderr);
+	OQStatistics(stderr);
+	SubscribersStatistics(stderr);
+	fprintf(stderr,
+		"attributes messages cache : %ld hits, %ld rebuilds\n",
+		lFrameCacheHits,
+		lFrameCacheRebuilds);
+	fprintf(stderr,
+		"attributes notifications : %ld requested, %ld sent (delay %d ms)\n",
+		lNotifyRequests,
+		lNotifySent,
+		lNotifyDelay);
+	fprintf(stderr,
+		"commands : %ld parsed, %ld invalid, %ld binary requests\n",
+		lCommandsParsed,
+		lCommandsInvalid,
+		lBinaryRequests);
+	NetlinkStatistics(stderr);
+	TimerStatistics(stderr);
+	SnapshotStatistics(stderr);
+	JournalStatistics(stderr);
+}
+
+// GetTimeMs : monotonic time, in milliseconds
+static	long	GetTimeMs(void)
+{
+	struct timespec	ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return(ts.tv_sec * 1000L + ts.tv_nsec / 1000000L);
+}
+
 /*
  * PvdRdnssToJsonArray : aggregate the kernel and user RDNSS fields
  * and buid a JSON string for this array of in6_addr values
@@ -371,37 +650,214 @@ static	int	CreateServerSocket(int Port)
 		close(s);
 		return(-1);
 	}
+
+	// The listening socket is drained by HandleConnection() until EAGAIN
+	fcntl(s, F_SETFL, fcntl(s, F_GETFL) | O_NONBLOCK);
+
+	return(s);
+}
+
+// CreateUnixServerSocket : create a local socket (SOCK_STREAM or
+// SOCK_SEQPACKET) for use by the clients. A stale file system entry (from
+// a previous run) is removed
+static	int	CreateUnixServerSocket(char *Name, int Type)
+{
+	int			s;
+	int			salen;
+	struct sockaddr_un	sa;
+
+	if ((salen = UnixSocketAddress(Name, &sa)) == -1) {
+		errno = ENAMETOOLONG;
+		return(-1);
+	}
+
+	if ((s = socket(AF_UNIX, Type, 0)) == -1) {
+		return(-1);
+	}
+
+	if (Name[0] != '@') {
+		unlink(Name);
+	}
+
+	if (bind(s, (struct sockaddr *) &sa, salen) < 0) {
+		close(s);
+		return(-1);
+	}
+
+	if (listen(s, 10) == -1) {
+		close(s);
+		return(-1);
+	}
+
+	fcntl(s, F_SETFL, fcntl(s, F_GETFL) | O_NONBLOCK);
+
 	return(s);
 }
 
+// WatchFd : register a file descriptor in the epoll set. Notifications are
+// edge triggered : the handlers must drain the file descriptor until EAGAIN
+// Clients sockets are also watched for EPOLLOUT : being edge triggered, it
+// is only reported when the socket becomes writable again, which is when
+// the pending output, if any, can be flushed
+static	int	WatchFd(int fd, void *data, uint32_t events)
+{
+	struct epoll_event ev;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = events | EPOLLRDHUP | EPOLLET;
+	ev.data.ptr = data;
+
+	if (epoll_ctl(lEpollFd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+		DLOG("epoll_ctl(ADD, %d) : %s\n", fd, strerror(errno));
+		return(-1);
+	}
+	return(0);
+}
+
+// InitClient : initialize a client slot for a new connection
+static	void	InitClient(t_PvdClient *PtClient, int s)
+{
+	PtClient->s = s;
+	PtClient->type = SOCKET_GENERAL;
+	PtClient->Subscription = NULL;
+	PtClient->SubscriptionMask = 0;
+	PtClient->pvdIdTransaction = NULL;
+	PtClient->multiLines = 0;
+	PtClient->diffMode = false;
+	PtClient->notifyStamp = 0;
+	PtClient->local = false;
+	PtClient->uid = -1;
+	PtClient->seqpacket = false;
+	PtClient->eventFd = -1;
+	SBInit(&PtClient->SB);
+	IBInit(&PtClient->Input);
+	OQInit(&PtClient->Output);
+}
+
 // HandleConnection : a client is connecting. Accept the connection and register
-// the new socket
-static	void	HandleConnection(int serverSock)
+// the new socket. Free slots (s == -1) in the clients table are reused, so
+// that the t_PvdClient addresses registered in the epoll set remain valid
+// Returns -1 when there is no more pending connection
+static	int	HandleConnection(int serverSock)
 {
 	int s;
-	struct sockaddr_in sa;
+	int i;
+	struct sockaddr_storage sa;
+	struct ucred cred;
+	int sotype;
 
 	socklen_t salen = sizeof(sa);
 
 	if ((s = accept(serverSock, (struct sockaddr *) &sa, &salen)) == -1) {
-		return;
+		if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+			DLOG("accept : %s\n", strerror(errno));
+		}
+		return(errno == EINTR ? 0 : -1);
 	}
 
-	if (lNClients < DIM(lTabClients)) {
-		t_PvdClient	*PtClient = &lTabClients[lNClients++];
+	for (i = 0; i < lNClients && lTabClients[i].s != -1; i++) {
+		;
+	}
+
+	if (i < DIM(lTabClients)) {
+		t_PvdClient	*PtClient = &lTabClients[i];
+
+		InitClient(PtClient, s);
+
+		// Credentials of local clients
+		if (sa.ss_family == AF_UNIX) {
+			salen = sizeof(cred);
+			PtClient->local = true;
+			if (getsockopt(s, SOL_SOCKET, SO_PEERCRED, &cred, &salen) == 0) {
+				PtClient->uid = cred.uid;
+			}
+			// SOCK_SEQPACKET clients speak the binary protocol
+			// from the start
+			salen = sizeof(sotype);
+			if (getsockopt(s, SOL_SOCKET, SO_TYPE, &sotype, &salen) == 0 &&
+			    sotype == SOCK_SEQPACKET) {
+				PtClient->type = SOCKET_BINARY_V2;
+				PtClient->seqpacket = true;
+			}
+		}
+
+		// Never block on a slow client
+		fcntl(s, F_SETFL, fcntl(s, F_GETFL) | O_NONBLOCK);
 
-		PtClient->s = s;
-		PtClient->type = SOCKET_GENERAL;
-		PtClient->Subscription = NULL;
-		PtClient->SubscriptionMask = 0;
-		PtClient->pvdIdTransaction = NULL;
-		PtClient->multiLines = 0;
-		SBInit(&PtClient->SB);
+		if (WatchFd(s, PtClient, EPOLLIN | EPOLLOUT) == -1) {
+			close(s);
+			PtClient->s = -1;
+			return(0);
+		}
+		if (i == lNClients) {
+			lNClients++;
+		}
 		DLOG("client connection accepted on socket %d\n", s);
 	}
 	else {
 		close(s);	// this will trigger an error on the client's side
 	}
+	return(0);
+}
+
+// LookupPvd : retrieve a pvd in the hash index. The probe sequence stops
+// on the first empty slot
+static	t_Pvd	*LookupPvd(char *pvdname)
+{
+	unsigned int	h = HashString(pvdname);
+	unsigned int	i = h & (PVDHASHSIZE - 1);
+	t_Pvd		*PtPvd;
+
+	while ((PtPvd = lPvdHash[i]) != NULL) {
+		if (PtPvd->hash == h && EQSTR(PtPvd->pvdname, pvdname)) {
+			return(PtPvd);
+		}
+		i = (i + 1) & (PVDHASHSIZE - 1);
+	}
+	return(NULL);
+}
+
+// HashInsertPvd : add a pvd in the hash index. The index is sized so that
+// it can never be full (the number of pvd is limited to MAXPVD)
+static	void	HashInsertPvd(t_Pvd *PtPvd)
+{
+	unsigned int	i = PtPvd->hash & (PVDHASHSIZE - 1);
+
+	while (lPvdHash[i] != NULL) {
+		i = (i + 1) & (PVDHASHSIZE - 1);
+	}
+	lPvdHash[i] = PtPvd;
+}
+
+// HashRemovePvd : remove a pvd from the hash index. Entries following the
+// removed one in the same cluster are shifted back, so that no tombstone
+// is needed
+static	void	HashRemovePvd(t_Pvd *PtPvd)
+{
+	unsigned int	i = PtPvd->hash & (PVDHASHSIZE - 1);
+	unsigned int	j, k;
+
+	while (lPvdHash[i] != PtPvd) {
+		if (lPvdHash[i] == NULL) {
+			return;
+		}
+		i = (i + 1) & (PVDHASHSIZE - 1);
+	}
+	lPvdHash[i] = NULL;
+
+	for (j = (i + 1) & (PVDHASHSIZE - 1);
+	     lPvdHash[j] != NULL;
+	     j = (j + 1) & (PVDHASHSIZE - 1)) {
+		// k is the home slot of the entry. It can be moved in the
+		// hole only if k is not cyclically in ]i, j]
+		k = lPvdHash[j]->hash & (PVDHASHSIZE - 1);
+		if (i <= j ? (i < k && k <= j) : (i < k || k <= j)) {
+			continue;
+		}
+		lPvdHash[i] = lPvdHash[j];
+		lPvdHash[j] = NULL;
+		i = j;
+	}
 }
 
 // GetPvd : given a pvdname, return the address of the pvd structure
@@ -413,15 +869,11 @@ static	t_Pvd	*GetPvd(char *pvdname)
 		return(NULL);
 	}
 
-	for (PtPvd = lFirstPvd; PtPvd != NULL; PtPvd = PtPvd->next) {
-		if (EQSTR(PtPvd->pvdname, pvdname)) {
-			return(PtPvd);
-		}
+	if ((PtPvd = LookupPvd(pvdname)) == NULL) {
+		DLOG("unknown pvd (%s)\n", pvdname);
 	}
 
-	DLOG("unknown pvd (%s)\n", pvdname);
-
-	return(NULL);
+	return(PtPvd);
 }
 
 // RemoveSubscription : remove a given pvdname from the list of subscribed pvd
@@ -437,6 +889,7 @@ static	int	RemoveSubscription(int ix, char *pvdname)
 		ptNext = pt->next;
 
 		if (EQSTR(pt->pvdname, pvdname)) {
+			SubscribersRemove(pvdname, ix);
 			free(pt->pvdname);
 			free(pt);
 			if (ptPrev == NULL) {
@@ -462,6 +915,7 @@ static	void	ReleaseSubscriptionsList(int ix)
 
 	while (pt != NULL) {
 		ptNext = pt->next;
+		SubscribersRemove(pt->pvdname, ix);
 		free(pt->pvdname);
 		free(pt);
 		pt = ptNext;
@@ -484,10 +938,25 @@ static	void	ReleaseClient(int ix)
 		pt->pvdIdTransaction = NULL;
 	}
 	ReleaseSubscriptionsList(ix);
+	SBUninit(&pt->SB);
+	IBUninit(&pt->Input);
+	OQUninit(&pt->Output);
+	if (pt->eventFd != -1) {
+		close(pt->eventFd);
+		pt->eventFd = -1;
+		RemoveEventFdClient(ix);
+	}
 	if (pt->s != -1) {
+		epoll_ctl(lEpollFd, EPOLL_CTL_DEL, pt->s, NULL);
 		close(pt->s);
 	}
 	pt->s = -1;
+
+	// Trailing free slots can be given back (the other ones will be
+	// reused by the next connections)
+	while (lNClients > 0 && lTabClients[lNClients - 1].s == -1) {
+		lNClients--;
+	}
 }
 
 // AddSubscription : a client has requested to be notified for changes on a
@@ -514,42 +983,97 @@ static	int	AddSubscription(int ix, char *pvdname)
 		DLOG("AddSubscription : memory overflow\n");
 		return(-1);
 	}
+	if (SubscribersAdd(pvdname, ix) == -1) {
+		free(pt->pvdname);
+		free(pt);
+		return(-1);
+	}
 	pt->next = lTabClients[ix].Subscription;
 	lTabClients[ix].Subscription = pt;
 
 	return(0);
 }
 
-// WriteString : send a string over a socket (any file descriptor in fact).
-// Return true if the whole string could be written, false otherwise
-static	int	WriteString(int s, char *str, int binary)
+// SendToClient : send a whole message, made of iovcnt fragments, to a
+// client (with a single writev()). What can not be written at once is
+// queued (see pvdd-output.c). Key identifies notifications that a more
+// recent one can supersede (NULL if none)
+// Returns -1 if the client must be released
+static	int	SendToClient(int ix, struct iovec *iov, int iovcnt, char *Key)
+{
+	t_PvdClient	*pt = &lTabClients[ix];
+
+	return(OQSendv(&pt->Output, pt->s, iov, iovcnt, Key));
+}
+
+// SetIovec : helper to fill an iovec
+static	inline	void	SetIovec(struct iovec *iov, void *Data, int Length)
+{
+	iov->iov_base = Data;
+	iov->iov_len = Length;
+}
+
+// FlushClient : the socket of a client has become writable again
+static	void	FlushClient(int ix)
+{
+	t_PvdClient	*pt = &lTabClients[ix];
+
+	if (OQFlush(&pt->Output, pt->s) == -1) {
+		DLOG("client for socket %d : write error\n", pt->s);
+		ReleaseClient(ix);
+	}
+}
+
+// WriteString : send a string to a client (preceded by its length in case
+// of a binary connection)
+// Return true if the whole string could be sent (or queued), false otherwise
+static	int	WriteString(int ix, char *str)
 {
-	int	l = strlen(str);
-	if (binary) {
-		return(write(s, &l, sizeof(l)) == sizeof(l) &&
-		       write(s, str, l) == l);
+	int		l = strlen(str);
+	struct iovec	iov[2];
+
+	if (lTabClients[ix].type != SOCKET_BINARY) {
+		SetIovec(&iov[0], str, l);
+		return(SendToClient(ix, iov, 1, NULL) == 0);
+	}
+
+	SetIovec(&iov[0], &l, sizeof(l));
+	SetIovec(&iov[1], str, l);
+
+	return(SendToClient(ix, iov, 2, NULL) == 0);
+}
+
+// BinaryPvdList : encode the current list of pvd (binary protocol payload)
+static	int	BinaryPvdList(t_BinaryBuffer *BB)
+{
+	t_Pvd	*PtPvd;
+
+	for (PtPvd = lFirstPvd; PtPvd != NULL; PtPvd = PtPvd->next) {
+		BBAddTlvString(BB, PVD_TLV_PVDNAME, PtPvd->pvdname);
 	}
-	return(write(s, str, l) == l);
+	return(BB->Error ? -1 : 0);
 }
 
 // SendPvdList : send the current list of pvd to a client that
 // has requested it
-static	int	SendPvdList(int s, int binary)
+static	int	SendPvdList(int ix)
 {
-	char	msg[2048];
-	t_Pvd	*PtPvd;
+	t_StringBuffer	SB;
+	t_Pvd		*PtPvd;
+	int		rc = 0;
 
-	// FIXME : check for overflow
-	sprintf(msg, "PVD_LIST");
+	// The list can be up to MAXPVD names long
+	SBInit(&SB);
+	SBAddString(&SB, "PVD_LIST");
 	for (PtPvd = lFirstPvd; PtPvd != NULL; PtPvd = PtPvd->next) {
-		strcat(msg, " ");
-		strcat(msg, PtPvd->pvdname);
+		SBAddString(&SB, " %s", PtPvd->pvdname);
 	}
-	strcat(msg, "\n");
-	if (! WriteString(s, msg, binary)) {
-		return(-1);
+	SBAddString(&SB, "\n");
+	if (SB.String == NULL || ! WriteString(ix, SB.String)) {
+		rc = -1;
 	}
-	return(0);
+	SBUninit(&SB);
+	return(rc);
 }
 
 // NotifyPvdState : send a notification message for this pvd (NEW/DEL) to
@@ -558,8 +1082,13 @@ static	void	NotifyPvdState(char *pvdname, int Mask)
 {
 	int		i;
 	char		msg[2048];
+	int		Opcode = Mask == SUBSCRIPTION_NEW_PVD ? PVD_OP_NEW_PVD : PVD_OP_DEL_PVD;
 	t_PvdClient	*pt;
 
+	// Delayed attributes notifications are sent first, to preserve the
+	// order of the events
+	FlushPendingNotifications();
+
 	msg[sizeof(msg) - 1] = '\0';
 
 	snprintf(msg, sizeof(msg) - 1,
@@ -573,7 +1102,9 @@ static	void	NotifyPvdState(char *pvdname, int Mask)
 		}
 		if ((pt->SubscriptionMask & Mask) != 0) {
 			DLOG("NotifyPvdState : sending on socket %d msg %s", pt->s, msg);
-			if (! WriteString(pt->s, msg, pt->type == SOCKET_BINARY)) {
+			if (pt->type == SOCKET_BINARY_V2 ?
+			    SendBinaryPvdName(i, Opcode, PVD_STATUS_OK, 0, pvdname) == -1 :
+			    ! WriteString(i, msg)) {
 				ReleaseClient(i);
 			}
 		}
@@ -585,21 +1116,28 @@ static	void	NotifyPvdState(char *pvdname, int Mask)
 static	void	NotifyPvdList(void)
 {
 	t_Pvd		*PtPvd;
-	char		msg[2048];
+	t_StringBuffer	SB;
+	t_BinaryBuffer	BB;
+	char		*msg;
 	t_PvdClient	*pt;
 	int		i;
+	int		rc;
 
-	msg[sizeof(msg) - 1] = '\0';
+	FlushPendingNotifications();
+
+	// The binary version is only built if needed
+	BBInit(&BB);
 
-	// FIXME : check for overflow
-	sprintf(msg, "PVD_LIST ");	// Important : there must always be a ' '
+	SBInit(&SB);
+	SBAddString(&SB, "PVD_LIST ");	// Important : there must always be a ' '
 	for (PtPvd = lFirstPvd; PtPvd != NULL; PtPvd = PtPvd->next) {
-		strcat(msg, PtPvd->pvdname);
-		if (PtPvd->next != NULL) {
-			strcat(msg, " ");
-		}
+		SBAddString(&SB, "%s%s", PtPvd->pvdname, PtPvd->next != NULL ? " " : "");
+	}
+	SBAddString(&SB, "\n");
+
+	if ((msg = SB.String) == NULL) {
+		return;
 	}
-	strcat(msg, "\n");
 
 	for (i = 0, pt = lTabClients; i < lNClients; i++, pt++) {
 		if (pt->s == -1 || pt->type == SOCKET_CONTROL) {
@@ -607,26 +1145,105 @@ static	void	NotifyPvdList(void)
 		}
 		if ((pt->SubscriptionMask & SUBSCRIPTION_LIST) != 0) {
 			DLOG("NotifyPvdList : sending on socket %d msg %s", pt->s, msg);
-			if (! WriteString(pt->s, msg, pt->type == SOCKET_BINARY)) {
+			if (pt->type != SOCKET_BINARY_V2) {
+				rc = WriteString(i, msg) ? 0 : -1;
+			} else
+			if (BB.Length > 0 || BinaryPvdList(&BB) == 0) {
+				rc = SendBinary(i, PVD_OP_LIST, PVD_STATUS_OK, 0,
+						BB.Data, BB.Length, NULL);
+			}
+			else {
+				continue;
+			}
+			if (rc == -1) {
 				ReleaseClient(i);
 			}
 		}
 	}
+	SBUninit(&SB);
+	BBUninit(&BB);
 }
 
-/*
- * GetPvdByName : given a pvd name, retrieve its t_Pvd
- */
-static	t_Pvd *GetPvdByName(char *pvdname)
+// AddEventFdClient : a client has been given an eventfd
+static	void	AddEventFdClient(int ix)
 {
-	t_Pvd	*PtPvd;
+	lEventFdClients[lNEventFds++] = ix;
+}
+
+// RemoveEventFdClient : the eventfd of a client has been closed
+static	void	RemoveEventFdClient(int ix)
+{
+	int	i;
+
+	for (i = 0; i < lNEventFds; i++) {
+		if (lEventFdClients[i] == ix) {
+			lEventFdClients[i] = lEventFdClients[--lNEventFds];
+			return;
+		}
+	}
+}
+
+// InvalidateSnapshot : a pvd has changed (NULL if a pvd has been removed)
+// The snapshot will be published again by PublishSnapshot()
+static	void	InvalidateSnapshot(t_Pvd *Changed)
+{
+	if (Changed != NULL) {
+		Changed->snapshotChanged = true;
+	}
+	lSnapshotDirty = true;
+}
+
+// PublishSnapshot : publish the whole database in shared memory, if it
+// has changed since the last time. Called from the main loop, so that a
+// batch of changes (or the changes of a notifications coalescing window)
+// results in one copy, and one wake up of the readers
+static	void	PublishSnapshot(void)
+{
+	int		i;
+	unsigned int	Generation;
+	t_Pvd		*PtPvd;
+	t_PvdAttribute	*Attributes;
+
+	if (! lSnapshot || ! lSnapshotDirty) {
+		return;
+	}
+	lSnapshotDirty = false;
+
+	Generation = SnapshotBegin();
 
 	for (PtPvd = lFirstPvd; PtPvd != NULL; PtPvd = PtPvd->next) {
-		if (EQSTR(PtPvd->pvdname, pvdname)) {
-			return(PtPvd);
+		// Pvd changed, or never published so far
+		if (PtPvd->snapshotChanged || PtPvd->snapshotGeneration == 0) {
+			PtPvd->snapshotGeneration = Generation;
+			PtPvd->snapshotChanged = false;
+		}
+		SnapshotAddPvd(PtPvd->pvdname, PtPvd->snapshotGeneration);
+
+		Attributes = PtPvd->Attributes.Entries;
+		for (i = 0; i < PtPvd->Attributes.nEntries; i++) {
+			if (Attributes[i].Key != NULL) {
+				SnapshotAddAttribute(Attributes[i].Key, Attributes[i].Value);
+			}
 		}
 	}
-	return(NULL);
+
+	if (SnapshotPublish() == -1) {
+		DLOG("snapshot of the database could not be published\n");
+		return;
+	}
+
+	// Readers waiting via epoll/poll rather than on the futex word
+	for (i = 0; i < lNEventFds; i++) {
+		eventfd_write(lTabClients[lEventFdClients[i]].eventFd, 1);
+	}
+}
+
+/*
+ * GetPvdByName : given a pvd name, retrieve its t_Pvd
+ */
+static	t_Pvd *GetPvdByName(char *pvdname)
+{
+	return(LookupPvd(pvdname));
 }
 
 // RegisterPvd : register a new pvdid. It should normally come from
@@ -639,14 +1256,17 @@ static	t_Pvd	*RegisterPvd(int pvdid, char *pvdname)
 	t_Pvd	*PtPvd;
 	char	*tmpStr;
 
-	for (PtPvd = lFirstPvd; PtPvd != NULL; PtPvd = PtPvd->next) {
-		if (EQSTR(PtPvd->pvdname, pvdname)) {
-			if (pvdid != -1) {
-				PtPvd->pvdid = pvdid;
-			}
-			PtPvd->dirty = true;
-			return(PtPvd);
+	if ((PtPvd = LookupPvd(pvdname)) != NULL) {
+		if (pvdid != -1) {
+			PtPvd->pvdid = pvdid;
 		}
+		PtPvd->dirty = true;
+		return(PtPvd);
+	}
+
+	if (lNPvd >= MAXPVD) {
+		DLOG("too many pvd registered (max %d) : %s ignored\n", MAXPVD, pvdname);
+		return(NULL);
 	}
 
 	if ((PtPvd = NEW(t_Pvd)) == NULL) {
@@ -662,9 +1282,18 @@ static	t_Pvd	*RegisterPvd(int pvdid, char *pvdname)
 	}
 
 	PtPvd->pvdid = pvdid == -1 ? 0 : pvdid;
-	PtPvd->pvdname = strdup(pvdname);	// TODO : check overflow
+	if ((PtPvd->pvdname = strdup(pvdname)) == NULL) {
+		free(PtPvd);
+		DLOG("allocating pvdid : memory overflow\n");
+		return(NULL);
+	}
+	PtPvd->hash = HashString(pvdname);
 	PtPvd->dirty = false;
-	memset(PtPvd->Attributes, 0, sizeof(PtPvd->Attributes));
+	ATInit(&PtPvd->Attributes);
+	PtPvd->AttributesFrame = NULL;
+	PtPvd->AttributesFrameLen = 0;
+	PtPvd->BinaryAttributes = NULL;
+	PtPvd->BinaryAttributesLen = 0;
 
 	/*
 	 * Create the set of well known attributes (representing the
@@ -679,12 +1308,20 @@ static	t_Pvd	*RegisterPvd(int pvdid, char *pvdname)
 	PvdSetAttr(PtPvd, "lFlag", "0");
 	PvdSetAttr(PtPvd, "aFlag", "0");   // introduced in draft-01
 
-	// Link it at the head of the list
+	// Link it at the head of the list and index it
+	PtPvd->prev = NULL;
 	PtPvd->next = lFirstPvd;
+	if (lFirstPvd != NULL) {
+		lFirstPvd->prev = PtPvd;
+	}
 	lFirstPvd = PtPvd;
+	HashInsertPvd(PtPvd);
+	lNPvd++;
 
 	DLOG("pvdid %s/%d registered\n", pvdname, pvdid);
 
+	InvalidateSnapshot(PtPvd);
+
 	NotifyPvdState(pvdname, SUBSCRIPTION_NEW_PVD);
 	NotifyPvdList();
 
@@ -697,41 +1334,130 @@ static	t_Pvd	*RegisterPvd(int pvdid, char *pvdname)
 int	UnregisterPvd(char *pvdname)
 {
 	int	i;
-	t_Pvd	*PtPvd, *PtPvdPrev = NULL;
+	t_Pvd	*PtPvd;
 
-	for (PtPvd = lFirstPvd; PtPvd != NULL; PtPvd = PtPvd->next) {
-		if (EQSTR(PtPvd->pvdname, pvdname)) {
-			// Unlink the pvd and frees all of its fields
-			if (PtPvdPrev == NULL) {
-				lFirstPvd = PtPvd->next;
-			}
-			else {
-				PtPvdPrev->next = PtPvd->next;
-			}
-			for (i = 0; i < DIM(PtPvd->Attributes); i++) {
-				if (PtPvd->Attributes[i].Key != NULL) {
-					free(PtPvd->Attributes[i].Key);
-				}
-				if (PtPvd->Attributes[i].Value != NULL) {
-					free(PtPvd->Attributes[i].Value);
-				}
-			}
-			free(PtPvd->pvdname);
-			free(PtPvd);
-			NotifyPvdState(pvdname, SUBSCRIPTION_DEL_PVD);
-			NotifyPvdList();
-			return(0);
-		}
-		PtPvdPrev = PtPvd;
+	if ((PtPvd = LookupPvd(pvdname)) == NULL) {
+		return(0);
 	}
-	return(0);
-}
 
-// DeleteAttribute : delete a given attribute for a given pvd
-static	int	DeleteAttribute(t_Pvd *PtPvd, char *Key)
-{
-	int	i;
+	// A delayed notification for this pvd must not survive it (nor be
+	// sent after its deletion notification)
+	FlushPendingNotifications();
 
+	// Unlink the pvd and frees all of its fields
+	HashRemovePvd(PtPvd);
+	if (PtPvd->prev == NULL) {
+		lFirstPvd = PtPvd->next;
+	}
+	else {
+		PtPvd->prev->next = PtPvd->next;
+	}
+	if (PtPvd->next != NULL) {
+		PtPvd->next->prev = PtPvd->prev;
+	}
+	lNPvd--;
+
+	ATUninit(&PtPvd->Attributes);
+	InvalidateAttributesFrame(PtPvd);
+	ClearRemovedKeys(PtPvd);
+	if (PtPvd->RemovedKeys != NULL) {
+		free(PtPvd->RemovedKeys);
+	}
+	for (i = 0; i < PtPvd->nKernelDnssl; i++) {
+		free(PtPvd->KernelDnssl[i]);
+	}
+	for (i = 0; i < PtPvd->nUserDnssl; i++) {
+		free(PtPvd->UserDnssl[i]);
+	}
+	if (PtPvd->raState != NULL) {
+		ReleaseRaState(PtPvd->raState);
+	}
+	free(PtPvd->pvdname);
+	free(PtPvd);
+
+	InvalidateSnapshot(NULL);
+
+	NotifyPvdState(pvdname, SUBSCRIPTION_DEL_PVD);
+	NotifyPvdList();
+	return(0);
+}
+
+// ClearRemovedKeys : forget the keys removed since the last notification
+static	void	ClearRemovedKeys(t_Pvd *PtPvd)
+{
+	int	i;
+
+	for (i = 0; i < PtPvd->nRemovedKeys; i++) {
+		KeyRelease(PtPvd->RemovedKeys[i]);
+	}
+	PtPvd->nRemovedKeys = 0;
+}
+
+// FindRemovedKey : index of a key in the list of removed keys, -1 if absent
+static	int	FindRemovedKey(t_Pvd *PtPvd, char *Key)
+{
+	int	i;
+
+	for (i = 0; i < PtPvd->nRemovedKeys; i++) {
+		if (EQSTR(PtPvd->RemovedKeys[i], Key)) {
+			return(i);
+		}
+	}
+	return(-1);
+}
+
+// AttributeChanged : an attribute has been created or modified. It will be
+// part of the next notification
+static	void	AttributeChanged(t_Pvd *PtPvd, t_PvdAttribute *Attr)
+{
+	int	i;
+
+	Attr->generation = PtPvd->generation + 1;
+	PtPvd->changes = ++lPvdChanges;
+
+	// Removed, then set again
+	if ((i = FindRemovedKey(PtPvd, Attr->Key)) != -1) {
+		KeyRelease(PtPvd->RemovedKeys[i]);
+		PtPvd->RemovedKeys[i] = PtPvd->RemovedKeys[--PtPvd->nRemovedKeys];
+	}
+
+	PtPvd->dirty = true;
+	InvalidateAttributesFrame(PtPvd);
+}
+
+// AttributeRemoved : an attribute has been removed. Its key is kept (and
+// referenced) until the next notification
+static	void	AttributeRemoved(t_Pvd *PtPvd, char *Key)
+{
+	char	**RemovedKeys;
+	int	MaxRemovedKeys;
+
+	PtPvd->changes = ++lPvdChanges;
+	InvalidateAttributesFrame(PtPvd);
+
+	if (FindRemovedKey(PtPvd, Key) != -1) {
+		return;
+	}
+	if (PtPvd->nRemovedKeys == PtPvd->MaxRemovedKeys) {
+		MaxRemovedKeys = PtPvd->MaxRemovedKeys == 0 ? 4 : PtPvd->MaxRemovedKeys * 2;
+
+		if ((RemovedKeys = realloc(
+					PtPvd->RemovedKeys,
+					MaxRemovedKeys * sizeof(char *))) == NULL) {
+			DLOG("memory overflow allocating removed keys for %s\n", PtPvd->pvdname);
+			return;
+		}
+		PtPvd->RemovedKeys = RemovedKeys;
+		PtPvd->MaxRemovedKeys = MaxRemovedKeys;
+	}
+	if ((Key = KeyIntern(Key)) != NULL) {
+		PtPvd->RemovedKeys[PtPvd->nRemovedKeys++] = Key;
+	}
+}
+
+// DeleteAttribute : delete a given attribute for a given pvd
+static	int	DeleteAttribute(t_Pvd *PtPvd, char *Key)
+{
 	if (PtPvd == NULL) {
 		DLOG("DeleteAttribute : unknown pvd\n");
 		return(0);
@@ -739,20 +1465,9 @@ static	int	DeleteAttribute(t_Pvd *PtPvd, char *Key)
 
 	DLOG("DeleteAttribute : pvdname = %s, Key = %s\n", PtPvd->pvdname, Key);
 
-	for (i = 0; i < MAXATTRIBUTES; i++) {
-		char	*attrKey = PtPvd->Attributes[i].Key;
-		char	*attrVal = PtPvd->Attributes[i].Value;
-
-		if (attrKey != NULL && EQSTR(attrKey, Key)) {
-			if (attrVal != NULL) {
-				free(attrVal);
-				PtPvd->Attributes[i].Value = NULL;
-			}
-			free(attrKey);
-			PtPvd->Attributes[i].Key = NULL;
-			NotifyPvdAttributes(PtPvd);
-			break;
-		}
+	if (ATRemove(&PtPvd->Attributes, Key) == 0) {
+		AttributeRemoved(PtPvd, Key);
+		NotifyPvdAttributes(PtPvd);
 	}
 
 	return(0);
@@ -767,10 +1482,9 @@ static	char	*lUnsettableAttributes[] = {
 
 static	int	UpdateAttribute(t_Pvd *PtPvd, char *Key, char *Value)
 {
-	int	i;
-	char	*key_;
-	char	*value_;
-	int	firstAvailable = -1;
+	int		i;
+	char		*value_;
+	t_PvdAttribute	*Attr;
 
 	if (PtPvd == NULL) {
 		DLOG("UpdateAttribute : unknown pvd\n");
@@ -787,52 +1501,38 @@ static	int	UpdateAttribute(t_Pvd *PtPvd, char *Key, char *Value)
 		}
 	}
 
-	for (i = 0; i < MAXATTRIBUTES; i++) {
-		char	*attrKey = PtPvd->Attributes[i].Key;
-		char	*attrVal = PtPvd->Attributes[i].Value;
-
-		if (attrKey == NULL && firstAvailable == -1) {
-			firstAvailable = i;
+	if ((Attr = ATLookup(&PtPvd->Attributes, Key)) != NULL) {
+		if (EQSTR(Attr->Value, Value)) {
+			// Same key/value pair => no change
+			return(0);
 		}
 
-		if (attrKey != NULL && EQSTR(attrKey, Key)) {
-			if (attrVal != NULL && EQSTR(attrVal, Value)) {
-				// Same key/value pair => no change
-				return(0);
-			}
-
-			if ((value_ = strdup(Value)) != NULL) {
-				if (attrVal != NULL) {
-					free(attrVal);
-				}
-				PtPvd->Attributes[i].Value = value_;
-				PtPvd->dirty = true;
-				return(0);
-			}
-			DLOG("memory overflow allocating attribute %s/%s for %s\n",
-				Key, Value, PtPvd->pvdname);
+		if ((value_ = strdup(Value)) != NULL) {
+			free(Attr->Value);
+			Attr->Value = value_;
+			AttributeChanged(PtPvd, Attr);
 			return(0);
 		}
+		DLOG("memory overflow allocating attribute %s/%s for %s\n",
+			Key, Value, PtPvd->pvdname);
+		return(0);
 	}
 
-	if (firstAvailable != -1) {
-		i = firstAvailable;
-		if ((key_ = strdup(Key)) != NULL) {
-			if ((value_ = strdup(Value)) != NULL) {
-				PtPvd->Attributes[i].Key = key_;
-				PtPvd->Attributes[i].Value = value_;
-				PtPvd->dirty = true;
-				return(0);
-			}
-			free(key_);
-			DLOG("memory overflow allocating attribute %s/%s for %s\n",
-			     Key, Value,
-			     PtPvd->pvdname);
-		}
-	}
-	if (i > MAXATTRIBUTES) {
+	if (PtPvd->Attributes.nAttributes >= MAXATTRIBUTES) {
 		DLOG("too many attributes defined for %s\n", PtPvd->pvdname);
+		return(0);
+	}
+
+	if ((value_ = strdup(Value)) != NULL) {
+		if ((Attr = ATAdd(&PtPvd->Attributes, Key, value_)) != NULL) {
+			AttributeChanged(PtPvd, Attr);
+			return(0);
+		}
+		free(value_);
 	}
+	DLOG("memory overflow allocating attribute %s/%s for %s\n",
+	     Key, Value,
+	     PtPvd->pvdname);
 	return(0);
 }
 
@@ -841,20 +1541,20 @@ static	int	UpdateAttribute(t_Pvd *PtPvd, char *Key, char *Value)
 // so true)
 static	char	*PvdAttributes2Json(t_Pvd *PtPvd)
 {
-	int		i;
+	int		i, n;
 	t_StringBuffer	SB;
-	t_PvdAttribute	*Attributes = PtPvd->Attributes;
+	t_PvdAttribute	*Attributes = PtPvd->Attributes.Entries;
 
 	SBInit(&SB);
 
 	SBAddString(&SB, "{");
 
-	for (i = 0; i < MAXATTRIBUTES; i++) {
+	for (i = n = 0; i < PtPvd->Attributes.nEntries; i++) {
 		if (Attributes[i].Key != NULL) {
 			SBAddString(
 				&SB,
 				"%s\n\t\"%s\" : %s",
-				i == 0 ? "" : ",",
+				n++ == 0 ? "" : ",",
 				JsonString(Attributes[i].Key),
 				Attributes[i].Value);
 		}
@@ -867,6 +1567,98 @@ static	char	*PvdAttributes2Json(t_Pvd *PtPvd)
 	return(SB.String);
 }
 
+// InvalidateAttributesFrame : must be called each time the attributes of
+// a pvd are modified
+static	void	InvalidateAttributesFrame(t_Pvd *PtPvd)
+{
+	if (PtPvd->AttributesFrame != NULL) {
+		free(PtPvd->AttributesFrame);
+		PtPvd->AttributesFrame = NULL;
+		PtPvd->AttributesFrameLen = 0;
+	}
+	if (PtPvd->BinaryAttributes != NULL) {
+		free(PtPvd->BinaryAttributes);
+		PtPvd->BinaryAttributes = NULL;
+		PtPvd->BinaryAttributesLen = 0;
+	}
+}
+
+// GetAttributesFrame : return the PVD_ATTRIBUTES message of a pvd, building
+// it if the cached one has been invalidated. The serialization is thus done
+// once, whatever the number of notified clients or of GET requests
+static	char	*GetAttributesFrame(t_Pvd *PtPvd, int *FrameLen)
+{
+	char	*JsonString;
+	char	*Frame;
+	int	len;
+
+	if (PtPvd->AttributesFrame != NULL) {
+		lFrameCacheHits++;
+		*FrameLen = PtPvd->AttributesFrameLen;
+		return(PtPvd->AttributesFrame);
+	}
+
+	if ((JsonString = PvdAttributes2Json(PtPvd)) == NULL) {
+		return(NULL);
+	}
+
+	len = strlen("PVD_ATTRIBUTES \n") + strlen(PtPvd->pvdname) + strlen(JsonString);
+
+	if ((Frame = malloc(sizeof(int) + len + 1)) == NULL) {
+		DLOG("memory overflow allocating attributes of %s\n", PtPvd->pvdname);
+		free(JsonString);
+		return(NULL);
+	}
+	memcpy(Frame, &len, sizeof(int));
+	sprintf(Frame + sizeof(int), "PVD_ATTRIBUTES %s\n%s", PtPvd->pvdname, JsonString);
+	free(JsonString);
+
+	lFrameCacheRebuilds++;
+
+	PtPvd->AttributesFrame = Frame;
+	PtPvd->AttributesFrameLen = sizeof(int) + len;
+
+	*FrameLen = PtPvd->AttributesFrameLen;
+	return(Frame);
+}
+
+// GetBinaryAttributes : return the payload of the PVD_OP_ATTRIBUTES message
+// of a pvd (binary protocol), building it if needed : the pvd name, then
+// each attribute (key and JSON value)
+static	char	*GetBinaryAttributes(t_Pvd *PtPvd, int *Length)
+{
+	int		i;
+	t_BinaryBuffer	BB;
+	t_PvdAttribute	*Attributes = PtPvd->Attributes.Entries;
+
+	if (PtPvd->BinaryAttributes != NULL) {
+		lFrameCacheHits++;
+		*Length = PtPvd->BinaryAttributesLen;
+		return(PtPvd->BinaryAttributes);
+	}
+
+	BBInit(&BB);
+	BBAddTlvString(&BB, PVD_TLV_PVDNAME, PtPvd->pvdname);
+	for (i = 0; i < PtPvd->Attributes.nEntries; i++) {
+		if (Attributes[i].Key != NULL) {
+			BBAddTlvString(&BB, PVD_TLV_KEY, Attributes[i].Key);
+			BBAddTlvString(&BB, PVD_TLV_VALUE, Attributes[i].Value);
+		}
+	}
+	if (BB.Error) {
+		BBUninit(&BB);
+		return(NULL);
+	}
+
+	lFrameCacheRebuilds++;
+
+	PtPvd->BinaryAttributes = BB.Data;
+	PtPvd->BinaryAttributesLen = BB.Length;
+
+	*Length = BB.Length;
+	return(BB.Data);
+}
+
 // SendMultiLines : send a multi-line string to a client. Multi-line messages are :
 // PVD_BEGIN_MULTILINE
 // ...
@@ -874,48 +1666,43 @@ static	char	*PvdAttributes2Json(t_Pvd *PtPvd)
 // PVD_END_MULTILINE
 // In case of a binary promoted connection, there is no such MULTILINE header
 // because binary connections messages are made of a length + data payload
-static	int	SendMultiLines(int s, int binary, char *Prefix, ...)
+// The parts of the message (NULL terminated list, at most MAXFRAGMENTS) are
+// not copied : they are gathered by a single writev()
+static	int	SendMultiLines(int ix, char *Key, char *Prefix, ...)
 {
 	va_list ap;
 	char	*pt;
+	int	len;
+	int	n = 0;
+	struct iovec	iov[MAXFRAGMENTS + 3];
 
 	/*
 	 * Header of the message :
-	 * + length in case of binary connection
+	 * + length in case of binary connection (set below)
 	 * + PVD_BEGIN_MULTILINE string otherwise
 	 */
-	if (binary) {
-		int	len = strlen(Prefix);
-
-		// Computes the length of the payload
-		va_start(ap, Prefix);
-		while ((pt = va_arg(ap, char *)) != NULL) {
-			len += strlen(pt);
-		}
-		va_end(ap);
-		// Writes the length first
-		if (write(s, &len, sizeof(len)) != sizeof(len)) {
-			return(-1);
-		}
+	if (lTabClients[ix].type == SOCKET_BINARY) {
+		SetIovec(&iov[n++], &len, sizeof(len));
 	}
 	else {
-		if (! WriteString(s, "PVD_BEGIN_MULTILINE\n", false)) {
-			return(-1);
-		}
+		SetIovec(&iov[n++], BEGIN_MULTILINE, strlen(BEGIN_MULTILINE));
 	}
 
 	/*
 	 * The payload itself
 	 */
-	if (! WriteString(s, Prefix, false)) {
-		return(-1);
-	}
+	len = strlen(Prefix);
+	SetIovec(&iov[n++], Prefix, len);
 
 	va_start(ap, Prefix);
 	while ((pt = va_arg(ap, char *)) != NULL) {
-		if (! WriteString(s, pt, false)) {
+		if (n == MAXFRAGMENTS + 1) {
+			DLOG("SendMultiLines : too many fragments\n");
+			va_end(ap);
 			return(-1);
 		}
+		SetIovec(&iov[n], pt, strlen(pt));
+		len += iov[n++].iov_len;
 	}
 	va_end(ap);
 
@@ -924,79 +1711,352 @@ static	int	SendMultiLines(int s, int binary, char *Prefix, ...)
 	 * + nothing in case of binary connection
 	 * + PVD_END_MULTILINE string otherwise
 	 */
-	if (! binary) {
-		if (! WriteString(s, "PVD_END_MULTILINE\n", false)) {
-			return(-1);
-		}
+	if (lTabClients[ix].type != SOCKET_BINARY) {
+		SetIovec(&iov[n++], END_MULTILINE, strlen(END_MULTILINE));
+	}
+
+	return(SendToClient(ix, iov, n, Key));
+}
+
+// SendAttributesFrame : send a cached PVD_ATTRIBUTES message. Binary
+// connections receive the frame as is (length header included)
+static	int	SendAttributesFrame(int ix, char *Frame, int FrameLen, char *Key)
+{
+	struct iovec	iov[3];
+
+	if (lTabClients[ix].type == SOCKET_BINARY) {
+		SetIovec(&iov[0], Frame, FrameLen);
+		return(SendToClient(ix, iov, 1, Key));
+	}
+	SetIovec(&iov[0], BEGIN_MULTILINE, strlen(BEGIN_MULTILINE));
+	SetIovec(&iov[1], Frame + sizeof(int), FrameLen - sizeof(int));
+	SetIovec(&iov[2], END_MULTILINE, strlen(END_MULTILINE));
+
+	return(SendToClient(ix, iov, 3, Key));
+}
+
+// SendAttributesGeneration : reply to PVD_GET_ATTRIBUTES for the clients
+// having selected the delta notifications. The first line of the cached
+// frame is replaced by PVD_ATTRIBUTES <pvdname> <generation>, generation
+// being the one of the last PVD_ATTRIBUTES_DIFF sent for the pvd : the
+// client can then drop the notifications it has already received
+static	int	SendAttributesGeneration(int ix, t_Pvd *PtPvd, char *Frame, int FrameLen)
+{
+	char		Header[sizeof("PVD_ATTRIBUTES  4294967295\n") + PVDNAMSIZ];
+	char		*Json;
+	char		*End = Frame + FrameLen;
+	int		len;
+	int		n = 0;
+	struct iovec	iov[4];
+
+	if ((Json = memchr(Frame + sizeof(int), '\n', FrameLen - sizeof(int))) == NULL) {
+		return(0);
+	}
+	Json++;
+
+	snprintf(Header, sizeof(Header), "PVD_ATTRIBUTES %s %u\n",
+		 PtPvd->pvdname, PtPvd->generation);
+	len = strlen(Header) + (End - Json);
+
+	if (lTabClients[ix].type == SOCKET_BINARY) {
+		SetIovec(&iov[n++], &len, sizeof(len));
+	}
+	else {
+		SetIovec(&iov[n++], BEGIN_MULTILINE, strlen(BEGIN_MULTILINE));
+	}
+	SetIovec(&iov[n++], Header, strlen(Header));
+	SetIovec(&iov[n++], Json, End - Json);
+	if (lTabClients[ix].type != SOCKET_BINARY) {
+		SetIovec(&iov[n++], END_MULTILINE, strlen(END_MULTILINE));
+	}
+
+	return(SendToClient(ix, iov, n, NULL));
+}
+
+// SendBinary : send a binary protocol (v2) message, made of a header and of
+// a payload of TLVs (not copied)
+static	int	SendBinary(
+			int ix,
+			int Opcode,
+			int Status,
+			unsigned int Id,
+			char *Payload,
+			int Length,
+			char *Key)
+{
+	char		Header[PVD_BIN_HEADER_SIZE];
+	struct iovec	iov[2];
+
+	BinPutHeader(Header, Opcode, Status, Id, Length);
+
+	SetIovec(&iov[0], Header, sizeof(Header));
+	SetIovec(&iov[1], Payload, Length);
+
+	return(SendToClient(ix, iov, Length == 0 ? 1 : 2, Key));
+}
+
+// SendBinaryFd : send a binary protocol message without payload, carrying
+// a file descriptor (SCM_RIGHTS). The descriptor travels with the first
+// byte of the message : this is only possible if nothing is pending
+// Returns 1 if the message could not be sent this way
+static	int	SendBinaryFd(int ix, int Opcode, unsigned int Id, int fd)
+{
+	t_PvdClient	*pt = &lTabClients[ix];
+	char		Header[PVD_BIN_HEADER_SIZE];
+	struct iovec	iov;
+	struct msghdr	msg;
+	struct cmsghdr	*cmsg;
+	union {
+		struct cmsghdr	Align;
+		char		Buffer[CMSG_SPACE(sizeof(int))];
+	}	Control;
+	int		n;
+
+	if (pt->Output.Count > 0) {
+		return(1);
 	}
 
+	BinPutHeader(Header, Opcode, PVD_STATUS_OK, Id, 0);
+	SetIovec(&iov, Header, sizeof(Header));
+
+	memset(&msg, 0, sizeof(msg));
+	memset(&Control, 0, sizeof(Control));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = Control.Buffer;
+	msg.msg_controllen = sizeof(Control.Buffer);
+
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+	memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+
+	while ((n = sendmsg(pt->s, &msg, MSG_NOSIGNAL)) == -1 && errno == EINTR) {
+		;
+	}
+	if (n == -1) {
+		return(errno == EAGAIN || errno == EWOULDBLOCK ? 1 : -1);
+	}
+	if (n < sizeof(Header)) {
+		// The descriptor went with the first bytes : queue the others
+		return(OQSend(&pt->Output, pt->s, Header + n, sizeof(Header) - n, NULL));
+	}
 	return(0);
 }
 
+// SendBinaryPvdName : send a binary protocol message, carrying a pvd name.
+// A name too long for a TLV (the requests are checked by BinGetTlvString,
+// so it can not happen) makes it a PVD_STATUS_INVALID_REQUEST reply
+static	int	SendBinaryPvdName(
+			int ix,
+			int Opcode,
+			int Status,
+			unsigned int Id,
+			char *pvdname)
+{
+	char	Tlv[PVD_BIN_TLV_SIZE + PVDNAMSIZ];
+	int	l = strlen(pvdname);
+
+	if (l >= PVDNAMSIZ) {
+		return(SendBinary(ix, Opcode, PVD_STATUS_INVALID_REQUEST, Id, NULL, 0, NULL));
+	}
+
+	l = BinPutTlv(Tlv, PVD_TLV_PVDNAME, pvdname, l);
+
+	return(SendBinary(ix, Opcode, Status, Id, Tlv, l, NULL));
+}
+
 // NotifyPvdAttributes : when one or more attributes for a given pvd has/have
 // changed, we must notify all clients interested in this pvd of the change(s)
-// For now, we send all attributes (JSON format) at once
+// The notification is either sent now, or delayed until the end of the
+// current coalescing window (the pvd being queued once per window)
 static	int	NotifyPvdAttributes(t_Pvd *PtPvd)
 {
-	int	i;
-	char	*pvdname = PtPvd->pvdname;
-	int	FlagInterested = false;
-	char	Prefix[1024];
-	char	*JsonString;
+	lNotifyRequests++;
 
-	for (i = 0; i < lNClients; i++) {
-		t_PvdNameList	*pt = lTabClients[i].Subscription;
+	InvalidateSnapshot(PtPvd);
 
-		if (lTabClients[i].s == -1) {
-			continue;
-		}
-		while (pt != NULL) {
-			if (EQSTR(pt->pvdname, pvdname) || EQSTR(pt->pvdname, "*")) {
-				FlagInterested = true;
-				break;
-			}
-			pt = pt->next;
-		}
-		if (FlagInterested) {
-			break;
-		}
+	if (lNotifyDelay == 0) {
+		return(NotifyPvdAttributesNow(PtPvd));
 	}
 
-	if (! FlagInterested) {
+	if (PtPvd->notifyPending) {
 		return(0);
 	}
+	if (lFirstPendingPvd == NULL) {
+		lNotifyDeadline = GetTimeMs() + lNotifyDelay;
+		lFirstPendingPvd = PtPvd;
+	}
+	else {
+		lLastPendingPvd->nextPending = PtPvd;
+	}
+	lLastPendingPvd = PtPvd;
+	PtPvd->nextPending = NULL;
+	PtPvd->notifyPending = true;
 
-	if ((JsonString = PvdAttributes2Json(PtPvd)) == NULL) {
-		// Don't fail here (this is not the caller's fault)
-		return(0);
+	return(0);
+}
+
+// FlushPendingNotifications : send the delayed attributes notifications
+// (in the order of the first change of each pvd)
+static	void	FlushPendingNotifications(void)
+{
+	t_Pvd	*PtPvd;
+
+	while ((PtPvd = lFirstPendingPvd) != NULL) {
+		lFirstPendingPvd = PtPvd->nextPending;
+		PtPvd->notifyPending = false;
+		PtPvd->nextPending = NULL;
+		NotifyPvdAttributesNow(PtPvd);
 	}
+	lLastPendingPvd = NULL;
+}
 
-	sprintf(Prefix, "PVD_ATTRIBUTES %s\n", pvdname);
+// GetAttributesDiffFrame : build the PVD_ATTRIBUTES_DIFF message of a pvd
+// (same layout as the PVD_ATTRIBUTES one). It carries the attributes changed
+// and removed since the previous notification, whose generation number is
+// the next one. The returned frame must be freed by the caller
+static	char	*GetAttributesDiffFrame(t_Pvd *PtPvd, int *FrameLen)
+{
+	int		i, n;
+	int		len;
+	t_StringBuffer	SB;
+	t_PvdAttribute	*Attributes = PtPvd->Attributes.Entries;
 
-	for (i = 0; i < lNClients; i++) {
-		int		s = lTabClients[i].s;
-		t_PvdNameList	*pt = lTabClients[i].Subscription;
+	SBInit(&SB);
 
-		if (s == -1 || lTabClients[i].type == SOCKET_CONTROL) {
-			continue;
+	// Room for the length header (binary connections)
+	SBAddString(&SB, "%*s", (int) sizeof(int), "");
+	SBAddString(&SB,
+		"PVD_ATTRIBUTES_DIFF %s %u\n{\n\t\"changed\" : {",
+		PtPvd->pvdname,
+		PtPvd->generation + 1);
+
+	for (i = n = 0; i < PtPvd->Attributes.nEntries; i++) {
+		if (Attributes[i].Key != NULL &&
+		    Attributes[i].generation > PtPvd->generation) {
+			SBAddString(
+				&SB,
+				"%s\n\t\t\"%s\" : %s",
+				n++ == 0 ? "" : ",",
+				JsonString(Attributes[i].Key),
+				Attributes[i].Value);
 		}
+	}
 
-		while (pt != NULL) {
-			if (EQSTR(pt->pvdname, pvdname) || EQSTR(pt->pvdname, "*")) {
-				if (SendMultiLines(
-						s,
-						lTabClients[i].type == SOCKET_BINARY,
-						Prefix,
-						JsonString,
-						NULL) == -1) {
-					ReleaseClient(i);
-				}
-				break;
+	SBAddString(&SB, "\n\t},\n\t\"removed\" : [");
+
+	for (i = 0; i < PtPvd->nRemovedKeys; i++) {
+		SBAddString(
+			&SB,
+			"%s\"%s\"",
+			i == 0 ? "" : ", ",
+			JsonString(PtPvd->RemovedKeys[i]));
+	}
+
+	SBAddString(&SB, "]\n}\n");
+
+	if (SB.String == NULL) {
+		DLOG("memory overflow allocating attributes diff of %s\n", PtPvd->pvdname);
+		return(NULL);
+	}
+
+	len = strlen(SB.String + sizeof(int));
+	memcpy(SB.String, &len, sizeof(int));
+
+	*FrameLen = sizeof(int) + len;
+	return(SB.String);
+}
+
+// NotifyPvdAttributesNow : send all attributes (JSON format) at once to
+// the clients having subscribed to the given pvd. Clients having selected
+// the delta notifications only receive the changes. Each notification
+// starts a new generation of the attributes
+static	int	NotifyPvdAttributesNow(t_Pvd *PtPvd)
+{
+	int	i, j, n;
+	int	Clients[2 * MAXCLIENTS];
+	char	*pvdname = PtPvd->pvdname;
+	char	*Frame = NULL;
+	int	FrameLen;
+	char	*DiffFrame = NULL;
+	int	DiffFrameLen;
+	char	*Binary = NULL;
+	int	BinaryLen;
+
+	/*
+	 * Subscribers of the pvd, then wildcard subscribers. A client
+	 * having subscribed to both is only notified once (the stamp). The
+	 * sets are copied first : they are updated when a client is released
+	 */
+	lNotifyStamp++;
+
+	for (n = 0, j = 0; j < 2; j++) {
+		t_Subscribers	*S = SubscribersLookup(j == 0 ? pvdname : "*");
+
+		if (S != NULL) {
+			memcpy(&Clients[n], S->Clients, S->nClients * sizeof(int));
+			n += S->nClients;
+		}
+	}
+
+	if (n > 0) {
+		lNotifySent++;
+	}
+
+	for (j = 0; j < n; j++) {
+		i = Clients[j];
+
+		if (lTabClients[i].s == -1 ||
+		    lTabClients[i].type == SOCKET_CONTROL ||
+		    lTabClients[i].notifyStamp == lNotifyStamp) {
+			continue;
+		}
+		lTabClients[i].notifyStamp = lNotifyStamp;
+
+		// The frames are built once, for all clients. Don't fail
+		// here (this is not the caller's fault)
+		if (lTabClients[i].type == SOCKET_BINARY_V2) {
+			if (Binary == NULL &&
+			    (Binary = GetBinaryAttributes(PtPvd, &BinaryLen)) == NULL) {
+				continue;
+			}
+			if (SendBinary(i, PVD_OP_ATTRIBUTES, PVD_STATUS_OK, 0,
+				       Binary, BinaryLen, pvdname) == -1) {
+				ReleaseClient(i);
+			}
+		} else
+		if (lTabClients[i].diffMode) {
+			if (DiffFrame == NULL &&
+			    (DiffFrame = GetAttributesDiffFrame(PtPvd, &DiffFrameLen)) == NULL) {
+				continue;
+			}
+			// Deltas can not be coalesced
+			if (SendAttributesFrame(i, DiffFrame, DiffFrameLen, NULL) == -1) {
+				ReleaseClient(i);
+			}
+		}
+		else {
+			if (Frame == NULL &&
+			    (Frame = GetAttributesFrame(PtPvd, &FrameLen)) == NULL) {
+				continue;
+			}
+			// A pending notification for this pvd is superseded
+			// by this one
+			if (SendAttributesFrame(i, Frame, FrameLen, pvdname) == -1) {
+				ReleaseClient(i);
 			}
-			pt = pt->next;
 		}
 	}
-	free(JsonString);
+
+	if (DiffFrame != NULL) {
+		free(DiffFrame);
+	}
+
+	// Next changes belong to the next generation
+	PtPvd->generation++;
+	ClearRemovedKeys(PtPvd);
 
 	return(0);
 }
@@ -1029,46 +2089,60 @@ void	PvdEndTransaction(t_Pvd *PtPvd)
 	}
 }
 
-// SendOneAttribute : send a given attributes for a given pvd to a given client
-static	int	SendOneAttribute(int s, int binary, char *pvdname, char *attrName)
+// PvdChanges : stamp of the last change of the attributes of a pvd. A
+// value saved along with some attributes is still equal if none of them
+// has been modified (or removed) since then
+unsigned int	PvdChanges(t_Pvd *PtPvd)
 {
-	int		i;
-	char		Prefix[1024];
-	t_Pvd		*PtPvd;
-	t_PvdAttribute	*Attributes;
+	return(PtPvd->changes);
+}
+
+// PvdLookup : retrieve an existing pvd (NULL if unknown)
+t_Pvd	*PvdLookup(char *pvdname)
+{
+	return(LookupPvd(pvdname));
+}
+
+// PvdRaState : slot holding the values decoded from the last RA of a pvd.
+// The state is released along with the pvd, by ReleaseRaState()
+void	**PvdRaState(t_Pvd *PtPvd)
+{
+	return(&PtPvd->raState);
+}
+
+// SendOneAttribute : send a given attributes for a given pvd to a given client
+static	int	SendOneAttribute(int ix, char *pvdname, char *attrName)
+{
+	char		Prefix[sizeof("PVD_ATTRIBUTE  \n") + PVDNAMSIZ + ATTRNAMSIZ];
+	t_Pvd		*PtPvd;
+	t_PvdAttribute	*Attr;
 
-	DLOG("send attribute %s for pvdid %s on socket %d\n", attrName, pvdname, s);
+	DLOG("send attribute %s for pvdid %s on socket %d\n", attrName, pvdname, lTabClients[ix].s);
 
 	if ((PtPvd = GetPvd(pvdname)) == NULL) {
 		DLOG("%s : unknown PvD\n", pvdname);
 		return(0);
 	}
 
-	Attributes = PtPvd->Attributes;
-
-	sprintf(Prefix, "PVD_ATTRIBUTE %s %s\n", pvdname, attrName);
+	snprintf(Prefix, sizeof(Prefix), "PVD_ATTRIBUTE %s %s\n", pvdname, attrName);
 
-	for (i = 0; i < MAXATTRIBUTES; i++) {
-		if (Attributes[i].Value != NULL &&
-		    Attributes[i].Key != NULL &&
-		    EQSTR(Attributes[i].Key, attrName)) {
-			return(SendMultiLines(s, binary, Prefix, Attributes[i].Value, "\n", NULL));
-		}
+	if ((Attr = ATLookup(&PtPvd->Attributes, attrName)) != NULL) {
+		return(SendMultiLines(ix, NULL, Prefix, Attr->Value, "\n", NULL));
 	}
 	// Not found : send something to the client to avoid having it
 	// waiting forever (in case of binary clients mostly)
-	return(SendMultiLines(s, binary, Prefix, "null", "\n", NULL));
+	return(SendMultiLines(ix, NULL, Prefix, "null", "\n", NULL));
 }
 
 // SendAllAttributes : send the attributes for a given pvd to a given client
-static	int	SendAllAttributes(int s, int binary, char *pvdname)
+static	int	SendAllAttributes(int ix, char *pvdname)
 {
 	int	rc;
-	char	Prefix[1024];
-	char	*JsonString;
+	char	*Frame;
+	int	FrameLen;
 	t_Pvd	*PtPvd;
 
-	DLOG("send all attributes for pvdid %s on socket %d\n", pvdname, s);
+	DLOG("send all attributes for pvdid %s on socket %d\n", pvdname, lTabClients[ix].s);
 
 	// Recursive call in case the client wants to receive the
 	// attributes for all currently registered PvD
@@ -1076,7 +2150,7 @@ static	int	SendAllAttributes(int s, int binary, char *pvdname)
 		t_Pvd	*PtPvd;
 
 		for (PtPvd = lFirstPvd; PtPvd != NULL; PtPvd = PtPvd->next) {
-			if ((rc = SendAllAttributes(s, binary, PtPvd->pvdname)) != 0) {
+			if ((rc = SendAllAttributes(ix, PtPvd->pvdname)) != 0) {
 				return(rc);
 			}
 		}
@@ -1088,17 +2162,14 @@ static	int	SendAllAttributes(int s, int binary, char *pvdname)
 		return(0);
 	}
 
-	if ((JsonString = PvdAttributes2Json(PtPvd)) == NULL) {
+	if ((Frame = GetAttributesFrame(PtPvd, &FrameLen)) == NULL) {
 		return(0);
 	}
 
-	sprintf(Prefix, "PVD_ATTRIBUTES %s\n", pvdname);
-
-	rc = SendMultiLines(s, binary, Prefix, JsonString, NULL);
-
-	free(JsonString);
-
-	return(rc);
+	if (lTabClients[ix].diffMode) {
+		return(SendAttributesGeneration(ix, PtPvd, Frame, FrameLen));
+	}
+	return(SendAttributesFrame(ix, Frame, FrameLen, NULL));
 }
 
 // HandleMultiLinesMessage : in some cases, we may receive multi-lines messages
@@ -1106,8 +2177,7 @@ static	int	SendAllAttributes(int s, int binary, char *pvdname)
 // can be handled inline the DispatchMessage() function)
 static	int	HandleMultiLinesMessage(int ix)
 {
-	char	attributeName[1024];
-	char	pvdname[PVDNAMSIZ];
+	char	*Args[2];
 	char	*pt;
 	int	rc;
 	int	l;
@@ -1127,11 +2197,14 @@ static	int	HandleMultiLinesMessage(int ix)
 		pt[--l] = '\0';
 	}
 
-	if (sscanf(
-		SB->String,
-		"PVD_SET_ATTRIBUTE %[^ ] %[^ ]",
-		pvdname,
-		attributeName) == 2) {
+	// Same rules as the one-line version : the pvd name and the
+	// attribute name must fit in their buffers
+	if (strncmp(SB->String, "PVD_SET_ATTRIBUTE ", 18) == 0 &&
+	    ParseArgs(SB->String + 18, 2, Args, false) == 2 &&
+	    strlen(Args[0]) < PVDNAMSIZ &&
+	    strlen(Args[1]) < ATTRNAMSIZ) {
+		char	*pvdname = Args[0];
+		char	*attributeName = Args[1];
 
 		if (lTabClients[ix].pvdIdTransaction == NULL ||
 		    ! EQSTR(lTabClients[ix].pvdIdTransaction, pvdname)) {
@@ -1141,6 +2214,9 @@ static	int	HandleMultiLinesMessage(int ix)
 		// Here, pt points to the 2nd line : it is the attributeValue and
 		// is part of the allocated string buffer (be careful to not free
 		// this string buffer before we have duplicated the attributeValue)
+		if (GetPvd(pvdname) != NULL) {
+			JournalSetAttribute(pvdname, attributeName, pt);
+		}
 		rc = UpdateAttribute(GetPvd(pvdname), attributeName, pt);
 
 		SBUninit(SB);
@@ -1155,504 +2231,1544 @@ static	int	HandleMultiLinesMessage(int ix)
 	return(0);
 }
 
-// DispatchMessage : given a message read from a client socket, handle it
-// Only certain messages are allowed for a given connection type
-// s can also be modified
-// type : can be modified if an undefined connection gets promoted
-//
-// msg : line extracted from a buffer read on the socket, without a
-// terminating \n, but with a \0 instead
-// Some messages however are multi-line (typically the ones containing
-// JSON payload). Multi-line messages are formatted as follows :
-// PVD_XXX ... <number of lines>
-// ...
-// ...
-//
-static	int	DispatchMessage(char *msg, int ix)
-{
-	char	attributeName[1024];
-	char	attributeValue[4096];
-	char	pvdname[PVDNAMSIZ];	// be careful with overflow
-	int	pvdid;
-	int	s = lTabClients[ix].s;
-	int	type = lTabClients[ix].type;
-	int	binary = type == SOCKET_BINARY;
-
-	if (msg[0] != '\0') {
-		DLOG("handling message %s on socket %d, type %d\n", msg, s, type);
-	}
+/*
+ * Commands received from the clients. Each command is made of a verb,
+ * followed by arguments separated by spaces. For the commands carrying a
+ * free-form value (PVD_SET_ATTRIBUTE), the last argument spans the end of
+ * the line (it can contain spaces, typically a JSON value)
+ *
+ * Lines are parsed once and in place : the arguments point into the line,
+ * no copy is made. The verb is looked up in a hash index of the commands
+ * table (open addressing, like the pvd index)
+ */
+#define	MAXARGS		3
+#define	CMDHASHSIZE	64	// power of 2, at least twice the number of commands
 
-	// Only one kind of promotion for now (more a restriction
-	// than a promotion in fact)
-	if (EQSTR(msg, "PVD_CONNECTION_PROMOTE_CONTROL")) {
-		// TODO : perform some credentials verifications
-		if (lTabClients[ix].type == SOCKET_CONTROL) {
-			// Already promoted (no way back to regular connection)
-			return(0);
-		}
-		if (lTabClients[ix].Subscription != NULL) {
-			ReleaseSubscriptionsList(ix);
-		}
-		lTabClients[ix].type = SOCKET_CONTROL;
+// Sockets types allowed to issue a command
+#define	CMD_GENERAL	((1 << SOCKET_GENERAL) | (1 << SOCKET_BINARY))
+#define	CMD_CONTROL	(1 << SOCKET_CONTROL)
+#define	CMD_ANY		(CMD_GENERAL | CMD_CONTROL)
 
-		return(0);
+typedef	struct {
+	char		*Verb;
+	int		Sockets;	// CMD_xxx
+	int		nArgs;
+	int		Rest;		// true if the last argument spans the line
+	int		MaxLen[MAXARGS];// buffer size for each argument, 0 if none
+	int		(*Handler)(int ix, char **Args);
+	unsigned int	hash;		// HashString(Verb)
+}	t_Command;
+
+// Only one kind of promotion for now (more a restriction
+// than a promotion in fact)
+static	int	CmdPromoteControl(int ix, char **Args)
+{
+	t_PvdClient	*PtClient = &lTabClients[ix];
+
+	// Local clients are authenticated : root and the daemon's user
+	// only. TCP clients can not be
+	if (PtClient->local ?
+		PtClient->uid != 0 && PtClient->uid != geteuid() :
+		! lTcpControl) {
+		DLOG("control promotion denied to client %d (uid %d)\n",
+		     ix, (int) PtClient->uid);
+		ReleaseClient(ix);
+		return(-1);
 	}
 
-	if (EQSTR(msg, "PVD_CONNECTION_PROMOTE_BINARY")) {
-		lTabClients[ix].type = SOCKET_BINARY;
+	if (lTabClients[ix].type == SOCKET_CONTROL) {
+		// Already promoted (no way back to regular connection)
 		return(0);
 	}
+	if (lTabClients[ix].Subscription != NULL) {
+		ReleaseSubscriptionsList(ix);
+	}
+	lTabClients[ix].type = SOCKET_CONTROL;
 
-	// Control sockets : typically used by authorized clients to update
-	// some pvdid attributes (or trigger maintenance tasks)
-	if (type == SOCKET_CONTROL) {
+	return(0);
+}
 
-		// Beginning of a multi-lines section ? We want to
-		// test here (ie, before END_MULTILINE & Co) to have
-		// the chance to reset the buffers in case we have missed
-		// a previous multi-lines section END message
-		if (EQSTR(msg, "PVD_BEGIN_MULTILINE")) {
-			lTabClients[ix].multiLines = true;
-			SBUninit(&lTabClients[ix].SB);
-			SBInit(&lTabClients[ix].SB);
-			return(0);
-		}
+static	int	CmdPromoteBinary(int ix, char **Args)
+{
+	lTabClients[ix].type = SOCKET_BINARY;
+	return(0);
+}
 
-		// Are we at the end of a multi-lines section ?
-		if (EQSTR(msg, "PVD_END_MULTILINE")) {
-			lTabClients[ix].multiLines = false;
-			return(HandleMultiLinesMessage(ix));
-		}
+// The bytes following this line are binary protocol (v2) requests
+static	int	CmdPromoteBinaryV2(int ix, char **Args)
+{
+	int	one = 1;
 
-		// Are we inside a multi-lines section ? If yes just add it to
-		// the current buffer
-		if (lTabClients[ix].multiLines) {
-			SBAddString(&lTabClients[ix].SB, "%s\n", msg);
-			return(0);
-		}
+	lTabClients[ix].type = SOCKET_BINARY_V2;
 
-		if (sscanf(msg, "PVD_BEGIN_TRANSACTION %[^\n]", pvdname) == 1) {
-			if (lTabClients[ix].pvdIdTransaction != NULL) {
-				DLOG("beginning transaction for %s while %s still on-going\n",
-				     pvdname,
-				     lTabClients[ix].pvdIdTransaction);
-				return(0);
-			}
+	// Binary clients pipeline their requests : do not let Nagle's
+	// algorithm hold the last replies of a batch until they are acked
+	setsockopt(lTabClients[ix].s, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
 
-			lTabClients[ix].pvdIdTransaction = strdup(pvdname);
+	return(0);
+}
 
-			return(0);
-		}
+static	int	CmdBeginTransaction(int ix, char **Args)
+{
+	char	*pvdname = Args[0];
 
-		if (sscanf(msg, "PVD_END_TRANSACTION %[^\n]", pvdname) == 1) {
-			t_Pvd	*PtPvd;
+	if (lTabClients[ix].pvdIdTransaction != NULL) {
+		DLOG("beginning transaction for %s while %s still on-going\n",
+		     pvdname,
+		     lTabClients[ix].pvdIdTransaction);
+		return(0);
+	}
 
-			if (lTabClients[ix].pvdIdTransaction == NULL) {
-				DLOG("ending transaction for %s while no transaction on-going\n",
-				     pvdname);
-				return(-1);
-			}
-			if (! EQSTR(lTabClients[ix].pvdIdTransaction, pvdname)) {
-				DLOG("ending transaction for %s while on-going one is %s\n",
-				     pvdname,
-				     lTabClients[ix].pvdIdTransaction);
-				return(-1);
-			}
+	lTabClients[ix].pvdIdTransaction = strdup(pvdname);
 
-			free(lTabClients[ix].pvdIdTransaction);
-			lTabClients[ix].pvdIdTransaction = NULL;
+	return(0);
+}
 
-			if ((PtPvd = GetPvd(pvdname)) != NULL) {
-				if (PtPvd->dirty) {
-					NotifyPvdAttributes(PtPvd);
-					PtPvd->dirty = false;
-				}
-			}
-			return(0);
-			
-		}
-
-		if (sscanf(
-			msg,
-			"PVD_UNSET_ATTRIBUTE %[^ ] %[^\n]",
-			pvdname,
-			attributeName) == 2) {
-			return(DeleteAttribute(GetPvd(pvdname), attributeName));
-		}
-
-		// PVD_SET_ATTRIBUTE message are special : either the
-		// content fits on the line, either it is part of a
-		// multi-lines string. We only handle here the one-line
-		// version
-		if (sscanf(
-			msg,
-			"PVD_SET_ATTRIBUTE %[^ ] %[^ ] %[^\n]",
-			pvdname,
-			attributeName,
-			attributeValue) == 3) {
-			if (lTabClients[ix].pvdIdTransaction == NULL ||
-			    ! EQSTR(lTabClients[ix].pvdIdTransaction, pvdname)) {
-				DLOG("updating attribute for %s outside transaction\n",
-				     pvdname);
-				return(0);
-			}
-			if (lKernelHasPvdSupport &&
-			    (EQSTR(attributeName, "hFlag") ||
-			     EQSTR(attributeName, "lFlag") ||
-			     EQSTR(attributeName, "sequenceNumber"))) {
-				if (kernel_update_pvd_attr(
-						pvdname,
-						attributeName,
-						attributeValue) == -1) {
-					perror("kernel_update_pvd_attr");
-				}
-				return(0);
-			}
-			return(UpdateAttribute(GetPvd(pvdname), attributeName, attributeValue));
-		}
+static	int	CmdEndTransaction(int ix, char **Args)
+{
+	char	*pvdname = Args[0];
+	t_Pvd	*PtPvd;
 
-		if (sscanf(msg, "PVD_CREATE_PVD %d %[^\n]", &pvdid, pvdname) == 2) {
-			if (lKernelHasPvdSupport) {
-				if (kernel_create_pvd(pvdname) == -1) {
-					perror("kernel_create_pvd");
-				}
-				return(0);
-			}
-			return(RegisterPvd(pvdid, pvdname) != NULL);
-		}
+	if (lTabClients[ix].pvdIdTransaction == NULL) {
+		DLOG("ending transaction for %s while no transaction on-going\n",
+		     pvdname);
+		return(-1);
+	}
+	if (! EQSTR(lTabClients[ix].pvdIdTransaction, pvdname)) {
+		DLOG("ending transaction for %s while on-going one is %s\n",
+		     pvdname,
+		     lTabClients[ix].pvdIdTransaction);
+		return(-1);
+	}
 
-		if (sscanf(msg, "PVD_REMOVE_PVD %[^\n]", pvdname) == 1) {
-			if (lKernelHasPvdSupport) {
-				if (kernel_update_pvd_attr(
-						pvdname, ".deprecated", "1") == -1) {
-					perror("kernel_update_pvd_attr");
-				}
-				return(0);
-			}
-			return(UnregisterPvd(pvdname));
-		}
+	free(lTabClients[ix].pvdIdTransaction);
+	lTabClients[ix].pvdIdTransaction = NULL;
 
-		// Unknown message : don't fail on error
-		if (msg[0] != '\0') {
-			DLOG("invalid message received (%s) on a control socket\n", msg);
+	if ((PtPvd = GetPvd(pvdname)) != NULL) {
+		if (PtPvd->dirty) {
+			NotifyPvdAttributes(PtPvd);
+			PtPvd->dirty = false;
 		}
-
-		return(0);
 	}
+	return(0);
+}
 
-	// Non control clients
-	// Beware : PVD_SUBSCRIBE_NOTIFICATIONS must appear before the
-	// sscanf(PVD_SUBSCRIBE %[^\ ] otherwise the sscanf pattern will
-	// catch the string !
-	if (EQSTR(msg, "PVD_SUBSCRIBE_NOTIFICATIONS")) {
-		lTabClients[ix].SubscriptionMask = 0xFF;
+static	int	CmdUnsetAttribute(int ix, char **Args)
+{
+	JournalUnsetAttribute(Args[0], Args[1]);
+	return(DeleteAttribute(GetPvd(Args[0]), Args[1]));
+}
+
+// PVD_SET_ATTRIBUTE message are special : either the content fits on the
+// line, either it is part of a multi-lines string. We only handle here the
+// one-line version
+static	int	CmdSetAttribute(int ix, char **Args)
+{
+	char	*pvdname = Args[0];
+	char	*attributeName = Args[1];
+	char	*attributeValue = Args[2];
+
+	if (lTabClients[ix].pvdIdTransaction == NULL ||
+	    ! EQSTR(lTabClients[ix].pvdIdTransaction, pvdname)) {
+		DLOG("updating attribute for %s outside transaction\n",
+		     pvdname);
 		return(0);
 	}
-
-	if (EQSTR(msg, "PVD_UNSUBSCRIBE_NOTIFICATIONS")) {
-		lTabClients[ix].SubscriptionMask = 0;
+	if (lKernelHasPvdSupport &&
+	    (EQSTR(attributeName, "hFlag") ||
+	     EQSTR(attributeName, "lFlag") ||
+	     EQSTR(attributeName, "sequenceNumber"))) {
+		if (kernel_update_pvd_attr(
+				pvdname,
+				attributeName,
+				attributeValue) == -1) {
+			perror("kernel_update_pvd_attr");
+		}
 		return(0);
 	}
+	if (GetPvd(pvdname) != NULL) {
+		JournalSetAttribute(pvdname, attributeName, attributeValue);
+	}
+	return(UpdateAttribute(GetPvd(pvdname), attributeName, attributeValue));
+}
+
+static	int	CmdCreatePvd(int ix, char **Args)
+{
+	int	pvdid;
+	char	*pvdname = Args[1];
 
-	if (sscanf(msg, "PVD_SUBSCRIBE %[^\n]", pvdname) == 1) {
-		AddSubscription(ix, pvdname);
+	if (getint(Args[0], &pvdid) == -1) {
+		DLOG("invalid pvd id (%s) for %s\n", Args[0], pvdname);
 		return(0);
 	}
-	if (sscanf(msg, "PVD_UNSUBSCRIBE %[^\n]", pvdname) == 1) {
-		RemoveSubscription(ix, pvdname);
+	if (lKernelHasPvdSupport) {
+		if (kernel_create_pvd(pvdname) == -1) {
+			perror("kernel_create_pvd");
+		}
 		return(0);
 	}
-
-	if (EQSTR(msg, "PVD_GET_LIST")) {
-		if (SendPvdList(s, binary) == -1) {
-			goto BadExit;
-		}
+	if (RegisterPvd(pvdid, pvdname) == NULL) {
 		return(0);
 	}
+	JournalCreatePvd(pvdid, pvdname);
+	return(1);
+}
+
+static	int	CmdRemovePvd(int ix, char **Args)
+{
+	char	*pvdname = Args[0];
 
-	// Once again, PVD_GET_ATTRIBUTES must come BEFORE PVD_GET_ATTRIBUTE
-	if (sscanf(msg, "PVD_GET_ATTRIBUTES %[^\n]", pvdname) == 1) {
-		// Send to the client all known attributes of the
-		// associated pvd. The attributes are sent
-		// as a JSON object, with embedded \n : multi-lines
-		// message
-		if (SendAllAttributes(s, binary, pvdname) == -1) {
-			goto BadExit;
+	if (lKernelHasPvdSupport) {
+		if (kernel_update_pvd_attr(
+				pvdname, ".deprecated", "1") == -1) {
+			perror("kernel_update_pvd_attr");
 		}
 		return(0);
 	}
-
-	if (sscanf(msg, "PVD_GET_ATTRIBUTE %[^ ] %[^\n]", pvdname, attributeName) == 2) {
-		if (SendOneAttribute(s, binary, pvdname, attributeName) == -1) {
-			goto BadExit;
-		}
+	// Only the removals actually made are journaled
+	if (GetPvd(pvdname) == NULL) {
 		return(0);
 	}
+	JournalRemovePvd(pvdname);
+	return(UnregisterPvd(pvdname));
+}
 
-	// Unknown message : don't fail on error
-	if (msg[0] != '\0') {
-		DLOG("invalid message received (%s) on a general socket\n", msg);
-	}
+static	int	CmdSubscribeNotifications(int ix, char **Args)
+{
+	lTabClients[ix].SubscriptionMask = 0xFF;
 	return(0);
+}
 
-BadExit :
-	ReleaseClient(ix);
+static	int	CmdUnsubscribeNotifications(int ix, char **Args)
+{
+	lTabClients[ix].SubscriptionMask = 0;
+	return(0);
+}
 
-	return(-1);
+static	int	CmdSubscribeAttributesDiff(int ix, char **Args)
+{
+	lTabClients[ix].diffMode = true;
+	return(0);
 }
 
-// A message has arrived on a socket of a given type (undefined, general, pvdid or
-// control). Read it and handle it. We have specified line oriented messages
-// A message can be built of multiple lines (FIXME : we only care of full lines,
-// not of lines across buffer boundaries)
-static	int	HandleMessage(int ix)
+static	int	CmdUnsubscribeAttributesDiff(int ix, char **Args)
 {
-	static char lMsg[PVD_MAX_MSG_SIZE];
+	lTabClients[ix].diffMode = false;
+	return(0);
+}
 
-	int	s = lTabClients[ix].s;
-	int	type = lTabClients[ix].type;
+static	int	CmdSubscribe(int ix, char **Args)
+{
+	AddSubscription(ix, Args[0]);
+	return(0);
+}
 
-	int	n;
-	char	*pt = lMsg;
-	char	*pt0 = lMsg;
+static	int	CmdUnsubscribe(int ix, char **Args)
+{
+	RemoveSubscription(ix, Args[0]);
+	return(0);
+}
 
-	if ((n = recv(s, lMsg, sizeof(lMsg) - 1, MSG_DONTWAIT)) <= 0) {
-		// Client disconnected
-		DLOG("client for socket %d (type %d) disconnected (n = %d)\n", s, type, n);
+static	int	CmdGetList(int ix, char **Args)
+{
+	if (SendPvdList(ix) == -1) {
 		ReleaseClient(ix);
 		return(-1);
 	}
+	return(0);
+}
 
-	if (n != 1) {
-		DLOG("client for socket %d : message len = %d\n", s, n);
-	}
-
-	lMsg[n] = '\0';
-
-	while (*pt != '\0') {
-		if (*pt == '\n') {
-			*pt++ = '\0';
-			if (DispatchMessage(pt0, ix) == -1) {
-				return(-1);
-			}
-			pt0 = pt;
-		}
-		else {
-			pt++;
-		}
-	}
-	if (pt0 != pt) {
-		return(DispatchMessage(pt0, ix));
+// Send to the client all known attributes of the associated pvd. The
+// attributes are sent as a JSON object, with embedded \n : multi-lines
+// message
+static	int	CmdGetAttributes(int ix, char **Args)
+{
+	if (SendAllAttributes(ix, Args[0]) == -1) {
+		ReleaseClient(ix);
+		return(-1);
 	}
 	return(0);
 }
 
-static	int	RegisterPvdAttributes(struct net_pvd_attribute *pa)
+static	int	CmdGetAttribute(int ix, char **Args)
 {
-	int	i;
-	char	*pt;
-	char	sAddr[INET6_ADDRSTRLEN + 1];
-	t_Pvd	*PtPvd = RegisterPvd(pa->index, pa->name);
-
-	if (PtPvd == NULL) {
-		// Fatal error
-		fprintf(stderr, "Can not register pvd %s\n", pa->name);
+	if (SendOneAttribute(ix, Args[0], Args[1]) == -1) {
+		ReleaseClient(ix);
 		return(-1);
 	}
-	PvdBeginTransaction(pa->name);
-	PvdSetAttr(
-		PtPvd,
-		"sequenceNumber",
-		GetIntStr(pa->sequence_number));
-	PvdSetAttr(PtPvd, "hFlag", GetIntStr(pa->h_flag));
-	PvdSetAttr(PtPvd, "lFlag", GetIntStr(pa->l_flag));
-	PvdSetAttr(PtPvd, "aFlag", GetIntStr(pa->a_flag));   // introduced in draft-01
-	PvdSetAttr(PtPvd, "implicit", pa->implicit_flag ? "true" : "false");
-	PvdSetAttr(
-		PtPvd,
-		"lla",
-		Stringify(addrtostr(&pa->lla, sAddr, sizeof(sAddr))));
-	PvdSetAttr(PtPvd, "dev", Stringify(JsonString(pa->dev)));
+	return(0);
+}
 
-	PvdSetAttr(
-		PtPvd,
-		"addresses",
-		pt = In6AddrToJsonArray(
-			pa->naddresses,
-			pa->addresses,
-			pa->addr_prefix_len));
-	free(pt);
+static	t_Command	lCommands[] = {
+	{ "PVD_CONNECTION_PROMOTE_CONTROL", CMD_ANY, 0, false, { 0 }, CmdPromoteControl },
+	{ "PVD_CONNECTION_PROMOTE_BINARY", CMD_ANY, 0, false, { 0 }, CmdPromoteBinary },
+	{ "PVD_CONNECTION_PROMOTE_BINARY_V2", CMD_GENERAL, 0, false, { 0 }, CmdPromoteBinaryV2 },
 
-	PvdSetAttr(
-		PtPvd,
-		"routes",
-		pt = In6RoutesToJsonArray(pa->nroutes, pa->routes));
-	free(pt);
+	// Control sockets : typically used by authorized clients to update
+	// some pvdid attributes (or trigger maintenance tasks)
+	{ "PVD_BEGIN_TRANSACTION", CMD_CONTROL, 1, false, { PVDNAMSIZ }, CmdBeginTransaction },
+	{ "PVD_END_TRANSACTION", CMD_CONTROL, 1, false, { PVDNAMSIZ }, CmdEndTransaction },
+	{ "PVD_UNSET_ATTRIBUTE", CMD_CONTROL, 2, false, { PVDNAMSIZ, ATTRNAMSIZ }, CmdUnsetAttribute },
+	{ "PVD_SET_ATTRIBUTE", CMD_CONTROL, 3, true, { PVDNAMSIZ, ATTRNAMSIZ, 0 }, CmdSetAttribute },
+	{ "PVD_CREATE_PVD", CMD_CONTROL, 2, false, { 0, PVDNAMSIZ }, CmdCreatePvd },
+	{ "PVD_REMOVE_PVD", CMD_CONTROL, 1, false, { PVDNAMSIZ }, CmdRemovePvd },
 
-	/*
-	 * User options now : RDNSS/DNSSL
-	 */
-	for (i = 0; i < pa->nrdnss; i++) {
-		PtPvd->KernelRdnss[i] = pa->rdnss[i];
-	}
-	PtPvd->nKernelRdnss = pa->nrdnss;
+	// Non control clients
+	{ "PVD_SUBSCRIBE_NOTIFICATIONS", CMD_GENERAL, 0, false, { 0 }, CmdSubscribeNotifications },
+	{ "PVD_UNSUBSCRIBE_NOTIFICATIONS", CMD_GENERAL, 0, false, { 0 }, CmdUnsubscribeNotifications },
+	{ "PVD_SUBSCRIBE_ATTRIBUTES_DIFF", CMD_GENERAL, 0, false, { 0 }, CmdSubscribeAttributesDiff },
+	{ "PVD_UNSUBSCRIBE_ATTRIBUTES_DIFF", CMD_GENERAL, 0, false, { 0 }, CmdUnsubscribeAttributesDiff },
+	{ "PVD_SUBSCRIBE", CMD_GENERAL, 1, false, { PVDNAMSIZ }, CmdSubscribe },
+	{ "PVD_UNSUBSCRIBE", CMD_GENERAL, 1, false, { PVDNAMSIZ }, CmdUnsubscribe },
+	{ "PVD_GET_LIST", CMD_GENERAL, 0, false, { 0 }, CmdGetList },
+	{ "PVD_GET_ATTRIBUTES", CMD_GENERAL, 1, false, { PVDNAMSIZ }, CmdGetAttributes },
+	{ "PVD_GET_ATTRIBUTE", CMD_GENERAL, 2, false, { PVDNAMSIZ, ATTRNAMSIZ }, CmdGetAttribute },
+};
 
-	for (i = 0; i < PtPvd->nKernelDnssl; i++) {
-		free(PtPvd->KernelDnssl[i]);
-	}
-	for (i = 0; i < pa->ndnssl; i++) {
-		PtPvd->KernelDnssl[i] = strdup(pa->dnssl[i]);
-	}
-	PtPvd->nKernelDnssl = pa->ndnssl;
+static	t_Command	*lCommandsHash[CMDHASHSIZE];
 
-	PvdSetAttr(
-		PtPvd,
-		"rdnss",
-		pt = PvdRdnssToJsonArray(PtPvd));
-	free(pt);
+// InitCommands : build the hash index of the commands verbs
+static	void	InitCommands(void)
+{
+	int		i, j;
+	int		Mask = CMDHASHSIZE - 1;
+	t_Command	*Cmd;
 
-	PvdSetAttr(
-		PtPvd,
+	for (i = 0; i < DIM(lCommands); i++) {
+		Cmd = &lCommands[i];
+		Cmd->hash = HashString(Cmd->Verb);
+
+		for (j = Cmd->hash & Mask;
+		     lCommandsHash[j] != NULL;
+		     j = (j + 1) & Mask) {
+			;
+		}
+		lCommandsHash[j] = Cmd;
+	}
+}
+
+// LookupCommand : retrieve a command by its verb, NULL if unknown
+static	t_Command	*LookupCommand(char *Verb)
+{
+	int		i;
+	int		Mask = CMDHASHSIZE - 1;
+	unsigned int	h = HashString(Verb);
+	t_Command	*Cmd;
+
+	for (i = h & Mask; (Cmd = lCommandsHash[i]) != NULL; i = (i + 1) & Mask) {
+		if (Cmd->hash == h && EQSTR(Cmd->Verb, Verb)) {
+			return(Cmd);
+		}
+	}
+	return(NULL);
+}
+
+// ParseArgs : split (in place) the arguments of a command. If Rest is true,
+// the last one spans the end of the line, otherwise only trailing spaces can
+// follow it. Returns the number of arguments found (at most nArgs), -1 if
+// there are too many of them
+static	int	ParseArgs(char *pt, int nArgs, char **Args, int Rest)
+{
+	int	n;
+
+	for (n = 0; n < nArgs; n++) {
+		while (*pt == ' ') {
+			pt++;
+		}
+		if (*pt == '\0') {
+			return(n);
+		}
+		Args[n] = pt;
+		if (Rest && n == nArgs - 1) {
+			return(nArgs);
+		}
+		while (*pt != ' ' && *pt != '\0') {
+			pt++;
+		}
+		if (*pt == ' ') {
+			*pt++ = '\0';
+		}
+	}
+
+	while (*pt == ' ') {
+		pt++;
+	}
+	return(*pt == '\0' ? n : -1);
+}
+
+// DispatchMessage : given a message read from a client socket, handle it
+// Only certain messages are allowed for a given connection type
+// s can also be modified
+// type : can be modified if an undefined connection gets promoted
+//
+// msg : line extracted from a buffer read on the socket, without a
+// terminating \n, but with a \0 instead. It is modified by the parsing
+// Some messages however are multi-line (typically the ones containing
+// JSON payload). Multi-line messages are formatted as follows :
+// PVD_XXX ... <number of lines>
+// ...
+// ...
+//
+static	int	DispatchMessage(char *msg, int ix)
+{
+	char		*Args[MAXARGS];
+	char		*pt;
+	int		s = lTabClients[ix].s;
+	int		type = lTabClients[ix].type;
+	t_Command	*Cmd;
+	int		i;
+
+	if (msg[0] != '\0') {
+		DLOG("handling message %s on socket %d, type %d\n", msg, s, type);
+	}
+
+	if (type == SOCKET_CONTROL) {
+
+		// Beginning of a multi-lines section ? We want to
+		// test here (ie, before END_MULTILINE & Co) to have
+		// the chance to reset the buffers in case we have missed
+		// a previous multi-lines section END message
+		if (EQSTR(msg, "PVD_BEGIN_MULTILINE")) {
+			lTabClients[ix].multiLines = true;
+			SBUninit(&lTabClients[ix].SB);
+			SBInit(&lTabClients[ix].SB);
+			return(0);
+		}
+
+		// Are we at the end of a multi-lines section ?
+		if (EQSTR(msg, "PVD_END_MULTILINE")) {
+			lTabClients[ix].multiLines = false;
+			return(HandleMultiLinesMessage(ix));
+		}
+
+		// Are we inside a multi-lines section ? If yes just add it to
+		// the current buffer
+		if (lTabClients[ix].multiLines) {
+			SBAddString(&lTabClients[ix].SB, "%s\n", msg);
+			return(0);
+		}
+	}
+
+	if (msg[0] == '\0') {
+		return(0);
+	}
+
+	// Isolate the verb
+	if ((pt = strchr(msg, ' ')) != NULL) {
+		*pt++ = '\0';
+	}
+	else {
+		pt = msg + strlen(msg);
+	}
+
+	lCommandsParsed++;
+
+	if ((Cmd = LookupCommand(msg)) == NULL ||
+	    (Cmd->Sockets & (1 << type)) == 0 ||
+	    ParseArgs(pt, Cmd->nArgs, Args, Cmd->Rest) != Cmd->nArgs) {
+		// Unknown message : don't fail on error
+		DLOG("invalid message received (%s) on a %s socket\n",
+		     msg,
+		     type == SOCKET_CONTROL ? "control" : "general");
+		lCommandsInvalid++;
+		return(0);
+	}
+
+	for (i = 0; i < Cmd->nArgs; i++) {
+		if (Cmd->MaxLen[i] != 0 && strlen(Args[i]) >= Cmd->MaxLen[i]) {
+			DLOG("argument %d too long in %s message\n", i + 1, msg);
+			lCommandsInvalid++;
+			return(0);
+		}
+	}
+
+	return(Cmd->Handler(ix, Args));
+}
+
+/*
+ * Binary protocol (v2) requests. They are dispatched by opcode. Each request
+ * gets at least one reply carrying its id (PVD_OP_ACK if nothing else is
+ * expected), the status telling if it has failed
+ */
+#define	BIN_PVDNAME	0x01	// PVD_TLV_PVDNAME needed
+#define	BIN_KEY		0x02	// PVD_TLV_KEY needed
+
+typedef	struct {
+	int	Needed;		// BIN_xxx
+	int	(*Handler)(int ix, unsigned int Id, char *pvdname, char *Key);
+}	t_BinaryCommand;
+
+// BinaryReply : send a reply without payload, releasing the client on error
+static	int	BinaryReply(int ix, int Opcode, int Status, unsigned int Id)
+{
+	if (SendBinary(ix, Opcode, Status, Id, NULL, 0, NULL) == -1) {
+		ReleaseClient(ix);
+		return(-1);
+	}
+	return(0);
+}
+
+static	int	BinGetList(int ix, unsigned int Id, char *pvdname, char *Key)
+{
+	int		rc = -1;
+	t_BinaryBuffer	BB;
+
+	BBInit(&BB);
+	if (BinaryPvdList(&BB) == 0) {
+		rc = SendBinary(ix, PVD_OP_LIST, PVD_STATUS_OK, Id, BB.Data, BB.Length, NULL);
+	}
+	BBUninit(&BB);
+
+	if (rc == -1) {
+		ReleaseClient(ix);
+	}
+	return(rc);
+}
+
+// BinSendAttributes : send the (cached) attributes of a pvd. The reply
+// ends with the generation of the pvd (PVD_TLV_GENERATION), as the text
+// one sent to the clients having selected the delta notifications. Returns
+// 1 if the attributes could not be rendered (a PVD_STATUS_FAILED reply is
+// sent instead)
+static	int	BinSendAttributes(int ix, unsigned int Id, t_Pvd *PtPvd)
+{
+	char		Header[PVD_BIN_HEADER_SIZE];
+	char		Tlv[PVD_BIN_TLV_SIZE + 4];
+	char		*Payload;
+	int		Length;
+	int		l;
+	struct iovec	iov[3];
+
+	if ((Payload = GetBinaryAttributes(PtPvd, &Length)) == NULL) {
+		if (BinaryReply(ix, PVD_OP_ATTRIBUTES, PVD_STATUS_FAILED, Id) == -1) {
+			return(-1);
+		}
+		return(1);
+	}
+	l = BinPutTlvInt(Tlv, PVD_TLV_GENERATION, PtPvd->generation);
+
+	BinPutHeader(Header, PVD_OP_ATTRIBUTES, PVD_STATUS_OK, Id, Length + l);
+
+	SetIovec(&iov[0], Header, sizeof(Header));
+	SetIovec(&iov[1], Payload, Length);
+	SetIovec(&iov[2], Tlv, l);
+
+	if (SendToClient(ix, iov, 3, NULL) == -1) {
+		ReleaseClient(ix);
+		return(-1);
+	}
+	return(0);
+}
+
+// All the pvd are sent for *, followed by a PVD_OP_ACK (PVD_STATUS_FAILED
+// if some of them could not be sent : the list is incomplete)
+static	int	BinGetAttributes(int ix, unsigned int Id, char *pvdname, char *Key)
+{
+	t_Pvd	*PtPvd;
+	int	rc;
+	int	Status = PVD_STATUS_OK;
+
+	if (EQSTR(pvdname, "*")) {
+		for (PtPvd = lFirstPvd; PtPvd != NULL; PtPvd = PtPvd->next) {
+			if ((rc = BinSendAttributes(ix, Id, PtPvd)) == -1) {
+				return(-1);
+			}
+			if (rc == 1) {
+				Status = PVD_STATUS_FAILED;
+			}
+		}
+		return(BinaryReply(ix, PVD_OP_ACK, Status, Id));
+	}
+
+	if ((PtPvd = GetPvd(pvdname)) == NULL) {
+		if (SendBinaryPvdName(ix, PVD_OP_ATTRIBUTES, PVD_STATUS_UNKNOWN_PVD,
+				      Id, pvdname) == -1) {
+			ReleaseClient(ix);
+			return(-1);
+		}
+		return(0);
+	}
+	return(BinSendAttributes(ix, Id, PtPvd) == -1 ? -1 : 0);
+}
+
+static	int	BinGetAttribute(int ix, unsigned int Id, char *pvdname, char *Key)
+{
+	int		rc = -1;
+	int		Status = PVD_STATUS_OK;
+	t_Pvd		*PtPvd;
+	t_PvdAttribute	*Attr = NULL;
+	t_BinaryBuffer	BB;
+
+	if ((PtPvd = GetPvd(pvdname)) == NULL) {
+		Status = PVD_STATUS_UNKNOWN_PVD;
+	} else
+	if ((Attr = ATLookup(&PtPvd->Attributes, Key)) == NULL) {
+		Status = PVD_STATUS_UNKNOWN_ATTRIBUTE;
+	}
+
+	BBInit(&BB);
+	BBAddTlvString(&BB, PVD_TLV_PVDNAME, pvdname);
+	BBAddTlvString(&BB, PVD_TLV_KEY, Key);
+	if (Attr != NULL) {
+		BBAddTlvString(&BB, PVD_TLV_VALUE, Attr->Value);
+	}
+	if (! BB.Error) {
+		rc = SendBinary(ix, PVD_OP_ATTRIBUTE, Status, Id, BB.Data, BB.Length, NULL);
+	}
+	BBUninit(&BB);
+
+	if (rc == -1) {
+		ReleaseClient(ix);
+	}
+	return(rc);
+}
+
+static	int	BinSubscribe(int ix, unsigned int Id, char *pvdname, char *Key)
+{
+	int	Status = AddSubscription(ix, pvdname) == -1 ?
+				PVD_STATUS_FAILED : PVD_STATUS_OK;
+
+	return(BinaryReply(ix, PVD_OP_ACK, Status, Id));
+}
+
+static	int	BinUnsubscribe(int ix, unsigned int Id, char *pvdname, char *Key)
+{
+	RemoveSubscription(ix, pvdname);
+	return(BinaryReply(ix, PVD_OP_ACK, PVD_STATUS_OK, Id));
+}
+
+static	int	BinSubscribeNotifications(int ix, unsigned int Id, char *pvdname, char *Key)
+{
+	lTabClients[ix].SubscriptionMask = 0xFF;
+	return(BinaryReply(ix, PVD_OP_ACK, PVD_STATUS_OK, Id));
+}
+
+static	int	BinUnsubscribeNotifications(int ix, unsigned int Id, char *pvdname, char *Key)
+{
+	lTabClients[ix].SubscriptionMask = 0;
+	return(BinaryReply(ix, PVD_OP_ACK, PVD_STATUS_OK, Id));
+}
+
+// BinGetSnapshotEventFd : give a local client an eventfd signaled on each
+// update of the shared memory snapshot. It is released with the client
+static	int	BinGetSnapshotEventFd(int ix, unsigned int Id, char *pvdname, char *Key)
+{
+	int		rc;
+	t_PvdClient	*pt = &lTabClients[ix];
+
+	if (! lSnapshot || ! pt->local) {
+		return(BinaryReply(ix, PVD_OP_ACK, PVD_STATUS_INVALID_REQUEST, Id));
+	}
+
+	if (pt->eventFd == -1) {
+		if ((pt->eventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) == -1) {
+			DLOG("eventfd : %s\n", strerror(errno));
+			return(BinaryReply(ix, PVD_OP_ACK, PVD_STATUS_FAILED, Id));
+		}
+		AddEventFdClient(ix);
+	}
+
+	if ((rc = SendBinaryFd(ix, PVD_OP_ACK, Id, pt->eventFd)) == 1) {
+		return(BinaryReply(ix, PVD_OP_ACK, PVD_STATUS_FAILED, Id));
+	}
+	if (rc == -1) {
+		ReleaseClient(ix);
+	}
+	return(rc);
+}
+
+static	t_BinaryCommand	lBinaryCommands[] = {
+	[PVD_OP_GET_LIST] = { 0, BinGetList },
+	[PVD_OP_GET_ATTRIBUTES] = { BIN_PVDNAME, BinGetAttributes },
+	[PVD_OP_GET_ATTRIBUTE] = { BIN_PVDNAME | BIN_KEY, BinGetAttribute },
+	[PVD_OP_SUBSCRIBE] = { BIN_PVDNAME, BinSubscribe },
+	[PVD_OP_UNSUBSCRIBE] = { BIN_PVDNAME, BinUnsubscribe },
+	[PVD_OP_SUBSCRIBE_NOTIFICATIONS] = { 0, BinSubscribeNotifications },
+	[PVD_OP_UNSUBSCRIBE_NOTIFICATIONS] = { 0, BinUnsubscribeNotifications },
+	[PVD_OP_GET_SNAPSHOT_EVENTFD] = { 0, BinGetSnapshotEventFd },
+};
+
+// DispatchBinaryMessage : handle a binary protocol request (header
+// included). Invalid requests are answered with an error status
+static	int	DispatchBinaryMessage(char *msg, int ix)
+{
+	t_BinaryHeader	H;
+	t_BinaryCommand	*Cmd = NULL;
+	char		pvdname[PVDNAMSIZ];
+	char		attributeName[ATTRNAMSIZ];
+	char		*pt = msg + PVD_BIN_HEADER_SIZE;
+	char		*Value;
+	int		Type;
+	int		Length;
+	int		Found = 0;
+
+	BinGetHeader(msg, &H);
+
+	lBinaryRequests++;
+
+	if (H.Version == PVD_BIN_VERSION && H.Opcode < DIM(lBinaryCommands)) {
+		Cmd = &lBinaryCommands[H.Opcode];
+	}
+	if (Cmd == NULL || Cmd->Handler == NULL) {
+		DLOG("invalid binary request (opcode %d, version %d)\n", H.Opcode, H.Version);
+		goto Invalid;
+	}
+
+	// Unknown TLVs are ignored
+	while (BinNextTlv(&pt, msg + PVD_BIN_HEADER_SIZE + H.Length,
+			  &Type, &Value, &Length) == 0) {
+		if (Type == PVD_TLV_PVDNAME) {
+			if (BinGetTlvString(Value, Length, pvdname, sizeof(pvdname)) == -1) {
+				goto Invalid;
+			}
+			Found |= BIN_PVDNAME;
+		} else
+		if (Type == PVD_TLV_KEY) {
+			if (BinGetTlvString(Value, Length, attributeName, sizeof(attributeName)) == -1) {
+				goto Invalid;
+			}
+			Found |= BIN_KEY;
+		}
+	}
+	if ((Found & Cmd->Needed) != Cmd->Needed) {
+		DLOG("binary request (opcode %d) with missing arguments\n", H.Opcode);
+		goto Invalid;
+	}
+
+	return(Cmd->Handler(ix, H.Id, pvdname, attributeName));
+
+Invalid :
+	lCommandsInvalid++;
+
+	return(BinaryReply(ix, PVD_OP_ACK, PVD_STATUS_INVALID_REQUEST, H.Id));
+}
+
+// HandleDatagrams : binary requests have arrived on a SOCK_SEQPACKET
+// socket. Each datagram is a whole message : it is dispatched as is
+// The socket is drained until EAGAIN
+static	int	HandleDatagrams(int ix)
+{
+	static	char	lDatagram[IB_MAXSIZE];
+
+	int		s = lTabClients[ix].s;
+	int		n;
+	t_BinaryHeader	H;
+
+	while (lTabClients[ix].s == s) {
+		if ((n = recv(s, lDatagram, sizeof(lDatagram), MSG_TRUNC)) <= 0) {
+			if (n == -1 && errno == EINTR) {
+				continue;
+			}
+			if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+				return(0);
+			}
+			DLOG("client for socket %d (seqpacket) disconnected (n = %d)\n", s, n);
+			ReleaseClient(ix);
+			return(-1);
+		}
+		if (n > sizeof(lDatagram)) {
+			DLOG("client for socket %d : binary message too long (%d)\n", s, n);
+			ReleaseClient(ix);
+			return(-1);
+		}
+		if (n < PVD_BIN_HEADER_SIZE) {
+			lCommandsInvalid++;
+			continue;
+		}
+		BinGetHeader(lDatagram, &H);
+		if (H.Length != n - PVD_BIN_HEADER_SIZE) {
+			lCommandsInvalid++;
+			BinaryReply(ix, PVD_OP_ACK, PVD_STATUS_INVALID_REQUEST, H.Id);
+			continue;
+		}
+		DispatchBinaryMessage(lDatagram, ix);
+	}
+	// The client has been released while handling its messages
+	return(-1);
+}
+
+// A message has arrived on a socket of a given type (undefined, general, pvdid or
+// control). Read it and handle it. We have specified line oriented messages
+// A message can be built of multiple lines. Lines may span several reads
+// (the partial line is kept in the client's input buffer), and a read may
+// bring many pipelined lines. Once promoted to the binary protocol (v2), the
+// connection carries binary messages instead of lines
+// The socket is drained until EAGAIN (the epoll set is edge triggered)
+static	int	HandleMessage(int ix)
+{
+	int		s = lTabClients[ix].s;
+	int		type = lTabClients[ix].type;
+	t_InputBuffer	*B = &lTabClients[ix].Input;
+
+	int		n;
+	char		*msg;
+	t_BinaryHeader	H;
+
+	while (lTabClients[ix].s == s) {
+		if ((n = IBRead(B, s)) <= 0) {
+			if (n == -1 && errno == EINTR) {
+				continue;
+			}
+			if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+				return(0);
+			}
+			// Client disconnected. An unterminated last line is
+			// still honored
+			DLOG("client for socket %d (type %d) disconnected (n = %d)\n", s, type, n);
+			if (n == 0 &&
+			    lTabClients[ix].type != SOCKET_BINARY_V2 &&
+			    (msg = IBGetRemainder(B)) != NULL) {
+				DispatchMessage(msg, ix);
+			}
+			if (lTabClients[ix].s == s) {
+				ReleaseClient(ix);
+			}
+			return(-1);
+		}
+
+		if (n != 1) {
+			DLOG("client for socket %d : message len = %d\n", s, n);
+		}
+
+		// Dispatching a message can release the client, or promote
+		// the connection to the binary protocol
+		while (lTabClients[ix].s == s) {
+			if (lTabClients[ix].type != SOCKET_BINARY_V2) {
+				if ((msg = IBGetLine(B)) == NULL) {
+					break;
+				}
+				DispatchMessage(msg, ix);
+				continue;
+			}
+			if ((msg = IBPeek(B, PVD_BIN_HEADER_SIZE)) == NULL) {
+				break;
+			}
+			BinGetHeader(msg, &H);
+			if (H.Length > IB_MAXSIZE - PVD_BIN_HEADER_SIZE) {
+				DLOG("client for socket %d : binary message too long (%u)\n",
+				     s, H.Length);
+				ReleaseClient(ix);
+				break;
+			}
+			if ((msg = IBGetBytes(B, PVD_BIN_HEADER_SIZE + H.Length)) == NULL) {
+				break;
+			}
+			DispatchBinaryMessage(msg, ix);
+		}
+	}
+	// The client has been released while handling its messages
+	return(-1);
+}
+
+static	int	RegisterPvdAttributes(struct net_pvd_attribute *pa)
+{
+	int	i;
+	char	*pt;
+	char	sAddr[INET6_ADDRSTRLEN + 1];
+	t_Pvd	*PtPvd = RegisterPvd(pa->index, pa->name);
+
+	if (PtPvd == NULL) {
+		// Fatal error
+		fprintf(stderr, "Can not register pvd %s\n", pa->name);
+		return(-1);
+	}
+	PvdBeginTransaction(pa->name);
+	PvdSetAttr(
+		PtPvd,
+		"sequenceNumber",
+		GetIntStr(pa->sequence_number));
+	PvdSetAttr(PtPvd, "hFlag", GetIntStr(pa->h_flag));
+	PvdSetAttr(PtPvd, "lFlag", GetIntStr(pa->l_flag));
+	PvdSetAttr(PtPvd, "aFlag", GetIntStr(pa->a_flag));   // introduced in draft-01
+	PvdSetAttr(PtPvd, "implicit", pa->implicit_flag ? "true" : "false");
+	PvdSetAttr(
+		PtPvd,
+		"lla",
+		Stringify(addrtostr(&pa->lla, sAddr, sizeof(sAddr))));
+	PvdSetAttr(PtPvd, "dev", Stringify(JsonString(pa->dev)));
+
+	PvdSetAttr(
+		PtPvd,
+		"addresses",
+		pt = In6AddrToJsonArray(
+			pa->naddresses,
+			pa->addresses,
+			pa->addr_prefix_len));
+	free(pt);
+
+	PvdSetAttr(
+		PtPvd,
+		"routes",
+		pt = In6RoutesToJsonArray(pa->nroutes, pa->routes));
+	free(pt);
+
+	/*
+	 * User options now : RDNSS/DNSSL
+	 */
+	for (i = 0; i < pa->nrdnss; i++) {
+		PtPvd->KernelRdnss[i] = pa->rdnss[i];
+	}
+	PtPvd->nKernelRdnss = pa->nrdnss;
+
+	for (i = 0; i < PtPvd->nKernelDnssl; i++) {
+		free(PtPvd->KernelDnssl[i]);
+	}
+	for (i = 0; i < pa->ndnssl; i++) {
+		PtPvd->KernelDnssl[i] = strdup(pa->dnssl[i]);
+	}
+	PtPvd->nKernelDnssl = pa->ndnssl;
+
+	PvdSetAttr(
+		PtPvd,
+		"rdnss",
+		pt = PvdRdnssToJsonArray(PtPvd));
+	free(pt);
+
+	PvdSetAttr(
+		PtPvd,
 		"dnssl",
 		pt = PvdDnsslToJsonArray(PtPvd));
 	free(pt);
 
 	PvdEndTransaction(PtPvd);
 
-	return(0);
+	return(0);
+}
+
+static	int	DeleteRdnss(int *nrdnss, struct in6_addr *rdnss, struct in6_addr *oneRdnss)
+{
+	int	i, j;
+
+	for (i = 0; i < *nrdnss; i++) {
+		if (memcmp(&rdnss[i], oneRdnss, sizeof(*oneRdnss)) == 0) {
+			for (j = i + 1; j < *nrdnss; j++) {
+				rdnss[j - 1] = rdnss[j];
+			}
+			(*nrdnss)--;
+			return(1);
+		}
+	}
+	return(0);
+}
+
+static	int	DeleteDnssl(int *ndnssl, char **dnssl, char *oneDnssl)
+{
+	int	i, j;
+
+	for (i = 0; i < *ndnssl; i++) {
+		if (EQSTR(dnssl[i], oneDnssl)) {
+			free(dnssl[i]);
+			for (j = i + 1; j < *ndnssl; j++) {
+				dnssl[j - 1] = dnssl[j];
+			}
+			(*ndnssl)--;
+			return(1);
+		}
+	}
+	return(0);
+}
+
+// HandleRtNetlink : read and handle one rtnetlink message. Returns -1 if
+// no message could be read (the socket is non blocking). An interrupted
+// read, or messages lost by the kernel (ENOBUFS), are not the end of the
+// queue : the caller must go on reading (the socket is edge triggered)
+static	int	HandleRtNetlink(t_rtnetlink_cnx *cnx)
+{
+	void *vmsg;
+	int type;
+	int rc;
+	t_Pvd *PtPvd;
+
+	errno = 0;
+	if ((vmsg = rtnetlink_recv(cnx, &type)) == NULL) {
+		if (errno == ENOBUFS) {
+			DLOG("rtnetlink messages lost (ENOBUFS)\n");
+		}
+		return(errno == EINTR || errno == ENOBUFS ? 0 : -1);
+	}
+
+	if (type == RTM_PVDSTATUS) {
+		struct pvdmsg *pvdmsg = vmsg;
+		struct net_pvd_attribute attr;
+
+		printf("HandleRtNetlink : RTM_PVDSTATUS received\n");
+
+		if (pvdmsg->pvd_state == PVD_NEW || pvdmsg->pvd_state == PVD_UPDATE) {
+			if (kernel_get_pvd_attributes(pvdmsg->pvd_name, &attr) == 0) {
+				RegisterPvdAttributes(&attr);
+			}
+			else {
+				perror("kernel_get_pvd_attribute");
+			}
+			return(0);
+		}
+
+		if (pvdmsg->pvd_state == PVD_DEL) {
+			UnregisterPvd(pvdmsg->pvd_name);
+			return(0);
+		}
+		return(0);
+	}
+
+	if (type == RTM_RDNSS) {
+		struct rdnssmsg *rdnssmsg = vmsg;
+
+		DLOG("HandleRtNetlink : RTM_RDNSS received (state = %s)\n",
+			rdnssmsg->rdnss_state == RDNSS_DEL ?
+				"RDNSS_DEL" : "RDNSS_NEW");
+
+		/*
+		 * RDNSS_DEL can reference a user defined RDNSS
+		 */
+		if (rdnssmsg->rdnss_state == RDNSS_DEL) {
+			if ((PtPvd = GetPvdByName(rdnssmsg->pvd_name)) != NULL) {
+				rc = DeleteRdnss(
+					&PtPvd->nKernelRdnss,
+					PtPvd->KernelRdnss,
+					&rdnssmsg->rdnss);
+				rc += DeleteRdnss(
+					&PtPvd->nUserRdnss,
+					PtPvd->UserRdnss,
+					&rdnssmsg->rdnss);
+				if (rc != 0) {
+					NotifyPvdAttributes(PtPvd);
+				}
+			}		
+		}
+		return(0);
+	}
+
+	if (type == RTM_DNSSL) {
+		struct dnsslmsg *dnsslmsg = vmsg;
+
+		DLOG("HandleRtNetlink : RTM_DNSSL received (state = %s)\n",
+			dnsslmsg->dnssl_state == DNSSL_DEL ?
+				"DNSSL_DEL" :"DNSSL_NEW");
+
+		/*
+		 * DNSSL_DEL can reference a user defined DNSSL
+		 */
+		if (dnsslmsg->dnssl_state == DNSSL_DEL) {
+			if ((PtPvd = GetPvdByName(dnsslmsg->pvd_name)) != NULL) {
+				rc = DeleteDnssl(
+					&PtPvd->nKernelDnssl,
+					PtPvd->KernelDnssl,
+					dnsslmsg->dnssl);
+				rc += DeleteDnssl(
+					&PtPvd->nUserDnssl,
+					PtPvd->UserDnssl,
+					dnsslmsg->dnssl);
+				if (rc != 0) {
+					NotifyPvdAttributes(PtPvd);
+				}
+			}
+		}
+		return(0);
+	}
+	return(0);
+}
+
+// RestorePvd : restore a pvd of the persistent state. The pvd that have
+// not been created by a control client (pvdid -1) are nevertheless
+// created when the RAs are parsed by the daemon itself : they will be
+// updated by the next RA
+static	void	RestorePvd(int pvdid, char *pvdname, t_AttributeTable *Attributes)
+{
+	int		i;
+	t_Pvd		*PtPvd;
+	t_PvdAttribute	*Attr = Attributes->Entries;
+
+	if ((PtPvd = GetPvd(pvdname)) == NULL &&
+	    (lKernelHasPvdSupport || (PtPvd = RegisterPvd(pvdid, pvdname)) == NULL)) {
+		DLOG("persistent pvd %s not restored\n", pvdname);
+		return;
+	}
+
+	for (i = 0; i < Attributes->nEntries; i++) {
+		if (Attr[i].Key != NULL) {
+			UpdateAttribute(PtPvd, Attr[i].Key, Attr[i].Value);
+		}
+	}
+	if (PtPvd->dirty) {
+		NotifyPvdAttributes(PtPvd);
+		PtPvd->dirty = false;
+	}
+}
+
+/*
+ * Warm restart. The running daemon serializes its state (SaveState()) when
+ * a new instance connects to its upgrade socket (HandleUpgrade()), and
+ * exits once the new instance, having rebuilt it (LoadState()), takes over
+ */
+
+// AddTlvInt : helper to encode an integer TLV (host order)
+static	void	AddTlvInt(t_BinaryBuffer *BB, int Type, int v)
+{
+	BBAddTlv(BB, Type, (char *) &v, sizeof(v));
+}
+
+// GetTlvInt : decode an integer TLV (-1 if invalid)
+static	int	GetTlvInt(char *Value, int Length)
+{
+	int	v = -1;
+
+	if (Length == sizeof(v)) {
+		memcpy(&v, Value, sizeof(v));
+	}
+	return(v);
+}
+
+// SaveState : serialize the listening sockets, the pvd and the clients
+// The file descriptors to hand over are collected in Fds, the records
+// giving their index
+static	void	SaveState(t_BinaryBuffer *BB, int *Listeners, int *Fds, int *nFds)
+{
+	int		i, j;
+	int		Flags;
+	t_Pvd		*PtPvd;
+	t_PvdClient	*pt;
+	t_PvdNameList	*Sub;
+	t_PvdAttribute	*Attr;
+	t_OutputQueue	*Q;
+	t_OutputMessage	*M;
+	char		*Record;
+	int		Length;
+
+	*nFds = 0;
+
+	for (i = 0; i < NLISTENERS; i++) {
+		if (Listeners[i] != -1) {
+			BBBeginMessage(BB, UPGRADE_REC_LISTENER, i, *nFds);
+			BBEndMessage(BB);
+			Fds[(*nFds)++] = Listeners[i];
+		}
+	}
+
+	// Oldest first, so that the new instance registers them in the
+	// same order
+	for (PtPvd = lFirstPvd; PtPvd != NULL && PtPvd->next != NULL; PtPvd = PtPvd->next) {
+		;
+	}
+	for (; PtPvd != NULL; PtPvd = PtPvd->prev) {
+		BBBeginMessage(BB, UPGRADE_REC_PVD, 0, PtPvd->pvdid);
+		BBAddTlvString(BB, PVD_TLV_PVDNAME, PtPvd->pvdname);
+		AddTlvInt(BB, UPGRADE_TLV_GENERATION, PtPvd->generation);
+
+		Attr = PtPvd->Attributes.Entries;
+		for (i = 0; i < PtPvd->Attributes.nEntries; i++) {
+			if (Attr[i].Key != NULL) {
+				BBAddTlvString(BB, PVD_TLV_KEY, Attr[i].Key);
+				BBAddTlvString(BB, PVD_TLV_VALUE, Attr[i].Value);
+			}
+		}
+		for (i = 0; i < PtPvd->nKernelRdnss; i++) {
+			BBAddTlv(BB, UPGRADE_TLV_KERNEL_RDNSS,
+				 (char *) &PtPvd->KernelRdnss[i], sizeof(struct in6_addr));
+		}
+		for (i = 0; i < PtPvd->nUserRdnss; i++) {
+			BBAddTlv(BB, UPGRADE_TLV_USER_RDNSS,
+				 (char *) &PtPvd->UserRdnss[i], sizeof(struct in6_addr));
+		}
+		for (i = 0; i < PtPvd->nKernelDnssl; i++) {
+			BBAddTlvString(BB, UPGRADE_TLV_KERNEL_DNSSL, PtPvd->KernelDnssl[i]);
+		}
+		for (i = 0; i < PtPvd->nUserDnssl; i++) {
+			BBAddTlvString(BB, UPGRADE_TLV_USER_DNSSL, PtPvd->UserDnssl[i]);
+		}
+		// With the remaining lifetimes, so that the pvd still expires
+		if ((Record = SaveRaState(PtPvd, &Length)) != NULL) {
+			BBAddTlv(BB, UPGRADE_TLV_RA_STATE, Record, Length);
+		}
+		BBEndMessage(BB);
+	}
+
+	for (i = 0; i < lNClients; i++) {
+		pt = &lTabClients[i];
+
+		if (pt->s == -1) {
+			continue;
+		}
+		BBBeginMessage(BB, UPGRADE_REC_CLIENT, pt->type, i);
+
+		AddTlvInt(BB, UPGRADE_TLV_SOCKET, *nFds);
+		Fds[(*nFds)++] = pt->s;
+		if (pt->eventFd != -1) {
+			AddTlvInt(BB, UPGRADE_TLV_EVENTFD, *nFds);
+			Fds[(*nFds)++] = pt->eventFd;
+		}
+
+		Flags = (pt->diffMode ? UPGRADE_DIFFMODE : 0) |
+			(pt->local ? UPGRADE_LOCAL : 0) |
+			(pt->seqpacket ? UPGRADE_SEQPACKET : 0);
+		AddTlvInt(BB, UPGRADE_TLV_FLAGS, Flags);
+		AddTlvInt(BB, UPGRADE_TLV_MASK, pt->SubscriptionMask);
+		AddTlvInt(BB, UPGRADE_TLV_UID, pt->uid);
+
+		for (Sub = pt->Subscription; Sub != NULL; Sub = Sub->next) {
+			BBAddTlvString(BB, PVD_TLV_PVDNAME, Sub->pvdname);
+		}
+		if (pt->pvdIdTransaction != NULL) {
+			BBAddTlvString(BB, UPGRADE_TLV_TRANSACTION, pt->pvdIdTransaction);
+		}
+		if (pt->multiLines) {
+			BBAddTlv(BB, UPGRADE_TLV_MULTILINES, pt->SB.String, pt->SB.Length);
+		}
+		if (pt->Input.Length > 0) {
+			BBAddTlv(BB, UPGRADE_TLV_INPUT,
+				 pt->Input.Data + pt->Input.Start, pt->Input.Length);
+		}
+
+		// What remains of the messages (the head one may have been
+		// partially written)
+		Q = &pt->Output;
+		for (j = 0; j < Q->Count; j++) {
+			M = &Q->Messages[(Q->Head + j) & (Q->Size - 1)];
+			if (M->Key != NULL) {
+				BBAddTlvString(BB, UPGRADE_TLV_OUTPUT_KEY, M->Key);
+			}
+			BBAddTlv(BB, UPGRADE_TLV_OUTPUT,
+				 M->Data + (j == 0 ? Q->Offset : 0),
+				 M->Length - (j == 0 ? Q->Offset : 0));
+		}
+		BBEndMessage(BB);
+	}
+}
+
+// TakeFd : adopt a file descriptor, given its index in the transfer (-1 if
+// invalid, or already adopted)
+static	int	TakeFd(int *Fds, int nFds, int Index)
+{
+	int	fd;
+
+	if (Index < 0 || Index >= nFds) {
+		return(-1);
+	}
+	fd = Fds[Index];
+	Fds[Index] = -1;
+
+	return(fd);
+}
+
+// LoadPvd : rebuild a pvd. Its attributes replace the default ones (or the
+// ones retrieved from the kernel)
+static	void	LoadPvd(unsigned int pvdid, char *pt, char *End)
+{
+	int		i;
+	int		Type;
+	int		Length;
+	char		*Value;
+	char		*value_;
+	char		pvdname[PVDNAMSIZ];
+	char		Key[ATTRNAMSIZ];
+	t_Pvd		*PtPvd;
+
+	if (BinNextTlv(&pt, End, &Type, &Value, &Length) == -1 ||
+	    Type != PVD_TLV_PVDNAME ||
+	    BinGetTlvString(Value, Length, pvdname, sizeof(pvdname)) == -1) {
+		DLOG("upgrade : invalid pvd record\n");
+		return;
+	}
+	if ((PtPvd = RegisterPvd(pvdid, pvdname)) == NULL) {
+		return;
+	}
+
+	ATUninit(&PtPvd->Attributes);
+	ATInit(&PtPvd->Attributes);
+	InvalidateAttributesFrame(PtPvd);
+	PtPvd->changes = ++lPvdChanges;
+	ClearRemovedKeys(PtPvd);
+	for (i = 0; i < PtPvd->nKernelDnssl; i++) {
+		free(PtPvd->KernelDnssl[i]);
+	}
+	for (i = 0; i < PtPvd->nUserDnssl; i++) {
+		free(PtPvd->UserDnssl[i]);
+	}
+	PtPvd->nKernelRdnss = PtPvd->nUserRdnss = 0;
+	PtPvd->nKernelDnssl = PtPvd->nUserDnssl = 0;
+
+	Key[0] = '\0';
+
+	while (BinNextTlv(&pt, End, &Type, &Value, &Length) == 0) {
+		if (Type == UPGRADE_TLV_GENERATION) {
+			PtPvd->generation = GetTlvInt(Value, Length);
+		} else
+		if (Type == PVD_TLV_KEY) {
+			if (BinGetTlvString(Value, Length, Key, sizeof(Key)) == -1) {
+				Key[0] = '\0';
+			}
+		} else
+		if (Type == PVD_TLV_VALUE && Key[0] != '\0') {
+			if ((value_ = strndup(Value, Length)) != NULL &&
+			    ATAdd(&PtPvd->Attributes, Key, value_) == NULL) {
+				free(value_);
+			}
+		} else
+		if (Type == UPGRADE_TLV_KERNEL_RDNSS &&
+		    Length == sizeof(struct in6_addr) &&
+		    PtPvd->nKernelRdnss < MAXRDNSSPERPVD) {
+			memcpy(&PtPvd->KernelRdnss[PtPvd->nKernelRdnss++], Value, Length);
+		} else
+		if (Type == UPGRADE_TLV_USER_RDNSS &&
+		    Length == sizeof(struct in6_addr) &&
+		    PtPvd->nUserRdnss < MAXRDNSSPERPVD) {
+			memcpy(&PtPvd->UserRdnss[PtPvd->nUserRdnss++], Value, Length);
+		} else
+		if (Type == UPGRADE_TLV_KERNEL_DNSSL && PtPvd->nKernelDnssl < MAXDNSSLPERPVD) {
+			if ((value_ = strndup(Value, Length)) != NULL) {
+				PtPvd->KernelDnssl[PtPvd->nKernelDnssl++] = value_;
+			}
+		} else
+		if (Type == UPGRADE_TLV_USER_DNSSL && PtPvd->nUserDnssl < MAXDNSSLPERPVD) {
+			if ((value_ = strndup(Value, Length)) != NULL) {
+				PtPvd->UserDnssl[PtPvd->nUserDnssl++] = value_;
+			}
+		} else
+		if (Type == UPGRADE_TLV_RA_STATE) {
+			LoadRaState(PtPvd, pvdname, Value, Length);
+		}
+	}
+
+	// Nothing to notify : the clients already know this state
+	PtPvd->dirty = false;
 }
 
-static	int	DeleteRdnss(int *nrdnss, struct in6_addr *rdnss, struct in6_addr *oneRdnss)
+// LoadClient : rebuild a client, in the slot it had. Its pending output is
+// only flushed once the transfer is complete (EPOLLOUT)
+static	void	LoadClient(t_BinaryHeader *H, char *pt, char *End, int *Fds, int nFds)
 {
-	int	i, j;
-
-	for (i = 0; i < *nrdnss; i++) {
-		if (memcmp(&rdnss[i], oneRdnss, sizeof(*oneRdnss)) == 0) {
-			for (j = i + 1; j < *nrdnss; j++) {
-				rdnss[j - 1] = rdnss[j];
+	int		ix = H->Id;
+	int		v;
+	int		Type;
+	int		Length;
+	char		*Value;
+	char		*Key = NULL;
+	char		pvdname[PVDNAMSIZ];
+	t_PvdClient	*PtClient;
+
+	if (ix >= MAXCLIENTS || (ix < lNClients && lTabClients[ix].s != -1)) {
+		DLOG("upgrade : invalid client record (%d)\n", ix);
+		return;
+	}
+	while (lNClients <= ix) {
+		lTabClients[lNClients++].s = -1;
+	}
+	PtClient = &lTabClients[ix];
+	InitClient(PtClient, -1);
+	PtClient->type = H->Status;
+
+	while (BinNextTlv(&pt, End, &Type, &Value, &Length) == 0) {
+		v = GetTlvInt(Value, Length);
+
+		if (Type == UPGRADE_TLV_SOCKET) {
+			PtClient->s = TakeFd(Fds, nFds, v);
+		} else
+		if (Type == UPGRADE_TLV_EVENTFD) {
+			if ((PtClient->eventFd = TakeFd(Fds, nFds, v)) != -1) {
+				AddEventFdClient(ix);
+			}
+		} else
+		if (Type == UPGRADE_TLV_FLAGS) {
+			PtClient->diffMode = (v & UPGRADE_DIFFMODE) != 0;
+			PtClient->local = (v & UPGRADE_LOCAL) != 0;
+			PtClient->seqpacket = (v & UPGRADE_SEQPACKET) != 0;
+		} else
+		if (Type == UPGRADE_TLV_MASK) {
+			PtClient->SubscriptionMask = v;
+		} else
+		if (Type == UPGRADE_TLV_UID) {
+			PtClient->uid = v;
+		} else
+		if (Type == PVD_TLV_PVDNAME) {
+			if (BinGetTlvString(Value, Length, pvdname, sizeof(pvdname)) == 0) {
+				AddSubscription(ix, pvdname);
+			}
+		} else
+		if (Type == UPGRADE_TLV_TRANSACTION) {
+			PtClient->pvdIdTransaction = strndup(Value, Length);
+		} else
+		if (Type == UPGRADE_TLV_MULTILINES) {
+			PtClient->multiLines = true;
+			SBAddString(&PtClient->SB, "%.*s", Length, Value);
+		} else
+		if (Type == UPGRADE_TLV_INPUT) {
+			IBAppend(&PtClient->Input, Value, Length);
+		} else
+		if (Type == UPGRADE_TLV_OUTPUT_KEY) {
+			if (Key != NULL) {
+				free(Key);
+			}
+			Key = strndup(Value, Length);
+		} else
+		if (Type == UPGRADE_TLV_OUTPUT) {
+			OQQueue(&PtClient->Output, Value, Length, Key);
+			if (Key != NULL) {
+				free(Key);
+				Key = NULL;
 			}
-			(*nrdnss)--;
-			return(1);
 		}
 	}
-	return(0);
+	if (Key != NULL) {
+		free(Key);
+	}
+
+	if (PtClient->s == -1) {
+		DLOG("upgrade : client %d without socket\n", ix);
+		ReleaseClient(ix);
+	}
 }
 
-static	int	DeleteDnssl(int *ndnssl, char **dnssl, char *oneDnssl)
+// LoadState : rebuild the pvd and the clients. The listening sockets are
+// returned in Listeners. The file descriptors not adopted are closed
+static	int	LoadState(char *State, int Length, int *Fds, int nFds, int *Listeners)
 {
-	int	i, j;
+	int		i;
+	char		*pt = State;
+	char		*End = State + Length;
+	char		*Payload;
+	t_BinaryHeader	H;
+
+	while (End - pt >= PVD_BIN_HEADER_SIZE) {
+		BinGetHeader(pt, &H);
+		if (H.Length > End - pt - PVD_BIN_HEADER_SIZE) {
+			break;
+		}
+		Payload = pt + PVD_BIN_HEADER_SIZE;
+		pt = Payload + H.Length;
 
-	for (i = 0; i < *ndnssl; i++) {
-		if (EQSTR(dnssl[i], oneDnssl)) {
-			free(dnssl[i]);
-			for (j = i + 1; j < *ndnssl; j++) {
-				dnssl[j - 1] = dnssl[j];
+		if (H.Opcode == UPGRADE_REC_LISTENER) {
+			if (H.Status < NLISTENERS && Listeners[H.Status] == -1) {
+				Listeners[H.Status] = TakeFd(Fds, nFds, H.Id);
 			}
-			(*ndnssl)--;
-			return(1);
+		} else
+		if (H.Opcode == UPGRADE_REC_PVD) {
+			LoadPvd(H.Id, Payload, pt);
+		} else
+		if (H.Opcode == UPGRADE_REC_CLIENT) {
+			LoadClient(&H, Payload, pt, Fds, nFds);
+		}
+	}
+
+	for (i = 0; i < nFds; i++) {
+		if (Fds[i] != -1) {
+			close(Fds[i]);
 		}
 	}
+
+	if (pt != End) {
+		DLOG("upgrade : truncated state\n");
+		return(-1);
+	}
 	return(0);
 }
 
-static	void	HandleRtNetlink(t_rtnetlink_cnx *cnx)
+// HandleUpgrade : a new instance of the daemon is connecting to the upgrade
+// socket (root, or the daemon's user only). The service is suspended while
+// the state is handed over, then the daemon exits. If the transfer fails,
+// it goes on serving. Returns -1 when there is no more pending connection
+static	int	HandleUpgrade(int upgradeServerSock, int *Listeners)
 {
-	void *vmsg;
-	int type;
-	int rc;
-	t_Pvd *PtPvd;
-
-	if ((vmsg = rtnetlink_recv(cnx, &type)) == NULL) {
-		return;
+	int		s;
+	int		nFds;
+	int		Fds[NLISTENERS + 2 * MAXCLIENTS];
+	struct ucred	cred;
+	socklen_t	credlen = sizeof(cred);
+	t_BinaryBuffer	BB;
+
+	if ((s = accept4(upgradeServerSock, NULL, NULL, SOCK_CLOEXEC)) == -1) {
+		if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+			DLOG("accept : %s\n", strerror(errno));
+		}
+		return(errno == EINTR ? 0 : -1);
 	}
 
-	if (type == RTM_PVDSTATUS) {
-		struct pvdmsg *pvdmsg = vmsg;
-		struct net_pvd_attribute attr;
+	if (getsockopt(s, SOL_SOCKET, SO_PEERCRED, &cred, &credlen) == -1 ||
+	    (cred.uid != 0 && cred.uid != geteuid())) {
+		DLOG("upgrade refused (uid %d)\n", (int) cred.uid);
+		close(s);
+		return(0);
+	}
 
-		printf("HandleRtNetlink : RTM_PVDSTATUS received\n");
+	// Nothing must be left behind
+	FlushPendingNotifications();
+	JournalFlush();
 
-		if (pvdmsg->pvd_state == PVD_NEW || pvdmsg->pvd_state == PVD_UPDATE) {
-			if (kernel_get_pvd_attributes(pvdmsg->pvd_name, &attr) == 0) {
-				RegisterPvdAttributes(&attr);
-			}
-			else {
-				perror("kernel_get_pvd_attribute");
-			}
-			return;
-		}
+	BBInit(&BB);
+	SaveState(&BB, Listeners, Fds, &nFds);
 
-		if (pvdmsg->pvd_state == PVD_DEL) {
-			UnregisterPvd(pvdmsg->pvd_name);
-			return;
-		}
-		return;
+	if (BB.Error ||
+	    UpgradeSend(s, Fds, nFds, BB.Data, BB.Length) == -1 ||
+	    UpgradeWaitDone(s) == -1) {
+		DLOG("upgrade failed : service goes on\n");
+		BBUninit(&BB);
+		close(s);
+		return(0);
 	}
 
-	if (type == RTM_RDNSS) {
-		struct rdnssmsg *rdnssmsg = vmsg;
+	if (lFlagVerbose) {
+		fprintf(stderr,
+			"%s : %d file descriptors and %d bytes of state handed over, exiting\n",
+			lMyName,
+			nFds,
+			BB.Length);
+	}
+	exit(0);
+}
 
-		DLOG("HandleRtNetlink : RTM_RDNSS received (state = %s)\n",
-			rdnssmsg->rdnss_state == RDNSS_DEL ?
-				"RDNSS_DEL" : "RDNSS_NEW");
+// TakeOver : receive the sockets and the state of the running daemon. The
+// listening sockets are returned in Listeners (-1 for the missing ones)
+static	int	TakeOver(int s, int *Listeners)
+{
+	int	i;
+	int	rc;
+	int	*Fds;
+	int	nFds;
+	char	*State;
+	int	Length;
 
-		/*
-		 * RDNSS_DEL can reference a user defined RDNSS
-		 */
-		if (rdnssmsg->rdnss_state == RDNSS_DEL) {
-			if ((PtPvd = GetPvdByName(rdnssmsg->pvd_name)) != NULL) {
-				rc = DeleteRdnss(
-					&PtPvd->nKernelRdnss,
-					PtPvd->KernelRdnss,
-					&rdnssmsg->rdnss);
-				rc += DeleteRdnss(
-					&PtPvd->nUserRdnss,
-					PtPvd->UserRdnss,
-					&rdnssmsg->rdnss);
-				if (rc != 0) {
-					NotifyPvdAttributes(PtPvd);
-				}
-			}		
-		}
-		return;
+	for (i = 0; i < NLISTENERS; i++) {
+		Listeners[i] = -1;
 	}
 
-	if (type == RTM_DNSSL) {
-		struct dnsslmsg *dnsslmsg = vmsg;
+	if (UpgradeReceive(s, &Fds, &nFds, &State, &Length) == -1) {
+		return(-1);
+	}
 
-		DLOG("HandleRtNetlink : RTM_DNSSL received (state = %s)\n",
-			dnsslmsg->dnssl_state == DNSSL_DEL ?
-				"DNSSL_DEL" :"DNSSL_NEW");
+	rc = LoadState(State, Length, Fds, nFds, Listeners);
 
-		/*
-		 * DNSSL_DEL can reference a user defined DNSSL
-		 */
-		if (dnsslmsg->dnssl_state == DNSSL_DEL) {
-			if ((PtPvd = GetPvdByName(dnsslmsg->pvd_name)) != NULL) {
-				rc = DeleteDnssl(
-					&PtPvd->nKernelDnssl,
-					PtPvd->KernelDnssl,
-					dnsslmsg->dnssl);
-				rc += DeleteDnssl(
-					&PtPvd->nUserDnssl,
-					PtPvd->UserDnssl,
-					dnsslmsg->dnssl);
-				if (rc != 0) {
-					NotifyPvdAttributes(PtPvd);
-				}
-			}
-		}
-		return;
+	if (lFlagVerbose) {
+		fprintf(stderr,
+			"%s : %d file descriptors and %d bytes of state taken over\n",
+			lMyName,
+			nFds,
+			Length);
 	}
+
+	free(Fds);
+	free(State);
+
+	return(rc);
 }
 
 int	main(int argc, char **argv)
 {
 	int		i;
 	int		Port = DEFAULT_PVDD_PORT;
+	char		*UnixSocket = NULL;
+	char		DefaultUnixSocket[64];
+	char		*Snapshot = NULL;
+	char		DefaultSnapshot[64];
+	int		QueueSize;
 	char		*PersistentDir = NULL;
 	int		sockIcmpv6 = -1;
-	int		serverSock;
+	int		serverSock = -1;
+	int		unixServerSock = -1;
+	int		seqpacketServerSock = -1;
+	int		upgradeServerSock = -1;
+	char		SeqpacketSocket[sizeof(((struct sockaddr_un *) 0)->sun_path) + 8];
+	char		UpgradeSocket[sizeof(((struct sockaddr_un *) 0)->sun_path) + 16];
+	int		Listeners[NLISTENERS];
+	int		FlagUpgrade = false;
+	int		upgradeSock = -1;
 	struct pvd_list	pvl;	/* careful : this can be quite big */
 	t_rtnetlink_cnx	*RtnlCnx = NULL;
 	int		sockRtnlink = -1;
@@ -1684,6 +3800,66 @@ int	main(int argc, char **argv)
 			}
 			continue;
 		}
+		if (EQSTR(argv[i], "-q") || EQSTR(argv[i], "--queue-size")) {
+			if (++i < argc) {
+				if (getint(argv[i], &QueueSize) == -1 || QueueSize <= 0) {
+					return(usage("invalid queue size (-q option)"));
+				}
+				OQSetHighWaterMark(QueueSize);
+			}
+			else {
+				return(usage("missing argument for -q option"));
+			}
+			continue;
+		}
+		if (EQSTR(argv[i], "--queue-policy")) {
+			if (++i < argc) {
+				if (OQSetPolicy(argv[i]) == -1) {
+					return(usage("invalid queue policy (--queue-policy option)"));
+				}
+			}
+			else {
+				return(usage("missing argument for --queue-policy option"));
+			}
+			continue;
+		}
+		if (EQSTR(argv[i], "--notify-delay-ms")) {
+			if (++i < argc) {
+				if (getint(argv[i], &lNotifyDelay) == -1 || lNotifyDelay < 0) {
+					return(usage("invalid delay (--notify-delay-ms option)"));
+				}
+			}
+			else {
+				return(usage("missing argument for --notify-delay-ms option"));
+			}
+			continue;
+		}
+		if (EQSTR(argv[i], "-u") || EQSTR(argv[i], "--unix-socket")) {
+			if (++i < argc) {
+				UnixSocket = argv[i];
+			}
+			else {
+				return(usage("missing argument for -u option"));
+			}
+			continue;
+		}
+		if (EQSTR(argv[i], "--snapshot")) {
+			if (++i < argc) {
+				Snapshot = argv[i];
+			}
+			else {
+				return(usage("missing argument for --snapshot option"));
+			}
+			continue;
+		}
+		if (EQSTR(argv[i], "--tcp-control")) {
+			lTcpControl = true;
+			continue;
+		}
+		if (EQSTR(argv[i], "--upgrade")) {
+			FlagUpgrade = true;
+			continue;
+		}
 		if (EQSTR(argv[i], "-d") || EQSTR(argv[i], "--dir")) {
 			if (++i < argc) {
 				PersistentDir = argv[i];
@@ -1695,8 +3871,33 @@ int	main(int argc, char **argv)
 		}
 	}
 
+	if (UnixSocket == NULL) {
+		sprintf(DefaultUnixSocket, DEFAULT_PVDD_UNIX_SOCKET, Port);
+		UnixSocket = DefaultUnixSocket;
+	}
+
+	if (Snapshot == NULL) {
+		sprintf(DefaultSnapshot, DEFAULT_PVDD_SNAPSHOT, Port);
+		Snapshot = DefaultSnapshot;
+	}
+
+	snprintf(SeqpacketSocket,
+		 sizeof(SeqpacketSocket),
+		 "%s" PVDD_SEQPACKET_SUFFIX,
+		 UnixSocket);
+	snprintf(UpgradeSocket,
+		 sizeof(UpgradeSocket),
+		 "%s" PVDD_UPGRADE_SUFFIX,
+		 UnixSocket);
+
+	if (FlagUpgrade && EQSTR(UnixSocket, "none")) {
+		return(usage("--upgrade requires a local socket (-u option)"));
+	}
+
 	if (lFlagVerbose) {
 		printf("Server port : %d\n", Port);
+		printf("Server local socket : %s\n", UnixSocket);
+		printf("Shared memory snapshot : %s\n", Snapshot);
 		printf("Persistent directory : %s\n",
 			PersistentDir == NULL ? "none defined" : PersistentDir);
 		printf("sizeof net_pvd_attribute = %lu\n",
@@ -1707,11 +3908,7 @@ int	main(int argc, char **argv)
 	}
 
 	signal(SIGPIPE, SIG_IGN);
-
-	/*
-	 * Read and parse the existing persistent files and configuration file,
-	 * if any
-	 */
+	signal(SIGUSR1, HandleSigUsr1);
 
 	/*
 	 * Here, we need to decide how to retrieve PvD information :
@@ -1772,6 +3969,31 @@ AutodetectDone :
 			lKernelHasPvdSupport ? "has" : " does not have");
 	}
 
+	/*
+	 * Warm restart : take over the sockets, the clients and the state of
+	 * the running daemon. It is suspended until the transfer is
+	 * acknowledged, once everything is in place (see below)
+	 */
+	if (FlagUpgrade) {
+		if ((upgradeSock = UpgradeConnect(UpgradeSocket)) == -1) {
+			fprintf(stderr,
+				"%s : no daemon to take over on %s (%s), starting afresh\n",
+				lMyName,
+				UpgradeSocket,
+				strerror(errno));
+		} else
+		if (TakeOver(upgradeSock, Listeners) == -1) {
+			fprintf(stderr, "%s : warm restart failed\n", lMyName);
+			return(1);
+		}
+		else {
+			serverSock = Listeners[LISTENER_TCP];
+			unixServerSock = Listeners[LISTENER_UNIX];
+			seqpacketServerSock = Listeners[LISTENER_SEQPACKET];
+			upgradeServerSock = Listeners[LISTENER_UPGRADE];
+		}
+	}
+
 	/*
 	 * Create the netlink raw socket with the kernel (to receive icmpv6
 	 * options conveying the pvdid/dns data carried over by router
@@ -1793,90 +4015,243 @@ AutodetectDone :
 	}
 
 	/*
-	 * Create the listening clients socket
+	 * Create the listening clients socket (unless taken over)
 	 */
-	if ((serverSock = CreateServerSocket(Port)) == -1) {
+	if (serverSock == -1 && (serverSock = CreateServerSocket(Port)) == -1) {
 		perror("server socket");
 		return(1);
 	}
 
+	// The local socket is an optimization : the clients fall back on TCP
+	if (! EQSTR(UnixSocket, "none")) {
+		if (unixServerSock == -1 &&
+		    (unixServerSock = CreateUnixServerSocket(UnixSocket, SOCK_STREAM)) == -1) {
+			fprintf(stderr,
+				"%s : local socket %s : %s\n",
+				lMyName,
+				UnixSocket,
+				strerror(errno));
+		}
+
+		if (seqpacketServerSock == -1 &&
+		    (seqpacketServerSock = CreateUnixServerSocket(SeqpacketSocket, SOCK_SEQPACKET)) == -1) {
+			fprintf(stderr,
+				"%s : local socket %s : %s\n",
+				lMyName,
+				SeqpacketSocket,
+				strerror(errno));
+		}
+
+		if (upgradeServerSock == -1 &&
+		    (upgradeServerSock = CreateUnixServerSocket(UpgradeSocket, SOCK_SEQPACKET)) == -1) {
+			fprintf(stderr,
+				"%s : upgrade socket %s : %s\n",
+				lMyName,
+				UpgradeSocket,
+				strerror(errno));
+		}
+	}
+
+	InitCommands();
+
 	/*
-	 * Main loop
+	 * All sockets are registered once in the epoll set. Only the ready
+	 * ones are reported by epoll_wait(), whatever the number of (idle)
+	 * clients
 	 */
-	while (true) {
-		fd_set fdsI;
-		int nMax = -1;
-		int s, n;
-		int FlagCompact;
+	if ((lEpollFd = epoll_create1(EPOLL_CLOEXEC)) == -1) {
+		perror("epoll_create1");
+		return(1);
+	}
+
+	if (WatchFd(serverSock, &lServerTag, EPOLLIN) == -1) {
+		perror("epoll_ctl");
+		return(1);
+	}
+
+	if (unixServerSock != -1 && WatchFd(unixServerSock, &lUnixServerTag, EPOLLIN) == -1) {
+		close(unixServerSock);
+		unixServerSock = -1;
+	}
 
-		FD_ZERO(&fdsI);
+	if (seqpacketServerSock != -1 && WatchFd(seqpacketServerSock, &lSeqpacketServerTag, EPOLLIN) == -1) {
+		close(seqpacketServerSock);
+		seqpacketServerSock = -1;
+	}
+
+	if (sockIcmpv6 != -1 && WatchFd(sockIcmpv6, &lIcmpv6Tag, EPOLLIN) == -1) {
+		sockIcmpv6 = -1;
+	}
+
+	if (sockRtnlink != -1 && WatchFd(sockRtnlink, &lRtnlTag, EPOLLIN) == -1) {
+		sockRtnlink = -1;
+	}
+
+	if (upgradeServerSock != -1 && WatchFd(upgradeServerSock, &lUpgradeServerTag, EPOLLIN) == -1) {
+		close(upgradeServerSock);
+		upgradeServerSock = -1;
+	}
 
-		if (serverSock != -1) {
-			FD_SET(serverSock, &fdsI);
-			if (serverSock > nMax) nMax = serverSock;
+	// Clients taken over (their pending input or output, if any, is
+	// reported at once)
+	for (i = 0; i < lNClients; i++) {
+		if (lTabClients[i].s != -1 &&
+		    WatchFd(lTabClients[i].s, &lTabClients[i], EPOLLIN | EPOLLOUT) == -1) {
+			ReleaseClient(i);
 		}
+	}
 
-		if (sockIcmpv6 != -1) {
-			FD_SET(sockIcmpv6, &fdsI);
-			if (sockIcmpv6 > nMax) nMax = sockIcmpv6;
+	// Everything is in place : the previous daemon can exit
+	if (upgradeSock != -1) {
+		if (UpgradeDone(upgradeSock) == -1) {
+			fprintf(stderr, "%s : warm restart failed\n", lMyName);
+			return(1);
 		}
+		close(upgradeSock);
+	}
 
-		if (sockRtnlink != -1) {
-			FD_SET(sockRtnlink, &fdsI);
-			if (sockRtnlink > nMax) nMax = sockRtnlink;
+	/*
+	 * Read back the persistent state, if any : the changes made by the
+	 * control clients before the daemon was restarted are applied again
+	 * (over the pvd retrieved from the kernel). After a warm restart,
+	 * they are already part of the state taken over
+	 */
+	if (PersistentDir != NULL) {
+		if (JournalOpen(PersistentDir) == -1) {
+			fprintf(stderr,
+				"%s : %s : changes will not be saved\n",
+				lMyName,
+				PersistentDir);
+		}
+		if (upgradeSock == -1) {
+			JournalRestore(RestorePvd);
 		}
+	}
 
-		for (i = 0; i < lNClients; i++) {
-			if ((s = lTabClients[i].s) != -1) {
-				FD_SET(s, &fdsI);
-				if (s > nMax) nMax = s;
-			}
+	/*
+	 * Shared memory snapshot of the database. This is an optimization
+	 * for local readers : the daemon can run without it. The one of the
+	 * previous daemon, if any, is superseded
+	 */
+	if (! EQSTR(Snapshot, "none")) {
+		if (SnapshotOpen(Snapshot) == -1) {
+			fprintf(stderr,
+				"%s : snapshot %s : %s\n",
+				lMyName,
+				Snapshot,
+				strerror(errno));
+		}
+		else {
+			lSnapshot = true;
+			InvalidateSnapshot(NULL);
 		}
+	}
 
-		if (select(nMax + 1, &fdsI, NULL, NULL, NULL) == -1) {
-			if (lFlagVerbose) {
-				perror("pvdd select");
-			}
-			usleep(100000);
-			continue;
+	/*
+	 * Main loop
+	 */
+	while (true) {
+		struct epoll_event events[MAXEVENTS];
+		int n;
+		int t;
+		int timeout = -1;
+
+		if (lFlagDumpStatistics) {
+			lFlagDumpStatistics = false;
+			DumpStatistics();
 		}
 
-		if (serverSock != -1 && FD_ISSET(serverSock, &fdsI)) {
-			HandleConnection(serverSock);
+		// Expire the lifetimes of the data learnt from the RAs
+		TimerRun();
+
+		// Wake up at the end of the notifications coalescing window
+		if (lFirstPendingPvd != NULL) {
+			if ((timeout = lNotifyDeadline - GetTimeMs()) <= 0) {
+				FlushPendingNotifications();
+				timeout = -1;
+			}
 		}
 
-		if (sockIcmpv6 != -1 && FD_ISSET(sockIcmpv6, &fdsI)) {
-			HandleNetlink(sockIcmpv6);
+		// The snapshot follows the notifications : it is not published
+		// while they are being delayed
+		if (lFirstPendingPvd == NULL) {
+			PublishSnapshot();
 		}
 
-		if (sockRtnlink != -1 && FD_ISSET(sockRtnlink, &fdsI)) {
-			HandleRtNetlink(RtnlCnx);
+		if ((t = TimerTimeout()) != -1 && (timeout == -1 || t < timeout)) {
+			timeout = t;
 		}
 
-		FlagCompact = false;
+		if ((n = epoll_wait(lEpollFd, events, MAXEVENTS, timeout)) == -1) {
+			if (errno != EINTR) {
+				if (lFlagVerbose) {
+					perror("pvdd epoll_wait");
+				}
+				usleep(100000);
+			}
+			continue;
+		}
 
-		for (i = 0; i < lNClients; i++) {
-			s = lTabClients[i].s;
+		for (i = 0; i < n; i++) {
+			void	*data = events[i].data.ptr;
 
-			if (s == -1) {
-				FlagCompact = true;
+			if (data == &lServerTag) {
+				while (HandleConnection(serverSock) == 0) {
+					;
+				}
+			} else
+			if (data == &lUnixServerTag) {
+				while (HandleConnection(unixServerSock) == 0) {
+					;
+				}
+			} else
+			if (data == &lSeqpacketServerTag) {
+				while (HandleConnection(seqpacketServerSock) == 0) {
+					;
+				}
+			} else
+			if (data == &lUpgradeServerTag) {
+				Listeners[LISTENER_TCP] = serverSock;
+				Listeners[LISTENER_UNIX] = unixServerSock;
+				Listeners[LISTENER_SEQPACKET] = seqpacketServerSock;
+				Listeners[LISTENER_UPGRADE] = upgradeServerSock;
+				while (HandleUpgrade(upgradeServerSock, Listeners) == 0) {
+					;
+				}
+			} else
+			if (data == &lIcmpv6Tag) {
+				HandleNetlink(sockIcmpv6);
 			} else
-			if (FD_ISSET(s, &fdsI)) {
-				HandleMessage(i);
+			if (data == &lRtnlTag) {
+				while (HandleRtNetlink(RtnlCnx) == 0) {
+					;
+				}
 			}
-		}
-
-		// Compact the clients table if necessary (we will be one loop
-		// late, because HandleMessage() is the one which may
-		// invalidate entries, but that does not matter a lot)
-		if (FlagCompact) {
-			for (n = 0, i = 0; i < lNClients; i++) {
-				if ((s = lTabClients[i].s) != -1) {
-					lTabClients[n++] = lTabClients[i];
+			else {
+				t_PvdClient	*PtClient = (t_PvdClient *) data;
+				int		ix = PtClient - lTabClients;
+
+				// The client may have been released by a
+				// previous event of this batch
+				if (PtClient->s != -1 &&
+				    (events[i].events & EPOLLOUT) &&
+				    PtClient->Output.Count > 0) {
+					FlushClient(ix);
+				}
+				if (PtClient->s != -1 &&
+				    (events[i].events & ~EPOLLOUT) != 0) {
+					if (PtClient->seqpacket) {
+						HandleDatagrams(ix);
+					}
+					else {
+						HandleMessage(ix);
+					}
 				}
 			}
-			lNClients = n;
 		}
+
+		// The changes of this batch are made durable at once
+		JournalFlush();
 	}
 
 	return(0);
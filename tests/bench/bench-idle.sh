@@ -0,0 +1,25 @@
+#!/bin/sh
+
+# Cost of a change (wall clock and daemon cpu time) as a function of the
+# number of idle clients connected to the daemon. The daemon is started
+# afresh for each number of clients (the table of the clients is limited
+# to MAXCLIENTS, and the previous ones may not all be released yet)
+# usage : bench-idle.sh [<pvdd binary> [<nchanges>]]
+
+DIR=`dirname $0`
+PVDD=${1:-$DIR/../../src/obj/pvdd}
+NCHANGES=${2:-5000}
+PORT=10301
+
+for n in 0 10 100 500 1000
+do
+	$PVDD -n -p $PORT --snapshot none >/dev/null 2>&1 &
+	PID=$!
+	sleep 0.5
+
+	$DIR/pvd-bench -p $PORT -P $PID idle $n $NCHANGES | grep -v "^idle : [0-9]* clients"|
+		sed "s/^idle/idle ($n clients)/"
+
+	kill $PID
+	wait $PID 2>/dev/null
+done
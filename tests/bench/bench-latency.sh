@@ -0,0 +1,20 @@
+#!/bin/sh
+
+# Round trip of a request through the local (AF_UNIX) socket of the daemon
+# and through TCP
+# usage : bench-latency.sh [<pvdd binary> [<nrequests>]]
+
+DIR=`dirname $0`
+PVDD=${1:-$DIR/../../src/obj/pvdd}
+NREQUESTS=${2:-20000}
+PORT=10307
+
+$PVDD -n -p $PORT --snapshot none >/dev/null 2>&1 &
+PID=$!
+sleep 0.5
+
+$DIR/pvd-bench -p $PORT populate 1 10 >/dev/null
+$DIR/pvd-bench -p $PORT -P $PID latency $NREQUESTS
+
+kill $PID
+wait $PID 2>/dev/null
@@ -0,0 +1,25 @@
+#!/bin/sh
+
+# Latency of the lookup of an attribute as a function of the number of pvd
+# registered (up to MAXPVD, ie 1024)
+# usage : bench-lookup.sh [<pvdd binary> [<nlookups>]]
+
+DIR=`dirname $0`
+PVDD=${1:-$DIR/../../src/obj/pvdd}
+NLOOKUPS=${2:-20000}
+PORT=10302
+
+$PVDD -n -p $PORT >/dev/null 2>&1 &
+PID=$!
+sleep 0.5
+
+N=0
+for n in 1 16 128 512 1024
+do
+	# The pvds created by the previous iterations are simply updated
+	$DIR/pvd-bench -p $PORT populate $n 10 >/dev/null
+	$DIR/pvd-bench -p $PORT -P $PID lookup $n $NLOOKUPS
+done
+
+kill $PID
+wait $PID 2>/dev/null
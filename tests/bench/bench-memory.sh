@@ -0,0 +1,36 @@
+#!/bin/sh
+
+# Memory used by the daemon with 1000 pvds (10 attributes each, in addition
+# to the standard ones) : resident size of the process and accounting of
+# the interned attributes keys (from the SIGUSR1 statistics)
+# usage : bench-memory.sh [<pvdd binary> [<npvd> [<nattr>]]]
+
+DIR=`dirname $0`
+PVDD=${1:-$DIR/../../src/obj/pvdd}
+NPVD=${2:-1000}
+NATTR=${3:-10}
+PORT=10303
+LOG=/tmp/bench-memory.$$
+
+$PVDD -n -p $PORT --snapshot none >$LOG 2>&1 &
+PID=$!
+sleep 0.5
+
+rss() {
+	grep VmRSS /proc/$PID/status | awk '{ print $2 }'
+}
+
+RSS0=`rss`
+$DIR/pvd-bench -p $PORT -P $PID populate $NPVD $NATTR
+RSS1=`rss`
+
+echo "memory : VmRSS $RSS0 kB at startup, $RSS1 kB with $NPVD pvd" \
+	"($(( (RSS1 - RSS0) * 1024 / NPVD )) bytes per pvd)"
+
+kill -USR1 $PID
+sleep 0.2
+grep "^attributes keys\|^pvd :" $LOG
+
+kill $PID
+wait $PID 2>/dev/null
+rm -f $LOG
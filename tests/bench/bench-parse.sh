@@ -0,0 +1,26 @@
+#!/bin/sh
+
+# Throughput of the command lines (all the verbs but the promotions, and an
+# invalid line), with the commands accounting of the daemon
+# usage : bench-parse.sh [<pvdd binary> [<nrounds>]]
+
+DIR=`dirname $0`
+PVDD=${1:-$DIR/../../src/obj/pvdd}
+NROUNDS=${2:-10000}
+PORT=10306
+LOG=/tmp/bench-parse.$$
+
+$PVDD -n -p $PORT --snapshot none >$LOG 2>&1 &
+PID=$!
+sleep 0.5
+
+$DIR/pvd-bench -p $PORT populate 1 10 >/dev/null
+$DIR/pvd-bench -p $PORT -P $PID parse $NROUNDS
+
+kill -USR1 $PID
+sleep 0.2
+grep "^commands :" $LOG
+
+kill $PID
+wait $PID 2>/dev/null
+rm -f $LOG
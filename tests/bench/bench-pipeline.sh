@@ -0,0 +1,25 @@
+#!/bin/sh
+
+# Throughput of the requests of a client pipelining them (batches of 1 to
+# 500 requests sent in a single write)
+# usage : bench-pipeline.sh [<pvdd binary> [<nrequests>]]
+
+DIR=`dirname $0`
+PVDD=${1:-$DIR/../../src/obj/pvdd}
+NREQUESTS=${2:-50000}
+PORT=10305
+
+$PVDD -n -p $PORT --snapshot none >/dev/null 2>&1 &
+PID=$!
+sleep 0.5
+
+$DIR/pvd-bench -p $PORT populate 1 10 >/dev/null
+
+for depth in 1 10 100 500
+do
+	$DIR/pvd-bench -p $PORT -P $PID pipeline $depth $NREQUESTS | grep -v "^pipeline : depth" |
+		sed "s/^pipeline/pipeline (depth $depth)/"
+done
+
+kill $PID
+wait $PID 2>/dev/null
@@ -0,0 +1,27 @@
+#!/bin/sh
+
+# Fuzzing of the RA parsing (process_ra() of pvdd-netlink.c), the corpus being
+# the RAs generated by ra-replay. No daemon nor interface is needed
+# usage : bench-ra-fuzz.sh [<nmutations> [<seed>]]
+# Set ASAN=1 to run the AddressSanitizer build (make ra-fuzz-asan)
+
+DIR=`dirname $0`
+NMUTATIONS=${1:-1000000}
+SEED=${2:-1}
+CORPUS=/tmp/bench-ra-fuzz.$$
+
+if [ "$ASAN" = 1 ]
+then
+	FUZZ=$DIR/ra-fuzz-asan
+else
+	FUZZ=$DIR/ra-fuzz
+fi
+
+mkdir -p $CORPUS
+$DIR/ra-replay -p 4 -w $CORPUS >/dev/null || exit 1
+
+$FUZZ -n $NMUTATIONS -s $SEED $CORPUS
+STATUS=$?
+
+rm -rf $CORPUS
+exit $STATUS
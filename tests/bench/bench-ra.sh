@@ -0,0 +1,56 @@
+#!/bin/sh
+
+# RA ingestion rate of the daemon : RAs are replayed as fast as possible on
+# one end of a veth pair, the daemon receiving them on the other end. The
+# RAs dropped by the kernel (socket receive queue full) are the ones the
+# daemon could not keep up with. Must be run as root
+# usage : bench-ra.sh [<pvdd binary> [<nras> [<npvd> [<change every>]]]]
+
+DIR=`dirname $0`
+PVDD=${1:-$DIR/../../src/obj/pvdd}
+NRA=${2:-200000}
+NPVD=${3:-50}
+CHANGE=${4:-0}
+PORT=10309
+LOG=/tmp/bench-ra.$$.log
+
+# The veth pair is created if needed, with a link local address on the
+# sending end (no DAD, to be usable at once)
+if ! ip link show rabench0 >/dev/null 2>&1
+then
+	ip link add rabench0 type veth peer name rabench1 || exit 1
+	ip link set rabench0 up
+	ip link set rabench1 up
+	ip -6 addr add fe80::1/64 dev rabench0 nodad
+	sleep 1
+fi
+
+$PVDD -n -p $PORT -u none --snapshot none >$LOG 2>&1 &
+PID=$!
+sleep 0.5
+
+cpu() {
+	awk '{ print $14 + $15 }' /proc/$PID/stat
+}
+
+drops() {
+	awk -v inode=`ls -l /proc/$PID/fd | awk '/socket/ { gsub(/[^0-9]/, "", $NF); print $NF }' | tr '\n' '|' | sed 's/|$//'` \
+		'NR > 1 && $10 ~ "^(" inode ")$" { n += $NF } END { print n + 0 }' /proc/net/raw6
+}
+
+C0=`cpu`
+D0=`drops`
+$DIR/ra-replay -i rabench0 -n $NRA -p $NPVD -c $CHANGE
+sleep 1
+C1=`cpu`
+D1=`drops`
+
+kill -USR1 $PID
+sleep 0.2
+grep "^RA" $LOG
+echo "ra : $((D1 - D0)) RAs dropped by the kernel, daemon cpu" \
+	"$(( (C1 - C0) * 1000000 / `getconf CLK_TCK` / NRA )) us/RA"
+
+kill $PID
+wait $PID 2>/dev/null
+rm -f $LOG
@@ -0,0 +1,38 @@
+#!/bin/sh
+
+# Cold start of a daemon restoring 1000 pvds of 100 attributes each from its
+# state directory (-d option) : first from the journal, then from the state
+# file written by the compaction made at the end of the first restart
+# usage : bench-startup.sh [<pvdd binary> [<npvd> [<nattr>]]]
+
+DIR=`dirname $0`
+PVDD=${1:-$DIR/../../src/obj/pvdd}
+NPVD=${2:-1000}
+NATTR=${3:-100}
+PORT=10308
+STATEDIR=/tmp/bench-startup.$$
+LOG=/tmp/bench-startup.$$.log
+
+mkdir -p $STATEDIR
+
+$PVDD -n -p $PORT --snapshot none -d $STATEDIR >/dev/null 2>&1 &
+PID=$!
+sleep 0.5
+$DIR/pvd-bench -p $PORT -P $PID populate $NPVD $NATTR
+kill $PID
+wait $PID 2>/dev/null
+ls -l $STATEDIR | awk 'NR > 1 { print "startup : " $NF " " $5 " bytes" }'
+
+for from in journal state
+do
+	$PVDD -n -p $PORT --snapshot none -d $STATEDIR >$LOG 2>&1 &
+	PID=$!
+	$DIR/pvd-bench -p $PORT ready $NPVD $NATTR | sed "s/^ready/ready (from the $from)/"
+	kill -USR1 $PID
+	sleep 0.2
+	grep "^journal :" $LOG
+	kill $PID
+	wait $PID 2>/dev/null
+done
+
+rm -rf $STATEDIR $LOG
@@ -0,0 +1,20 @@
+#!/bin/sh
+
+# Write system calls made by the daemon per reply (write and writev calls,
+# as accounted in /proc/<pid>/io)
+# usage : bench-syscalls.sh [<pvdd binary> [<nreplies>]]
+
+DIR=`dirname $0`
+PVDD=${1:-$DIR/../../src/obj/pvdd}
+NREPLIES=${2:-10000}
+PORT=10304
+
+$PVDD -n -p $PORT --snapshot none >/dev/null 2>&1 &
+PID=$!
+sleep 0.5
+
+$DIR/pvd-bench -p $PORT populate 1 10 >/dev/null
+$DIR/pvd-bench -p $PORT -P $PID replies $NREPLIES
+
+kill $PID
+wait $PID 2>/dev/null
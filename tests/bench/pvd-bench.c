@@ -0,0 +1,994 @@
+/*
+	Copyright 2017 Cisco
+
+	Licensed under the Apache License, Version 2.0 (the "License");
+	you may not use this file except in compliance with the License.
+	You may obtain a copy of the License at
+
+		http://www.apache.org/licenses/LICENSE-2.0
+
+	Unless required by applicable law or agreed to in writing, software
+	distributed under the License is distributed on an "AS IS" BASIS,
+	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+	See the License for the specific language governing permissions and
+	limitations under the License.
+*/
+/*
+ * pvd-bench : micro benchmarks of the pvdd daemon, run against a daemon
+ * already started (on the port given with -p). When the pid of the daemon
+ * is given (-P option), the cpu time it has consumed during the test is
+ * reported as well (taken from /proc/<pid>/stat)
+ *
+ * Each test is a sub command (see usage()). The results are printed on
+ * stdout, one line per measure
+ */
+
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <poll.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include <libpvd.h>
+
+#define	EQSTR(a, b)	(strcmp((a), (b)) == 0)
+
+#define	DIM(t)	(sizeof(t) / sizeof(t[0]))
+
+#undef	true
+#undef	false
+#define	true	(1 == 1)
+#define	false	(1 == 0)
+
+#define	BENCHPVD	"bench.pvd.example.com"
+
+static	int	lPort = -1;
+static	int	lDaemonPid = -1;
+
+static	void	usage(FILE *fo)
+{
+	fprintf(fo, "usage : pvd-bench [-h|--help] [<option>*] <test> [<arg>*]\n");
+	fprintf(fo, "where option :\n");
+	fprintf(fo, "\t-p|--port <#> : port of the daemon (PVDD_PORT or 10101 by default)\n");
+	fprintf(fo, "\t-P|--pid <#> : pid of the daemon, to report its cpu time\n");
+	fprintf(fo, "and test :\n");
+	fprintf(fo, "\tidle <nclients> <nchanges> : cost of <nchanges> changes with\n");
+	fprintf(fo, "\t\t<nclients> idle connections opened on the daemon\n");
+	fprintf(fo, "\tpopulate <npvd> <nattr> : create <npvd> pvds with <nattr>\n");
+	fprintf(fo, "\t\tattributes each\n");
+	fprintf(fo, "\tlookup <npvd> <nlookups> : latency of the lookup of an\n");
+	fprintf(fo, "\t\tattribute of a random pvd (among the <npvd> populated)\n");
+	fprintf(fo, "\treplies <nreplies> : write system calls made by the daemon per\n");
+	fprintf(fo, "\t\treply (on the first pvd populated)\n");
+	fprintf(fo, "\tpipeline <depth> <nrequests> : throughput of requests sent\n");
+	fprintf(fo, "\t\tby batches of <depth> in a single write\n");
+	fprintf(fo, "\tparse <nrounds> : throughput of the command lines, for\n");
+	fprintf(fo, "\t\t<nrounds> rounds of all the verbs\n");
+	fprintf(fo, "\tlatency <nrequests> : round trip of a request through the\n");
+	fprintf(fo, "\t\tlocal socket and through TCP\n");
+	fprintf(fo, "\tready <npvd> <nattr> : time for a daemon just started to\n");
+	fprintf(fo, "\t\trestore the <npvd> pvds populated (-d option)\n");
+	fprintf(fo, "\n");
+	fprintf(fo, "The local (AF_UNIX) socket of the daemon is used when it can be\n");
+	fprintf(fo, "reached (PVDD_SOCKET=none forces TCP)\n");
+}
+
+// Now : monotonic time, in micro seconds
+static	double	Now(void)
+{
+	struct timespec	ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return(ts.tv_sec * 1e6 + ts.tv_nsec / 1e3);
+}
+
+// DaemonCpu : user + system cpu time of the daemon, in micro seconds (0
+// if its pid is unknown)
+static	double	DaemonCpu(void)
+{
+	FILE		*fi;
+	char		Path[64];
+	char		Line[1024];
+	char		*pt;
+	unsigned long	utime, stime;
+
+	if (lDaemonPid == -1) {
+		return(0);
+	}
+	sprintf(Path, "/proc/%d/stat", lDaemonPid);
+
+	if ((fi = fopen(Path, "r")) == NULL) {
+		return(0);
+	}
+	pt = fgets(Line, sizeof(Line), fi);
+	fclose(fi);
+
+	// The command name (2nd field) can contain spaces
+	if (pt == NULL || (pt = strrchr(Line, ')')) == NULL) {
+		return(0);
+	}
+	if (sscanf(pt + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu",
+			&utime, &stime) != 2) {
+		return(0);
+	}
+	return((utime + stime) * 1e6 / sysconf(_SC_CLK_TCK));
+}
+
+// DaemonWrites : write system calls (write, writev, but not send/sendmsg)
+// made so far by the daemon, from /proc/<pid>/io. -1 if unknown
+static	long	DaemonWrites(void)
+{
+	FILE	*fi;
+	char	Path[64];
+	char	Line[256];
+	long	n = -1;
+
+	if (lDaemonPid == -1) {
+		return(-1);
+	}
+	sprintf(Path, "/proc/%d/io", lDaemonPid);
+
+	if ((fi = fopen(Path, "r")) == NULL) {
+		return(-1);
+	}
+	while (fgets(Line, sizeof(Line), fi) != NULL) {
+		sscanf(Line, "syscw: %ld", &n);
+	}
+	fclose(fi);
+
+	return(n);
+}
+
+// Report : print out a measure, with the cpu time of the daemon if known
+static	void	Report(char *Test, int n, double Elapsed, double Cpu)
+{
+	printf("%s : %d operations in %.3f ms, %.2f us/op, %.0f op/s",
+		Test,
+		n,
+		Elapsed / 1e3,
+		Elapsed / n,
+		n * 1e6 / Elapsed);
+	if (lDaemonPid != -1) {
+		printf(", daemon cpu %.2f us/op", Cpu / n);
+	}
+	printf("\n");
+}
+
+// RaiseFdLimit : allow the process to open at least n files
+static	void	RaiseFdLimit(int n)
+{
+	struct rlimit	rl;
+
+	if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < n) {
+		rl.rlim_cur = rl.rlim_max < n ? rl.rlim_max : n;
+		setrlimit(RLIMIT_NOFILE, &rl);
+	}
+}
+
+// SendString : write a full string on a connection
+static	int	SendString(t_pvd_connection *conn, char *s)
+{
+	int	fd = pvd_connection_fd(conn);
+	int	l = strlen(s);
+	int	n;
+
+	while (l > 0) {
+		if ((n = write(fd, s, l)) == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+			perror("write");
+			return(-1);
+		}
+		s += n;
+		l -= n;
+	}
+	return(0);
+}
+
+// OpenControl : create a pvd (if pvdname is not NULL) on a new control
+// connection
+static	t_pvd_connection	*OpenControl(char *pvdname)
+{
+	t_pvd_connection	*conn;
+	t_pvd_connection	*ctrl;
+	char			s[1024];
+
+	if ((conn = pvd_connect(lPort)) == NULL) {
+		fprintf(stderr, "pvd-bench : can not connect to the daemon\n");
+		return(NULL);
+	}
+	ctrl = pvd_get_control_socket(conn);
+	pvd_disconnect(conn);
+
+	if (ctrl == NULL) {
+		fprintf(stderr, "pvd-bench : can not promote the connection\n");
+		return(NULL);
+	}
+	if (pvdname == NULL) {
+		return(ctrl);
+	}
+	sprintf(s, "PVD_CREATE_PVD 0 %s\n", pvdname);
+
+	if (SendString(ctrl, s) == -1) {
+		pvd_disconnect(ctrl);
+		return(NULL);
+	}
+	return(ctrl);
+}
+
+// SetAttribute : send one (transaction wrapped) change of an attribute
+static	int	SetAttribute(
+			t_pvd_connection *ctrl,
+			char *pvdname,
+			char *key,
+			char *value)
+{
+	char	s[4096];
+
+	snprintf(s, sizeof(s),
+		"PVD_BEGIN_TRANSACTION %s\n"
+		"PVD_SET_ATTRIBUTE %s %s %s\n"
+		"PVD_END_TRANSACTION %s\n",
+		pvdname,
+		pvdname, key, value,
+		pvdname);
+
+	return(SendString(ctrl, s));
+}
+
+// ReadReply : read a (multi lines) reply on a regular connection, waiting
+// for it up to Timeout ms. Returns the reply (in a static buffer) or NULL
+static	char	*ReadReply(t_pvd_connection *conn, int Timeout)
+{
+	static	char	Buffer[65536];
+	static	char	Reply[65536];
+	static	int	InBuffer = 0;
+
+	char		*EOM;
+	int		n;
+	int		One = 1;
+	struct pollfd	pfd;
+
+	pfd.fd = pvd_connection_fd(conn);
+	pfd.events = POLLIN;
+
+	for ( ; ; ) {
+		Buffer[InBuffer] = '\0';
+		if ((EOM = strstr(Buffer, "PVD_END_MULTILINE\n")) != NULL) {
+			EOM += strlen("PVD_END_MULTILINE\n");
+			memcpy(Reply, Buffer, EOM - Buffer);
+			Reply[EOM - Buffer] = '\0';
+			InBuffer -= EOM - Buffer;
+			memmove(Buffer, EOM, InBuffer);
+			return(Reply);
+		}
+		if (InBuffer >= sizeof(Buffer) - 1) {
+			fprintf(stderr, "pvd-bench : reply too long\n");
+			return(NULL);
+		}
+		if (poll(&pfd, 1, Timeout) != 1) {
+			return(NULL);
+		}
+		// The daemons before user-007 send a reply in several writes :
+		// each one would wait for the delayed ACK of the previous one
+		setsockopt(pfd.fd, IPPROTO_TCP, TCP_QUICKACK, &One, sizeof(One));
+		if ((n = recv(pfd.fd,
+			      &Buffer[InBuffer],
+			      sizeof(Buffer) - 1 - InBuffer,
+			      0)) <= 0) {
+			fprintf(stderr, "pvd-bench : connection closed\n");
+			return(NULL);
+		}
+		InBuffer += n;
+	}
+}
+
+// WaitAttribute : wait (up to 5 seconds) for an attribute to have a given
+// value. The control connections do not receive any reply : this is how the
+// end of a test is detected (the changes of a connection are handled in
+// order). There is no reply for an unknown pvd : the request is repeated
+static	int	WaitAttribute(
+			t_pvd_connection *conn,
+			char *pvdname,
+			char *key,
+			char *value)
+{
+	char	s[1024];
+	char	Expected[1024];
+	char	*Reply;
+	double	Deadline = Now() + 5e6;
+
+	sprintf(s, "PVD_GET_ATTRIBUTE %s %s\n", pvdname, key);
+	sprintf(Expected, "PVD_ATTRIBUTE %s %s\n%s\nPVD_END_MULTILINE\n",
+		pvdname, key, value);
+
+	while (Now() < Deadline) {
+		if (SendString(conn, s) == -1) {
+			return(-1);
+		}
+		if ((Reply = ReadReply(conn, 1)) != NULL &&
+		    strstr(Reply, Expected) != NULL) {
+			return(0);
+		}
+	}
+	fprintf(stderr, "pvd-bench : %s %s never reached %s\n", pvdname, key, value);
+	return(-1);
+}
+
+// WaitNotification : wait for a whole notification on a subscribed
+// connection and discard it. A notification read in part would let the
+// next change be sent before the notification of the previous one
+static	int	WaitNotification(t_pvd_connection *conn)
+{
+	struct pollfd	pfd;
+	static	char	Buffer[65536];
+	int		l = 0;
+	int		n;
+	char		*EOM = "PVD_END_MULTILINE\n";
+	int		lEOM = strlen(EOM);
+
+	pfd.fd = pvd_connection_fd(conn);
+	pfd.events = POLLIN;
+
+	for (;;) {
+		if (poll(&pfd, 1, 5000) != 1 ||
+		    (n = recv(pfd.fd, Buffer + l, sizeof(Buffer) - l, 0)) <= 0) {
+			fprintf(stderr, "pvd-bench : no notification received\n");
+			return(-1);
+		}
+		l += n;
+		if (l >= lEOM && memcmp(Buffer + l - lEOM, EOM, lEOM) == 0) {
+			return(0);
+		}
+		// Only the end of the message matters
+		if (l > sizeof(Buffer) / 2) {
+			memmove(Buffer, Buffer + l - lEOM, lEOM);
+			l = lEOM;
+		}
+	}
+}
+
+// WaitAccepted : wait until the daemon has accepted a connection (and the
+// ones opened before it), with a PVD_GET_LIST round trip. The connections
+// left in the backlog of a TCP listening socket would be dropped, then
+// retransmitted seconds later
+static	int	WaitAccepted(t_pvd_connection *conn)
+{
+	struct pollfd	pfd;
+	char		Buffer[4096];
+	int		n;
+
+	if (SendString(conn, "PVD_GET_LIST\n") == -1) {
+		return(-1);
+	}
+	pfd.fd = pvd_connection_fd(conn);
+	pfd.events = POLLIN;
+
+	do {
+		if (poll(&pfd, 1, 5000) != 1 ||
+		    (n = recv(pfd.fd, Buffer, sizeof(Buffer), 0)) <= 0) {
+			fprintf(stderr, "pvd-bench : connection not accepted\n");
+			return(-1);
+		}
+	} while (Buffer[n - 1] != '\n');
+
+	return(0);
+}
+
+/*
+ * idle : cost of a change with many idle clients. Each change is sent once
+ * the notification of the previous one has been received, so that each one
+ * wakes the daemon up : its cost must not depend on the number of
+ * connections that have nothing to do
+ */
+static	int	TestIdle(char **argv)
+{
+	int			i;
+	int			nClients = atoi(argv[0]);
+	int			nChanges = atoi(argv[1]);
+	t_pvd_connection	**TabConn;
+	t_pvd_connection	*ctrl;
+	t_pvd_connection	*conn;
+	char			Value[32];
+	double			t0, c0;
+
+	if (nClients < 0 || nChanges <= 0) {
+		usage(stderr);
+		return(-1);
+	}
+	RaiseFdLimit(nClients + 64);
+
+	if ((TabConn = calloc(nClients + 1, sizeof(*TabConn))) == NULL) {
+		perror("calloc");
+		return(-1);
+	}
+	for (i = 0; i < nClients; i++) {
+		if ((TabConn[i] = pvd_connect(lPort)) == NULL) {
+			fprintf(stderr, "pvd-bench : only %d clients connected\n", i);
+			nClients = i;
+			break;
+		}
+		// Do not overflow the backlog of the daemon
+		if ((i % 8 == 7 || i == nClients - 1) && WaitAccepted(TabConn[i]) == -1) {
+			return(-1);
+		}
+	}
+	if ((ctrl = OpenControl(BENCHPVD)) == NULL ||
+	    (conn = pvd_connect(lPort)) == NULL ||
+	    SetAttribute(ctrl, BENCHPVD, "benchIdle", "0") == -1 ||
+	    WaitAttribute(conn, BENCHPVD, "benchIdle", "0") == -1 ||
+	    pvd_subscribe_pvd_notifications(conn, BENCHPVD) == -1) {
+		return(-1);
+	}
+	// The subscription is effective once the next reply is received
+	if (pvd_get_attributes(conn, BENCHPVD) == -1 ||
+	    WaitNotification(conn) == -1) {
+		return(-1);
+	}
+
+	t0 = Now();
+	c0 = DaemonCpu();
+
+	for (i = 1; i <= nChanges; i++) {
+		sprintf(Value, "%d", i);
+		if (SetAttribute(ctrl, BENCHPVD, "benchIdle", Value) == -1 ||
+		    WaitNotification(conn) == -1) {
+			return(-1);
+		}
+	}
+	printf("idle : %d clients\n", nClients);
+	Report("idle", nChanges, Now() - t0, DaemonCpu() - c0);
+
+	for (i = 0; i < nClients; i++) {
+		pvd_disconnect(TabConn[i]);
+	}
+	free(TabConn);
+	pvd_disconnect(conn);
+	pvd_disconnect(ctrl);
+
+	return(0);
+}
+
+// BenchPvdName : name of the i-th pvd created by the populate test
+static	char	*BenchPvdName(int i, char *pvdname)
+{
+	sprintf(pvdname, "bench%d.pvd.example.com", i);
+
+	return(pvdname);
+}
+
+/*
+ * populate : create npvd pvds with nattr attributes each (benchAttr0 to
+ * benchAttr<nattr-1>, whose value is their index). The pvds are left in
+ * the daemon for the next tests. Each pvd is sent in a single write, once
+ * the previous one has been applied : a daemon reading a line in two parts
+ * (before user-011) would otherwise mangle it
+ */
+static	int	TestPopulate(char **argv)
+{
+	int			i, j;
+	int			l;
+	int			nPvd = atoi(argv[0]);
+	int			nAttr = atoi(argv[1]);
+	t_pvd_connection	*ctrl;
+	t_pvd_connection	*conn;
+	char			pvdname[PVDNAMSIZ];
+	char			Key[32];
+	char			Value[32];
+	char			*s;
+	double			t0, c0;
+
+	if (nPvd <= 0 || nAttr <= 0) {
+		usage(stderr);
+		return(-1);
+	}
+	if ((ctrl = OpenControl(NULL)) == NULL ||
+	    (conn = pvd_connect(lPort)) == NULL) {
+		return(-1);
+	}
+	if ((s = malloc((nAttr + 3) * (PVDNAMSIZ + 64))) == NULL) {
+		perror("malloc");
+		return(-1);
+	}
+
+	t0 = Now();
+	c0 = DaemonCpu();
+
+	for (i = 0; i < nPvd; i++) {
+		BenchPvdName(i, pvdname);
+		l = sprintf(s, "PVD_CREATE_PVD 0 %s\nPVD_BEGIN_TRANSACTION %s\n",
+			    pvdname, pvdname);
+		for (j = 0; j < nAttr; j++) {
+			sprintf(Key, "benchAttr%d", j);
+			sprintf(Value, "%d", j);
+			l += sprintf(s + l, "PVD_SET_ATTRIBUTE %s %s %s\n", pvdname, Key, Value);
+		}
+		sprintf(s + l, "PVD_END_TRANSACTION %s\n", pvdname);
+		if (SendString(ctrl, s) == -1 ||
+		    WaitAttribute(conn, pvdname, Key, Value) == -1) {
+			return(-1);
+		}
+	}
+	printf("populate : %d pvd, %d attributes each\n", nPvd, nAttr);
+	Report("populate", nPvd * nAttr, Now() - t0, DaemonCpu() - c0);
+
+	free(s);
+	pvd_disconnect(conn);
+	pvd_disconnect(ctrl);
+
+	return(0);
+}
+
+/*
+ * lookup : latency of the lookup of an attribute of a random pvd among the
+ * npvd first ones created by populate, via a GET_ATTRIBUTE request (binary
+ * connection), then in the snapshot published by the daemon (if any)
+ */
+static	int	TestLookup(char **argv)
+{
+	int			i;
+	int			nPvd = atoi(argv[0]);
+	int			nLookups = atoi(argv[1]);
+	t_pvd_connection	*conn;
+	t_pvd_snapshot		*snap;
+	char			pvdname[PVDNAMSIZ];
+	char			*v;
+	char			Value[256];
+	double			t0, c0;
+
+	if (nPvd <= 0 || nLookups <= 0) {
+		usage(stderr);
+		return(-1);
+	}
+	if ((conn = pvd_connect(lPort)) == NULL) {
+		fprintf(stderr, "pvd-bench : can not connect to the daemon\n");
+		return(-1);
+	}
+	srandom(getpid());
+
+	printf("lookup : %d pvd\n", nPvd);
+
+	t0 = Now();
+	c0 = DaemonCpu();
+
+	for (i = 0; i < nLookups; i++) {
+		BenchPvdName(random() % nPvd, pvdname);
+		if (pvd_get_attribute_sync(conn, pvdname, "benchAttr0", &v) == -1) {
+			fprintf(stderr, "pvd-bench : %s benchAttr0 not found "
+				"(see the populate test)\n", pvdname);
+			return(-1);
+		}
+		free(v);
+	}
+	Report("lookup request", nLookups, Now() - t0, DaemonCpu() - c0);
+
+	pvd_disconnect(conn);
+
+	if ((snap = pvd_snapshot_open(lPort)) == NULL) {
+		printf("lookup : no snapshot published\n");
+		return(0);
+	}
+
+	t0 = Now();
+	c0 = DaemonCpu();
+
+	for (i = 0; i < nLookups; i++) {
+		BenchPvdName(random() % nPvd, pvdname);
+		if (pvd_snapshot_get_attribute(snap, pvdname, "benchAttr0",
+				Value, sizeof(Value)) == -1) {
+			fprintf(stderr, "pvd-bench : %s benchAttr0 not in the snapshot\n",
+				pvdname);
+			return(-1);
+		}
+	}
+	Report("lookup snapshot", nLookups, Now() - t0, DaemonCpu() - c0);
+
+	pvd_snapshot_close(snap);
+
+	return(0);
+}
+
+/*
+ * replies : write system calls made by the daemon per reply, for nreplies
+ * GET_ATTRIBUTE then GET_ATTRIBUTES requests sent one at a time on a
+ * regular connection, on the first pvd created by populate
+ */
+static	int	TestReplies(char **argv)
+{
+	int			i, v;
+	int			nReplies = atoi(argv[0]);
+	t_pvd_connection	*conn;
+	char			pvdname[PVDNAMSIZ];
+	char			s[1024];
+	long			w0, w1;
+	double			t0, c0;
+	static	char		*Verbs[] = {
+					"PVD_GET_ATTRIBUTE %s benchAttr0\n",
+					"PVD_GET_ATTRIBUTES %s\n"
+				};
+
+	if (nReplies <= 0) {
+		usage(stderr);
+		return(-1);
+	}
+	if ((conn = pvd_connect(lPort)) == NULL) {
+		fprintf(stderr, "pvd-bench : can not connect to the daemon\n");
+		return(-1);
+	}
+	BenchPvdName(0, pvdname);
+
+	for (v = 0; v < DIM(Verbs); v++) {
+		sprintf(s, Verbs[v], pvdname);
+
+		w0 = DaemonWrites();
+		t0 = Now();
+		c0 = DaemonCpu();
+
+		for (i = 0; i < nReplies; i++) {
+			if (SendString(conn, s) == -1 || ReadReply(conn, 5000) == NULL) {
+				return(-1);
+			}
+		}
+		Report(v == 0 ? "replies GET_ATTRIBUTE" : "replies GET_ATTRIBUTES",
+			nReplies, Now() - t0, DaemonCpu() - c0);
+
+		if (w0 != -1 && (w1 = DaemonWrites()) != -1) {
+			printf("replies : %.2f write system calls per reply\n",
+				(double) (w1 - w0) / nReplies);
+		}
+	}
+	pvd_disconnect(conn);
+
+	return(0);
+}
+
+/*
+ * pipeline : throughput of GET_ATTRIBUTE requests sent by batches of depth
+ * requests in a single write, the replies of a batch being read before the
+ * next batch is sent
+ */
+static	int	TestPipeline(char **argv)
+{
+	int			i, j;
+	int			Depth = atoi(argv[0]);
+	int			nRequests = atoi(argv[1]);
+	t_pvd_connection	*conn;
+	char			pvdname[PVDNAMSIZ];
+	char			s[1024];
+	char			*Batch;
+	int			l;
+	double			t0, c0;
+
+	if (Depth <= 0 || nRequests < Depth) {
+		usage(stderr);
+		return(-1);
+	}
+	if ((conn = pvd_connect(lPort)) == NULL) {
+		fprintf(stderr, "pvd-bench : can not connect to the daemon\n");
+		return(-1);
+	}
+	l = sprintf(s, "PVD_GET_ATTRIBUTE %s benchAttr0\n", BenchPvdName(0, pvdname));
+
+	if ((Batch = malloc(Depth * l + 1)) == NULL) {
+		perror("malloc");
+		return(-1);
+	}
+	for (i = 0; i < Depth; i++) {
+		strcpy(Batch + i * l, s);
+	}
+	nRequests -= nRequests % Depth;
+
+	printf("pipeline : depth %d\n", Depth);
+
+	t0 = Now();
+	c0 = DaemonCpu();
+
+	for (i = 0; i < nRequests; i += Depth) {
+		if (SendString(conn, Batch) == -1) {
+			return(-1);
+		}
+		for (j = 0; j < Depth; j++) {
+			if (ReadReply(conn, 5000) == NULL) {
+				fprintf(stderr, "pvd-bench : reply %d of the batch missing\n", j);
+				return(-1);
+			}
+		}
+	}
+	Report("pipeline", nRequests, Now() - t0, DaemonCpu() - c0);
+
+	free(Batch);
+	pvd_disconnect(conn);
+
+	return(0);
+}
+
+/*
+ * parse : throughput of the command lines, for all the verbs but the
+ * promotions. nrounds rounds of the control verbs are sent on a control
+ * connection, then nrounds rounds of the other verbs on a regular one, by
+ * batches of 100 rounds. Each round has an invalid line as well
+ */
+#define	PARSEBATCH	100
+
+static	int	TestParse(char **argv)
+{
+	int			i, j;
+	int			nRounds = atoi(argv[0]);
+	t_pvd_connection	*ctrl;
+	t_pvd_connection	*conn;
+	char			pvdname[PVDNAMSIZ];
+	char			*Batch;
+	char			*pt;
+	char			Value[32];
+	double			t0, c0;
+
+	if (nRounds < PARSEBATCH) {
+		usage(stderr);
+		return(-1);
+	}
+	nRounds -= nRounds % PARSEBATCH;
+
+	if ((ctrl = OpenControl(NULL)) == NULL ||
+	    (conn = pvd_connect(lPort)) == NULL) {
+		return(-1);
+	}
+	if ((Batch = malloc(PARSEBATCH * 1024)) == NULL) {
+		perror("malloc");
+		return(-1);
+	}
+	BenchPvdName(0, pvdname);
+
+	t0 = Now();
+	c0 = DaemonCpu();
+
+	for (i = 0; i < nRounds; i += PARSEBATCH) {
+		for (j = 0, pt = Batch; j < PARSEBATCH; j++) {
+			pt += sprintf(pt,
+				"PVD_BEGIN_TRANSACTION %s\n"
+				"PVD_SET_ATTRIBUTE %s benchParse %d\n"
+				"PVD_UNSET_ATTRIBUTE %s benchGone\n"
+				"PVD_END_TRANSACTION %s\n"
+				"PVD_CREATE_PVD 0 parse.%s\n"
+				"PVD_REMOVE_PVD parse.%s\n"
+				"PVD_BOGUS_VERB %s\n",
+				pvdname,
+				pvdname, i + j,
+				pvdname,
+				pvdname,
+				pvdname,
+				pvdname,
+				pvdname);
+		}
+		if (SendString(ctrl, Batch) == -1) {
+			return(-1);
+		}
+	}
+	sprintf(Value, "%d", nRounds - 1);
+	if (WaitAttribute(conn, pvdname, "benchParse", Value) == -1) {
+		return(-1);
+	}
+	Report("parse control", nRounds * 7, Now() - t0, DaemonCpu() - c0);
+
+	t0 = Now();
+	c0 = DaemonCpu();
+
+	for (i = 0; i < nRounds; i += PARSEBATCH) {
+		for (j = 0, pt = Batch; j < PARSEBATCH; j++) {
+			pt += sprintf(pt,
+				"PVD_SUBSCRIBE %s\n"
+				"PVD_UNSUBSCRIBE %s\n"
+				"PVD_SUBSCRIBE_NOTIFICATIONS\n"
+				"PVD_UNSUBSCRIBE_NOTIFICATIONS\n"
+				"PVD_SUBSCRIBE_ATTRIBUTES_DIFF\n"
+				"PVD_UNSUBSCRIBE_ATTRIBUTES_DIFF\n"
+				"PVD_GET_LIST\n"
+				"PVD_GET_LIST extra\n"
+				"PVD_GET_ATTRIBUTE %s benchAttr0\n"
+				"PVD_GET_ATTRIBUTES %s\n",
+				pvdname,
+				pvdname,
+				pvdname,
+				pvdname);
+		}
+		if (SendString(conn, Batch) == -1) {
+			return(-1);
+		}
+		// The PVD_LIST replies are read along with the multi lines ones
+		for (j = 0; j < PARSEBATCH * 2; j++) {
+			if (ReadReply(conn, 5000) == NULL) {
+				fprintf(stderr, "pvd-bench : reply %d of the batch missing\n", j);
+				return(-1);
+			}
+		}
+	}
+	Report("parse general", nRounds * 10, Now() - t0, DaemonCpu() - c0);
+
+	free(Batch);
+	pvd_disconnect(conn);
+	pvd_disconnect(ctrl);
+
+	return(0);
+}
+
+/*
+ * latency : round trip of a GET_ATTRIBUTE request on a regular (text)
+ * connection and on a binary one, through the local (AF_UNIX) socket of
+ * the daemon then through TCP
+ */
+static	int	TestLatency(char **argv)
+{
+	int			i, t;
+	int			nRequests = atoi(argv[0]);
+	t_pvd_connection	*conn;
+	char			pvdname[PVDNAMSIZ];
+	char			s[1024];
+	char			Test[64];
+	char			*v;
+	struct sockaddr_storage	sa;
+	socklen_t		salen;
+	double			t0, c0;
+
+	if (nRequests <= 0) {
+		usage(stderr);
+		return(-1);
+	}
+	sprintf(s, "PVD_GET_ATTRIBUTE %s benchAttr0\n", BenchPvdName(0, pvdname));
+
+	for (t = 0; t < 2; t++) {
+		// TCP is forced by disabling the local socket
+		if (t == 1) {
+			setenv("PVDD_SOCKET", "none", 1);
+		}
+		if ((conn = pvd_connect(lPort)) == NULL) {
+			fprintf(stderr, "pvd-bench : can not connect to the daemon\n");
+			return(-1);
+		}
+		salen = sizeof(sa);
+		if (getsockname(pvd_connection_fd(conn), (struct sockaddr *) &sa, &salen) == -1) {
+			perror("getsockname");
+			return(-1);
+		}
+		if (t == 0 && sa.ss_family != AF_UNIX) {
+			printf("latency : no local socket\n");
+			pvd_disconnect(conn);
+			continue;
+		}
+
+		t0 = Now();
+		c0 = DaemonCpu();
+
+		for (i = 0; i < nRequests; i++) {
+			if (SendString(conn, s) == -1 || ReadReply(conn, 5000) == NULL) {
+				return(-1);
+			}
+		}
+		sprintf(Test, "latency %s text", t == 0 ? "unix" : "tcp");
+		Report(Test, nRequests, Now() - t0, DaemonCpu() - c0);
+
+		t0 = Now();
+		c0 = DaemonCpu();
+
+		for (i = 0; i < nRequests; i++) {
+			if (pvd_get_attribute_sync(conn, pvdname, "benchAttr0", &v) == -1) {
+				fprintf(stderr, "pvd-bench : %s benchAttr0 not found\n", pvdname);
+				return(-1);
+			}
+			free(v);
+		}
+		sprintf(Test, "latency %s binary", t == 0 ? "unix" : "tcp");
+		Report(Test, nRequests, Now() - t0, DaemonCpu() - c0);
+
+		pvd_disconnect(conn);
+	}
+	return(0);
+}
+
+/*
+ * ready : time for a daemon just started to answer with the last attribute
+ * of the last pvd created by populate (ie to restore its state, see the -d
+ * option of the daemon). To be started along with the daemon
+ */
+static	int	TestReady(char **argv)
+{
+	int			nPvd = atoi(argv[0]);
+	int			nAttr = atoi(argv[1]);
+	t_pvd_connection	*conn;
+	char			pvdname[PVDNAMSIZ];
+	char			Key[32];
+	char			Value[32];
+	double			t0 = Now();
+
+	if (nPvd <= 0 || nAttr <= 0) {
+		usage(stderr);
+		return(-1);
+	}
+	while ((conn = pvd_connect(lPort)) == NULL) {
+		if (Now() - t0 > 5e6) {
+			fprintf(stderr, "pvd-bench : can not connect to the daemon\n");
+			return(-1);
+		}
+		usleep(1000);
+	}
+	sprintf(Key, "benchAttr%d", nAttr - 1);
+	sprintf(Value, "%d", nAttr - 1);
+
+	if (WaitAttribute(conn, BenchPvdName(nPvd - 1, pvdname), Key, Value) == -1) {
+		return(-1);
+	}
+	printf("ready : %d pvd with %d attributes each restored in %.3f ms\n",
+		nPvd, nAttr, (Now() - t0) / 1e3);
+
+	pvd_disconnect(conn);
+
+	return(0);
+}
+
+static	struct {
+	char	*Name;
+	int	nArgs;
+	int	(*Handler)(char **argv);
+}	lTabTests[] = {
+	{ "idle", 2, TestIdle },
+	{ "populate", 2, TestPopulate },
+	{ "lookup", 2, TestLookup },
+	{ "replies", 1, TestReplies },
+	{ "pipeline", 2, TestPipeline },
+	{ "parse", 1, TestParse },
+	{ "latency", 1, TestLatency },
+	{ "ready", 2, TestReady },
+};
+
+int	main(int argc, char **argv)
+{
+	int	i;
+	int	t;
+
+	for (i = 1; i < argc && argv[i][0] == '-'; i++) {
+		if (EQSTR(argv[i], "-h") || EQSTR(argv[i], "--help")) {
+			usage(stdout);
+			return(0);
+		}
+		if (EQSTR(argv[i], "-p") || EQSTR(argv[i], "--port")) {
+			if (i + 1 < argc) {
+				lPort = atoi(argv[++i]);
+				continue;
+			}
+		}
+		else
+		if (EQSTR(argv[i], "-P") || EQSTR(argv[i], "--pid")) {
+			if (i + 1 < argc) {
+				lDaemonPid = atoi(argv[++i]);
+				continue;
+			}
+		}
+		usage(stderr);
+		return(1);
+	}
+	if (i == argc) {
+		usage(stderr);
+		return(1);
+	}
+
+	for (t = 0; t < DIM(lTabTests); t++) {
+		if (EQSTR(argv[i], lTabTests[t].Name)) {
+			if (argc - i - 1 != lTabTests[t].nArgs) {
+				usage(stderr);
+				return(1);
+			}
+			return(lTabTests[t].Handler(&argv[i + 1]) == -1 ? 1 : 0);
+		}
+	}
+	usage(stderr);
+	return(1);
+}
+
+/* ex: set ts=8 noexpandtab wrap: */
@@ -0,0 +1,580 @@
+/*
+	Copyright 2017 Cisco
+
+	Licensed under the Apache License, Version 2.0 (the "License");
+	you may not use this file except in compliance with the License.
+	You may obtain a copy of the License at
+
+		http://www.apache.org/licenses/LICENSE-2.0
+
+	Unless required by applicable law or agreed to in writing, software
+	distributed under the License is distributed on an "AS IS" BASIS,
+	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+	See the License for the specific language governing permissions and
+	limitations under the License.
+*/
+/*
+ * ra-fuzz : in process driver of the RA parser of the daemon. The objects
+ * of the daemon handling the RAs (pvdd-netlink, pvdd-timer and pvd-utils)
+ * are linked with a stub of the pvd registry (the pvdd.h API), which checks
+ * that every attribute rendered from an RA is valid JSON
+ *
+ * An input is either a raw ICMPv6 message (an RA, as written by ra-replay
+ * -w), either a sequence of RAs, each one preceded by its length (2 bytes,
+ * network order), applied in turn. The registry is emptied after each
+ * input
+ *
+ * LLVMFuzzerTestOneInput() is the libFuzzer entry point (main() is left
+ * out when built with -DLIBFUZZER). The standalone program replays a
+ * corpus (files or directories), then runs mutations of it (-n option) :
+ * it reports the inputs processed per second, and aborts on the first
+ * invalid attribute (along with the sanitizers, when built with them)
+ */
+
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/icmp6.h>
+#include <arpa/inet.h>
+
+#include "pvd-defs.h"
+#include "pvdd.h"
+#include "pvdd-netlink.h"
+#include "pvdd-timer.h"
+#include "pvd-utils.h"
+
+#define	EQSTR(a, b)	(strcmp((a), (b)) == 0)
+
+#undef	true
+#undef	false
+#define	true	(1 == 1)
+#define	false	(1 == 0)
+
+#define	RASIZE		1280	// largest input handled
+#define	MAXFUZZPVD	16	// registry size (PvdBeginTransaction() fails beyond)
+#define	MAXFUZZATTR	32	// attributes per pvd
+#define	MAXCORPUS	4096
+
+/*
+ * Stub of the pvd registry
+ */
+struct t_Pvd {
+	char		pvdname[PVDNAMSIZ];
+	void		*raState;
+	unsigned int	changes;
+	int		nAttr;
+	char		*Keys[MAXFUZZATTR];
+	char		*Values[MAXFUZZATTR];
+};
+
+static	t_Pvd	lTabPvd[MAXFUZZPVD];
+static	int	lNPvd = 0;
+
+static	long	lSetAttr = 0;		// attributes rendered
+static	long	lRegistered = 0;	// pvds created
+
+static	t_Pvd	*GetFuzzPvd(char *pvdname)
+{
+	int	i;
+
+	for (i = 0; i < lNPvd; i++) {
+		if (EQSTR(lTabPvd[i].pvdname, pvdname)) {
+			return(&lTabPvd[i]);
+		}
+	}
+	return(NULL);
+}
+
+static	void	ReleaseFuzzPvd(t_Pvd *PtPvd)
+{
+	int	i;
+
+	if (PtPvd->raState != NULL) {
+		ReleaseRaState(PtPvd->raState);
+	}
+	for (i = 0; i < PtPvd->nAttr; i++) {
+		free(PtPvd->Keys[i]);
+		free(PtPvd->Values[i]);
+	}
+	// The last pvd takes the place of the released one
+	if (PtPvd != &lTabPvd[--lNPvd]) {
+		*PtPvd = lTabPvd[lNPvd];
+	}
+}
+
+// JsonValue : skip a JSON value. Returns the position following it, NULL
+// if the value is not valid
+static	char	*JsonValue(char *pt, int Depth)
+{
+	while (*pt == ' ' || *pt == '\t' || *pt == '\n' || *pt == '\r') {
+		pt++;
+	}
+	if (Depth > 16) {
+		return(NULL);
+	}
+
+	switch (*pt) {
+	case '"' :
+		for (pt++; *pt != '"'; pt++) {
+			if ((unsigned char) *pt < 0x20) {
+				return(NULL);
+			}
+			if (*pt == '\\') {
+				pt++;
+				if (strchr("\"\\/bfnrtu", *pt) == NULL) {
+					return(NULL);
+				}
+			}
+		}
+		return(pt + 1);
+	case '[' :
+	case '{' : {
+		char	Close = *pt == '[' ? ']' : '}';
+		int	First = true;
+
+		for (pt++; ; First = false) {
+			while (*pt == ' ' || *pt == '\t' || *pt == '\n' || *pt == '\r') {
+				pt++;
+			}
+			if (*pt == Close && First) {
+				return(pt + 1);
+			}
+			if (Close == '}') {
+				if ((pt = JsonValue(pt, Depth + 1)) == NULL) {
+					return(NULL);
+				}
+				while (*pt == ' ' || *pt == '\t' || *pt == '\n') {
+					pt++;
+				}
+				if (*pt++ != ':') {
+					return(NULL);
+				}
+			}
+			if ((pt = JsonValue(pt, Depth + 1)) == NULL) {
+				return(NULL);
+			}
+			while (*pt == ' ' || *pt == '\t' || *pt == '\n' || *pt == '\r') {
+				pt++;
+			}
+			if (*pt == Close) {
+				return(pt + 1);
+			}
+			if (*pt++ != ',') {
+				return(NULL);
+			}
+		}
+	}
+	default :
+		if (strncmp(pt, "true", 4) == 0 || strncmp(pt, "null", 4) == 0) {
+			return(pt + 4);
+		}
+		if (strncmp(pt, "false", 5) == 0) {
+			return(pt + 5);
+		}
+		if (*pt == '-' || (*pt >= '0' && *pt <= '9')) {
+			char	*End;
+
+			strtod(pt, &End);
+			return(End);
+		}
+		return(NULL);
+	}
+}
+
+// CheckJson : an attribute rendered from an RA must be valid JSON
+static	void	CheckJson(char *Key, char *Value)
+{
+	char	*End = JsonValue(Value, 0);
+
+	while (End != NULL && (*End == ' ' || *End == '\n')) {
+		End++;
+	}
+	if (End == NULL || *End != '\0') {
+		fprintf(stderr, "ra-fuzz : invalid JSON value for %s : %s\n", Key, Value);
+		abort();
+	}
+}
+
+t_Pvd	*PvdBeginTransaction(char *pvdname)
+{
+	t_Pvd	*PtPvd;
+
+	if ((PtPvd = GetFuzzPvd(pvdname)) != NULL) {
+		return(PtPvd);
+	}
+	if (lNPvd == MAXFUZZPVD) {
+		return(NULL);
+	}
+	PtPvd = &lTabPvd[lNPvd++];
+	memset(PtPvd, 0, sizeof(*PtPvd));
+	snprintf(PtPvd->pvdname, sizeof(PtPvd->pvdname), "%s", pvdname);
+	lRegistered++;
+
+	return(PtPvd);
+}
+
+int	PvdSetAttr(t_Pvd *PtPvd, char *Key, char *Value)
+{
+	int	i;
+
+	CheckJson(Key, Value);
+	lSetAttr++;
+
+	for (i = 0; i < PtPvd->nAttr; i++) {
+		if (EQSTR(PtPvd->Keys[i], Key)) {
+			if (! EQSTR(PtPvd->Values[i], Value)) {
+				free(PtPvd->Values[i]);
+				PtPvd->Values[i] = strdup(Value);
+				PtPvd->changes++;
+			}
+			return(0);
+		}
+	}
+	if (PtPvd->nAttr == MAXFUZZATTR) {
+		return(-1);
+	}
+	PtPvd->Keys[PtPvd->nAttr] = strdup(Key);
+	PtPvd->Values[PtPvd->nAttr] = strdup(Value);
+	PtPvd->nAttr++;
+	PtPvd->changes++;
+
+	return(0);
+}
+
+int	UnregisterPvd(char *pvdname)
+{
+	t_Pvd	*PtPvd;
+
+	if ((PtPvd = GetFuzzPvd(pvdname)) == NULL) {
+		return(-1);
+	}
+	ReleaseFuzzPvd(PtPvd);
+
+	return(0);
+}
+
+void	PvdEndTransaction(t_Pvd *PtPvd)
+{
+}
+
+t_Pvd	*PvdLookup(char *pvdname)
+{
+	return(GetFuzzPvd(pvdname));
+}
+
+unsigned int	PvdChanges(t_Pvd *PtPvd)
+{
+	return(PtPvd->changes);
+}
+
+void	**PvdRaState(t_Pvd *PtPvd)
+{
+	return(&PtPvd->raState);
+}
+
+/*
+ * Driver
+ */
+static	void	ApplyOneRa(const uint8_t *Data, size_t Size)
+{
+	static	struct in6_addr	Src = { { { 0xfe, 0x80, [15] = 0x01 } } };
+	unsigned char		*Ra;
+
+	// process_ra() expects at least an RA header (checked on reception)
+	if (Size < sizeof(struct nd_router_advert) || Size > RASIZE) {
+		return;
+	}
+	// Copied in a buffer of the exact size of the message, for the
+	// sanitizers to catch any read beyond its end
+	if ((Ra = malloc(Size)) == NULL) {
+		return;
+	}
+	memcpy(Ra, Data, Size);
+
+	process_ra(Ra, Size, NULL, &Src, "fuzz0");
+
+	free(Ra);
+
+	// As in the main loop of the daemon : the entries whose lifetime
+	// has elapsed are expired (a long run is needed for this)
+	TimerRun();
+}
+
+int	LLVMFuzzerTestOneInput(const uint8_t *Data, size_t Size)
+{
+	size_t	Offset;
+	size_t	l;
+
+	// A sequence of RAs preceded by their length, or a single RA
+	for (Offset = 0; Offset + 2 <= Size; Offset += 2 + l) {
+		l = (Data[Offset] << 8) | Data[Offset + 1];
+		if (l == 0 || Offset + 2 + l > Size) {
+			break;
+		}
+	}
+	if (Offset == Size && Size > 0) {
+		for (Offset = 0; Offset < Size; Offset += 2 + l) {
+			l = (Data[Offset] << 8) | Data[Offset + 1];
+			ApplyOneRa(Data + Offset + 2, l);
+		}
+	}
+	else {
+		ApplyOneRa(Data, Size);
+	}
+
+	while (lNPvd > 0) {
+		ReleaseFuzzPvd(&lTabPvd[0]);
+	}
+	return(0);
+}
+
+#ifndef	LIBFUZZER
+
+static	struct {
+	unsigned char	*Data;
+	int		Size;
+}	lCorpus[MAXCORPUS];
+static	int	lNCorpus = 0;
+
+static	void	usage(FILE *fo)
+{
+	fprintf(fo, "usage : ra-fuzz [-h|--help] [<option>*] <file|dir>+\n");
+	fprintf(fo, "where option :\n");
+	fprintf(fo, "\t-n|--mutations <#> : number of mutated inputs to run after the\n");
+	fprintf(fo, "\t\treplay of the corpus (default 0)\n");
+	fprintf(fo, "\t-s|--seed <#> : seed of the mutations (default 1)\n");
+	fprintf(fo, "\t-v|--verbose : the daemon's traces\n");
+	fprintf(fo, "\n");
+	fprintf(fo, "The inputs of the corpus are raw RAs (see ra-replay -w), or\n");
+	fprintf(fo, "sequences of RAs each preceded by its length (2 bytes)\n");
+}
+
+static	double	Now(void)
+{
+	struct timespec	ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return(ts.tv_sec + ts.tv_nsec / 1e9);
+}
+
+static	int	LoadFile(char *Path)
+{
+	int		fd;
+	int		l;
+	unsigned char	Buffer[RASIZE];
+
+	if (lNCorpus == MAXCORPUS) {
+		return(0);
+	}
+	if ((fd = open(Path, O_RDONLY)) == -1) {
+		perror(Path);
+		return(-1);
+	}
+	l = read(fd, Buffer, sizeof(Buffer));
+	close(fd);
+
+	if (l <= 0) {
+		return(0);
+	}
+	if ((lCorpus[lNCorpus].Data = malloc(l)) == NULL) {
+		perror("malloc");
+		return(-1);
+	}
+	memcpy(lCorpus[lNCorpus].Data, Buffer, l);
+	lCorpus[lNCorpus].Size = l;
+	lNCorpus++;
+
+	return(0);
+}
+
+static	int	LoadCorpus(char *Path)
+{
+	DIR		*dir;
+	struct dirent	*de;
+	struct stat	st;
+	char		FullPath[1024];
+
+	if (stat(Path, &st) == -1) {
+		perror(Path);
+		return(-1);
+	}
+	if (! S_ISDIR(st.st_mode)) {
+		return(LoadFile(Path));
+	}
+	if ((dir = opendir(Path)) == NULL) {
+		perror(Path);
+		return(-1);
+	}
+	while ((de = readdir(dir)) != NULL) {
+		if (de->d_name[0] == '.') {
+			continue;
+		}
+		snprintf(FullPath, sizeof(FullPath), "%s/%s", Path, de->d_name);
+		if (LoadFile(FullPath) == -1) {
+			closedir(dir);
+			return(-1);
+		}
+	}
+	closedir(dir);
+
+	return(0);
+}
+
+// Mutate : apply 1 to 4 random mutations to an input. Returns its new size
+static	int	Mutate(unsigned char *Data, int Size)
+{
+	static	unsigned char	Interesting[] = { 0, 1, 2, 3, 5, 7, 0x7f, 0x80, 0xff };
+	int			n = 1 + random() % 4;
+	int			i;
+	int			Pos;
+
+	for ( ; n > 0 && Size > 0; n--) {
+		Pos = random() % Size;
+
+		switch (random() % 6) {
+		case 0 :	// flip a bit
+			Data[Pos] ^= 1 << (random() % 8);
+			break;
+		case 1 :	// random byte
+			Data[Pos] = random();
+			break;
+		case 2 :	// interesting byte (option lengths, prefix lengths)
+			Data[Pos] = Interesting[random() % sizeof(Interesting)];
+			break;
+		case 3 :	// truncate
+			Size = Pos + 1;
+			break;
+		case 4 :	// duplicate an option sized chunk
+			i = (Pos & ~7) + 8;
+			if (i + 8 <= Size && Size + 8 <= RASIZE) {
+				memmove(Data + i + 8, Data + i, Size - i);
+				Size += 8;
+			}
+			break;
+		case 5 :	// change the length of an option (aligned on 8)
+			i = (Pos & ~7) + 1;
+			if (i < Size) {
+				Data[i] = random() % 8;
+			}
+			break;
+		}
+	}
+	return(Size);
+}
+
+// NextInput : a mutated input of the corpus or, once out of 4, a sequence
+// of 2 or 3 of them (to change the state left by the previous RAs)
+static	int	NextInput(unsigned char *Input)
+{
+	int	i;
+	int	n;
+	int	l;
+	int	Size;
+
+	if (random() % 4 != 0) {
+		i = random() % lNCorpus;
+		memcpy(Input, lCorpus[i].Data, lCorpus[i].Size);
+		return(Mutate(Input, lCorpus[i].Size));
+	}
+	for (n = 2 + random() % 2, Size = 0; n > 0; n--) {
+		i = random() % lNCorpus;
+		if (Size + 2 + lCorpus[i].Size > RASIZE) {
+			break;
+		}
+		memcpy(Input + Size + 2, lCorpus[i].Data, lCorpus[i].Size);
+		// Unchanged entries (refreshes) are likely as well
+		l = random() % 2 ? Mutate(Input + Size + 2, lCorpus[i].Size) : lCorpus[i].Size;
+		Input[Size] = l >> 8;
+		Input[Size + 1] = l & 0xff;
+		Size += 2 + l;
+	}
+	return(Size);
+}
+
+int	main(int argc, char **argv)
+{
+	int		i;
+	long		n;
+	long		nMutations = 0;
+	unsigned int	Seed = 1;
+	unsigned char	Input[RASIZE];
+	int		Size;
+	double		t0, t1;
+
+	for (i = 1; i < argc && argv[i][0] == '-'; i++) {
+		if (EQSTR(argv[i], "-h") || EQSTR(argv[i], "--help")) {
+			usage(stdout);
+			return(0);
+		}
+		if (EQSTR(argv[i], "-v") || EQSTR(argv[i], "--verbose")) {
+			lFlagVerbose = true;
+			continue;
+		}
+		if (i + 1 < argc) {
+			if (EQSTR(argv[i], "-n") || EQSTR(argv[i], "--mutations")) {
+				nMutations = atol(argv[++i]);
+				continue;
+			}
+			if (EQSTR(argv[i], "-s") || EQSTR(argv[i], "--seed")) {
+				Seed = atoi(argv[++i]);
+				continue;
+			}
+		}
+		usage(stderr);
+		return(1);
+	}
+	for ( ; i < argc; i++) {
+		if (LoadCorpus(argv[i]) == -1) {
+			return(1);
+		}
+	}
+	if (lNCorpus == 0) {
+		usage(stderr);
+		return(1);
+	}
+
+	// Replay of the corpus, repeated to last at least a second
+	t0 = Now();
+	for (n = 0; n == 0 || (t1 = Now()) - t0 < 1; ) {
+		for (i = 0; i < lNCorpus; i++, n++) {
+			LLVMFuzzerTestOneInput(lCorpus[i].Data, lCorpus[i].Size);
+		}
+	}
+	printf("ra-fuzz : corpus of %d inputs, %ld inputs replayed in %.3f s "
+		"(%.0f inputs/s, %.2f us/input)\n",
+		lNCorpus, n, t1 - t0, n / (t1 - t0), (t1 - t0) * 1e6 / n);
+
+	if (nMutations == 0) {
+		return(0);
+	}
+	srandom(Seed);
+	lSetAttr = lRegistered = 0;
+
+	t0 = Now();
+	for (n = 0; n < nMutations; n++) {
+		Size = NextInput(Input);
+		LLVMFuzzerTestOneInput(Input, Size);
+	}
+	t1 = Now();
+
+	printf("ra-fuzz : %ld mutated inputs in %.3f s (%.0f inputs/s), "
+		"%ld pvds registered, %ld attributes rendered\n",
+		nMutations, t1 - t0, nMutations / (t1 - t0), lRegistered, lSetAttr);
+
+	return(0);
+}
+
+#endif	/* LIBFUZZER */
+
+/* ex: set ts=8 noexpandtab wrap: */
@@ -0,0 +1,321 @@
+/*
+	Copyright 2017 Cisco
+
+	Licensed under the Apache License, Version 2.0 (the "License");
+	you may not use this file except in compliance with the License.
+	You may obtain a copy of the License at
+
+		http://www.apache.org/licenses/LICENSE-2.0
+
+	Unless required by applicable law or agreed to in writing, software
+	distributed under the License is distributed on an "AS IS" BASIS,
+	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+	See the License for the specific language governing permissions and
+	limitations under the License.
+*/
+/*
+ * ra-replay : send router advertisements as fast as possible on an
+ * interface (to ff02::1), to measure the RA ingestion rate of a pvdd
+ * daemon listening on the other end of the link (a veth pair for example)
+ *
+ * The RAs are either generated (a PVD option, a prefix, RDNSS and DNSSL
+ * options, for a given number of distinct pvds), either read from files
+ * (one raw ICMPv6 message per file, as written with the -w option), which
+ * are sent in turn
+ *
+ * It must be run as root (raw socket)
+ */
+
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/icmp6.h>
+#include <net/if.h>
+
+#define	EQSTR(a, b)	(strcmp((a), (b)) == 0)
+
+#undef	true
+#undef	false
+#define	true	(1 == 1)
+#define	false	(1 == 0)
+
+#define	RASIZE		1280	// large enough for any RA of the corpus
+#define	MAXFILES	1024
+
+#define	ND_OPT_PVD	21
+#define	ND_OPT_RDNSS	25
+#define	ND_OPT_DNSSL	31
+
+static	void	usage(FILE *fo)
+{
+	fprintf(fo, "usage : ra-replay [-h|--help] [<option>*] [<file>*]\n");
+	fprintf(fo, "where option :\n");
+	fprintf(fo, "\t-i|--interface <ifname> : interface to send the RAs on\n");
+	fprintf(fo, "\t-n|--count <#> : number of RAs to send (default 100000)\n");
+	fprintf(fo, "\t-p|--pvd <#> : number of distinct pvds generated (default 10)\n");
+	fprintf(fo, "\t-c|--change <#> : change the sequence number of the pvds\n");
+	fprintf(fo, "\t\tevery <#> RAs (default never)\n");
+	fprintf(fo, "\t-w|--write <dir> : write the generated RAs (one per pvd) in\n");
+	fprintf(fo, "\t\t<dir> instead of sending them\n");
+	fprintf(fo, "\n");
+	fprintf(fo, "When files are given, the RAs they contain (one raw ICMPv6\n");
+	fprintf(fo, "message per file) are sent in turn instead of generated ones\n");
+}
+
+// AddOption : append an option (Length in bytes, rounded up to 8 bytes) to
+// an RA. Returns the new length of the RA
+static	int	AddOption(unsigned char *Ra, int l, int Type, unsigned char *Data, int Length)
+{
+	int	OptLen = (2 + Length + 7) / 8;
+
+	memset(Ra + l, 0, OptLen * 8);
+	Ra[l] = Type;
+	Ra[l + 1] = OptLen;
+	memcpy(Ra + l + 2, Data, Length);
+
+	return(l + OptLen * 8);
+}
+
+// BuildRa : generate the RA of the i-th pvd, with a given sequence number
+static	int	BuildRa(unsigned char *Ra, int i, int Seq)
+{
+	struct nd_router_advert		*ra = (struct nd_router_advert *) Ra;
+	struct nd_opt_prefix_info	pi;
+	unsigned char			Data[256];
+	int				l;
+	int				n;
+
+	memset(Ra, 0, sizeof(*ra));
+	ra->nd_ra_type = ND_ROUTER_ADVERT;
+	ra->nd_ra_curhoplimit = 64;
+	ra->nd_ra_router_lifetime = htons(1800);
+	l = sizeof(*ra);
+
+	// PVD option : flags (H bit), sequence number, then the FQDN
+	memset(Data, 0, sizeof(Data));
+	Data[0] = 0x80;
+	Data[2] = Seq >> 8;
+	Data[3] = Seq & 0xff;
+	n = sprintf((char *) Data + 4, "pvd%d.replay.example.com", i);
+	l = AddOption(Ra, l, ND_OPT_PVD, Data, 4 + n);
+
+	// Prefix information : 2001:db8:<i>::/64
+	memset(&pi, 0, sizeof(pi));
+	pi.nd_opt_pi_type = ND_OPT_PREFIX_INFORMATION;
+	pi.nd_opt_pi_len = sizeof(pi) / 8;
+	pi.nd_opt_pi_prefix_len = 64;
+	pi.nd_opt_pi_flags_reserved = ND_OPT_PI_FLAG_ONLINK | ND_OPT_PI_FLAG_AUTO;
+	pi.nd_opt_pi_valid_time = htonl(86400);
+	pi.nd_opt_pi_preferred_time = htonl(14400);
+	inet_pton(AF_INET6, "2001:db8::", &pi.nd_opt_pi_prefix);
+	pi.nd_opt_pi_prefix.s6_addr[4] = i >> 8;
+	pi.nd_opt_pi_prefix.s6_addr[5] = i & 0xff;
+	memcpy(Ra + l, &pi, sizeof(pi));
+	l += sizeof(pi);
+
+	// RDNSS : 2 servers, lifetime 60 s
+	memset(Data, 0, sizeof(Data));
+	Data[5] = 60;
+	inet_pton(AF_INET6, "2001:db8::53", Data + 6);
+	inet_pton(AF_INET6, "2001:db8::54", Data + 22);
+	Data[6 + 5] = i & 0xff;
+	l = AddOption(Ra, l, ND_OPT_RDNSS, Data, 6 + 2 * 16);
+
+	// DNSSL : replay.example.com and lab, lifetime 60 s
+	memset(Data, 0, sizeof(Data));
+	Data[5] = 60;
+	memcpy(Data + 6, "\006replay\007example\003com\000\003lab\000", 25);
+	l = AddOption(Ra, l, ND_OPT_DNSSL, Data, 6 + 25);
+
+	return(l);
+}
+
+// WriteRas : write the RA of each pvd in a file of a directory
+static	int	WriteRas(char *Dir, int nPvd)
+{
+	int		i;
+	int		fd;
+	int		l;
+	char		Path[1024];
+	unsigned char	Ra[RASIZE];
+
+	for (i = 0; i < nPvd; i++) {
+		l = BuildRa(Ra, i, 1);
+		snprintf(Path, sizeof(Path), "%s/ra-pvd%d", Dir, i);
+
+		if ((fd = open(Path, O_WRONLY | O_CREAT | O_TRUNC, 0644)) == -1) {
+			perror(Path);
+			return(-1);
+		}
+		if (write(fd, Ra, l) != l) {
+			perror(Path);
+			close(fd);
+			return(-1);
+		}
+		close(fd);
+	}
+	printf("ra-replay : %d RAs written in %s\n", nPvd, Dir);
+
+	return(0);
+}
+
+// ReadRa : read an RA from a file. Returns its length, -1 on error
+static	int	ReadRa(char *Path, unsigned char *Ra)
+{
+	int	fd;
+	int	l;
+
+	if ((fd = open(Path, O_RDONLY)) == -1) {
+		perror(Path);
+		return(-1);
+	}
+	if ((l = read(fd, Ra, RASIZE)) <= 0) {
+		fprintf(stderr, "ra-replay : %s : empty or unreadable\n", Path);
+		l = -1;
+	}
+	close(fd);
+
+	return(l);
+}
+
+int	main(int argc, char **argv)
+{
+	int			i;
+	int			s;
+	int			Hops = 255;
+	int			Loop = 0;
+	int			ifindex;
+	char			*ifname = NULL;
+	char			*Dir = NULL;
+	int			nRa = 100000;
+	int			nPvd = 10;
+	int			ChangeEvery = 0;
+	int			nFiles = 0;
+	static	unsigned char	TabRa[MAXFILES][RASIZE];
+	int			TabLen[MAXFILES];
+	unsigned char		Ra[RASIZE];
+	unsigned char		*PtRa;
+	int			l;
+	struct sockaddr_in6	sa6;
+	struct timespec		t0, t1;
+	double			Elapsed;
+
+	for (i = 1; i < argc && argv[i][0] == '-'; i++) {
+		if (EQSTR(argv[i], "-h") || EQSTR(argv[i], "--help")) {
+			usage(stdout);
+			return(0);
+		}
+		if (i + 1 == argc) {
+			usage(stderr);
+			return(1);
+		}
+		if (EQSTR(argv[i], "-i") || EQSTR(argv[i], "--interface")) {
+			ifname = argv[++i];
+		}
+		else
+		if (EQSTR(argv[i], "-n") || EQSTR(argv[i], "--count")) {
+			nRa = atoi(argv[++i]);
+		}
+		else
+		if (EQSTR(argv[i], "-p") || EQSTR(argv[i], "--pvd")) {
+			nPvd = atoi(argv[++i]);
+		}
+		else
+		if (EQSTR(argv[i], "-c") || EQSTR(argv[i], "--change")) {
+			ChangeEvery = atoi(argv[++i]);
+		}
+		else
+		if (EQSTR(argv[i], "-w") || EQSTR(argv[i], "--write")) {
+			Dir = argv[++i];
+		}
+		else {
+			usage(stderr);
+			return(1);
+		}
+	}
+	if (nRa <= 0 || nPvd <= 0 || nPvd > 65536 || ChangeEvery < 0) {
+		usage(stderr);
+		return(1);
+	}
+
+	if (Dir != NULL) {
+		return(WriteRas(Dir, nPvd) == -1 ? 1 : 0);
+	}
+
+	for ( ; i < argc; i++) {
+		if (nFiles == MAXFILES) {
+			fprintf(stderr, "ra-replay : only %d files replayed\n", MAXFILES);
+			break;
+		}
+		if ((TabLen[nFiles] = ReadRa(argv[i], TabRa[nFiles])) != -1) {
+			nFiles++;
+		}
+	}
+
+	if (ifname == NULL) {
+		usage(stderr);
+		return(1);
+	}
+	if ((ifindex = if_nametoindex(ifname)) == 0) {
+		fprintf(stderr, "ra-replay : unknown interface %s\n", ifname);
+		return(1);
+	}
+	if ((s = socket(AF_INET6, SOCK_RAW, IPPROTO_ICMPV6)) == -1) {
+		perror("socket");
+		return(1);
+	}
+	// RAs must be sent with a hop limit of 255. They are not looped
+	// back to the local listeners of the sending interface
+	if (setsockopt(s, IPPROTO_IPV6, IPV6_MULTICAST_HOPS, &Hops, sizeof(Hops)) == -1 ||
+	    setsockopt(s, IPPROTO_IPV6, IPV6_MULTICAST_IF, &ifindex, sizeof(ifindex)) == -1 ||
+	    setsockopt(s, IPPROTO_IPV6, IPV6_MULTICAST_LOOP, &Loop, sizeof(Loop)) == -1) {
+		perror("setsockopt");
+		return(1);
+	}
+
+	memset(&sa6, 0, sizeof(sa6));
+	sa6.sin6_family = AF_INET6;
+	inet_pton(AF_INET6, "ff02::1", &sa6.sin6_addr);
+	sa6.sin6_scope_id = ifindex;
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+
+	for (i = 0; i < nRa; i++) {
+		if (nFiles > 0) {
+			PtRa = TabRa[i % nFiles];
+			l = TabLen[i % nFiles];
+		}
+		else {
+			PtRa = Ra;
+			l = BuildRa(Ra, i % nPvd, ChangeEvery == 0 ? 1 : 1 + i / ChangeEvery);
+		}
+		if (sendto(s, PtRa, l, 0, (struct sockaddr *) &sa6, sizeof(sa6)) == -1) {
+			// The queue of the interface is full : retry
+			if (errno == ENOBUFS || errno == EAGAIN) {
+				i--;
+				continue;
+			}
+			perror("sendto");
+			return(1);
+		}
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	Elapsed = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+
+	printf("ra-replay : %d RAs sent in %.3f s (%.0f RAs/s)\n", nRa, Elapsed, nRa / Elapsed);
+
+	close(s);
+
+	return(0);
+}
+
+/* ex: set ts=8 noexpandtab wrap: */